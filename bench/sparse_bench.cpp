@@ -0,0 +1,394 @@
+#include "../include/csr_operations.hpp"
+#include "../include/dispatch.hpp"
+#include "../include/xtensor_operations.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+Benchmark suite for the conversions, the sparsity checks and the products.
+Every input comes from a seeded generator so runs are reproducible, results are written as JSON.
+sparse_ops::multiply routes with the built in cost model unless a profile is given, so results do not depend on
+whatever profile the machine holds. Every measurement reports how far the resident set grew while it ran.
+
+usage: sparse_bench [--quick] [--seed N] [--profile PATH] [--out results.json]
+*/
+
+namespace
+{
+    // Synthetic generators, all produce rows x cols tensors with about density * rows * cols nonzeros
+    using Generator = std::function<xt::xarray<double>(size_t, size_t, double, unsigned)>;
+
+    double _value(std::mt19937 &rng)
+    {
+        return std::uniform_real_distribution<double>(0.5, 1.5)(rng);
+    }
+
+    // nonzeros spread uniformly
+    xt::xarray<double> _uniform(size_t rows, size_t cols, double density, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        xt::xarray<double> tensor = xt::zeros<double>(std::vector<size_t>{rows, cols});
+        for (auto &val : tensor)
+        {
+            if (uniform(rng) < density)
+            {
+                val = _value(rng);
+            }
+        }
+        return tensor;
+    }
+
+    // row lengths follow a power law, a few rows hold most of the nonzeros
+    xt::xarray<double> _powerLaw(size_t rows, size_t cols, double density, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        std::vector<double> weights(rows);
+        double total = 0.0;
+        for (size_t row = 0; row < rows; ++row)
+        {
+            weights[row] = 1.0 / std::pow(static_cast<double>(row + 1), 0.9);
+            total += weights[row];
+        }
+        std::shuffle(weights.begin(), weights.end(), rng);
+
+        xt::xarray<double> tensor = xt::zeros<double>(std::vector<size_t>{rows, cols});
+        std::uniform_int_distribution<size_t> column(0, cols - 1);
+        double nonZeros = density * rows * cols;
+        for (size_t row = 0; row < rows; ++row)
+        {
+            size_t length = std::min(cols, static_cast<size_t>(std::round(nonZeros * weights[row] / total)));
+            for (size_t i = 0; i < length; ++i)
+            {
+                tensor(row, column(rng)) = _value(rng);
+            }
+        }
+        return tensor;
+    }
+
+    // nonzeros inside a band around the diagonal
+    xt::xarray<double> _banded(size_t rows, size_t cols, double density, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        size_t halfWidth = static_cast<size_t>(density * cols / 2);
+        xt::xarray<double> tensor = xt::zeros<double>(std::vector<size_t>{rows, cols});
+        for (size_t row = 0; row < rows; ++row)
+        {
+            size_t center = row * cols / rows;
+            size_t begin = center > halfWidth ? center - halfWidth : 0;
+            size_t end = std::min(cols, center + halfWidth + 1);
+            for (size_t col = begin; col < end; ++col)
+            {
+                tensor(row, col) = _value(rng);
+            }
+        }
+        return tensor;
+    }
+
+    // dense blocks on the diagonal
+    xt::xarray<double> _blockDiagonal(size_t rows, size_t cols, double density, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        size_t block = std::max<size_t>(1, static_cast<size_t>(density * cols));
+        xt::xarray<double> tensor = xt::zeros<double>(std::vector<size_t>{rows, cols});
+        for (size_t row = 0; row < rows; ++row)
+        {
+            size_t begin = (row * cols / rows) / block * block;
+            for (size_t col = begin; col < std::min(cols, begin + block); ++col)
+            {
+                tensor(row, col) = _value(rng);
+            }
+        }
+        return tensor;
+    }
+
+    // field of /proc/self/status in kB, -1 where it does not exist
+    long _statusKb(const char *field)
+    {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        size_t length = std::strlen(field);
+        while (std::getline(status, line))
+        {
+            if (line.compare(0, length, field) == 0 && line.size() > length && line[length] == ':')
+            {
+                return std::stol(line.substr(length + 1));
+            }
+        }
+        return -1;
+    }
+
+    // Linux resets the peak resident set of the process to its current size, VmHWM, when 5 goes to clear_refs
+    bool _resetPeakRss()
+    {
+        std::ofstream clearRefs("/proc/self/clear_refs");
+        clearRefs << "5";
+        clearRefs.flush();
+        return static_cast<bool>(clearRefs);
+    }
+
+    long _peakRssKb()
+    {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // fastest of a few runs, in seconds, and how far the resident set grew above its size before them
+    struct Timing
+    {
+        double seconds;
+        long rssGrowthKb; // -1 where the peak cannot be reset
+    };
+
+    Timing _bestOf(int repetitions, const std::function<void()> &run)
+    {
+        bool tracked = _resetPeakRss();
+        long before = _statusKb("VmRSS");
+        double best = 1e30;
+        for (int i = 0; i < repetitions; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        long peak = _statusKb("VmHWM");
+        return {best, tracked && before >= 0 && peak >= 0 ? std::max(0L, peak - before) : -1};
+    }
+
+    int _maxThreads()
+    {
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    void _setThreads(int threads)
+    {
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#else
+        (void)threads;
+#endif
+    }
+
+    // One timed operation
+    struct Measurement
+    {
+        std::string operation;
+        std::string generator;
+        size_t rows;
+        size_t cols;
+        double density;
+        size_t nnz;
+        int threads;
+        double seconds;
+        long rssGrowthKb;
+        double flops;
+        double bytes;
+    };
+
+    std::string _toJson(const Measurement &m)
+    {
+        std::ostringstream out;
+        out << "{\"operation\": \"" << m.operation << "\", \"generator\": \"" << m.generator << "\""
+            << ", \"rows\": " << m.rows << ", \"cols\": " << m.cols << ", \"density\": " << m.density
+            << ", \"nnz\": " << m.nnz << ", \"threads\": " << m.threads << ", \"seconds\": " << m.seconds
+            << ", \"rss_growth_kb\": " << m.rssGrowthKb
+            << ", \"nnz_per_s\": " << m.nnz / m.seconds << ", \"gflops\": " << m.flops / m.seconds * 1e-9
+            << ", \"gbps\": " << m.bytes / m.seconds * 1e-9 << "}";
+        return out.str();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool quick = false;
+    unsigned seed = 42;
+    std::string outPath;
+    std::string profilePath;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--quick") == 0)
+        {
+            quick = true;
+        }
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+        {
+            seed = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            profilePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+        {
+            outPath = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: sparse_bench [--quick] [--seed N] [--profile PATH] [--out results.json]" << std::endl;
+            return 1;
+        }
+    }
+
+    // never calibrate or pick up a stray profile while timing
+    sparse_ops::CostModel model = sparse_ops::defaultCostModel();
+    if (!profilePath.empty() && !sparse_ops::loadCostModel(model, profilePath))
+    {
+        std::cerr << "cannot read the cost model profile " << profilePath << std::endl;
+        return 1;
+    }
+    sparse_ops::setCostModel(model);
+
+    int repetitions = quick ? 1 : 3;
+    std::vector<size_t> sizes = quick ? std::vector<size_t>{512} : std::vector<size_t>{512, 2048};
+    std::vector<double> densities = quick ? std::vector<double>{0.01, 0.1} : std::vector<double>{0.001, 0.01, 0.05, 0.1, 0.3};
+    std::vector<std::pair<std::string, Generator>> generators = {
+        {"uniform", _uniform}, {"power_law", _powerLaw}, {"banded", _banded}, {"block_diagonal", _blockDiagonal}};
+
+    int threads = _maxThreads();
+    std::vector<Measurement> measurements;
+    std::vector<std::string> crossover;
+
+    for (const auto &[name, generate] : generators)
+    {
+        for (size_t n : sizes)
+        {
+            for (double density : densities)
+            {
+                xt::xarray<double> a = generate(n, n, density, seed);
+                xt::xarray<double> b = generate(n, n, density, seed + 1);
+                double size = static_cast<double>(a.size());
+
+                CSR<double> csrA = DenseToCSR(a);
+                CSR<double> csrB = DenseToCSR(b);
+                double nnz = static_cast<double>(csrA.nnz());
+                double compressedBytes = nnz * (sizeof(double) + sizeof(size_t)) + (n + 1) * sizeof(size_t);
+                auto record = [&](const std::string &operation, Timing timing, double flops, double bytes)
+                {
+                    measurements.push_back({operation, name, n, n, density, csrA.nnz(), threads, timing.seconds,
+                                            timing.rssGrowthKb, flops, bytes});
+                };
+
+                record("DenseToCSR", _bestOf(repetitions, [&]
+                                             { DenseToCSR(a); }),
+                       0, size * sizeof(double) + compressedBytes);
+                record("CSRToDense", _bestOf(repetitions, [&]
+                                             { CSRToDense(csrA); }),
+                       0, size * sizeof(double) + compressedBytes);
+                record("isSparse", _bestOf(repetitions, [&]
+                                           { sparse_ops::isSparse(a, 0.5); }),
+                       0, size * sizeof(double));
+                record("sparsity", _bestOf(repetitions, [&]
+                                           { sparse_ops::sparsity(a); }),
+                       0, size * sizeof(double));
+
+                double flops = 0;
+                for (size_t rowFlops : _rowFlops(csrA, csrB))
+                {
+                    flops += 2.0 * rowFlops;
+                }
+                size_t resultNnz = 0;
+                Timing sparse = _bestOf(repetitions, [&]
+                                        { resultNnz = CSRMult(csrA, csrB).nnz(); });
+                record("CSRMult", sparse, flops, 2 * compressedBytes + resultNnz * (sizeof(double) + sizeof(size_t)));
+
+                Timing compressed = _bestOf(repetitions, [&]
+                                            { sparse_ops::multiplyCompressedFormat(a, b); });
+                record("multiplyCompressedFormat", compressed, flops, 3 * size * sizeof(double));
+
+                // sparse vs dense crossover, measured rather than predicted
+                Timing dense = _bestOf(repetitions, [&]
+                                       { sparse_ops::multiplyDense(a, b); });
+                record("multiplyDense", dense, 2.0 * size * n, 3 * size * sizeof(double));
+
+                sparse_ops::multiply(a, b);
+                std::ostringstream point;
+                point << "{\"generator\": \"" << name << "\", \"n\": " << n << ", \"density\": " << density
+                      << ", \"dense_seconds\": " << dense.seconds << ", \"sparse_seconds\": " << compressed.seconds
+                      << ", \"faster\": \"" << (compressed.seconds < dense.seconds ? "sparse" : "dense") << "\""
+                      << ", \"dispatched\": \"" << sparse_ops::kernelName(sparse_ops::dispatchLog().back().kernel) << "\"}";
+                crossover.push_back(point.str());
+            }
+        }
+    }
+
+    // thread scaling of the products on the skewed generator
+    size_t scalingSize = quick ? 1024 : 4096;
+    xt::xarray<double> skewedA = _powerLaw(scalingSize, scalingSize, 0.005, seed);
+    xt::xarray<double> skewedB = _powerLaw(scalingSize, scalingSize, 0.005, seed + 1);
+    CSR<double> skewedCsrA = DenseToCSR(skewedA);
+    CSR<double> skewedCsrB = DenseToCSR(skewedB);
+    double skewedFlops = 0;
+    for (size_t rowFlops : _rowFlops(skewedCsrA, skewedCsrB))
+    {
+        skewedFlops += 2.0 * rowFlops;
+    }
+
+    std::vector<std::string> scaling;
+    for (int t = 1; t <= threads; t = (t == threads || 2 * t <= threads) ? 2 * t : threads)
+    {
+        _setThreads(t);
+        double multSeconds = _bestOf(repetitions, [&]
+                                     { CSRMult(skewedCsrA, skewedCsrB); })
+                                 .seconds;
+        double convertSeconds = _bestOf(repetitions, [&]
+                                        { DenseToCSR(skewedA); })
+                                    .seconds;
+        std::ostringstream point;
+        point << "{\"threads\": " << t << ", \"CSRMult_seconds\": " << multSeconds
+              << ", \"CSRMult_gflops\": " << skewedFlops / multSeconds * 1e-9
+              << ", \"DenseToCSR_seconds\": " << convertSeconds << "}";
+        scaling.push_back(point.str());
+    }
+    _setThreads(threads);
+
+    std::ostringstream json;
+    json << "{\n  \"seed\": " << seed << ",\n  \"threads\": " << threads
+         << ",\n  \"cost_model\": \"" << (profilePath.empty() ? "default" : profilePath) << "\""
+         << ",\n  \"peak_rss_kb\": " << _peakRssKb()
+         << ",\n  \"measurements\": [\n";
+    for (size_t i = 0; i < measurements.size(); ++i)
+    {
+        json << "    " << _toJson(measurements[i]) << (i + 1 < measurements.size() ? ",\n" : "\n");
+    }
+    json << "  ],\n  \"crossover\": [\n";
+    for (size_t i = 0; i < crossover.size(); ++i)
+    {
+        json << "    " << crossover[i] << (i + 1 < crossover.size() ? ",\n" : "\n");
+    }
+    json << "  ],\n  \"thread_scaling\": [\n";
+    for (size_t i = 0; i < scaling.size(); ++i)
+    {
+        json << "    " << scaling[i] << (i + 1 < scaling.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+
+    if (outPath.empty())
+    {
+        std::cout << json.str();
+    }
+    else
+    {
+        std::ofstream(outPath) << json.str();
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "../include/dispatch.hpp"
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+/*
+Measures the cost model of this machine for sparse_ops::multiply and writes it to a profile file, which later
+processes read on their first product. Without a profile the dispatcher uses the built in coefficients.
+
+usage: sparse_calibrate [--profile PATH]
+*/
+
+int main(int argc, char **argv)
+{
+    std::string path = sparse_ops::defaultProfilePath();
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            path = argv[++i];
+        }
+        else
+        {
+            std::cerr << "usage: sparse_calibrate [--profile PATH]" << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        sparse_ops::CostModel model = sparse_ops::calibrateProfile(path);
+        std::cout << "wrote " << path << "\n"
+                  << "denseFlop " << model.denseFlop << "\n"
+                  << "scanElement " << model.scanElement << "\n"
+                  << "convertNonZero " << model.convertNonZero << "\n"
+                  << "sparseFlop " << model.sparseFlop << "\n"
+                  << "sparseOutput " << model.sparseOutput << "\n"
+                  << "spmmFlop " << model.spmmFlop << "\n"
+                  << "denseOutput " << model.denseOutput << std::endl;
+    }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef BFLOAT16_HPP
+#define BFLOAT16_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+Brain floating point, the upper 16 bits of an IEEE float: same exponent range, 8 bits of mantissa.
+Converted in software, so no hardware support is needed. Values are only stored in this type, arithmetic
+goes through float, and the kernels accumulate in a wider type, see AccumulatorType.
+*/
+struct bfloat16
+{
+    uint16_t bits = 0;
+
+    bfloat16() = default;
+
+    // round to nearest even, NaN stays NaN
+    bfloat16(float value) : bits(round(value))
+    {
+    }
+
+    operator float() const
+    {
+        uint32_t word = static_cast<uint32_t>(bits) << 16;
+        float value;
+        std::memcpy(&value, &word, sizeof(value));
+        return value;
+    }
+
+    bfloat16 &operator+=(float value)
+    {
+        return *this = static_cast<float>(*this) + value;
+    }
+
+    bfloat16 &operator-=(float value)
+    {
+        return *this = static_cast<float>(*this) - value;
+    }
+
+    bfloat16 &operator*=(float value)
+    {
+        return *this = static_cast<float>(*this) * value;
+    }
+
+    static uint16_t round(float value)
+    {
+        uint32_t word;
+        std::memcpy(&word, &value, sizeof(word));
+        if ((word & 0x7fffffffu) > 0x7f800000u)
+        {
+            return static_cast<uint16_t>((word >> 16) | 0x40u);
+        }
+        word += 0x7fffu + ((word >> 16) & 1u);
+        return static_cast<uint16_t>(word >> 16);
+    }
+};
+
+// type the kernels sum values of T in, wider than the storage for the 16 bit types
+template <typename T>
+struct AccumulatorOf
+{
+    using type = T;
+};
+
+template <>
+struct AccumulatorOf<bfloat16>
+{
+    using type = float;
+};
+
+// accumulator of a product of T and D, Acc when the caller picked one
+template <typename Acc, typename T, typename D = T>
+using AccumulatorType = std::conditional_t<std::is_void_v<Acc>,
+                                           std::common_type_t<typename AccumulatorOf<T>::type, typename AccumulatorOf<D>::type>,
+                                           Acc>;
+
+#endif // BFLOAT16_HPP
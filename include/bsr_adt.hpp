@@ -0,0 +1,92 @@
+#ifndef BSR_ADT_HPP
+#define BSR_ADT_HPP
+
+#include "csr_adt.hpp"
+#include <utility>
+#include <vector>
+
+/*
+Block compressed sparse row storage. The flattened matrix (leading dimensions folded into rows like CSR) is cut
+into blockRows x blockCols tiles and only the tiles holding a nonzero are stored, each one dense and row major.
+Block row r owns the tiles [blockRowPtr[r], blockRowPtr[r + 1]) of blockColIndices and values, sorted by column.
+One index covers a whole tile, and the multiply kernels run a dense micro kernel per tile.
+The block size must divide the matrix, detectBlockSize only proposes sizes that do.
+*/
+template <typename T>
+class BSR
+{
+private:
+    Buffer<T> values;               // tiles of blockRows * blockCols values, block row by block row
+    Buffer<size_t> blockColIndices; // block column of each tile
+    Buffer<size_t> blockRowPtr;     // offset of each block row into the tiles, size is rows / blockRows + 1
+    std::vector<size_t> shape;      // shape of original tensor
+    size_t blockRows;
+    size_t blockCols;
+
+    // delegation targets of the detecting constructors
+    BSR(const xt::xarray<T> &tensor, std::pair<size_t, size_t> blockSize);
+
+    template <typename Index>
+    BSR(const CSR<T, Index> &csr, std::pair<size_t, size_t> blockSize);
+
+public:
+    // constructor for BSR using xarray or xtensor, with the block size found by detectBlockSize
+    explicit BSR(const xt::xarray<T> &tensor);
+
+    // constructor for BSR using xarray or xtensor with a given block size
+    BSR(const xt::xarray<T> &tensor, size_t blockRows, size_t blockCols);
+
+    // constructors regrouping the nonzeros of a CSR object into tiles
+    template <typename Index>
+    explicit BSR(const CSR<T, Index> &csr);
+
+    template <typename Index>
+    BSR(const CSR<T, Index> &csr, size_t blockRows, size_t blockCols);
+
+    // constructor for BSR from already compressed arrays
+    BSR(std::vector<size_t> shape, size_t blockRows, size_t blockCols, Buffer<size_t> blockRowPtr,
+        Buffer<size_t> blockColIndices, Buffer<T> values);
+
+    // CSR object holding the nonzeros of the tiles, explicit zeros inside tiles are dropped
+    template <typename Index = size_t>
+    CSR<T, Index> toCSR() const;
+
+    // Accessors
+    const Buffer<T> &getValues() const;
+    const Buffer<size_t> &getBlockColIndices() const;
+    const Buffer<size_t> &getBlockRowPtr() const;
+    const std::vector<size_t> &getShape() const;
+
+    size_t getBlockRows() const;
+    size_t getBlockCols() const;
+    size_t rows() const;
+    size_t cols() const;
+    size_t numBlocks() const;
+
+    /*
+    Largest square block size out of 8, 4 and 2 that divides the matrix and whose stored tiles would be
+    at least minFill nonzero, 1 if none is. Fill below 1 means padding zeros are multiplied, the default
+    accepts up to as many padding values as nonzeros since a tile runs several times faster than scalar nonzeros.
+    */
+    static std::pair<size_t, size_t> detectBlockSize(const T *data, const std::vector<size_t> &shape, double minFill = 0.5);
+
+    template <typename Index>
+    static std::pair<size_t, size_t> detectBlockSize(const CSR<T, Index> &csr, double minFill = 0.5);
+};
+
+namespace
+{
+    // helper functions
+    inline bool _isValidBlockSize(const std::vector<size_t> &shape, size_t blockRows, size_t blockCols);
+
+    template <typename Src>
+    void _denseTiles(const Src *blockRow, size_t cols, size_t blockRows, size_t blockCols, std::vector<size_t> &tiles);
+
+    template <typename T, typename Index>
+    void _csrTiles(const CSR<T, Index> &csr, size_t blockRow, size_t blockRows, size_t blockCols, std::vector<size_t> &stamps,
+                   std::vector<size_t> &tiles);
+}
+
+#include "bsr_adt_impl.hpp"
+
+#endif // BSR_ADT_HPP
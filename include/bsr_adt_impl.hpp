@@ -0,0 +1,440 @@
+#ifndef BSR_ADT_IMPL_HPP
+#define BSR_ADT_IMPL_HPP
+
+#include "bsr_adt.hpp"
+#include "simd_kernels.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+// Constructors
+template <typename T>
+BSR<T>::BSR(const xt::xarray<T> &tensor)
+    : BSR(tensor, detectBlockSize(tensor.data(), std::vector<size_t>(tensor.shape().begin(), tensor.shape().end())))
+{
+}
+
+template <typename T>
+BSR<T>::BSR(const xt::xarray<T> &tensor, std::pair<size_t, size_t> blockSize)
+    : BSR(tensor, blockSize.first, blockSize.second)
+{
+}
+
+/*
+Two passes over the block rows, both parallel: find the tiles holding a nonzero and count them, then after a
+prefix sum every block row copies its tiles straight into its slice of the values.
+*/
+template <typename T>
+BSR<T>::BSR(const xt::xarray<T> &tensor, size_t blockRows, size_t blockCols)
+    : shape(tensor.shape().begin(), tensor.shape().end()), blockRows(blockRows), blockCols(blockCols)
+{
+    if (!_isValidBlockSize(shape, blockRows, blockCols))
+    {
+        throw std::invalid_argument("Block size does not divide the tensor");
+    }
+
+    const T *data = tensor.data();
+    size_t numCols = CSR<T>::colsOf(shape);
+    size_t numBlockRows = CSR<T>::rowsOf(shape) / blockRows;
+    size_t tileSize = blockRows * blockCols;
+    long long blockRowCount = static_cast<long long>(numBlockRows);
+
+    // Pass 1, tiles per block row
+    std::vector<size_t> offsets(numBlockRows + 1, 0);
+#pragma omp parallel if (tensor.size() > 100000)
+    {
+        std::vector<size_t> tiles;
+#pragma omp for schedule(static)
+        for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+        {
+            _denseTiles(data + blockRow * blockRows * numCols, numCols, blockRows, blockCols, tiles);
+            offsets[blockRow + 1] = tiles.size();
+        }
+    }
+
+    for (size_t blockRow = 0; blockRow < numBlockRows; ++blockRow)
+    {
+        offsets[blockRow + 1] += offsets[blockRow];
+    }
+
+    // Pass 2, copy the tiles row by row
+    std::vector<size_t> tileCols(offsets.back());
+    std::vector<T> tileValues(offsets.back() * tileSize);
+#pragma omp parallel if (tensor.size() > 100000)
+    {
+        std::vector<size_t> tiles;
+#pragma omp for schedule(static)
+        for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+        {
+            const T *source = data + blockRow * blockRows * numCols;
+            _denseTiles(source, numCols, blockRows, blockCols, tiles);
+            for (size_t t = 0; t < tiles.size(); ++t)
+            {
+                size_t tile = offsets[blockRow] + t;
+                tileCols[tile] = tiles[t];
+                for (size_t r = 0; r < blockRows; ++r)
+                {
+                    const T *from = source + r * numCols + tiles[t] * blockCols;
+                    std::copy(from, from + blockCols, tileValues.data() + tile * tileSize + r * blockCols);
+                }
+            }
+        }
+    }
+
+    blockRowPtr = std::move(offsets);
+    blockColIndices = std::move(tileCols);
+    values = std::move(tileValues);
+}
+
+template <typename T>
+template <typename Index>
+BSR<T>::BSR(const CSR<T, Index> &csr)
+    : BSR(csr, detectBlockSize(csr))
+{
+}
+
+template <typename T>
+template <typename Index>
+BSR<T>::BSR(const CSR<T, Index> &csr, std::pair<size_t, size_t> blockSize)
+    : BSR(csr, blockSize.first, blockSize.second)
+{
+}
+
+// Same two passes over the nonzeros of the CSR rows of every block row
+template <typename T>
+template <typename Index>
+BSR<T>::BSR(const CSR<T, Index> &csr, size_t blockRows, size_t blockCols)
+    : shape(csr.getShape()), blockRows(blockRows), blockCols(blockCols)
+{
+    if (!_isValidBlockSize(shape, blockRows, blockCols))
+    {
+        throw std::invalid_argument("Block size does not divide the tensor");
+    }
+
+    const auto &rowPtr = csr.getRowPtr();
+    const auto &colIndices = csr.getColIndices();
+    const auto &csrValues = csr.getValues();
+    size_t numBlockCols = csr.cols() / blockCols;
+    size_t numBlockRows = csr.rows() / blockRows;
+    size_t tileSize = blockRows * blockCols;
+    long long blockRowCount = static_cast<long long>(numBlockRows);
+
+    // Pass 1, tiles per block row
+    std::vector<size_t> offsets(numBlockRows + 1, 0);
+#pragma omp parallel if (csr.nnz() > 100000)
+    {
+        std::vector<size_t> stamps(numBlockCols, 0);
+        std::vector<size_t> tiles;
+#pragma omp for schedule(dynamic, 64)
+        for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+        {
+            _csrTiles(csr, blockRow, blockRows, blockCols, stamps, tiles);
+            offsets[blockRow + 1] = tiles.size();
+        }
+    }
+
+    for (size_t blockRow = 0; blockRow < numBlockRows; ++blockRow)
+    {
+        offsets[blockRow + 1] += offsets[blockRow];
+    }
+
+    // Pass 2, scatter every nonzero into its tile, the slot of a block column is kept in the stamp array
+    std::vector<size_t> tileCols(offsets.back());
+    std::vector<T> tileValues(offsets.back() * tileSize, T(0));
+#pragma omp parallel if (csr.nnz() > 100000)
+    {
+        std::vector<size_t> stamps(numBlockCols, 0);
+        std::vector<size_t> tiles;
+#pragma omp for schedule(dynamic, 64)
+        for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+        {
+            _csrTiles(csr, blockRow, blockRows, blockCols, stamps, tiles);
+            for (size_t t = 0; t < tiles.size(); ++t)
+            {
+                tileCols[offsets[blockRow] + t] = tiles[t];
+                stamps[tiles[t]] = offsets[blockRow] + t;
+            }
+
+            for (size_t r = 0; r < blockRows; ++r)
+            {
+                size_t row = blockRow * blockRows + r;
+                for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+                {
+                    size_t col = colIndices[i];
+                    tileValues[stamps[col / blockCols] * tileSize + r * blockCols + col % blockCols] = csrValues[i];
+                }
+            }
+
+            // slots can collide with the stamps of later block rows, reset the touched entries
+            for (size_t tile : tiles)
+            {
+                stamps[tile] = 0;
+            }
+        }
+    }
+
+    blockRowPtr = std::move(offsets);
+    blockColIndices = std::move(tileCols);
+    values = std::move(tileValues);
+}
+
+template <typename T>
+BSR<T>::BSR(std::vector<size_t> shape, size_t blockRows, size_t blockCols, Buffer<size_t> blockRowPtr,
+            Buffer<size_t> blockColIndices, Buffer<T> values)
+    : values(std::move(values)), blockColIndices(std::move(blockColIndices)), blockRowPtr(std::move(blockRowPtr)),
+      shape(std::move(shape)), blockRows(blockRows), blockCols(blockCols)
+{
+    if (!_isValidBlockSize(this->shape, blockRows, blockCols) ||
+        this->blockRowPtr.size() != CSR<T>::rowsOf(this->shape) / blockRows + 1 ||
+        this->blockRowPtr.back() != this->blockColIndices.size() ||
+        this->values.size() != this->blockColIndices.size() * blockRows * blockCols)
+    {
+        throw std::invalid_argument("Compressed arrays do not match the shape of the tensor");
+    }
+
+    // the kernels index the dense operand and their stamp arrays with the block columns unchecked
+    size_t numBlockCols = cols() / blockCols;
+    if (std::any_of(this->blockColIndices.begin(), this->blockColIndices.end(),
+                    [numBlockCols](size_t blockCol) { return blockCol >= numBlockCols; }))
+    {
+        throw std::invalid_argument("Block column index is out of range");
+    }
+}
+
+// Conversion, counts the nonzeros of every scalar row first so the CSR arrays are allocated once
+template <typename T>
+template <typename Index>
+CSR<T, Index> BSR<T>::toCSR() const
+{
+    size_t numRows = rows();
+    size_t tileSize = blockRows * blockCols;
+    long long blockRowCount = static_cast<long long>(blockRowPtr.size() - 1);
+
+    std::vector<size_t> rowPtr(numRows + 1, 0);
+#pragma omp parallel for schedule(dynamic, 64) if (values.size() > 100000)
+    for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+    {
+        for (size_t r = 0; r < blockRows; ++r)
+        {
+            size_t count = 0;
+            for (size_t tile = blockRowPtr[blockRow]; tile < blockRowPtr[blockRow + 1]; ++tile)
+            {
+                count += _countNonZeros(values.data() + tile * tileSize + r * blockCols, blockCols);
+            }
+            rowPtr[blockRow * blockRows + r + 1] = count;
+        }
+    }
+
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        rowPtr[row + 1] += rowPtr[row];
+    }
+
+    std::vector<Index> colIndices(rowPtr.back());
+    std::vector<T> csrValues(rowPtr.back());
+#pragma omp parallel for schedule(dynamic, 64) if (values.size() > 100000)
+    for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+    {
+        for (size_t r = 0; r < blockRows; ++r)
+        {
+            size_t position = rowPtr[blockRow * blockRows + r];
+            for (size_t tile = blockRowPtr[blockRow]; tile < blockRowPtr[blockRow + 1]; ++tile)
+            {
+                position += _gatherNonZeros(values.data() + tile * tileSize + r * blockCols, blockCols,
+                                            blockColIndices[tile] * blockCols, colIndices.data() + position,
+                                            csrValues.data() + position);
+            }
+        }
+    }
+
+    return CSR<T, Index>(shape, std::move(rowPtr), std::move(colIndices), std::move(csrValues));
+}
+
+// Accessors
+template <typename T>
+const Buffer<T> &BSR<T>::getValues() const
+{
+    return values;
+}
+
+template <typename T>
+const Buffer<size_t> &BSR<T>::getBlockColIndices() const
+{
+    return blockColIndices;
+}
+
+template <typename T>
+const Buffer<size_t> &BSR<T>::getBlockRowPtr() const
+{
+    return blockRowPtr;
+}
+
+template <typename T>
+const std::vector<size_t> &BSR<T>::getShape() const
+{
+    return shape;
+}
+
+template <typename T>
+size_t BSR<T>::getBlockRows() const
+{
+    return blockRows;
+}
+
+template <typename T>
+size_t BSR<T>::getBlockCols() const
+{
+    return blockCols;
+}
+
+template <typename T>
+size_t BSR<T>::rows() const
+{
+    return CSR<T>::rowsOf(shape);
+}
+
+template <typename T>
+size_t BSR<T>::cols() const
+{
+    return CSR<T>::colsOf(shape);
+}
+
+template <typename T>
+size_t BSR<T>::numBlocks() const
+{
+    return blockColIndices.size();
+}
+
+// Block size detection, counts the tiles every candidate would store
+template <typename T>
+std::pair<size_t, size_t> BSR<T>::detectBlockSize(const T *data, const std::vector<size_t> &shape, double minFill)
+{
+    size_t numRows = CSR<T>::rowsOf(shape);
+    size_t numCols = CSR<T>::colsOf(shape);
+    size_t nnz = _countNonZeros(data, numRows * numCols);
+    if (nnz == 0)
+    {
+        return {1, 1};
+    }
+
+    for (size_t size : {8, 4, 2})
+    {
+        if (!_isValidBlockSize(shape, size, size))
+        {
+            continue;
+        }
+
+        size_t numTiles = 0;
+        long long blockRowCount = static_cast<long long>(numRows / size);
+#pragma omp parallel reduction(+ : numTiles) if (numRows * numCols > 100000)
+        {
+            std::vector<size_t> tiles;
+#pragma omp for schedule(static)
+            for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+            {
+                _denseTiles(data + blockRow * size * numCols, numCols, size, size, tiles);
+                numTiles += tiles.size();
+            }
+        }
+
+        if (static_cast<double>(nnz) >= minFill * static_cast<double>(numTiles * size * size))
+        {
+            return {size, size};
+        }
+    }
+    return {1, 1};
+}
+
+template <typename T>
+template <typename Index>
+std::pair<size_t, size_t> BSR<T>::detectBlockSize(const CSR<T, Index> &csr, double minFill)
+{
+    if (csr.nnz() == 0)
+    {
+        return {1, 1};
+    }
+
+    for (size_t size : {8, 4, 2})
+    {
+        if (!_isValidBlockSize(csr.getShape(), size, size))
+        {
+            continue;
+        }
+
+        size_t numTiles = 0;
+        long long blockRowCount = static_cast<long long>(csr.rows() / size);
+#pragma omp parallel reduction(+ : numTiles) if (csr.nnz() > 100000)
+        {
+            std::vector<size_t> stamps(csr.cols() / size, 0);
+            std::vector<size_t> tiles;
+#pragma omp for schedule(dynamic, 64)
+            for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+            {
+                _csrTiles(csr, blockRow, size, size, stamps, tiles);
+                numTiles += tiles.size();
+            }
+        }
+
+        if (static_cast<double>(csr.nnz()) >= minFill * static_cast<double>(numTiles * size * size))
+        {
+            return {size, size};
+        }
+    }
+    return {1, 1};
+}
+
+namespace
+{
+    inline bool _isValidBlockSize(const std::vector<size_t> &shape, size_t blockRows, size_t blockCols)
+    {
+        if (blockRows == 0 || blockCols == 0)
+        {
+            return false;
+        }
+        return CSR<double>::rowsOf(shape) % blockRows == 0 && CSR<double>::colsOf(shape) % blockCols == 0;
+    }
+
+    // block columns of the tiles of a dense block row holding a nonzero, in order
+    template <typename Src>
+    void _denseTiles(const Src *blockRow, size_t cols, size_t blockRows, size_t blockCols, std::vector<size_t> &tiles)
+    {
+        tiles.clear();
+        for (size_t tile = 0; tile < cols / blockCols; ++tile)
+        {
+            for (size_t r = 0; r < blockRows; ++r)
+            {
+                if (_countNonZeros(blockRow + r * cols + tile * blockCols, blockCols) != 0)
+                {
+                    tiles.push_back(tile);
+                    break;
+                }
+            }
+        }
+    }
+
+    // same for a block row of a CSR object, stamps holds blockRow + 1 for the block columns already seen
+    template <typename T, typename Index>
+    void _csrTiles(const CSR<T, Index> &csr, size_t blockRow, size_t blockRows, size_t blockCols, std::vector<size_t> &stamps,
+                   std::vector<size_t> &tiles)
+    {
+        const auto &rowPtr = csr.getRowPtr();
+        const auto &colIndices = csr.getColIndices();
+
+        tiles.clear();
+        for (size_t row = blockRow * blockRows; row < (blockRow + 1) * blockRows; ++row)
+        {
+            for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+            {
+                size_t tile = colIndices[i] / blockCols;
+                if (stamps[tile] != blockRow + 1)
+                {
+                    stamps[tile] = blockRow + 1;
+                    tiles.push_back(tile);
+                }
+            }
+        }
+        std::sort(tiles.begin(), tiles.end());
+    }
+}
+
+#endif // BSR_ADT_IMPL_HPP
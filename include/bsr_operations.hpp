@@ -0,0 +1,39 @@
+#ifndef BSR_OPERATIONS_HPP
+#define BSR_OPERATIONS_HPP
+
+#include "bsr_adt.hpp"
+#include <xtensor/xtensor.hpp>
+
+// convert BSR object to an xarray
+template <typename T>
+xt::xarray<T> BSRToDense(const BSR<T>& bsr);
+
+// multiply a BSR object with a dense matrix, (..., K) x (K, N) -> (..., N), written into result
+template <typename T>
+void BSRMultDense(const BSR<T>& bsr, const xt::xarray<T>& dense, xt::xarray<T>& result);
+
+// multiply two BSR objects, (..., K) x (K, N) -> (..., N), the block columns of bsr1 must match the block rows of bsr2
+template <typename T>
+BSR<T> BSRMult(const BSR<T>& bsr1, const BSR<T>& bsr2);
+
+namespace
+{
+    // helper functions
+    template <size_t R, size_t C, size_t S, typename T>
+    void _tileTimesStrip(const T* __restrict tile, const T* __restrict panel, size_t panelStride, T* __restrict out,
+                         size_t outStride);
+
+    template <size_t R, size_t C, size_t S, typename T>
+    void _tileTimesTail(const T* tile, const T* panel, size_t panelStride, T* out, size_t outStride, size_t width);
+
+    template <size_t R, size_t C, typename T>
+    void _tileTimesPanel(const T* tile, const T* panel, size_t panelStride, T* out, size_t outStride, size_t width);
+
+    template <typename T>
+    void _tileTimesPanel(size_t blockRows, size_t blockCols, const T* tile, const T* panel, size_t panelStride, T* out,
+                         size_t outStride, size_t width);
+}
+
+#include "bsr_operations_impl.hpp"
+
+#endif // BSR_OPERATIONS_HPP
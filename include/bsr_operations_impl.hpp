@@ -0,0 +1,292 @@
+#ifndef BSR_OPERATIONS_IMPL_HPP
+#define BSR_OPERATIONS_IMPL_HPP
+
+#include "bsr_operations.hpp"
+#include "simd_kernels.hpp"
+#include <algorithm>
+#include <xtensor/xbuilder.hpp>
+#include <stdexcept>
+
+// convert BSR object to an xarray
+template <typename T>
+xt::xarray<T> BSRToDense(const BSR<T> &bsr)
+{
+    xt::xarray<T> tensor = xt::zeros<T>(bsr.getShape());
+
+    const auto &blockRowPtr = bsr.getBlockRowPtr();
+    const auto &blockColIndices = bsr.getBlockColIndices();
+    const T *values = bsr.getValues().data();
+    size_t blockRows = bsr.getBlockRows();
+    size_t blockCols = bsr.getBlockCols();
+    size_t numCols = bsr.cols();
+
+    T *data = tensor.data();
+    long long numBlockRows = static_cast<long long>(blockRowPtr.size() - 1);
+#pragma omp parallel for schedule(static) if (bsr.getValues().size() > 100000)
+    for (long long blockRow = 0; blockRow < numBlockRows; ++blockRow)
+    {
+        for (size_t tile = blockRowPtr[blockRow]; tile < blockRowPtr[blockRow + 1]; ++tile)
+        {
+            for (size_t r = 0; r < blockRows; ++r)
+            {
+                const T *from = values + (tile * blockRows + r) * blockCols;
+                std::copy(from, from + blockCols, data + (blockRow * blockRows + r) * numCols + blockColIndices[tile] * blockCols);
+            }
+        }
+    }
+
+    return tensor;
+}
+
+/*
+Every tile multiplies the blockCols rows of dense it covers into the blockRows rows of the result it owns.
+Wide outputs are processed in column strips so the result rows of a block row stay in L1 across its tiles.
+*/
+template <typename T>
+void BSRMultDense(const BSR<T> &bsr, const xt::xarray<T> &dense, xt::xarray<T> &result)
+{
+    if (bsr.getShape().empty() || dense.dimension() != 2 || dense.shape()[0] != bsr.cols())
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    std::vector<size_t> resultShape(bsr.getShape());
+    resultShape.back() = dense.shape()[1];
+    if (!std::equal(resultShape.begin(), resultShape.end(), result.shape().begin(), result.shape().end()))
+    {
+        result.resize(resultShape);
+    }
+
+    const auto &blockRowPtr = bsr.getBlockRowPtr();
+    const auto &blockColIndices = bsr.getBlockColIndices();
+    const T *values = bsr.getValues().data();
+    size_t blockRows = bsr.getBlockRows();
+    size_t blockCols = bsr.getBlockCols();
+    size_t tileSize = blockRows * blockCols;
+    size_t denseCols = dense.shape()[1];
+    const T *denseData = dense.data();
+    T *resultData = result.data();
+
+    constexpr size_t stripCols = 512;
+    long long numBlockRows = static_cast<long long>(blockRowPtr.size() - 1);
+#pragma omp parallel for schedule(dynamic, 16) if (bsr.getValues().size() * denseCols > 50000)
+    for (long long blockRow = 0; blockRow < numBlockRows; ++blockRow)
+    {
+        T *out = resultData + blockRow * blockRows * denseCols;
+        std::fill(out, out + blockRows * denseCols, T(0));
+        for (size_t strip = 0; strip < denseCols; strip += stripCols)
+        {
+            size_t width = std::min(stripCols, denseCols - strip);
+            for (size_t tile = blockRowPtr[blockRow]; tile < blockRowPtr[blockRow + 1]; ++tile)
+            {
+                const T *panel = denseData + blockColIndices[tile] * blockCols * denseCols + strip;
+                _tileTimesPanel(blockRows, blockCols, values + tile * tileSize, panel, denseCols, out + strip, denseCols, width);
+            }
+        }
+    }
+}
+
+/*
+Gustavson's algorithm over tiles: the output tiles of a block row are the block columns reached through its tiles,
+found with a stamp array, and every (A tile, B tile) pair is one tile times panel product into its output tile.
+Two passes like the scalar engine, counting the output tiles per block row, then filling them in place.
+*/
+template <typename T>
+BSR<T> BSRMult(const BSR<T> &bsr1, const BSR<T> &bsr2)
+{
+    const auto &shape1 = bsr1.getShape();
+    const auto &shape2 = bsr2.getShape();
+    if (shape1.empty() || shape2.size() != 2 || shape1.back() != shape2.front() ||
+        bsr1.getBlockCols() != bsr2.getBlockRows())
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    std::vector<size_t> resultShape(shape1);
+    resultShape.back() = shape2.back();
+
+    const auto &rowPtrA = bsr1.getBlockRowPtr();
+    const auto &colsA = bsr1.getBlockColIndices();
+    const auto &rowPtrB = bsr2.getBlockRowPtr();
+    const auto &colsB = bsr2.getBlockColIndices();
+    const T *valuesA = bsr1.getValues().data();
+    const T *valuesB = bsr2.getValues().data();
+
+    size_t blockRows = bsr1.getBlockRows();
+    size_t inner = bsr1.getBlockCols();
+    size_t blockCols = bsr2.getBlockCols();
+    size_t tileA = blockRows * inner;
+    size_t tileB = inner * blockCols;
+    size_t tileC = blockRows * blockCols;
+    size_t numBlockCols = bsr2.cols() / blockCols;
+    size_t numBlockRows = rowPtrA.size() - 1;
+    long long blockRowCount = static_cast<long long>(numBlockRows);
+    bool parallel = bsr1.numBlocks() * tileA > 10000;
+
+    // Symbolic pass, output tiles per block row
+    std::vector<size_t> resultRowPtr(numBlockRows + 1, 0);
+#pragma omp parallel if (parallel)
+    {
+        std::vector<size_t> stamps(numBlockCols, 0);
+#pragma omp for schedule(dynamic, 16)
+        for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+        {
+            size_t count = 0;
+            for (size_t i = rowPtrA[blockRow]; i < rowPtrA[blockRow + 1]; ++i)
+            {
+                for (size_t j = rowPtrB[colsA[i]]; j < rowPtrB[colsA[i] + 1]; ++j)
+                {
+                    if (stamps[colsB[j]] != static_cast<size_t>(blockRow) + 1)
+                    {
+                        stamps[colsB[j]] = blockRow + 1;
+                        ++count;
+                    }
+                }
+            }
+            resultRowPtr[blockRow + 1] = count;
+        }
+    }
+
+    for (size_t blockRow = 0; blockRow < numBlockRows; ++blockRow)
+    {
+        resultRowPtr[blockRow + 1] += resultRowPtr[blockRow];
+    }
+
+    // Numeric pass, the slot of every output block column is looked up through slots
+    std::vector<size_t> resultCols(resultRowPtr.back());
+    std::vector<T> resultValues(resultRowPtr.back() * tileC, T(0));
+#pragma omp parallel if (parallel)
+    {
+        std::vector<size_t> slots(numBlockCols, 0);
+        std::vector<size_t> stamps(numBlockCols, 0);
+#pragma omp for schedule(dynamic, 16)
+        for (long long blockRow = 0; blockRow < blockRowCount; ++blockRow)
+        {
+            size_t *rowCols = resultCols.data() + resultRowPtr[blockRow];
+            size_t count = 0;
+            for (size_t i = rowPtrA[blockRow]; i < rowPtrA[blockRow + 1]; ++i)
+            {
+                for (size_t j = rowPtrB[colsA[i]]; j < rowPtrB[colsA[i] + 1]; ++j)
+                {
+                    if (stamps[colsB[j]] != static_cast<size_t>(blockRow) + 1)
+                    {
+                        stamps[colsB[j]] = blockRow + 1;
+                        rowCols[count++] = colsB[j];
+                    }
+                }
+            }
+
+            std::sort(rowCols, rowCols + count);
+            for (size_t t = 0; t < count; ++t)
+            {
+                slots[rowCols[t]] = resultRowPtr[blockRow] + t;
+            }
+
+            for (size_t i = rowPtrA[blockRow]; i < rowPtrA[blockRow + 1]; ++i)
+            {
+                for (size_t j = rowPtrB[colsA[i]]; j < rowPtrB[colsA[i] + 1]; ++j)
+                {
+                    _tileTimesPanel(blockRows, inner, valuesA + i * tileA, valuesB + j * tileB, blockCols,
+                                    resultValues.data() + slots[colsB[j]] * tileC, blockCols, blockCols);
+                }
+            }
+        }
+    }
+
+    return BSR<T>(std::move(resultShape), blockRows, blockCols, std::move(resultRowPtr), std::move(resultCols),
+                  std::move(resultValues));
+}
+
+// Anonymous namespace
+namespace
+{
+    /*
+    out[0:R, 0:S] += tile (R x C, row major) * panel[0:C, 0:S], one strip of S columns.
+    An output row stays in registers while the C panel rows stream through it, so every output value is loaded and
+    stored once per tile. R, C and S are compile time constants and the loops unroll fully, the pointers do not alias
+    so the strip loop vectorizes instead of being packed across the tile.
+    */
+    template <size_t R, size_t C, size_t S, typename T>
+    void _tileTimesStrip(const T *__restrict tile, const T *__restrict panel, size_t panelStride, T *__restrict out,
+                         size_t outStride)
+    {
+        for (size_t r = 0; r < R; ++r)
+        {
+            T *__restrict outRow = out + r * outStride;
+            for (size_t c = 0; c < C; ++c)
+            {
+                T a = tile[r * C + c];
+                const T *__restrict panelRow = panel + c * panelStride;
+                for (size_t w = 0; w < S; ++w)
+                {
+                    outRow[w] += a * panelRow[w];
+                }
+            }
+        }
+    }
+
+    // the last width < 2 * S columns, one strip of every halving of S they contain
+    template <size_t R, size_t C, size_t S, typename T>
+    void _tileTimesTail(const T *tile, const T *panel, size_t panelStride, T *out, size_t outStride, size_t width)
+    {
+        if (width >= S)
+        {
+            _tileTimesStrip<R, C, S>(tile, panel, panelStride, out, outStride);
+            panel += S;
+            out += S;
+            width -= S;
+        }
+        if constexpr (S > 1)
+        {
+            _tileTimesTail<R, C, S / 2>(tile, panel, panelStride, out, outStride, width);
+        }
+    }
+
+    /*
+    out[0:R, 0:width] += tile (R x C, row major) * panel[0:C, 0:width].
+    The output is walked in strips of one 64 byte vector and the columns left over in narrower strips, so the
+    blockCols wide panels of BSRMult still use vectors, e.g. a 2 x 2 float tile goes through one strip of 2.
+    */
+    template <size_t R, size_t C, typename T>
+    void _tileTimesPanel(const T *tile, const T *panel, size_t panelStride, T *out, size_t outStride, size_t width)
+    {
+        constexpr size_t strip = 64 / sizeof(T);
+        size_t j = 0;
+        for (; j + strip <= width; j += strip)
+        {
+            _tileTimesStrip<R, C, strip>(tile, panel + j, panelStride, out + j, outStride);
+        }
+        _tileTimesTail<R, C, strip / 2>(tile, panel + j, panelStride, out + j, outStride, width - j);
+    }
+
+    // runtime block size, the common square sizes use the unrolled kernel, anything else one axpy per tile value
+    template <typename T>
+    void _tileTimesPanel(size_t blockRows, size_t blockCols, const T *tile, const T *panel, size_t panelStride, T *out,
+                         size_t outStride, size_t width)
+    {
+        if (blockRows == 8 && blockCols == 8)
+        {
+            _tileTimesPanel<8, 8>(tile, panel, panelStride, out, outStride, width);
+        }
+        else if (blockRows == 4 && blockCols == 4)
+        {
+            _tileTimesPanel<4, 4>(tile, panel, panelStride, out, outStride, width);
+        }
+        else if (blockRows == 2 && blockCols == 2)
+        {
+            _tileTimesPanel<2, 2>(tile, panel, panelStride, out, outStride, width);
+        }
+        else
+        {
+            for (size_t r = 0; r < blockRows; ++r)
+            {
+                for (size_t c = 0; c < blockCols; ++c)
+                {
+                    _axpy(width, tile[r * blockCols + c], panel + c * panelStride, out + r * outStride);
+                }
+            }
+        }
+    }
+}
+
+#endif // BSR_OPERATIONS_IMPL_HPP
@@ -0,0 +1,51 @@
+#ifndef CSC_ADT_HPP
+#define CSC_ADT_HPP
+
+#include "csr_adt.hpp"
+#include <vector>
+
+/*
+Compressed sparse column storage of a matrix. Column c owns the nonzeros [colPtr[c], colPtr[c + 1]) of rowIndices
+and values, sorted by row. The arrays are exactly those of the CSR of the transpose, which the class keeps as its
+storage, so transposed() hands out A^T as a CSR object without any copy and every CSR kernel runs on columns.
+*/
+template <typename T, typename Index = size_t>
+class CSC
+{
+private:
+    std::vector<size_t> shape; // shape of original matrix
+    CSR<T, Index> columns;     // CSR of the transpose, row c holds column c
+
+    // throws unless shape is a matrix
+    static std::vector<size_t> checkedShape(std::vector<size_t> shape);
+
+public:
+    // constructor for CSC using xarray or xtensor
+    explicit CSC(const xt::xarray<T> &tensor);
+
+    // constructor for CSC from a CSR matrix, one parallel transpose
+    explicit CSC(const CSR<T, Index> &csr);
+
+    // constructor for CSC from already compressed arrays
+    CSC(std::vector<size_t> shape, Buffer<size_t> colPtr, Buffer<Index> rowIndices, Buffer<T> values);
+
+    // CSR object holding the same matrix, one parallel transpose
+    CSR<T, Index> toCSR() const;
+
+    // the transpose of the matrix in CSR form, no copy
+    const CSR<T, Index> &transposed() const;
+
+    // Accessors
+    const Buffer<T> &getValues() const;
+    const Buffer<Index> &getRowIndices() const;
+    const Buffer<size_t> &getColPtr() const;
+    const std::vector<size_t> &getShape() const;
+
+    size_t rows() const;
+    size_t cols() const;
+    size_t nnz() const;
+};
+
+#include "csc_adt_impl.hpp"
+
+#endif // CSC_ADT_HPP
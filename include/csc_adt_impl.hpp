@@ -0,0 +1,94 @@
+#ifndef CSC_ADT_IMPL_HPP
+#define CSC_ADT_IMPL_HPP
+
+#include "csc_adt.hpp"
+#include "csr_operations.hpp"
+#include <stdexcept>
+#include <utility>
+
+// Constructors
+template <typename T, typename Index>
+CSC<T, Index>::CSC(const xt::xarray<T> &tensor)
+    : CSC(CSR<T, Index>(tensor))
+{
+}
+
+template <typename T, typename Index>
+CSC<T, Index>::CSC(const CSR<T, Index> &csr)
+    : shape(checkedShape(csr.getShape())), columns(CSRTranspose(csr))
+{
+}
+
+template <typename T, typename Index>
+CSC<T, Index>::CSC(std::vector<size_t> shape, Buffer<size_t> colPtr, Buffer<Index> rowIndices, Buffer<T> values)
+    : shape(checkedShape(std::move(shape))),
+      columns({this->shape[1], this->shape[0]}, std::move(colPtr), std::move(rowIndices), std::move(values))
+{
+}
+
+template <typename T, typename Index>
+std::vector<size_t> CSC<T, Index>::checkedShape(std::vector<size_t> shape)
+{
+    if (shape.size() != 2)
+    {
+        throw std::invalid_argument("CSC objects hold matrices, the tensor must have two dimensions");
+    }
+    return shape;
+}
+
+template <typename T, typename Index>
+CSR<T, Index> CSC<T, Index>::toCSR() const
+{
+    return CSRTranspose(columns);
+}
+
+template <typename T, typename Index>
+const CSR<T, Index> &CSC<T, Index>::transposed() const
+{
+    return columns;
+}
+
+// Accessors
+template <typename T, typename Index>
+const Buffer<T> &CSC<T, Index>::getValues() const
+{
+    return columns.getValues();
+}
+
+template <typename T, typename Index>
+const Buffer<Index> &CSC<T, Index>::getRowIndices() const
+{
+    return columns.getColIndices();
+}
+
+template <typename T, typename Index>
+const Buffer<size_t> &CSC<T, Index>::getColPtr() const
+{
+    return columns.getRowPtr();
+}
+
+template <typename T, typename Index>
+const std::vector<size_t> &CSC<T, Index>::getShape() const
+{
+    return shape;
+}
+
+template <typename T, typename Index>
+size_t CSC<T, Index>::rows() const
+{
+    return shape[0];
+}
+
+template <typename T, typename Index>
+size_t CSC<T, Index>::cols() const
+{
+    return shape[1];
+}
+
+template <typename T, typename Index>
+size_t CSC<T, Index>::nnz() const
+{
+    return columns.nnz();
+}
+
+#endif // CSC_ADT_IMPL_HPP
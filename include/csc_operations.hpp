@@ -0,0 +1,29 @@
+#ifndef CSC_OPERATIONS_HPP
+#define CSC_OPERATIONS_HPP
+
+#include "csc_adt.hpp"
+#include "csr_operations.hpp"
+
+// convert CSC object to an xarray
+template <typename T, typename Index>
+xt::xarray<T> CSCToDense(const CSC<T, Index>& csc);
+
+// multiply a CSC matrix with a dense vector, (M, K) x (K) -> (M), columns pushed into result
+template <typename T, typename Index>
+void CSCMultVec(const CSC<T, Index>& csc, const xt::xarray<T>& vector, xt::xarray<T>& result);
+
+// multiply a CSC matrix with a dense matrix, (M, K) x (K, N) -> (M, N)
+template <typename T, typename Index>
+void CSCMultDense(const CSC<T, Index>& csc, const xt::xarray<T>& dense, xt::xarray<T>& result);
+
+// multiply the transpose of a CSC matrix with a dense vector, (K, M)^T x (K) -> (M), one dot product per column
+template <typename T, typename Index>
+void CSCTransposeMultVec(const CSC<T, Index>& csc, const xt::xarray<T>& vector, xt::xarray<T>& result);
+
+// multiply the transpose of a CSC matrix with a dense matrix, (K, M)^T x (K, N) -> (M, N)
+template <typename T, typename Index>
+void CSCTransposeMultDense(const CSC<T, Index>& csc, const xt::xarray<T>& dense, xt::xarray<T>& result);
+
+#include "csc_operations_impl.hpp"
+
+#endif // CSC_OPERATIONS_HPP
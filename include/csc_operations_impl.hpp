@@ -0,0 +1,46 @@
+#ifndef CSC_OPERATIONS_IMPL_HPP
+#define CSC_OPERATIONS_IMPL_HPP
+
+#include "csc_operations.hpp"
+
+/*
+A CSC matrix is the CSR of its transpose, so A * x is the transposed product of that CSR, which pushes the
+columns into the result, and A^T * x is its plain product, which pulls every column with a dot product.
+*/
+
+// convert CSC object to an xarray
+template <typename T, typename Index>
+xt::xarray<T> CSCToDense(const CSC<T, Index> &csc)
+{
+    return CSRToDense(csc.toCSR());
+}
+
+// multiply a CSC matrix with a dense vector
+template <typename T, typename Index>
+void CSCMultVec(const CSC<T, Index> &csc, const xt::xarray<T> &vector, xt::xarray<T> &result)
+{
+    CSRTransposeMultVec(csc.transposed(), vector, result);
+}
+
+// multiply a CSC matrix with a dense matrix
+template <typename T, typename Index>
+void CSCMultDense(const CSC<T, Index> &csc, const xt::xarray<T> &dense, xt::xarray<T> &result)
+{
+    CSRTransposeMultDense(csc.transposed(), dense, result);
+}
+
+// multiply the transpose of a CSC matrix with a dense vector
+template <typename T, typename Index>
+void CSCTransposeMultVec(const CSC<T, Index> &csc, const xt::xarray<T> &vector, xt::xarray<T> &result)
+{
+    CSRMultVec(csc.transposed(), vector, result);
+}
+
+// multiply the transpose of a CSC matrix with a dense matrix
+template <typename T, typename Index>
+void CSCTransposeMultDense(const CSC<T, Index> &csc, const xt::xarray<T> &dense, xt::xarray<T> &result)
+{
+    CSRMultDense(csc.transposed(), dense, result);
+}
+
+#endif // CSC_OPERATIONS_IMPL_HPP
@@ -0,0 +1,73 @@
+#ifndef CSF_ADT_HPP
+#define CSF_ADT_HPP
+
+#include "csr_adt.hpp"
+#include <vector>
+#include <xtensor/xarray.hpp>
+
+/*
+Compressed sparse fiber storage for tensors of any rank. The nonzeros form a tree with one level per axis, taken in
+modeOrder: a node of level d is a distinct coordinate along modeOrder[d] under its parent's prefix, and the leaves of
+the last level hold the values. Level d keeps the coordinate of each of its nodes in fiberIndices[d], and for d < rank - 1
+the children of node n are the nodes [fiberPtr[d][n], fiberPtr[d][n + 1]) of level d + 1. Siblings are sorted.
+Shared prefixes are stored once, and every level partitions the leaves into contiguous ranges, so any leading group
+of axes can be treated as the rows of a matrix without moving data.
+*/
+template <typename T>
+class CSF
+{
+private:
+    std::vector<Buffer<size_t>> fiberPtr;     // child ranges of the nodes of levels 0 .. rank - 2
+    std::vector<Buffer<size_t>> fiberIndices; // coordinate of the nodes of every level
+    Buffer<T> values;                         // value of every leaf, in tree order
+    std::vector<size_t> shape;                // shape of original tensor
+    std::vector<size_t> modeOrder;            // axis stored at every level
+
+    // fill the levels from coordinates in axis order, shape and modeOrder must be set
+    void build(const std::vector<size_t> &coordinates, const T *entryValues, size_t count);
+
+public:
+    // constructor for CSF using xarray or xtensor, an empty modeOrder keeps the axes in order
+    explicit CSF(const xt::xarray<T> &tensor, std::vector<size_t> modeOrder = {});
+
+    // constructor for CSF from coordinates, nnz x rank row major in axis order, duplicates are summed
+    CSF(std::vector<size_t> shape, const std::vector<size_t> &coordinates, const std::vector<T> &values,
+        std::vector<size_t> modeOrder = {});
+
+    // constructor for CSF from the rows and columns of a CSR object, leading dimensions become axes again
+    template <typename Index>
+    explicit CSF(const CSR<T, Index> &csr, std::vector<size_t> modeOrder = {});
+
+    // same tensor stored with another mode order
+    CSF<T> permuted(std::vector<size_t> modeOrder) const;
+
+    // coordinates of the leaves, nnz x rank row major in axis order, matching getValues
+    std::vector<size_t> coordinates() const;
+
+    // Accessors
+    const Buffer<size_t> &getFiberPtr(size_t level) const;
+    const Buffer<size_t> &getFiberIndices(size_t level) const;
+    const Buffer<T> &getValues() const;
+    const std::vector<size_t> &getShape() const;
+    const std::vector<size_t> &getModeOrder() const;
+
+    size_t rank() const;
+    size_t nnz() const;
+    size_t numNodes(size_t level) const;
+
+    // Utilities
+    void print() const;
+};
+
+namespace
+{
+    // helper functions
+    inline std::vector<size_t> _checkedModeOrder(std::vector<size_t> modeOrder, size_t rank);
+
+    template <typename T>
+    std::vector<size_t> _leafBounds(const CSF<T> &csf, size_t level);
+}
+
+#include "csf_adt_impl.hpp"
+
+#endif // CSF_ADT_HPP
@@ -0,0 +1,314 @@
+#ifndef CSF_ADT_IMPL_HPP
+#define CSF_ADT_IMPL_HPP
+
+#include "csf_adt.hpp"
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+// Constructors
+template <typename T>
+CSF<T>::CSF(const xt::xarray<T> &tensor, std::vector<size_t> modeOrder)
+    : CSF(CSR<T>(tensor), std::move(modeOrder))
+{
+}
+
+template <typename T>
+CSF<T>::CSF(std::vector<size_t> shape, const std::vector<size_t> &coordinates, const std::vector<T> &values,
+            std::vector<size_t> modeOrder)
+    : shape(std::move(shape)), modeOrder(_checkedModeOrder(std::move(modeOrder), this->shape.size()))
+{
+    if (coordinates.size() != values.size() * this->shape.size())
+    {
+        throw std::invalid_argument("Coordinates do not match the number of values");
+    }
+    build(coordinates, values.data(), values.size());
+}
+
+// the nonzeros of the CSR rows are already in axis order, only the row has to be unflattened
+template <typename T>
+template <typename Index>
+CSF<T>::CSF(const CSR<T, Index> &csr, std::vector<size_t> modeOrder)
+    : shape(csr.getShape()), modeOrder(_checkedModeOrder(std::move(modeOrder), csr.getShape().size()))
+{
+    const auto &rowPtr = csr.getRowPtr();
+    const auto &colIndices = csr.getColIndices();
+    size_t order = shape.size();
+
+    std::vector<size_t> coordinates(csr.nnz() * order);
+    long long numRows = static_cast<long long>(csr.rows());
+#pragma omp parallel for schedule(dynamic, 256) if (csr.nnz() > 100000)
+    for (long long row = 0; row < numRows; ++row)
+    {
+        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+        {
+            size_t *entry = coordinates.data() + i * order;
+            size_t temp = row;
+            for (size_t dim = order - 1; dim > 0; --dim)
+            {
+                entry[dim - 1] = temp % shape[dim - 1];
+                temp /= shape[dim - 1];
+            }
+            entry[order - 1] = colIndices[i];
+        }
+    }
+    build(coordinates, csr.getValues().data(), csr.nnz());
+}
+
+/*
+The entries are sorted lexicographically in mode order, then walked once: an entry leaves the path of the previous
+one at its first differing level, and gets a new node on that level and every level below. Entries that never
+leave the path are duplicates and are summed into the last leaf.
+*/
+template <typename T>
+void CSF<T>::build(const std::vector<size_t> &coordinates, const T *entryValues, size_t count)
+{
+    size_t order = shape.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (size_t dim = 0; dim < order; ++dim)
+        {
+            if (coordinates[i * order + dim] >= shape[dim])
+            {
+                throw std::invalid_argument("Coordinates lie outside of the tensor");
+            }
+        }
+    }
+
+    auto less = [&](size_t lhs, size_t rhs)
+    {
+        for (size_t axis : modeOrder)
+        {
+            size_t left = coordinates[lhs * order + axis];
+            size_t right = coordinates[rhs * order + axis];
+            if (left != right)
+            {
+                return left < right;
+            }
+        }
+        return false;
+    };
+    std::vector<size_t> permutation(count);
+    std::iota(permutation.begin(), permutation.end(), 0);
+    if (!std::is_sorted(permutation.begin(), permutation.end(), less))
+    {
+        std::stable_sort(permutation.begin(), permutation.end(), less);
+    }
+
+    std::vector<std::vector<size_t>> pointers(order - 1);
+    std::vector<std::vector<size_t>> indices(order);
+    std::vector<T> leafValues;
+    leafValues.reserve(count);
+    for (size_t k = 0; k < count; ++k)
+    {
+        const size_t *entry = coordinates.data() + permutation[k] * order;
+        size_t level = 0;
+        if (k > 0)
+        {
+            const size_t *previous = coordinates.data() + permutation[k - 1] * order;
+            while (level < order && entry[modeOrder[level]] == previous[modeOrder[level]])
+            {
+                ++level;
+            }
+            if (level == order)
+            {
+                leafValues.back() += entryValues[permutation[k]];
+                continue;
+            }
+        }
+
+        for (size_t d = level; d < order; ++d)
+        {
+            if (d + 1 < order)
+            {
+                pointers[d].push_back(indices[d + 1].size());
+            }
+            indices[d].push_back(entry[modeOrder[d]]);
+        }
+        leafValues.push_back(entryValues[permutation[k]]);
+    }
+
+    fiberPtr.clear();
+    fiberIndices.clear();
+    for (size_t d = 0; d + 1 < order; ++d)
+    {
+        pointers[d].push_back(indices[d + 1].size());
+        fiberPtr.emplace_back(std::move(pointers[d]));
+    }
+    for (size_t d = 0; d < order; ++d)
+    {
+        fiberIndices.emplace_back(std::move(indices[d]));
+    }
+    values = std::move(leafValues);
+}
+
+template <typename T>
+CSF<T> CSF<T>::permuted(std::vector<size_t> modeOrder) const
+{
+    std::vector<T> leafValues(values.begin(), values.end());
+    return CSF<T>(shape, coordinates(), leafValues, std::move(modeOrder));
+}
+
+// every node writes its coordinate into the leaves below it
+template <typename T>
+std::vector<size_t> CSF<T>::coordinates() const
+{
+    size_t order = rank();
+    std::vector<size_t> result(nnz() * order);
+    for (size_t level = 0; level < order; ++level)
+    {
+        std::vector<size_t> bounds = _leafBounds(*this, level);
+        const auto &indices = fiberIndices[level];
+        size_t axis = modeOrder[level];
+        long long nodes = static_cast<long long>(indices.size());
+#pragma omp parallel for schedule(static) if (nnz() > 100000)
+        for (long long node = 0; node < nodes; ++node)
+        {
+            for (size_t leaf = bounds[node]; leaf < bounds[node + 1]; ++leaf)
+            {
+                result[leaf * order + axis] = indices[node];
+            }
+        }
+    }
+    return result;
+}
+
+// Accessors
+template <typename T>
+const Buffer<size_t> &CSF<T>::getFiberPtr(size_t level) const
+{
+    return fiberPtr[level];
+}
+
+template <typename T>
+const Buffer<size_t> &CSF<T>::getFiberIndices(size_t level) const
+{
+    return fiberIndices[level];
+}
+
+template <typename T>
+const Buffer<T> &CSF<T>::getValues() const
+{
+    return values;
+}
+
+template <typename T>
+const std::vector<size_t> &CSF<T>::getShape() const
+{
+    return shape;
+}
+
+template <typename T>
+const std::vector<size_t> &CSF<T>::getModeOrder() const
+{
+    return modeOrder;
+}
+
+template <typename T>
+size_t CSF<T>::rank() const
+{
+    return shape.size();
+}
+
+template <typename T>
+size_t CSF<T>::nnz() const
+{
+    return values.size();
+}
+
+template <typename T>
+size_t CSF<T>::numNodes(size_t level) const
+{
+    return fiberIndices[level].size();
+}
+
+// Utilities
+template <typename T>
+void CSF<T>::print() const
+{
+    std::cout << "Shape: [";
+    for (size_t i = 0; i < shape.size(); ++i)
+    {
+        std::cout << shape[i];
+        if (i != shape.size() - 1)
+        {
+            std::cout << ", ";
+        }
+    }
+    std::cout << "]" << std::endl;
+    std::cout << "(Values : [Indices]): ";
+
+    std::vector<size_t> coords = coordinates();
+    for (size_t i = 0; i < nnz(); ++i)
+    {
+        std::cout << "(" << values[i] << " : [";
+        for (size_t j = 0; j < rank(); ++j)
+        {
+            std::cout << coords[i * rank() + j];
+            if (j != rank() - 1)
+            {
+                std::cout << ", ";
+            }
+        }
+        std::cout << ((i != nnz() - 1) ? "]), " : "])");
+    }
+    std::cout << std::endl;
+}
+
+namespace
+{
+    // identity when empty, otherwise a permutation of the axes
+    inline std::vector<size_t> _checkedModeOrder(std::vector<size_t> modeOrder, size_t rank)
+    {
+        if (rank == 0)
+        {
+            throw std::invalid_argument("CSF tensors need at least one dimension");
+        }
+        if (modeOrder.empty())
+        {
+            modeOrder.resize(rank);
+            std::iota(modeOrder.begin(), modeOrder.end(), 0);
+            return modeOrder;
+        }
+
+        std::vector<size_t> sorted(modeOrder);
+        std::sort(sorted.begin(), sorted.end());
+        for (size_t axis = 0; axis < sorted.size(); ++axis)
+        {
+            if (sorted.size() != rank || sorted[axis] != axis)
+            {
+                throw std::invalid_argument("Mode order is not a permutation of the axes");
+            }
+        }
+        return modeOrder;
+    }
+
+    // leaves below the nodes of a level, node n covers the leaves [bounds[n], bounds[n + 1])
+    template <typename T>
+    std::vector<size_t> _leafBounds(const CSF<T> &csf, size_t level)
+    {
+        size_t lastLevel = csf.rank() - 1;
+        std::vector<size_t> bounds(csf.numNodes(level) + 1);
+        if (level == lastLevel)
+        {
+            std::iota(bounds.begin(), bounds.end(), 0);
+            return bounds;
+        }
+
+        const auto &pointers = csf.getFiberPtr(level);
+        std::copy(pointers.begin(), pointers.end(), bounds.begin());
+        for (size_t below = level + 1; below < lastLevel; ++below)
+        {
+            const auto &next = csf.getFiberPtr(below);
+            for (size_t &bound : bounds)
+            {
+                bound = next[bound];
+            }
+        }
+        return bounds;
+    }
+}
+
+#endif // CSF_ADT_IMPL_HPP
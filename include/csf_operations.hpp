@@ -0,0 +1,35 @@
+#ifndef CSF_OPERATIONS_HPP
+#define CSF_OPERATIONS_HPP
+
+#include "csf_adt.hpp"
+#include "csr_spgemm.hpp"
+#include <vector>
+
+// convert CSF object to an xarray
+template <typename T>
+xt::xarray<T> CSFToDense(const CSF<T>& csf);
+
+namespace sparse_ops
+{
+    // sum of tensorA * tensorB over the axis pairs (axesA[i], axesB[i]), like numpy.tensordot
+    // the result holds the other axes of tensorA in order, then the other axes of tensorB, a full contraction has shape (1)
+    template <typename T>
+    CSF<T> contract(const CSF<T>& tensorA, const CSF<T>& tensorB, const std::vector<size_t>& axesA,
+                    const std::vector<size_t>& axesB);
+}
+
+namespace
+{
+    // helper functions
+    template <typename T>
+    std::vector<size_t> _levelKeys(const CSF<T>& csf, size_t fromLevel, size_t toLevel);
+
+    template <typename T>
+    void _prefixGroups(const CSF<T>& csf, size_t depth, std::vector<size_t>& keys, std::vector<size_t>& bounds);
+
+    inline size_t _keySpace(const std::vector<size_t>& extents);
+}
+
+#include "csf_operations_impl.hpp"
+
+#endif // CSF_OPERATIONS_HPP
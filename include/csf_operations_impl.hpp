@@ -0,0 +1,302 @@
+#ifndef CSF_OPERATIONS_IMPL_HPP
+#define CSF_OPERATIONS_IMPL_HPP
+
+#include "csf_operations.hpp"
+#include <algorithm>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <xtensor/xbuilder.hpp>
+
+// convert CSF object to an xarray
+template <typename T>
+xt::xarray<T> CSFToDense(const CSF<T> &csf)
+{
+    xt::xarray<T> tensor = xt::zeros<T>(csf.getShape());
+
+    const auto &shape = csf.getShape();
+    const auto &values = csf.getValues();
+    std::vector<size_t> coordinates = csf.coordinates();
+    size_t order = csf.rank();
+
+    T *data = tensor.data();
+    for (size_t i = 0; i < csf.nnz(); ++i)
+    {
+        size_t flat = 0;
+        for (size_t dim = 0; dim < order; ++dim)
+        {
+            flat = flat * shape[dim] + coordinates[i * order + dim];
+        }
+        data[flat] = values[i];
+    }
+
+    return tensor;
+}
+
+namespace sparse_ops
+{
+    /*
+    The contraction is a sparse matrix product in disguise. A is stored with its free axes on the top levels and the
+    contracted axes below, so every node of its last free level is a row whose leaves carry a contraction key.
+    B is stored with the contracted axes on top, so every node of its last contracted level is the group of leaves
+    sharing one contraction key, each leaf carrying the key of its free coordinates. A hash join matches the leaves of
+    A to the groups of B, and every row accumulates its products in a hash accumulator like Gustavson's algorithm.
+    The tensors are only reordered when their stored mode order differs, and nothing dense is ever built.
+    */
+    template <typename T>
+    CSF<T> contract(const CSF<T> &tensorA, const CSF<T> &tensorB, const std::vector<size_t> &axesA,
+                    const std::vector<size_t> &axesB)
+    {
+        const auto &shapeA = tensorA.getShape();
+        const auto &shapeB = tensorB.getShape();
+        size_t rankA = shapeA.size();
+        size_t rankB = shapeB.size();
+
+        // Ensure the axes pair up, each axis at most once and with matching extents
+        std::vector<bool> contractedA(rankA, false), contractedB(rankB, false);
+        if (axesA.size() != axesB.size())
+        {
+            throw std::invalid_argument("Tensors are not compatible for contraction");
+        }
+        for (size_t i = 0; i < axesA.size(); ++i)
+        {
+            if (axesA[i] >= rankA || axesB[i] >= rankB || contractedA[axesA[i]] || contractedB[axesB[i]] ||
+                shapeA[axesA[i]] != shapeB[axesB[i]])
+            {
+                throw std::invalid_argument("Tensors are not compatible for contraction");
+            }
+            contractedA[axesA[i]] = true;
+            contractedB[axesB[i]] = true;
+        }
+
+        // mode orders, free axes of A above its contracted ones, contracted axes of B above its free ones
+        std::vector<size_t> orderA, orderB(axesB), freeExtentsA, freeExtentsB, contractedExtents;
+        for (size_t axis = 0; axis < rankA; ++axis)
+        {
+            if (!contractedA[axis])
+            {
+                orderA.push_back(axis);
+                freeExtentsA.push_back(shapeA[axis]);
+            }
+        }
+        orderA.insert(orderA.end(), axesA.begin(), axesA.end());
+        for (size_t axis = 0; axis < rankB; ++axis)
+        {
+            if (!contractedB[axis])
+            {
+                orderB.push_back(axis);
+                freeExtentsB.push_back(shapeB[axis]);
+            }
+        }
+        for (size_t axis : axesA)
+        {
+            contractedExtents.push_back(shapeA[axis]);
+        }
+
+        // keys are mixed radix numbers over the extents, they must fit in size_t
+        _keySpace(freeExtentsA);
+        _keySpace(freeExtentsB);
+        _keySpace(contractedExtents);
+
+        // Reorder only when needed
+        std::optional<CSF<T>> permutedA, permutedB;
+        const CSF<T> *a = &tensorA;
+        const CSF<T> *b = &tensorB;
+        if (tensorA.getModeOrder() != orderA)
+        {
+            permutedA.emplace(tensorA.permuted(orderA));
+            a = &*permutedA;
+        }
+        if (tensorB.getModeOrder() != orderB)
+        {
+            permutedB.emplace(tensorB.permuted(orderB));
+            b = &*permutedB;
+        }
+
+        size_t numFreeA = freeExtentsA.size();
+        size_t numContracted = contractedExtents.size();
+
+        // rows of A and the contraction key of every leaf of A
+        std::vector<size_t> rowKeys, rowBounds;
+        _prefixGroups(*a, numFreeA, rowKeys, rowBounds);
+        std::vector<size_t> leafKeysA = numContracted == 0 ? std::vector<size_t>(a->nnz(), 0)
+                                                           : _levelKeys(*a, numFreeA, rankA - 1);
+
+        // groups of B by contraction key and the free key of every leaf of B
+        std::vector<size_t> groupKeys, groupBounds;
+        _prefixGroups(*b, numContracted, groupKeys, groupBounds);
+        std::vector<size_t> leafKeysB = numContracted == rankB ? std::vector<size_t>(b->nnz(), 0)
+                                                               : _levelKeys(*b, numContracted, rankB - 1);
+        std::unordered_map<size_t, size_t> groupOf;
+        groupOf.reserve(groupKeys.size());
+        for (size_t group = 0; group < groupKeys.size(); ++group)
+        {
+            groupOf.emplace(groupKeys[group], group);
+        }
+
+        // Join, the matching group of every leaf of A and the multiply adds of every row
+        constexpr size_t noGroup = std::numeric_limits<size_t>::max();
+        size_t numRows = rowKeys.size();
+        std::vector<size_t> leafGroup(a->nnz(), noGroup);
+        std::vector<size_t> flops(numRows, 0);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            for (size_t leaf = rowBounds[row]; leaf < rowBounds[row + 1]; ++leaf)
+            {
+                auto match = groupOf.find(leafKeysA[leaf]);
+                if (match != groupOf.end())
+                {
+                    leafGroup[leaf] = match->second;
+                    flops[row] += groupBounds[match->second + 1] - groupBounds[match->second];
+                }
+            }
+        }
+
+        // Accumulate every row, chunks of equal flops collect their output in row order
+        bool parallel = false;
+        std::vector<size_t> bounds = _flopChunks(flops, parallel);
+        long long chunkCount = static_cast<long long>(bounds.size() - 1);
+
+        const auto &valuesA = a->getValues();
+        const auto &valuesB = b->getValues();
+        std::vector<std::vector<size_t>> chunkRows(chunkCount), chunkKeys(chunkCount);
+        std::vector<std::vector<T>> chunkValues(chunkCount);
+#pragma omp parallel if (parallel)
+        {
+            HashAccumulator<T> hash;
+            std::vector<std::pair<size_t, T>> scratch;
+            std::vector<size_t> keys;
+            std::vector<T> sums;
+#pragma omp for schedule(dynamic, 1)
+            for (long long chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                for (size_t row = bounds[chunk]; row < bounds[chunk + 1]; ++row)
+                {
+                    if (flops[row] == 0)
+                    {
+                        continue;
+                    }
+
+                    hash.reset(flops[row]);
+                    for (size_t leaf = rowBounds[row]; leaf < rowBounds[row + 1]; ++leaf)
+                    {
+                        size_t group = leafGroup[leaf];
+                        if (group == noGroup)
+                        {
+                            continue;
+                        }
+                        T value = valuesA[leaf];
+                        for (size_t j = groupBounds[group]; j < groupBounds[group + 1]; ++j)
+                        {
+                            hash.accumulate(leafKeysB[j], value * valuesB[j]);
+                        }
+                    }
+
+                    keys.resize(hash.size());
+                    sums.resize(hash.size());
+                    hash.extractSorted(keys.data(), sums.data(), scratch);
+                    chunkRows[chunk].insert(chunkRows[chunk].end(), keys.size(), row);
+                    chunkKeys[chunk].insert(chunkKeys[chunk].end(), keys.begin(), keys.end());
+                    chunkValues[chunk].insert(chunkValues[chunk].end(), sums.begin(), sums.end());
+                }
+            }
+        }
+
+        // Stitch, rows ascend and keys are sorted within rows, so the coordinates come out in axis order
+        std::vector<size_t> resultShape(freeExtentsA);
+        resultShape.insert(resultShape.end(), freeExtentsB.begin(), freeExtentsB.end());
+        bool scalar = resultShape.empty();
+        if (scalar)
+        {
+            resultShape.push_back(1);
+        }
+
+        size_t resultRank = resultShape.size();
+        std::vector<size_t> coordinates;
+        std::vector<T> resultValues;
+        for (long long chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            for (size_t i = 0; i < chunkKeys[chunk].size(); ++i)
+            {
+                size_t first = coordinates.size();
+                coordinates.resize(first + resultRank, 0);
+                size_t rowKey = rowKeys[chunkRows[chunk][i]];
+                for (size_t dim = numFreeA; dim > 0; --dim)
+                {
+                    coordinates[first + dim - 1] = rowKey % freeExtentsA[dim - 1];
+                    rowKey /= freeExtentsA[dim - 1];
+                }
+                size_t colKey = chunkKeys[chunk][i];
+                for (size_t dim = freeExtentsB.size(); dim > 0; --dim)
+                {
+                    coordinates[first + numFreeA + dim - 1] = colKey % freeExtentsB[dim - 1];
+                    colKey /= freeExtentsB[dim - 1];
+                }
+                resultValues.push_back(chunkValues[chunk][i]);
+            }
+        }
+
+        return CSF<T>(std::move(resultShape), coordinates, resultValues);
+    }
+}
+
+// Anonymous namespace
+namespace
+{
+    // mixed radix key of every node of toLevel over the coordinates of levels fromLevel .. toLevel
+    template <typename T>
+    std::vector<size_t> _levelKeys(const CSF<T> &csf, size_t fromLevel, size_t toLevel)
+    {
+        const auto &top = csf.getFiberIndices(fromLevel);
+        std::vector<size_t> keys(top.begin(), top.end());
+        for (size_t level = fromLevel + 1; level <= toLevel; ++level)
+        {
+            const auto &pointers = csf.getFiberPtr(level - 1);
+            const auto &indices = csf.getFiberIndices(level);
+            size_t extent = csf.getShape()[csf.getModeOrder()[level]];
+            std::vector<size_t> next(indices.size());
+            for (size_t parent = 0; parent < keys.size(); ++parent)
+            {
+                for (size_t child = pointers[parent]; child < pointers[parent + 1]; ++child)
+                {
+                    next[child] = keys[parent] * extent + indices[child];
+                }
+            }
+            keys = std::move(next);
+        }
+        return keys;
+    }
+
+    // groups of leaves sharing the coordinates of the first depth levels, with their keys and leaf ranges
+    template <typename T>
+    void _prefixGroups(const CSF<T> &csf, size_t depth, std::vector<size_t> &keys, std::vector<size_t> &bounds)
+    {
+        if (depth == 0)
+        {
+            keys.assign(1, 0);
+            bounds = {0, csf.nnz()};
+            return;
+        }
+        keys = _levelKeys(csf, 0, depth - 1);
+        bounds = _leafBounds(csf, depth - 1);
+    }
+
+    // number of distinct keys over the extents, throws if they do not fit in size_t
+    inline size_t _keySpace(const std::vector<size_t> &extents)
+    {
+        size_t space = 1;
+        for (size_t extent : extents)
+        {
+            if (extent != 0 && space > (std::numeric_limits<size_t>::max() - 1) / extent)
+            {
+                throw std::invalid_argument("Tensor is too large to key its coordinates in 64 bits");
+            }
+            space *= extent;
+        }
+        return space;
+    }
+}
+
+#endif // CSF_OPERATIONS_IMPL_HPP
@@ -1,30 +1,80 @@
 #ifndef CSR_ADT_HPP
 #define CSR_ADT_HPP
 
+#include "bfloat16.hpp"
+#include "csr_buffer.hpp"
+#include <cstdint>
+#include <type_traits>
+#include <variant>
 #include <vector>
 #include <xtensor/xarray.hpp>
 
-template <typename T>
+/*
+Compressed sparse row storage. Every dimension except the last one is flattened into rows,
+so a tensor of shape (d0, ..., dn-2, dn-1) is stored as a (d0 * ... * dn-2) x dn-1 matrix.
+The nonzeros of row r live in [rowPtr[r], rowPtr[r + 1]) of colIndices and values, sorted by column.
+The arrays are Buffers, so they can also be views into a memory mapped file, see LoadCSR.
+Column indices are stored as Index, narrow types cut the bytes streamed per nonzero by the multiply kernels,
+makeCompactCSR picks the narrowest one that fits the shape. Row offsets stay size_t, nnz is not bounded by cols.
+*/
+template <typename T, typename Index = size_t>
 class CSR
 {
+    static_assert(std::is_integral_v<Index> && std::is_unsigned_v<Index>, "CSR indices must be unsigned integers");
+
 private:
-    std::vector<T> values;                    // non zero values
-    std::vector<std::vector<size_t>> indices; // indices of non zero values for each dimension
-    std::vector<size_t> shape;                // shape of original tensor
+    Buffer<T> values;          // non zero values, row by row
+    Buffer<Index> colIndices;  // column (last dimension) index of each non zero value
+    Buffer<size_t> rowPtr;     // offset of each row into values and colIndices, size is rows + 1
+    std::vector<size_t> shape; // shape of original tensor
 
 public:
+    using index_type = Index;
+
     // constructor for CSR using xarray or xtensor
     explicit CSR(const xt::xarray<T> &tensor);
 
+    // constructor for CSR from a contiguous row major buffer holding a tensor of the given shape
+    template <typename Src>
+    CSR(const Src *data, std::vector<size_t> shape);
+
+    // constructor for CSR from already compressed arrays, the row offsets are checked, the column indices are trusted
+    CSR(std::vector<size_t> shape, Buffer<size_t> rowPtr, Buffer<Index> colIndices, Buffer<T> values);
+
     // Accessors
-    const std::vector<T> &getValues() const;
-    const std::vector<std::vector<size_t>> &getIndices() const;
+    const Buffer<T> &getValues() const;
+    const Buffer<Index> &getColIndices() const;
+    const Buffer<size_t> &getRowPtr() const;
     const std::vector<size_t> &getShape() const;
 
+    // values of the existing pattern, for products that rewrite them in place
+    Buffer<T> &getMutableValues();
+
+    size_t rows() const;
+    size_t cols() const;
+    size_t nnz() const;
+
     // Utilities
     void print() const;
+
+    // number of rows and columns of the flattened matrix for a tensor shape
+    static size_t rowsOf(const std::vector<size_t> &shape);
+    static size_t colsOf(const std::vector<size_t> &shape);
+
+    // largest number of columns Index can address
+    static size_t maxCols();
 };
 
+// CSR with the narrowest column index type for its shape
+template <typename T>
+using CompactCSR = std::variant<CSR<T, uint16_t>, CSR<T, uint32_t>, CSR<T, size_t>>;
+
+template <typename T>
+CompactCSR<T> makeCompactCSR(const xt::xarray<T> &tensor);
+
+template <typename T, typename Src>
+CompactCSR<T> makeCompactCSR(const Src *data, std::vector<size_t> shape);
+
 #include "csr_adt_impl.hpp"
 
-#endif // CSR_ADT_HPP
\ No newline at end of file
+#endif // CSR_ADT_HPP
@@ -2,93 +2,261 @@
 #define CSR_ADT_IMPL_HPP
 
 #include "csr_adt.hpp"
-#include <xtensor/xstrided_view.hpp>
+#include "simd_kernels.hpp"
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
 
 // Constructor
-template <typename T>
-CSR<T>::CSR(const xt::xarray<T> &tensor)
+template <typename T, typename Index>
+CSR<T, Index>::CSR(const xt::xarray<T> &tensor)
+    : CSR(tensor.data(), std::vector<size_t>(tensor.shape().begin(), tensor.shape().end()))
 {
-    shape = std::vector<size_t>(tensor.shape().begin().tensor.shape().end());
+}
 
-    for (auto i = tensor.begin(); i != tensor.end(); ++i)
+/*
+Two pass conversion over fixed size blocks of the flat buffer, so that even a single huge row splits across threads:
+1. count the nonzeros of every block
+2. prefix sum the counts into the output offset of every block and allocate the arrays once
+3. every block writes its nonzeros straight into its slice, and records the start of the rows beginning inside it
+The output is in row major order whatever the number of threads.
+*/
+template <typename T, typename Index>
+template <typename Src>
+CSR<T, Index>::CSR(const Src *data, std::vector<size_t> shape) : shape(std::move(shape))
+{
+    size_t numRows = rowsOf(this->shape);
+    size_t numCols = colsOf(this->shape);
+    size_t total = numRows * numCols;
+    if (numCols > maxCols())
     {
-        if (*i != 0)
-        {
-            values.push_back(*i);
+        throw std::invalid_argument("Index type is too narrow for the columns of the tensor");
+    }
+
+    constexpr size_t blockSize = size_t(1) << 16;
+    size_t numBlocks = (total + blockSize - 1) / blockSize;
+    long long blockCount = static_cast<long long>(numBlocks);
+
+    // Pass 1, nonzeros per block
+    std::vector<size_t> offsets(numBlocks + 1, 0);
+#pragma omp parallel for schedule(static) if (numBlocks > 1)
+    for (long long block = 0; block < blockCount; ++block)
+    {
+        size_t begin = block * blockSize;
+        offsets[block + 1] = _countNonZeros(data + begin, std::min(blockSize, total - begin));
+    }
+
+    for (size_t block = 0; block < numBlocks; ++block)
+    {
+        offsets[block + 1] += offsets[block];
+    }
+
+    values.resize(offsets.back());
+    colIndices.resize(offsets.back());
+    rowPtr.assign(numRows + 1, 0);
+    rowPtr.vector().back() = offsets.back();
+    if (total == 0)
+    {
+        return;
+    }
+
+    size_t *rowStarts = rowPtr.mutableData();
+    Index *cols = colIndices.mutableData();
+    T *vals = values.mutableData();
 
-            auto flat_index = std::distance(tensor.begin(), i);
-            std::vector multi_index(tensor.shape().size());
-            auto strides = xt::strides(tensor.shape());
-            for (auto dim = 0; dim < tensor.shape().size(); ++dim)
+    // Pass 2, fill, walking the block one row segment at a time so the column is just the position in the segment
+#pragma omp parallel for schedule(static) if (numBlocks > 1)
+    for (long long block = 0; block < blockCount; ++block)
+    {
+        size_t flat = block * blockSize;
+        size_t blockEnd = std::min(flat + blockSize, total);
+        size_t row = flat / numCols;
+        size_t col = flat % numCols;
+        size_t position = offsets[block];
+
+        while (flat < blockEnd)
+        {
+            if (col == 0)
             {
-                multi_index[dim] = flat_index / strides[dim];
-                flat_index %= strides[dim];
+                rowStarts[row] = position;
             }
-            indices.push_back(multi_index);
+
+            size_t length = std::min(numCols - col, blockEnd - flat);
+            position += _gatherNonZeros(data + flat, length, col, cols + position, vals + position);
+
+            flat += length;
+            col = 0;
+            ++row;
         }
     }
 }
 
+template <typename T, typename Index>
+CSR<T, Index>::CSR(std::vector<size_t> shape, Buffer<size_t> rowPtr, Buffer<Index> colIndices, Buffer<T> values)
+    : values(std::move(values)), colIndices(std::move(colIndices)), rowPtr(std::move(rowPtr)), shape(std::move(shape))
+{
+    if (this->rowPtr.size() != rowsOf(this->shape) + 1 || this->colIndices.size() != this->values.size() ||
+        this->rowPtr.back() != this->values.size())
+    {
+        throw std::invalid_argument("Compressed arrays do not match the shape of the tensor");
+    }
+    // the kernels slice rows by their offsets, so they have to start at 0 and never decrease
+    const size_t *offsets = this->rowPtr.data();
+    if (offsets[0] != 0 || !std::is_sorted(offsets, offsets + this->rowPtr.size()))
+    {
+        throw std::invalid_argument("Row offsets of the tensor are not increasing");
+    }
+    if (colsOf(this->shape) > maxCols())
+    {
+        throw std::invalid_argument("Index type is too narrow for the columns of the tensor");
+    }
+}
+
 // Accessors
-template <typename T>
-const std::vector<T> &CSR<T>::getValues() const
+template <typename T, typename Index>
+const Buffer<T> &CSR<T, Index>::getValues() const
 {
     return values;
 }
 
-template <typename T>
-const std::vector<std::vector<size_t>> &CSR<T>::getIndices() const
+template <typename T, typename Index>
+Buffer<T> &CSR<T, Index>::getMutableValues()
 {
-    return indices;
+    return values;
 }
 
-template <typename T>
-const std::vector<size_t> &CSR<T>::getShape() const
+template <typename T, typename Index>
+const Buffer<Index> &CSR<T, Index>::getColIndices() const
+{
+    return colIndices;
+}
+
+template <typename T, typename Index>
+const Buffer<size_t> &CSR<T, Index>::getRowPtr() const
+{
+    return rowPtr;
+}
+
+template <typename T, typename Index>
+const std::vector<size_t> &CSR<T, Index>::getShape() const
 {
     return shape;
 }
 
+template <typename T, typename Index>
+size_t CSR<T, Index>::rows() const
+{
+    return rowPtr.size() - 1;
+}
+
+template <typename T, typename Index>
+size_t CSR<T, Index>::cols() const
+{
+    return colsOf(shape);
+}
+
+template <typename T, typename Index>
+size_t CSR<T, Index>::nnz() const
+{
+    return values.size();
+}
+
+template <typename T, typename Index>
+size_t CSR<T, Index>::rowsOf(const std::vector<size_t> &shape)
+{
+    size_t numRows = 1;
+    for (size_t dim = 0; dim + 1 < shape.size(); ++dim)
+    {
+        numRows *= shape[dim];
+    }
+    return numRows;
+}
+
+template <typename T, typename Index>
+size_t CSR<T, Index>::colsOf(const std::vector<size_t> &shape)
+{
+    return shape.empty() ? 1 : shape.back();
+}
+
+template <typename T, typename Index>
+size_t CSR<T, Index>::maxCols()
+{
+    // columns are 0 .. cols - 1, so a narrow type addresses one more column than its largest value
+    constexpr size_t largest = std::numeric_limits<Index>::max();
+    return largest == std::numeric_limits<size_t>::max() ? largest : largest + 1;
+}
+
 // Utilities
-template <typename T>
-void CSR<T>::print() const
+template <typename T, typename Index>
+void CSR<T, Index>::print() const
 {
     std::cout << "Shape: [";
-    for (auto i = 0; i < shape.size(); ++i)
+    for (size_t i = 0; i < shape.size(); ++i)
     {
         std::cout << shape[i];
         if (i != shape.size() - 1)
         {
             std::cout << ", ";
         }
-        else
-        {
-            std::cout << "]";
-        }
     }
-    std::cout << std::endl;
+    std::cout << "]" << std::endl;
     std::cout << "(Values : [Indices]): ";
-    for (auto i = 0; i < values.size(); ++i)
+
+    std::vector<size_t> multi_index(shape.size());
+    for (size_t row = 0; row < rows(); ++row)
     {
-        std::cout << "(" << values[i] << " : [";
-        for (auto j = 0; j < indices[i].size(); ++j)
+        // unflatten the row into the leading dimensions
+        size_t temp = row;
+        for (size_t dim = shape.size(); dim > 1; --dim)
         {
-            std::cout << indices[i][j];
-            if (j != indices[i].size() - 1)
-            {
-                std::cout << ", ";
-            }
-        }
-        if (i != values.size() - 1)
-        {
-            std::cout << "]), ";
+            multi_index[dim - 2] = temp % shape[dim - 2];
+            temp /= shape[dim - 2];
         }
-        else
+
+        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
         {
-            std::cout << "])";
+            if (!shape.empty())
+            {
+                multi_index.back() = colIndices[i];
+            }
+
+            std::cout << "(" << values[i] << " : [";
+            for (size_t j = 0; j < multi_index.size(); ++j)
+            {
+                std::cout << multi_index[j];
+                if (j != multi_index.size() - 1)
+                {
+                    std::cout << ", ";
+                }
+            }
+            std::cout << ((i != values.size() - 1) ? "]), " : "])");
         }
     }
     std::cout << std::endl;
 }
 
-#endif // CSR_ADT_IMPL_HPP
\ No newline at end of file
+// Factories
+template <typename T>
+CompactCSR<T> makeCompactCSR(const xt::xarray<T> &tensor)
+{
+    return makeCompactCSR<T>(tensor.data(), std::vector<size_t>(tensor.shape().begin(), tensor.shape().end()));
+}
+
+template <typename T, typename Src>
+CompactCSR<T> makeCompactCSR(const Src *data, std::vector<size_t> shape)
+{
+    size_t numCols = CSR<T>::colsOf(shape);
+    if (numCols <= CSR<T, uint16_t>::maxCols())
+    {
+        return CSR<T, uint16_t>(data, std::move(shape));
+    }
+    if (numCols <= CSR<T, uint32_t>::maxCols())
+    {
+        return CSR<T, uint32_t>(data, std::move(shape));
+    }
+    return CSR<T, size_t>(data, std::move(shape));
+}
+
+#endif // CSR_ADT_IMPL_HPP
@@ -0,0 +1,50 @@
+#ifndef CSR_BUFFER_HPP
+#define CSR_BUFFER_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/*
+Contiguous array behind the compressed arrays of CSR. It either owns its elements in a vector or borrows
+memory owned elsewhere, like a memory mapped file, which keepAlive holds open for as long as any copy of the
+buffer exists. Writing to a borrowed buffer first copies it into an owned vector.
+*/
+template <typename T>
+class Buffer
+{
+private:
+    std::vector<T> owned;
+    const T *borrowedData = nullptr;
+    size_t borrowedSize = 0;
+    std::shared_ptr<const void> keepAlive; // set only for borrowed buffers
+
+public:
+    Buffer() = default;
+    Buffer(std::vector<T> values);
+    Buffer(size_t count, const T &value);
+
+    // view over memory kept alive by keepAlive, no copy
+    static Buffer borrow(const T *data, size_t count, std::shared_ptr<const void> keepAlive);
+
+    // Accessors
+    const T *data() const;
+    size_t size() const;
+    bool empty() const;
+    bool isBorrowed() const;
+    const T &operator[](size_t i) const;
+    const T &front() const;
+    const T &back() const;
+    const T *begin() const;
+    const T *end() const;
+
+    // Modifiers, a borrowed buffer is copied first
+    T *mutableData();
+    std::vector<T> &vector();
+    void resize(size_t count);
+    void assign(size_t count, const T &value);
+};
+
+#include "csr_buffer_impl.hpp"
+
+#endif // CSR_BUFFER_HPP
@@ -0,0 +1,118 @@
+#ifndef CSR_BUFFER_IMPL_HPP
+#define CSR_BUFFER_IMPL_HPP
+
+#include "csr_buffer.hpp"
+#include <utility>
+
+// Constructors
+template <typename T>
+Buffer<T>::Buffer(std::vector<T> values) : owned(std::move(values))
+{
+}
+
+template <typename T>
+Buffer<T>::Buffer(size_t count, const T &value) : owned(count, value)
+{
+}
+
+template <typename T>
+Buffer<T> Buffer<T>::borrow(const T *data, size_t count, std::shared_ptr<const void> keepAlive)
+{
+    Buffer buffer;
+    buffer.borrowedData = data;
+    buffer.borrowedSize = count;
+    buffer.keepAlive = std::move(keepAlive);
+    return buffer;
+}
+
+// Accessors
+template <typename T>
+const T *Buffer<T>::data() const
+{
+    return keepAlive ? borrowedData : owned.data();
+}
+
+template <typename T>
+size_t Buffer<T>::size() const
+{
+    return keepAlive ? borrowedSize : owned.size();
+}
+
+template <typename T>
+bool Buffer<T>::empty() const
+{
+    return size() == 0;
+}
+
+template <typename T>
+bool Buffer<T>::isBorrowed() const
+{
+    return static_cast<bool>(keepAlive);
+}
+
+template <typename T>
+const T &Buffer<T>::operator[](size_t i) const
+{
+    return data()[i];
+}
+
+template <typename T>
+const T &Buffer<T>::front() const
+{
+    return data()[0];
+}
+
+template <typename T>
+const T &Buffer<T>::back() const
+{
+    return data()[size() - 1];
+}
+
+template <typename T>
+const T *Buffer<T>::begin() const
+{
+    return data();
+}
+
+template <typename T>
+const T *Buffer<T>::end() const
+{
+    return data() + size();
+}
+
+// Modifiers
+template <typename T>
+std::vector<T> &Buffer<T>::vector()
+{
+    if (keepAlive)
+    {
+        owned.assign(borrowedData, borrowedData + borrowedSize);
+        borrowedData = nullptr;
+        borrowedSize = 0;
+        keepAlive.reset();
+    }
+    return owned;
+}
+
+template <typename T>
+T *Buffer<T>::mutableData()
+{
+    return vector().data();
+}
+
+template <typename T>
+void Buffer<T>::resize(size_t count)
+{
+    vector().resize(count);
+}
+
+template <typename T>
+void Buffer<T>::assign(size_t count, const T &value)
+{
+    keepAlive.reset();
+    borrowedData = nullptr;
+    borrowedSize = 0;
+    owned.assign(count, value);
+}
+
+#endif // CSR_BUFFER_IMPL_HPP
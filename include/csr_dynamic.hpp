@@ -0,0 +1,118 @@
+#ifndef CSR_DYNAMIC_HPP
+#define CSR_DYNAMIC_HPP
+
+#include "csr_adt.hpp"
+#include "csr_operations.hpp"
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*
+A CSR object that takes single entry updates. The compressed arrays are an immutable snapshot, updates go to a small
+delta buffer sorted by (row, column), like the memtable of an LSM tree, so an update costs a lookup in the delta and
+never touches the arrays. Once the delta holds mergeThreshold entries it is frozen and merged into a new snapshot on a
+background thread while later updates collect in a fresh delta. A merge copies the untouched runs of rows and only
+merges the rows named in the delta.
+Reads see the snapshot, the frozen delta and the delta, newest first. view() folds everything into one CSR snapshot,
+which stays valid and unchanged while later updates arrive, so products always run on a consistent matrix.
+Rows are the flattened leading dimensions, like CSR::rows(). All members are safe to call from several threads.
+*/
+template <typename T, typename Index = size_t>
+class DynamicCSR
+{
+private:
+    // pending change of one entry, erased entries are removed by the merge
+    struct Delta
+    {
+        T value;
+        bool erased;
+    };
+    using DeltaBuffer = std::map<std::pair<size_t, size_t>, Delta>;
+    using Snapshot = std::shared_ptr<const CSR<T, Index>>;
+
+    std::vector<size_t> shape;
+    mutable std::mutex mutex;
+    mutable Snapshot base;                              // compressed arrays as of the last finished merge
+    mutable DeltaBuffer delta;                          // updates since the last merge started
+    mutable std::shared_ptr<const DeltaBuffer> merging; // updates being merged in the background, null when idle
+    mutable std::future<Snapshot> pendingMerge;         // the background merge
+    size_t mergeThreshold;
+
+    // the entry as seen by a read, with the lock held, nullptr when it is not stored
+    const T *find(size_t row, size_t col) const;
+
+    // write one change into the delta with the lock held, starts a merge once the delta is full
+    void store(size_t row, size_t col, Delta change);
+
+    // install a finished background merge, with wait it blocks until the merge is done
+    void collect(bool wait) const;
+
+    // freeze the delta and start merging it, with the lock held and no merge running
+    void startMerge() const;
+
+    void checkCoordinates(size_t row, size_t col) const;
+
+public:
+    // start from a CSR object, a threshold of 0 picks one from the number of nonzeros
+    explicit DynamicCSR(CSR<T, Index> csr, size_t mergeThreshold = 0);
+
+    // start from an empty tensor
+    explicit DynamicCSR(std::vector<size_t> shape, size_t mergeThreshold = 0);
+
+    ~DynamicCSR();
+
+    DynamicCSR(const DynamicCSR &) = delete;
+    DynamicCSR &operator=(const DynamicCSR &) = delete;
+
+    // store value at (row, col), replacing any value already there
+    void insert(size_t row, size_t col, T value);
+
+    // replace the value at (row, col), returns false and changes nothing if the entry is not stored
+    bool update(size_t row, size_t col, T value);
+
+    // remove the entry at (row, col), returns false if it is not stored
+    bool erase(size_t row, size_t col);
+
+    // value at (row, col), 0 when the entry is not stored
+    T get(size_t row, size_t col) const;
+    bool contains(size_t row, size_t col) const;
+
+    // merge every pending update now, waits for a background merge first
+    void merge();
+
+    // start merging the pending updates on a background thread, returns at once
+    void mergeAsync();
+
+    // consistent snapshot with every update so far, pending updates are merged first
+    Snapshot view() const;
+
+    // Accessors
+    size_t pendingUpdates() const;
+    size_t getMergeThreshold() const;
+    void setMergeThreshold(size_t threshold);
+    const std::vector<size_t> &getShape() const;
+};
+
+// products of the current views
+template <typename T, typename Index>
+CSR<T, Index> CSRMult(const DynamicCSR<T, Index> &csr1, const DynamicCSR<T, Index> &csr2);
+
+template <typename T, typename Index>
+void CSRMultVec(const DynamicCSR<T, Index> &csr, const xt::xarray<T> &vector, xt::xarray<T> &result);
+
+template <typename T, typename Index>
+void CSRMultDense(const DynamicCSR<T, Index> &csr, const xt::xarray<T> &dense, xt::xarray<T> &result);
+
+namespace
+{
+    // helper functions
+    template <typename T, typename Index, typename DeltaBuffer>
+    CSR<T, Index> _mergeDelta(const CSR<T, Index> &base, const DeltaBuffer &delta);
+}
+
+#include "csr_dynamic_impl.hpp"
+
+#endif // CSR_DYNAMIC_HPP
@@ -0,0 +1,386 @@
+#ifndef CSR_DYNAMIC_IMPL_HPP
+#define CSR_DYNAMIC_IMPL_HPP
+
+#include "csr_dynamic.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+// Constructors
+template <typename T, typename Index>
+DynamicCSR<T, Index>::DynamicCSR(CSR<T, Index> csr, size_t mergeThreshold)
+    : shape(csr.getShape()), mergeThreshold(mergeThreshold)
+{
+    if (shape.empty())
+    {
+        throw std::invalid_argument("Tensor needs at least one dimension");
+    }
+    // a merge copies the arrays once, so the delta grows with them to keep the copy per update bounded
+    if (this->mergeThreshold == 0)
+    {
+        this->mergeThreshold = std::max<size_t>(4096, csr.nnz() / 32);
+    }
+    base = std::make_shared<const CSR<T, Index>>(std::move(csr));
+}
+
+template <typename T, typename Index>
+DynamicCSR<T, Index>::DynamicCSR(std::vector<size_t> shape, size_t mergeThreshold)
+    : DynamicCSR(CSR<T, Index>(shape, std::vector<size_t>(CSR<T, Index>::rowsOf(shape) + 1, 0), std::vector<Index>(),
+                               std::vector<T>()),
+                 mergeThreshold)
+{
+}
+
+template <typename T, typename Index>
+DynamicCSR<T, Index>::~DynamicCSR()
+{
+    if (pendingMerge.valid())
+    {
+        pendingMerge.wait();
+    }
+}
+
+// Updates
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::insert(size_t row, size_t col, T value)
+{
+    checkCoordinates(row, col);
+    std::lock_guard<std::mutex> lock(mutex);
+    collect(false);
+    store(row, col, Delta{value, false});
+}
+
+template <typename T, typename Index>
+bool DynamicCSR<T, Index>::update(size_t row, size_t col, T value)
+{
+    checkCoordinates(row, col);
+    std::lock_guard<std::mutex> lock(mutex);
+    collect(false);
+    if (find(row, col) == nullptr)
+    {
+        return false;
+    }
+    store(row, col, Delta{value, false});
+    return true;
+}
+
+template <typename T, typename Index>
+bool DynamicCSR<T, Index>::erase(size_t row, size_t col)
+{
+    checkCoordinates(row, col);
+    std::lock_guard<std::mutex> lock(mutex);
+    collect(false);
+    if (find(row, col) == nullptr)
+    {
+        return false;
+    }
+    store(row, col, Delta{T(0), true});
+    return true;
+}
+
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::store(size_t row, size_t col, Delta change)
+{
+    delta[{row, col}] = change;
+
+    // one merge at a time, a delta twice over the threshold waits for the running one
+    if (delta.size() >= mergeThreshold)
+    {
+        if (merging && delta.size() >= 2 * mergeThreshold)
+        {
+            collect(true);
+        }
+        if (!merging)
+        {
+            startMerge();
+        }
+    }
+}
+
+// Reads
+template <typename T, typename Index>
+T DynamicCSR<T, Index>::get(size_t row, size_t col) const
+{
+    checkCoordinates(row, col);
+    std::lock_guard<std::mutex> lock(mutex);
+    const T *value = find(row, col);
+    return value != nullptr ? *value : T(0);
+}
+
+template <typename T, typename Index>
+bool DynamicCSR<T, Index>::contains(size_t row, size_t col) const
+{
+    checkCoordinates(row, col);
+    std::lock_guard<std::mutex> lock(mutex);
+    return find(row, col) != nullptr;
+}
+
+template <typename T, typename Index>
+const T *DynamicCSR<T, Index>::find(size_t row, size_t col) const
+{
+    const DeltaBuffer *buffers[] = {&delta, merging.get()};
+    for (const DeltaBuffer *buffer : buffers)
+    {
+        if (buffer == nullptr)
+        {
+            continue;
+        }
+        auto entry = buffer->find({row, col});
+        if (entry != buffer->end())
+        {
+            return entry->second.erased ? nullptr : &entry->second.value;
+        }
+    }
+
+    const auto &rowPtr = base->getRowPtr();
+    const auto &colIndices = base->getColIndices();
+    auto first = colIndices.begin() + rowPtr[row];
+    auto last = colIndices.begin() + rowPtr[row + 1];
+    auto position = std::lower_bound(first, last, static_cast<Index>(col));
+    if (position == last || static_cast<size_t>(*position) != col)
+    {
+        return nullptr;
+    }
+    return &base->getValues()[position - colIndices.begin()];
+}
+
+// Merging
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::merge()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    collect(true);
+    if (!delta.empty())
+    {
+        base = std::make_shared<const CSR<T, Index>>(_mergeDelta(*base, delta));
+        delta.clear();
+    }
+}
+
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::mergeAsync()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    collect(false);
+    if (!merging && !delta.empty())
+    {
+        startMerge();
+    }
+}
+
+template <typename T, typename Index>
+typename DynamicCSR<T, Index>::Snapshot DynamicCSR<T, Index>::view() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    collect(true);
+    if (!delta.empty())
+    {
+        base = std::make_shared<const CSR<T, Index>>(_mergeDelta(*base, delta));
+        delta.clear();
+    }
+    return base;
+}
+
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::startMerge() const
+{
+    merging = std::make_shared<const DeltaBuffer>(std::move(delta));
+    delta.clear();
+
+    // the task owns what it reads, a later snapshot or delta never changes them
+    Snapshot snapshot = base;
+    std::shared_ptr<const DeltaBuffer> frozen = merging;
+    pendingMerge = std::async(std::launch::async, [snapshot, frozen]
+                              { return Snapshot(std::make_shared<const CSR<T, Index>>(_mergeDelta(*snapshot, *frozen))); });
+}
+
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::collect(bool wait) const
+{
+    if (!pendingMerge.valid())
+    {
+        return;
+    }
+    if (!wait && pendingMerge.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return;
+    }
+    base = pendingMerge.get();
+    merging.reset();
+}
+
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::checkCoordinates(size_t row, size_t col) const
+{
+    if (row >= CSR<T, Index>::rowsOf(shape) || col >= shape.back())
+    {
+        throw std::invalid_argument("Coordinates lie outside of the tensor");
+    }
+}
+
+// Accessors
+template <typename T, typename Index>
+size_t DynamicCSR<T, Index>::pendingUpdates() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return delta.size() + (merging ? merging->size() : 0);
+}
+
+template <typename T, typename Index>
+size_t DynamicCSR<T, Index>::getMergeThreshold() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return mergeThreshold;
+}
+
+template <typename T, typename Index>
+void DynamicCSR<T, Index>::setMergeThreshold(size_t threshold)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    mergeThreshold = std::max<size_t>(threshold, 1);
+}
+
+template <typename T, typename Index>
+const std::vector<size_t> &DynamicCSR<T, Index>::getShape() const
+{
+    return shape;
+}
+
+// Operations
+template <typename T, typename Index>
+CSR<T, Index> CSRMult(const DynamicCSR<T, Index> &csr1, const DynamicCSR<T, Index> &csr2)
+{
+    return CSRMult(*csr1.view(), *csr2.view());
+}
+
+template <typename T, typename Index>
+void CSRMultVec(const DynamicCSR<T, Index> &csr, const xt::xarray<T> &vector, xt::xarray<T> &result)
+{
+    CSRMultVec(*csr.view(), vector, result);
+}
+
+template <typename T, typename Index>
+void CSRMultDense(const DynamicCSR<T, Index> &csr, const xt::xarray<T> &dense, xt::xarray<T> &result)
+{
+    CSRMultDense(*csr.view(), dense, result);
+}
+
+// Anonymous namespace
+namespace
+{
+    /*
+    New arrays from a snapshot and a sorted delta. Only the rows named in the delta change length, their new lengths
+    come from one lookup per delta entry. Rows between them are copied as they are, the named rows are merged with
+    their delta entries, which arrive sorted by column.
+    */
+    template <typename T, typename Index, typename DeltaBuffer>
+    CSR<T, Index> _mergeDelta(const CSR<T, Index> &base, const DeltaBuffer &delta)
+    {
+        const auto &rowPtr = base.getRowPtr();
+        const auto &colIndices = base.getColIndices();
+        const auto &values = base.getValues();
+        size_t numRows = base.rows();
+
+        // rows named in the delta with the range of their entries
+        std::vector<typename DeltaBuffer::value_type> entries(delta.begin(), delta.end());
+        std::vector<size_t> touchedRows, touchedStart;
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            if (touchedRows.empty() || touchedRows.back() != entries[i].first.first)
+            {
+                touchedRows.push_back(entries[i].first.first);
+                touchedStart.push_back(i);
+            }
+        }
+        touchedStart.push_back(entries.size());
+
+        auto inBaseRow = [&](size_t row, size_t col)
+        {
+            auto first = colIndices.begin() + rowPtr[row];
+            auto last = colIndices.begin() + rowPtr[row + 1];
+            return std::binary_search(first, last, static_cast<Index>(col));
+        };
+
+        // new row lengths, every entry either adds a column, replaces one or removes one
+        std::vector<size_t> resultRowPtr(numRows + 1, 0);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            resultRowPtr[row + 1] = rowPtr[row + 1] - rowPtr[row];
+        }
+        for (size_t t = 0; t < touchedRows.size(); ++t)
+        {
+            size_t &length = resultRowPtr[touchedRows[t] + 1];
+            for (size_t i = touchedStart[t]; i < touchedStart[t + 1]; ++i)
+            {
+                bool inBase = inBaseRow(touchedRows[t], entries[i].first.second);
+                if (entries[i].second.erased)
+                {
+                    length -= inBase;
+                }
+                else
+                {
+                    length += !inBase;
+                }
+            }
+        }
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            resultRowPtr[row + 1] += resultRowPtr[row];
+        }
+
+        std::vector<Index> resultColIndices(resultRowPtr.back());
+        std::vector<T> resultValues(resultRowPtr.back());
+
+        // untouched runs of rows keep their layout and move by a fixed offset
+        long long runs = static_cast<long long>(touchedRows.size() + 1);
+#pragma omp parallel for schedule(dynamic, 16) if (base.nnz() > 100000)
+        for (long long run = 0; run < runs; ++run)
+        {
+            size_t firstRow = run == 0 ? 0 : touchedRows[run - 1] + 1;
+            size_t lastRow = run + 1 < runs ? touchedRows[run] : numRows;
+            if (firstRow >= lastRow)
+            {
+                continue;
+            }
+            std::copy(colIndices.begin() + rowPtr[firstRow], colIndices.begin() + rowPtr[lastRow],
+                      resultColIndices.begin() + resultRowPtr[firstRow]);
+            std::copy(values.begin() + rowPtr[firstRow], values.begin() + rowPtr[lastRow],
+                      resultValues.begin() + resultRowPtr[firstRow]);
+        }
+
+        // touched rows, a merge of the stored row with its delta entries
+        long long touched = static_cast<long long>(touchedRows.size());
+#pragma omp parallel for schedule(dynamic, 16) if (base.nnz() > 100000)
+        for (long long t = 0; t < touched; ++t)
+        {
+            size_t row = touchedRows[t];
+            size_t i = rowPtr[row];
+            size_t j = touchedStart[t];
+            size_t out = resultRowPtr[row];
+            while (i < rowPtr[row + 1] || j < touchedStart[t + 1])
+            {
+                size_t stored = i < rowPtr[row + 1] ? static_cast<size_t>(colIndices[i]) : static_cast<size_t>(-1);
+                size_t changed = j < touchedStart[t + 1] ? entries[j].first.second : static_cast<size_t>(-1);
+                if (stored < changed)
+                {
+                    resultColIndices[out] = colIndices[i];
+                    resultValues[out++] = values[i++];
+                    continue;
+                }
+
+                // the delta wins over the stored entry of the same column
+                i += stored == changed;
+                if (!entries[j].second.erased)
+                {
+                    resultColIndices[out] = static_cast<Index>(changed);
+                    resultValues[out++] = entries[j].second.value;
+                }
+                ++j;
+            }
+        }
+
+        return CSR<T, Index>(base.getShape(), std::move(resultRowPtr), std::move(resultColIndices), std::move(resultValues));
+    }
+}
+
+#endif // CSR_DYNAMIC_IMPL_HPP
@@ -0,0 +1,254 @@
+#ifndef CSR_EXPRESSION_HPP
+#define CSR_EXPRESSION_HPP
+
+#include "csr_adt.hpp"
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+Lazy elementwise expressions over CSR objects, in the spirit of xtensor's xexpression. Operators only build a small
+tree of expression nodes, CSREvaluate walks every row of the tree once, merging the sorted rows of the leaves, and
+writes the result directly, so a chain like alpha * A + beta * CSRHadamard(B, C) allocates no intermediate CSR.
+Every node can open a cursor on a row, which yields the stored columns of that row in ascending order, and bound the
+number of entries of a row. Leaves hold references to their CSR objects, which must outlive the expression.
+Results are structural: add and subtract produce the union of the patterns, Hadamard their intersection, and values
+that cancel to zero are still stored.
+*/
+template <typename Derived>
+class CSRExpression
+{
+public:
+    const Derived &derived() const;
+};
+
+// leaf of an expression, a view of a CSR object
+template <typename T, typename Index>
+class CSRTerminal : public CSRExpression<CSRTerminal<T, Index>>
+{
+private:
+    const CSR<T, Index> &csr;
+
+public:
+    using value_type = T;
+
+    class Cursor
+    {
+    private:
+        const Index *col;
+        const Index *end;
+        const T *val;
+
+    public:
+        Cursor(const Index *col, const Index *end, const T *val);
+        size_t column() const; // _endOfRow once the row is exhausted
+        T value() const;
+        void next();
+    };
+
+    explicit CSRTerminal(const CSR<T, Index> &csr);
+
+    const std::vector<size_t> &getShape() const;
+    size_t rowBound(size_t row) const;
+    Cursor cursor(size_t row) const;
+};
+
+// op(left, right) over the union of both patterns, a missing side reads as zero
+template <typename Op, typename L, typename R>
+class CSRUnion : public CSRExpression<CSRUnion<Op, L, R>>
+{
+private:
+    L left;
+    R right;
+
+public:
+    using value_type = typename L::value_type;
+
+    class Cursor
+    {
+    private:
+        typename L::Cursor left;
+        typename R::Cursor right;
+        size_t current;
+
+    public:
+        Cursor(typename L::Cursor left, typename R::Cursor right);
+        size_t column() const;
+        value_type value() const;
+        void next();
+    };
+
+    CSRUnion(L left, R right);
+
+    const std::vector<size_t> &getShape() const;
+    size_t rowBound(size_t row) const;
+    Cursor cursor(size_t row) const;
+};
+
+// op(left, right) over the intersection of both patterns
+template <typename Op, typename L, typename R>
+class CSRIntersection : public CSRExpression<CSRIntersection<Op, L, R>>
+{
+private:
+    L left;
+    R right;
+
+public:
+    using value_type = typename L::value_type;
+
+    class Cursor
+    {
+    private:
+        typename L::Cursor left;
+        typename R::Cursor right;
+
+        // advance the side behind until both sides stand on the same column or one is exhausted
+        void align();
+
+    public:
+        Cursor(typename L::Cursor left, typename R::Cursor right);
+        size_t column() const;
+        value_type value() const;
+        void next();
+    };
+
+    CSRIntersection(L left, R right);
+
+    const std::vector<size_t> &getShape() const;
+    size_t rowBound(size_t row) const;
+    Cursor cursor(size_t row) const;
+};
+
+// alpha * expression
+template <typename E>
+class CSRScaled : public CSRExpression<CSRScaled<E>>
+{
+private:
+    E expression;
+    typename E::value_type alpha;
+
+public:
+    using value_type = typename E::value_type;
+
+    class Cursor
+    {
+    private:
+        typename E::Cursor inner;
+        value_type alpha;
+
+    public:
+        Cursor(typename E::Cursor inner, value_type alpha);
+        size_t column() const;
+        value_type value() const;
+        void next();
+    };
+
+    CSRScaled(E expression, value_type alpha);
+
+    const std::vector<size_t> &getShape() const;
+    size_t rowBound(size_t row) const;
+    Cursor cursor(size_t row) const;
+};
+
+// function applied to the stored values of expression, the pattern is kept so function(0) is assumed to be 0
+template <typename F, typename E>
+class CSRMapped : public CSRExpression<CSRMapped<F, E>>
+{
+private:
+    E expression;
+    F function;
+
+public:
+    using value_type = typename E::value_type;
+
+    class Cursor
+    {
+    private:
+        typename E::Cursor inner;
+        const F *function;
+
+    public:
+        Cursor(typename E::Cursor inner, const F *function);
+        size_t column() const;
+        value_type value() const;
+        void next();
+    };
+
+    CSRMapped(E expression, F function);
+
+    const std::vector<size_t> &getShape() const;
+    size_t rowBound(size_t row) const;
+    Cursor cursor(size_t row) const;
+};
+
+namespace
+{
+    // helper functions
+    constexpr size_t _endOfRow = static_cast<size_t>(-1);
+
+    // CSR objects become terminals, expressions are used as they are
+    template <typename T, typename Index>
+    CSRTerminal<T, Index> _operand(const CSR<T, Index> &csr);
+
+    template <typename E>
+    const E &_operand(const CSRExpression<E> &expression);
+
+    template <typename X>
+    using _operandType = std::decay_t<decltype(_operand(std::declval<const X &>()))>;
+
+    template <typename X, typename = void>
+    struct _isCSROperand : std::false_type
+    {
+    };
+
+    template <typename X>
+    struct _isCSROperand<X, std::void_t<_operandType<X>>> : std::true_type
+    {
+    };
+
+    template <typename L, typename R>
+    using _ifCSROperands = std::enable_if_t<_isCSROperand<L>::value && _isCSROperand<R>::value &&
+                                            std::is_same_v<typename _operandType<L>::value_type,
+                                                           typename _operandType<R>::value_type>>;
+
+    // throws if the operands of an elementwise operation do not have the same shape
+    template <typename L, typename R>
+    void _checkSameShape(const L &left, const R &right);
+}
+
+// elementwise sum and difference, the union of both patterns
+template <typename L, typename R, typename = _ifCSROperands<L, R>>
+CSRUnion<std::plus<typename _operandType<L>::value_type>, _operandType<L>, _operandType<R>>
+operator+(const L &left, const R &right);
+
+template <typename L, typename R, typename = _ifCSROperands<L, R>>
+CSRUnion<std::minus<typename _operandType<L>::value_type>, _operandType<L>, _operandType<R>>
+operator-(const L &left, const R &right);
+
+// negation and scaling by a scalar
+template <typename E, typename = _ifCSROperands<E, E>>
+CSRScaled<_operandType<E>> operator-(const E &expression);
+
+template <typename E, typename = _ifCSROperands<E, E>>
+CSRScaled<_operandType<E>> operator*(typename _operandType<E>::value_type alpha, const E &expression);
+
+template <typename E, typename = _ifCSROperands<E, E>>
+CSRScaled<_operandType<E>> operator*(const E &expression, typename _operandType<E>::value_type alpha);
+
+// elementwise product, the intersection of both patterns, operator * between sparse operands is left to CSRMult
+template <typename L, typename R, typename = _ifCSROperands<L, R>>
+CSRIntersection<std::multiplies<typename _operandType<L>::value_type>, _operandType<L>, _operandType<R>>
+CSRHadamard(const L &left, const R &right);
+
+// function applied to every stored value
+template <typename E, typename F, typename = _ifCSROperands<E, E>>
+CSRMapped<F, _operandType<E>> CSRMap(const E &expression, F function);
+
+// evaluate an expression into a new CSR object in a single merge pass over the rows
+template <typename Index = size_t, typename E>
+CSR<typename E::value_type, Index> CSREvaluate(const CSRExpression<E> &expression);
+
+#include "csr_expression_impl.hpp"
+
+#endif // CSR_EXPRESSION_HPP
@@ -0,0 +1,441 @@
+#ifndef CSR_EXPRESSION_IMPL_HPP
+#define CSR_EXPRESSION_IMPL_HPP
+
+#include "csr_expression.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+template <typename Derived>
+const Derived &CSRExpression<Derived>::derived() const
+{
+    return static_cast<const Derived &>(*this);
+}
+
+// CSRTerminal
+template <typename T, typename Index>
+CSRTerminal<T, Index>::Cursor::Cursor(const Index *col, const Index *end, const T *val)
+    : col(col), end(end), val(val)
+{
+}
+
+template <typename T, typename Index>
+size_t CSRTerminal<T, Index>::Cursor::column() const
+{
+    return col == end ? _endOfRow : static_cast<size_t>(*col);
+}
+
+template <typename T, typename Index>
+T CSRTerminal<T, Index>::Cursor::value() const
+{
+    return *val;
+}
+
+template <typename T, typename Index>
+void CSRTerminal<T, Index>::Cursor::next()
+{
+    ++col;
+    ++val;
+}
+
+template <typename T, typename Index>
+CSRTerminal<T, Index>::CSRTerminal(const CSR<T, Index> &csr)
+    : csr(csr)
+{
+}
+
+template <typename T, typename Index>
+const std::vector<size_t> &CSRTerminal<T, Index>::getShape() const
+{
+    return csr.getShape();
+}
+
+template <typename T, typename Index>
+size_t CSRTerminal<T, Index>::rowBound(size_t row) const
+{
+    const auto &rowPtr = csr.getRowPtr();
+    return rowPtr[row + 1] - rowPtr[row];
+}
+
+template <typename T, typename Index>
+typename CSRTerminal<T, Index>::Cursor CSRTerminal<T, Index>::cursor(size_t row) const
+{
+    const auto &rowPtr = csr.getRowPtr();
+    const Index *cols = csr.getColIndices().data();
+    return Cursor(cols + rowPtr[row], cols + rowPtr[row + 1], csr.getValues().data() + rowPtr[row]);
+}
+
+// CSRUnion
+template <typename Op, typename L, typename R>
+CSRUnion<Op, L, R>::Cursor::Cursor(typename L::Cursor left, typename R::Cursor right)
+    : left(left), right(right), current(std::min(left.column(), right.column()))
+{
+}
+
+template <typename Op, typename L, typename R>
+size_t CSRUnion<Op, L, R>::Cursor::column() const
+{
+    return current;
+}
+
+template <typename Op, typename L, typename R>
+typename CSRUnion<Op, L, R>::value_type CSRUnion<Op, L, R>::Cursor::value() const
+{
+    value_type leftValue = left.column() == current ? left.value() : value_type(0);
+    value_type rightValue = right.column() == current ? right.value() : value_type(0);
+    return Op()(leftValue, rightValue);
+}
+
+template <typename Op, typename L, typename R>
+void CSRUnion<Op, L, R>::Cursor::next()
+{
+    if (left.column() == current)
+    {
+        left.next();
+    }
+    if (right.column() == current)
+    {
+        right.next();
+    }
+    current = std::min(left.column(), right.column());
+}
+
+template <typename Op, typename L, typename R>
+CSRUnion<Op, L, R>::CSRUnion(L left, R right)
+    : left(std::move(left)), right(std::move(right))
+{
+    _checkSameShape(this->left, this->right);
+}
+
+template <typename Op, typename L, typename R>
+const std::vector<size_t> &CSRUnion<Op, L, R>::getShape() const
+{
+    return left.getShape();
+}
+
+template <typename Op, typename L, typename R>
+size_t CSRUnion<Op, L, R>::rowBound(size_t row) const
+{
+    return left.rowBound(row) + right.rowBound(row);
+}
+
+template <typename Op, typename L, typename R>
+typename CSRUnion<Op, L, R>::Cursor CSRUnion<Op, L, R>::cursor(size_t row) const
+{
+    return Cursor(left.cursor(row), right.cursor(row));
+}
+
+// CSRIntersection
+template <typename Op, typename L, typename R>
+CSRIntersection<Op, L, R>::Cursor::Cursor(typename L::Cursor left, typename R::Cursor right)
+    : left(left), right(right)
+{
+    align();
+}
+
+template <typename Op, typename L, typename R>
+void CSRIntersection<Op, L, R>::Cursor::align()
+{
+    size_t leftColumn = left.column();
+    size_t rightColumn = right.column();
+    while (leftColumn != rightColumn && leftColumn != _endOfRow && rightColumn != _endOfRow)
+    {
+        if (leftColumn < rightColumn)
+        {
+            left.next();
+            leftColumn = left.column();
+        }
+        else
+        {
+            right.next();
+            rightColumn = right.column();
+        }
+    }
+}
+
+template <typename Op, typename L, typename R>
+size_t CSRIntersection<Op, L, R>::Cursor::column() const
+{
+    size_t leftColumn = left.column();
+    return leftColumn == right.column() ? leftColumn : _endOfRow;
+}
+
+template <typename Op, typename L, typename R>
+typename CSRIntersection<Op, L, R>::value_type CSRIntersection<Op, L, R>::Cursor::value() const
+{
+    return Op()(left.value(), right.value());
+}
+
+template <typename Op, typename L, typename R>
+void CSRIntersection<Op, L, R>::Cursor::next()
+{
+    left.next();
+    right.next();
+    align();
+}
+
+template <typename Op, typename L, typename R>
+CSRIntersection<Op, L, R>::CSRIntersection(L left, R right)
+    : left(std::move(left)), right(std::move(right))
+{
+    _checkSameShape(this->left, this->right);
+}
+
+template <typename Op, typename L, typename R>
+const std::vector<size_t> &CSRIntersection<Op, L, R>::getShape() const
+{
+    return left.getShape();
+}
+
+template <typename Op, typename L, typename R>
+size_t CSRIntersection<Op, L, R>::rowBound(size_t row) const
+{
+    return std::min(left.rowBound(row), right.rowBound(row));
+}
+
+template <typename Op, typename L, typename R>
+typename CSRIntersection<Op, L, R>::Cursor CSRIntersection<Op, L, R>::cursor(size_t row) const
+{
+    return Cursor(left.cursor(row), right.cursor(row));
+}
+
+// CSRScaled
+template <typename E>
+CSRScaled<E>::Cursor::Cursor(typename E::Cursor inner, value_type alpha)
+    : inner(inner), alpha(alpha)
+{
+}
+
+template <typename E>
+size_t CSRScaled<E>::Cursor::column() const
+{
+    return inner.column();
+}
+
+template <typename E>
+typename CSRScaled<E>::value_type CSRScaled<E>::Cursor::value() const
+{
+    return alpha * inner.value();
+}
+
+template <typename E>
+void CSRScaled<E>::Cursor::next()
+{
+    inner.next();
+}
+
+template <typename E>
+CSRScaled<E>::CSRScaled(E expression, value_type alpha)
+    : expression(std::move(expression)), alpha(alpha)
+{
+}
+
+template <typename E>
+const std::vector<size_t> &CSRScaled<E>::getShape() const
+{
+    return expression.getShape();
+}
+
+template <typename E>
+size_t CSRScaled<E>::rowBound(size_t row) const
+{
+    return expression.rowBound(row);
+}
+
+template <typename E>
+typename CSRScaled<E>::Cursor CSRScaled<E>::cursor(size_t row) const
+{
+    return Cursor(expression.cursor(row), alpha);
+}
+
+// CSRMapped
+template <typename F, typename E>
+CSRMapped<F, E>::Cursor::Cursor(typename E::Cursor inner, const F *function)
+    : inner(inner), function(function)
+{
+}
+
+template <typename F, typename E>
+size_t CSRMapped<F, E>::Cursor::column() const
+{
+    return inner.column();
+}
+
+template <typename F, typename E>
+typename CSRMapped<F, E>::value_type CSRMapped<F, E>::Cursor::value() const
+{
+    return static_cast<value_type>((*function)(inner.value()));
+}
+
+template <typename F, typename E>
+void CSRMapped<F, E>::Cursor::next()
+{
+    inner.next();
+}
+
+template <typename F, typename E>
+CSRMapped<F, E>::CSRMapped(E expression, F function)
+    : expression(std::move(expression)), function(std::move(function))
+{
+}
+
+template <typename F, typename E>
+const std::vector<size_t> &CSRMapped<F, E>::getShape() const
+{
+    return expression.getShape();
+}
+
+template <typename F, typename E>
+size_t CSRMapped<F, E>::rowBound(size_t row) const
+{
+    return expression.rowBound(row);
+}
+
+template <typename F, typename E>
+typename CSRMapped<F, E>::Cursor CSRMapped<F, E>::cursor(size_t row) const
+{
+    return Cursor(expression.cursor(row), &function);
+}
+
+// Operators
+template <typename L, typename R, typename>
+CSRUnion<std::plus<typename _operandType<L>::value_type>, _operandType<L>, _operandType<R>>
+operator+(const L &left, const R &right)
+{
+    return {_operand(left), _operand(right)};
+}
+
+template <typename L, typename R, typename>
+CSRUnion<std::minus<typename _operandType<L>::value_type>, _operandType<L>, _operandType<R>>
+operator-(const L &left, const R &right)
+{
+    return {_operand(left), _operand(right)};
+}
+
+template <typename E, typename>
+CSRScaled<_operandType<E>> operator-(const E &expression)
+{
+    return {_operand(expression), -typename _operandType<E>::value_type(1)};
+}
+
+template <typename E, typename>
+CSRScaled<_operandType<E>> operator*(typename _operandType<E>::value_type alpha, const E &expression)
+{
+    return {_operand(expression), alpha};
+}
+
+template <typename E, typename>
+CSRScaled<_operandType<E>> operator*(const E &expression, typename _operandType<E>::value_type alpha)
+{
+    return {_operand(expression), alpha};
+}
+
+template <typename L, typename R, typename>
+CSRIntersection<std::multiplies<typename _operandType<L>::value_type>, _operandType<L>, _operandType<R>>
+CSRHadamard(const L &left, const R &right)
+{
+    return {_operand(left), _operand(right)};
+}
+
+template <typename E, typename F, typename>
+CSRMapped<F, _operandType<E>> CSRMap(const E &expression, F function)
+{
+    return {_operand(expression), std::move(function)};
+}
+
+/*
+Every row is merged once into slots sized by the row bounds of the tree (the sum of the leaf rows below a union,
+the smaller one below an intersection), so no counting pass has to walk the leaves first.
+When a row ends up shorter than its bound, which only happens when patterns overlap, the rows are compacted
+into arrays of the exact size, otherwise the slots are the result.
+*/
+template <typename Index, typename E>
+CSR<typename E::value_type, Index> CSREvaluate(const CSRExpression<E> &expression)
+{
+    using T = typename E::value_type;
+    const E &tree = expression.derived();
+    const std::vector<size_t> &shape = tree.getShape();
+    if (CSR<T, Index>::colsOf(shape) > CSR<T, Index>::maxCols())
+    {
+        throw std::invalid_argument("Index type is too narrow for the columns of the tensor");
+    }
+
+    size_t numRows = CSR<T, Index>::rowsOf(shape);
+    long long rowCount = static_cast<long long>(numRows);
+
+    // Slot of every row
+    std::vector<size_t> slotPtr(numRows + 1, 0);
+#pragma omp parallel for schedule(static) if (numRows > 10000)
+    for (long long row = 0; row < rowCount; ++row)
+    {
+        slotPtr[row + 1] = tree.rowBound(row);
+    }
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        slotPtr[row + 1] += slotPtr[row];
+    }
+
+    // Merge pass
+    std::vector<Index> slotCols(slotPtr.back());
+    std::vector<T> slotValues(slotPtr.back());
+    std::vector<size_t> rowPtr(numRows + 1, 0);
+#pragma omp parallel for schedule(dynamic, 256) if (slotPtr.back() > 100000)
+    for (long long row = 0; row < rowCount; ++row)
+    {
+        size_t k = slotPtr[row];
+        for (auto cursor = tree.cursor(row); cursor.column() != _endOfRow; cursor.next())
+        {
+            slotCols[k] = static_cast<Index>(cursor.column());
+            slotValues[k] = cursor.value();
+            ++k;
+        }
+        rowPtr[row + 1] = k - slotPtr[row];
+    }
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        rowPtr[row + 1] += rowPtr[row];
+    }
+
+    if (rowPtr.back() == slotPtr.back())
+    {
+        return CSR<T, Index>(shape, std::move(rowPtr), std::move(slotCols), std::move(slotValues));
+    }
+
+    // Compact the rows that came out shorter than their slots
+    std::vector<Index> colIndices(rowPtr.back());
+    std::vector<T> values(rowPtr.back());
+#pragma omp parallel for schedule(static) if (rowPtr.back() > 100000)
+    for (long long row = 0; row < rowCount; ++row)
+    {
+        size_t length = rowPtr[row + 1] - rowPtr[row];
+        std::copy(slotCols.begin() + slotPtr[row], slotCols.begin() + slotPtr[row] + length, colIndices.begin() + rowPtr[row]);
+        std::copy(slotValues.begin() + slotPtr[row], slotValues.begin() + slotPtr[row] + length, values.begin() + rowPtr[row]);
+    }
+    return CSR<T, Index>(shape, std::move(rowPtr), std::move(colIndices), std::move(values));
+}
+
+// Anonymous namespace
+namespace
+{
+    template <typename T, typename Index>
+    CSRTerminal<T, Index> _operand(const CSR<T, Index> &csr)
+    {
+        return CSRTerminal<T, Index>(csr);
+    }
+
+    template <typename E>
+    const E &_operand(const CSRExpression<E> &expression)
+    {
+        return expression.derived();
+    }
+
+    template <typename L, typename R>
+    void _checkSameShape(const L &left, const R &right)
+    {
+        if (left.getShape() != right.getShape())
+        {
+            throw std::invalid_argument("Tensors are not compatible for elementwise operations");
+        }
+    }
+}
+
+#endif // CSR_EXPRESSION_IMPL_HPP
@@ -0,0 +1,81 @@
+#ifndef CSR_IO_HPP
+#define CSR_IO_HPP
+
+#include "csr_adt.hpp"
+#include <cstdint>
+#include <string>
+
+/*
+Binary CSR file, native byte order:
+    CSRFileHeader
+    shape, rank x uint64
+    rowPtr, (rows + 1) x uint64  at rowPtrOffset
+    colIndices, nnz x index      at colIndicesOffset, index is indexBytes wide
+    values, nnz x value          at valuesOffset
+Every array starts on a 64 byte boundary so a memory mapping of the file can be used in place.
+*/
+struct CSRFileHeader
+{
+    char magic[8];         // "SPCSRBIN"
+    uint32_t version;      // CSRFileVersion
+    uint32_t valueType;    // CSRValueType of the values
+    uint32_t indexBytes;   // width of colIndices entries, 2, 4 or 8
+    uint32_t rank;         // number of shape entries following the header
+    uint64_t rows;         // rows of the flattened matrix
+    uint64_t nnz;          // number of stored values
+    uint64_t rowPtrOffset; // byte offsets of the arrays from the start of the file
+    uint64_t colIndicesOffset;
+    uint64_t valuesOffset;
+    uint64_t fileSize;
+};
+
+constexpr uint32_t CSRFileVersion = 1;
+
+enum class CSRValueType : uint32_t
+{
+    Float32 = 1,
+    Float64 = 2,
+    Int32 = 3,
+    Int64 = 4,
+    BFloat16 = 5 // raw bits of bfloat16
+};
+
+// write a CSR object to a binary CSR file
+template <typename T, typename Index>
+void SaveCSR(const CSR<T, Index> &csr, const std::string &path);
+
+/*
+Map a binary CSR file, the arrays of the result point into the mapping and nothing is copied or parsed.
+The file must hold column indices of the width of Index. The layout and the row offsets are always checked, which
+reads the rows + 1 offsets. The column indices are only checked against the columns with checkColumns, which reads
+every index: the kernels index dense accumulators by column, so files from untrusted sources need it.
+*/
+template <typename T, typename Index = size_t>
+CSR<T, Index> LoadCSR(const std::string &path, bool checkColumns = false);
+
+// stream a Matrix Market coordinate file into a binary CSR file, never holding more than the output arrays
+template <typename T, typename Index = size_t>
+void MatrixMarketToCSRFile(const std::string &mtxPath, const std::string &csrPath);
+
+namespace
+{
+    // helper functions
+    template <typename T>
+    constexpr CSRValueType _valueTypeOf();
+
+    template <typename T, typename Index>
+    void _checkHeader(const CSRFileHeader &header, uint64_t length, const std::string &path);
+
+    inline uint64_t _checkedAdd(uint64_t a, uint64_t b);
+
+    inline uint64_t _checkedMul(uint64_t a, uint64_t b);
+
+    inline uint64_t _alignTo64(uint64_t offset);
+
+    inline CSRFileHeader _makeHeader(uint32_t valueType, uint32_t valueBytes, uint32_t indexBytes, uint32_t rank, uint64_t rows,
+                                     uint64_t nnz);
+}
+
+#include "csr_io_impl.hpp"
+
+#endif // CSR_IO_HPP
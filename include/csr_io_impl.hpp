@@ -0,0 +1,431 @@
+#ifndef CSR_IO_IMPL_HPP
+#define CSR_IO_IMPL_HPP
+
+#include "csr_io.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// write a CSR object to a binary CSR file
+template <typename T, typename Index>
+void SaveCSR(const CSR<T, Index> &csr, const std::string &path)
+{
+    const auto &shape = csr.getShape();
+    CSRFileHeader header = _makeHeader(static_cast<uint32_t>(_valueTypeOf<T>()), sizeof(T), sizeof(Index),
+                                       static_cast<uint32_t>(shape.size()), csr.rows(), csr.nnz());
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        throw std::runtime_error("Cannot open " + path + " for writing");
+    }
+
+    // write bytes, then zero padding up to the next array offset
+    uint64_t written = 0;
+    auto writeAt = [&](uint64_t offset, const void *data, uint64_t bytes)
+    {
+        static const char zeros[64] = {};
+        out.write(zeros, static_cast<std::streamsize>(offset - written));
+        out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes));
+        written = offset + bytes;
+    };
+
+    std::vector<uint64_t> fileShape(shape.begin(), shape.end());
+    writeAt(0, &header, sizeof(header));
+    writeAt(sizeof(header), fileShape.data(), fileShape.size() * sizeof(uint64_t));
+    writeAt(header.rowPtrOffset, csr.getRowPtr().data(), csr.getRowPtr().size() * sizeof(size_t));
+    writeAt(header.colIndicesOffset, csr.getColIndices().data(), csr.nnz() * sizeof(Index));
+    writeAt(header.valuesOffset, csr.getValues().data(), csr.nnz() * sizeof(T));
+    writeAt(header.fileSize, nullptr, 0);
+
+    if (!out)
+    {
+        throw std::runtime_error("Failed writing " + path);
+    }
+}
+
+// map a binary CSR file
+template <typename T, typename Index>
+CSR<T, Index> LoadCSR(const std::string &path, bool checkColumns)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot open " + path);
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < sizeof(CSRFileHeader))
+    {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a CSR file");
+    }
+
+    size_t length = static_cast<size_t>(info.st_size);
+    void *address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map " + path);
+    }
+
+    // the mapping lives as long as any buffer borrowing from it
+    std::shared_ptr<const void> mapping(address, [length](const void *p)
+                                        { ::munmap(const_cast<void *>(p), length); });
+
+    const char *base = static_cast<const char *>(address);
+    CSRFileHeader header;
+    std::memcpy(&header, base, sizeof(header));
+
+    _checkHeader<T, Index>(header, length, path);
+
+    std::vector<size_t> shape(header.rank);
+    uint64_t rows = 1;
+    for (uint32_t dim = 0; dim < header.rank; ++dim)
+    {
+        uint64_t extent;
+        std::memcpy(&extent, base + sizeof(header) + dim * sizeof(uint64_t), sizeof(uint64_t));
+        shape[dim] = static_cast<size_t>(extent);
+
+        // the leading dimensions multiply to the rows, checked before the product so it cannot wrap around
+        if (dim + 1 < header.rank)
+        {
+            if (extent != 0 && rows > header.rows / extent)
+            {
+                throw std::runtime_error(path + " is truncated or corrupt");
+            }
+            rows *= extent;
+        }
+    }
+    if (header.rank == 0 || rows != header.rows)
+    {
+        throw std::runtime_error(path + " is truncated or corrupt");
+    }
+
+    auto rowPtr = Buffer<size_t>::borrow(reinterpret_cast<const size_t *>(base + header.rowPtrOffset), header.rows + 1, mapping);
+    auto colIndices = Buffer<Index>::borrow(reinterpret_cast<const Index *>(base + header.colIndicesOffset), header.nnz, mapping);
+    auto values = Buffer<T>::borrow(reinterpret_cast<const T *>(base + header.valuesOffset), header.nnz, mapping);
+    CSR<T, Index> csr(std::move(shape), std::move(rowPtr), std::move(colIndices), std::move(values));
+
+    if (checkColumns)
+    {
+        const Index *cols = csr.getColIndices().data();
+        size_t numCols = csr.cols();
+        if (std::any_of(cols, cols + csr.nnz(), [numCols](Index col)
+                        { return static_cast<size_t>(col) >= numCols; }))
+        {
+            throw std::runtime_error(path + " has a column index outside of the tensor");
+        }
+    }
+    return csr;
+}
+
+/*
+Two passes over the text so memory stays bounded by the output:
+1. count the entries of every row, which sizes the output file
+2. place every entry at its row's cursor straight into a writable mapping of the output file
+Rows are then sorted by column, duplicates summed, and the arrays compacted if that removed entries.
+Symmetric and skew symmetric files store one triangle, the other one is mirrored.
+*/
+template <typename T, typename Index>
+void MatrixMarketToCSRFile(const std::string &mtxPath, const std::string &csrPath)
+{
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> in(std::fopen(mtxPath.c_str(), "r"), &std::fclose);
+    if (!in)
+    {
+        throw std::runtime_error("Cannot open " + mtxPath);
+    }
+
+    // banner, %%MatrixMarket matrix coordinate <field> <symmetry>
+    char line[1024];
+    if (!std::fgets(line, sizeof(line), in.get()))
+    {
+        throw std::runtime_error(mtxPath + " is empty");
+    }
+    std::string banner(line);
+    std::transform(banner.begin(), banner.end(), banner.begin(), [](unsigned char c)
+                   { return static_cast<char>(std::tolower(c)); });
+    if (banner.rfind("%%matrixmarket matrix coordinate", 0) != 0)
+    {
+        throw std::runtime_error(mtxPath + " is not a Matrix Market coordinate file");
+    }
+    bool pattern = banner.find(" pattern") != std::string::npos;
+    bool skew = banner.find("skew-symmetric") != std::string::npos;
+    bool symmetric = skew || banner.find(" symmetric") != std::string::npos;
+    if (banner.find(" complex") != std::string::npos || banner.find("hermitian") != std::string::npos)
+    {
+        throw std::invalid_argument("Complex Matrix Market files are not supported");
+    }
+
+    // size line, after the comments
+    unsigned long long rows = 0, cols = 0, entries = 0;
+    while (std::fgets(line, sizeof(line), in.get()) && line[0] == '%')
+    {
+    }
+    if (std::sscanf(line, "%llu %llu %llu", &rows, &cols, &entries) != 3)
+    {
+        throw std::runtime_error(mtxPath + " has no size line");
+    }
+    if (cols > CSR<T, Index>::maxCols())
+    {
+        throw std::invalid_argument("Index type is too narrow for the columns of " + mtxPath);
+    }
+    long dataStart = std::ftell(in.get());
+
+    // read the next entry as 0 based row and column
+    auto nextEntry = [&](size_t &row, size_t &col, T &value)
+    {
+        do
+        {
+            if (!std::fgets(line, sizeof(line), in.get()))
+            {
+                throw std::runtime_error(mtxPath + " has fewer entries than announced");
+            }
+        } while (line[0] == '%' || line[0] == '\n');
+
+        char *cursor = line;
+        row = std::strtoull(cursor, &cursor, 10) - 1;
+        col = std::strtoull(cursor, &cursor, 10) - 1;
+        value = pattern ? T(1) : static_cast<T>(std::strtod(cursor, &cursor));
+        if (row >= rows || col >= cols)
+        {
+            throw std::runtime_error(mtxPath + " has an entry outside of the matrix");
+        }
+    };
+
+    // Pass 1, entries per row
+    std::vector<size_t> cursor(rows + 1, 0);
+    size_t row, col;
+    T value;
+    for (unsigned long long i = 0; i < entries; ++i)
+    {
+        nextEntry(row, col, value);
+        ++cursor[row + 1];
+        if (symmetric && row != col)
+        {
+            ++cursor[col + 1];
+        }
+    }
+    for (size_t r = 0; r < rows; ++r)
+    {
+        cursor[r + 1] += cursor[r];
+    }
+    size_t capacity = cursor.back();
+
+    // Output file sized for every entry, mapped for writing
+    CSRFileHeader header = _makeHeader(static_cast<uint32_t>(_valueTypeOf<T>()), sizeof(T), sizeof(Index), 2, rows, capacity);
+    int fd = ::open(csrPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot create " + csrPath);
+    }
+
+    // the output is closed on every path and removed unless it was completed, so a failure leaves no valid looking file
+    bool finished = false;
+    auto closeOutput = [&csrPath, &finished](int *output)
+    {
+        ::close(*output);
+        if (!finished)
+        {
+            ::unlink(csrPath.c_str());
+        }
+    };
+    std::unique_ptr<int, decltype(closeOutput)> output(&fd, closeOutput);
+
+    if (::ftruncate(fd, static_cast<off_t>(header.fileSize)) != 0)
+    {
+        throw std::runtime_error("Cannot create " + csrPath);
+    }
+    size_t mappedLength = header.fileSize;
+    void *address = ::mmap(nullptr, mappedLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED)
+    {
+        throw std::runtime_error("Cannot map " + csrPath);
+    }
+    auto unmap = [mappedLength](char *p)
+    {
+        ::munmap(p, mappedLength);
+    };
+    std::unique_ptr<char, decltype(unmap)> mapping(static_cast<char *>(address), unmap);
+    char *base = mapping.get();
+    size_t *rowPtr = reinterpret_cast<size_t *>(base + header.rowPtrOffset);
+    Index *colIndices = reinterpret_cast<Index *>(base + header.colIndicesOffset);
+    T *values = reinterpret_cast<T *>(base + header.valuesOffset);
+    std::copy(cursor.begin(), cursor.end(), rowPtr);
+
+    // Pass 2, place the entries
+    std::fseek(in.get(), dataStart, SEEK_SET);
+    for (unsigned long long i = 0; i < entries; ++i)
+    {
+        nextEntry(row, col, value);
+        colIndices[cursor[row]] = static_cast<Index>(col);
+        values[cursor[row]++] = value;
+        if (symmetric && row != col)
+        {
+            colIndices[cursor[col]] = static_cast<Index>(row);
+            values[cursor[col]++] = skew ? -value : value;
+        }
+    }
+
+    // Sort every row and sum duplicates, compacting towards the front as entries disappear
+    std::vector<std::pair<size_t, T>> scratch;
+    size_t nnz = 0;
+    for (size_t r = 0; r < rows; ++r)
+    {
+        scratch.clear();
+        for (size_t i = rowPtr[r]; i < rowPtr[r + 1]; ++i)
+        {
+            scratch.emplace_back(colIndices[i], values[i]);
+        }
+        std::sort(scratch.begin(), scratch.end(), [](const auto &lhs, const auto &rhs)
+                  { return lhs.first < rhs.first; });
+
+        rowPtr[r] = nnz;
+        for (size_t i = 0; i < scratch.size(); ++i)
+        {
+            if (i > 0 && scratch[i].first == scratch[i - 1].first)
+            {
+                values[nnz - 1] += scratch[i].second;
+                continue;
+            }
+            colIndices[nnz] = static_cast<Index>(scratch[i].first);
+            values[nnz] = scratch[i].second;
+            ++nnz;
+        }
+    }
+    rowPtr[rows] = nnz;
+
+    // Values move down when duplicates shrank the index array, then the file is cut to its final size
+    CSRFileHeader finalHeader = _makeHeader(header.valueType, sizeof(T), sizeof(Index), 2, rows, nnz);
+    std::memmove(base + finalHeader.valuesOffset, values, nnz * sizeof(T));
+    std::memcpy(base, &finalHeader, sizeof(finalHeader));
+    uint64_t shape[2] = {rows, cols};
+    std::memcpy(base + sizeof(finalHeader), shape, sizeof(shape));
+
+    mapping.reset();
+    if (::ftruncate(fd, static_cast<off_t>(finalHeader.fileSize)) != 0)
+    {
+        throw std::runtime_error("Failed writing " + csrPath);
+    }
+    finished = true;
+}
+
+namespace
+{
+    template <typename T>
+    constexpr CSRValueType _valueTypeOf()
+    {
+        if constexpr (std::is_same_v<T, float>)
+        {
+            return CSRValueType::Float32;
+        }
+        else if constexpr (std::is_same_v<T, double>)
+        {
+            return CSRValueType::Float64;
+        }
+        else if constexpr (std::is_same_v<T, int32_t>)
+        {
+            return CSRValueType::Int32;
+        }
+        else if constexpr (std::is_same_v<T, bfloat16>)
+        {
+            static_assert(sizeof(bfloat16) == 2 && std::is_trivially_copyable_v<bfloat16>, "bfloat16 is stored as its bits");
+            return CSRValueType::BFloat16;
+        }
+        else
+        {
+            static_assert(std::is_same_v<T, int64_t>, "CSR files hold float, double, bfloat16, int32_t or int64_t values");
+            return CSRValueType::Int64;
+        }
+    }
+
+    // throws unless header describes a complete file of length bytes holding T values and Index columns
+    template <typename T, typename Index>
+    void _checkHeader(const CSRFileHeader &header, uint64_t length, const std::string &path)
+    {
+        if (std::memcmp(header.magic, "SPCSRBIN", 8) != 0 || header.version != CSRFileVersion)
+        {
+            throw std::runtime_error(path + " is not a CSR file of a supported version");
+        }
+        if (header.valueType != static_cast<uint32_t>(_valueTypeOf<T>()) || header.indexBytes != sizeof(Index))
+        {
+            throw std::runtime_error(path + " does not hold values and indices of the requested types");
+        }
+
+        // a hostile header can ask for offsets past 64 bits, which is corrupt rather than a wrapped around layout
+        CSRFileHeader expected;
+        try
+        {
+            expected = _makeHeader(header.valueType, sizeof(T), sizeof(Index), header.rank, header.rows, header.nnz);
+        }
+        catch (const std::overflow_error &)
+        {
+            throw std::runtime_error(path + " is truncated or corrupt");
+        }
+        if (header.fileSize != length || header.rowPtrOffset != expected.rowPtrOffset ||
+            header.colIndicesOffset != expected.colIndicesOffset || header.valuesOffset != expected.valuesOffset ||
+            header.fileSize != expected.fileSize)
+        {
+            throw std::runtime_error(path + " is truncated or corrupt");
+        }
+    }
+
+    // a + b and a * b, throwing instead of wrapping around
+    inline uint64_t _checkedAdd(uint64_t a, uint64_t b)
+    {
+        if (a > std::numeric_limits<uint64_t>::max() - b)
+        {
+            throw std::overflow_error("CSR file offsets do not fit in 64 bits");
+        }
+        return a + b;
+    }
+
+    inline uint64_t _checkedMul(uint64_t a, uint64_t b)
+    {
+        if (b != 0 && a > std::numeric_limits<uint64_t>::max() / b)
+        {
+            throw std::overflow_error("CSR file offsets do not fit in 64 bits");
+        }
+        return a * b;
+    }
+
+    inline uint64_t _alignTo64(uint64_t offset)
+    {
+        return _checkedAdd(offset, 63) / 64 * 64;
+    }
+
+    // header with the array offsets laid out for the given sizes
+    inline CSRFileHeader _makeHeader(uint32_t valueType, uint32_t valueBytes, uint32_t indexBytes, uint32_t rank, uint64_t rows,
+                                     uint64_t nnz)
+    {
+        CSRFileHeader header{};
+        std::memcpy(header.magic, "SPCSRBIN", 8);
+        header.version = CSRFileVersion;
+        header.valueType = valueType;
+        header.indexBytes = indexBytes;
+        header.rank = rank;
+        header.rows = rows;
+        header.nnz = nnz;
+        header.rowPtrOffset = _alignTo64(sizeof(CSRFileHeader) + uint64_t(rank) * sizeof(uint64_t));
+        header.colIndicesOffset = _alignTo64(_checkedAdd(header.rowPtrOffset, _checkedMul(_checkedAdd(rows, 1), sizeof(size_t))));
+        header.valuesOffset = _alignTo64(_checkedAdd(header.colIndicesOffset, _checkedMul(nnz, indexBytes)));
+        header.fileSize = _alignTo64(_checkedAdd(header.valuesOffset, _checkedMul(nnz, valueBytes)));
+        return header;
+    }
+}
+
+#endif // CSR_IO_IMPL_HPP
@@ -2,17 +2,113 @@
 #define CSR_OPERATIONS_HPP
 
 #include "csr_adt.hpp"
+#include "csr_spgemm.hpp"
+#include "csr_varint.hpp"
+#include <xtensor/xtensor.hpp>
 
 // convert CSR object to an xarray
-template <typename T>
-xt::xarray<T> CSRToDense(const CSR<T>& csr);
+template <typename T, typename Index>
+xt::xarray<T> CSRToDense(const CSR<T, Index>& csr);
 
 // convert xarray to CSR object
-template <typename T>
-CSR<T> DenseToCSR(const xt::xarray<T>& tensor);
+template <typename T, typename Index = size_t>
+CSR<T, Index> DenseToCSR(const xt::xarray<T>& tensor);
 
-// multiply two CSR objects
-template <typename T>
-CSR<T> CSRMult(const CSR<T>& csr1, const CSR<T>& csr2);
+// copy of a CSR object with its values converted to U, e.g. to store them as float or bfloat16
+template <typename U, typename T, typename Index>
+CSR<U, Index> CSRCast(const CSR<T, Index>& csr);
 
-#endif // CSR_OPERATIONS.HPP
\ No newline at end of file
+/*
+The products below take the accumulator type as their leading template parameter, CSRMult<double>(a, b) sums the
+products of float or bfloat16 values in double and rounds every output entry once. Left out it is the storage type,
+or float for bfloat16, see AccumulatorType. The masked and pruned products always accumulate in that default.
+*/
+
+// multiply two CSR objects, batched matmul [..., M, K] x [..., K, N] -> [..., M, N] with broadcast batch dimensions
+template <typename Acc = void, typename T, typename Index>
+CSR<T, Index> CSRMult(const CSR<T, Index>& csr1, const CSR<T, Index>& csr2);
+
+// multiply two CSR objects, pruning every output row inside the accumulator before it is written
+template <typename T, typename Index>
+CSR<T, Index> CSRMult(const CSR<T, Index>& csr1, const CSR<T, Index>& csr2, const PruneOptions& prune);
+
+// multiply two CSR objects keeping only the entries inside the pattern of mask, or outside of it with MaskMode::Complement
+// mask has the shape of the product, its values are ignored
+template <typename T, typename Index, typename MaskT, typename MaskIndex>
+CSR<T, Index> CSRMult(const CSR<T, Index>& csr1, const CSR<T, Index>& csr2, const CSR<MaskT, MaskIndex>& mask,
+                      MaskMode mode = MaskMode::Structural);
+
+// multiply a CSR object with a dense vector, (..., K) x (K) -> (...), written into result
+// the dense operand and the result may have another value type D than the sparse one, bfloat16 values with float vectors
+template <typename Acc = void, typename T, typename Index, typename D>
+void CSRMultVec(const CSR<T, Index>& csr, const xt::xarray<D>& vector, xt::xarray<D>& result);
+
+template <typename Acc = void, typename T, typename D>
+void CSRMultVec(const VarintCSR<T>& csr, const xt::xarray<D>& vector, xt::xarray<D>& result);
+
+// multiply a CSR object with a dense matrix, (..., K) x (K, N) -> (..., N), written into result
+template <typename Acc = void, typename T, typename Index, typename D>
+void CSRMultDense(const CSR<T, Index>& csr, const xt::xarray<D>& dense, xt::xarray<D>& result);
+
+template <typename Acc = void, typename T, typename D>
+void CSRMultDense(const VarintCSR<T>& csr, const xt::xarray<D>& dense, xt::xarray<D>& result);
+
+template <typename Acc = void, typename T, typename Index, typename D>
+void CSRMultDense(const CSR<T, Index>& csr, const xt::xtensor<D, 2>& dense, xt::xtensor<D, 2>& result);
+
+// transpose the last two dimensions, [..., M, N] -> [..., N, M]
+template <typename T, typename Index>
+CSR<T, Index> CSRTranspose(const CSR<T, Index>& csr);
+
+// multiply the transpose of csr1 with csr2, [..., K, M]^T x [..., K, N] -> [..., M, N]
+template <typename T, typename Index>
+CSR<T, Index> CSRTransposeMult(const CSR<T, Index>& csr1, const CSR<T, Index>& csr2);
+
+// multiply the transpose of a CSR matrix with a dense vector, (K, M)^T x (K) -> (M), written into result
+template <typename T, typename Index>
+void CSRTransposeMultVec(const CSR<T, Index>& csr, const xt::xarray<T>& vector, xt::xarray<T>& result);
+
+// multiply the transpose of a CSR matrix with a dense matrix, (K, M)^T x (K, N) -> (M, N), written into result
+template <typename T, typename Index>
+void CSRTransposeMultDense(const CSR<T, Index>& csr, const xt::xarray<T>& dense, xt::xarray<T>& result);
+
+namespace
+{
+    // helper functions
+    template <typename T, typename Index>
+    bool _areMultiplicable(const CSR<T, Index>& csr1, const CSR<T, Index>& csr2, BatchLayout& layout, std::vector<size_t>& resultShape);
+
+    template <typename Acc, typename Matrix, typename D>
+    void _multVec(const Matrix& csr, const xt::xarray<D>& vector, xt::xarray<D>& result);
+
+    template <typename Acc, typename Matrix, typename D>
+    void _multDense(const Matrix& csr, const xt::xarray<D>& dense, xt::xarray<D>& result);
+
+    template <typename Acc, typename T, typename Index, typename D>
+    void _spmv(const CSR<T, Index>& csr, const D* vector, D* result);
+
+    template <typename Acc, typename T, typename Index, typename D>
+    void _spmm(const CSR<T, Index>& csr, const D* dense, size_t denseCols, D* result);
+
+    template <typename Acc, typename T, typename D>
+    void _spmv(const VarintCSR<T>& csr, const D* vector, D* result);
+
+    template <typename Acc, typename T, typename D>
+    void _spmm(const VarintCSR<T>& csr, const D* dense, size_t denseCols, D* result);
+
+    template <typename T, typename Index>
+    bool _pushBeatsTranspose(const CSR<T, Index>& csr);
+
+    template <typename T, typename Index>
+    void _pushSpmm(const CSR<T, Index>& csr, const T* dense, size_t denseCols, T* result);
+
+    inline bool _pushMultBeatsTranspose(size_t rows, size_t cols, size_t flops, bool& parallel);
+
+    template <typename Acc, typename T, typename Index>
+    CSR<T, Index> _pushTransposeMult(const CSR<T, Index>& csr1, const CSR<T, Index>& csr2, std::vector<size_t> resultShape,
+                                     const BatchLayout& layout, bool parallel);
+}
+
+#include "csr_operations_impl.hpp"
+
+#endif // CSR_OPERATIONS.HPP
@@ -2,152 +2,913 @@
 #define CSR_OPERATIONS_IMPL_HPP
 
 #include "csr_operations.hpp"
-#include <unordered_map>
-#include <tuple>
+#include "csr_spgemm.hpp"
+#include "simd_kernels.hpp"
+#include <algorithm>
+#include <optional>
+#include <utility>
+#include <xtensor/xbuilder.hpp>
+#include <stdexcept>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // convert CSR object to an xarray
-template <typename T>
-xt::xarray<T> CSRToDense(const CSR<T> &csr)
+template <typename T, typename Index>
+xt::xarray<T> CSRToDense(const CSR<T, Index> &csr)
 {
     xt::xarray<T> tensor = xt::zeros<T>(csr.getShape());
 
-    for (size_t i = 0; i < csr.getValues().size(); ++i)
+    const auto &rowPtr = csr.getRowPtr();
+    const auto &colIndices = csr.getColIndices();
+    const auto &values = csr.getValues();
+
+    T *data = tensor.data();
+    size_t numCols = csr.cols();
+    long long numRows = static_cast<long long>(csr.rows());
+#pragma omp parallel for schedule(static) if (csr.nnz() > 100000)
+    for (long long row = 0; row < numRows; ++row)
     {
-        tensor[csr.getIndices()[i]] = csr.getValues()[i];
+        T *rowData = data + row * numCols;
+        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+        {
+            rowData[colIndices[i]] = values[i];
+        }
     }
 
     return tensor;
 }
 
 // convert xarray to CSR object
-template <typename T>
-CSR<T> DenseToCSR(const xt::xarray<T> &tensor)
+template <typename T, typename Index>
+CSR<T, Index> DenseToCSR(const xt::xarray<T> &tensor)
 {
-    CSR<T> csr(tensor);
+    CSR<T, Index> csr(tensor);
     return csr;
 }
 
+// copy of a CSR object with converted values, entries rounding to zero in U stay stored
+template <typename U, typename T, typename Index>
+CSR<U, Index> CSRCast(const CSR<T, Index> &csr)
+{
+    const T *values = csr.getValues().data();
+    std::vector<U> converted(csr.nnz());
+    long long count = static_cast<long long>(csr.nnz());
+#pragma omp parallel for schedule(static) if (count > 100000)
+    for (long long i = 0; i < count; ++i)
+    {
+        converted[i] = static_cast<U>(values[i]);
+    }
+
+    // the index arrays are shared with csr when they are borrowed, copied otherwise
+    return CSR<U, Index>(csr.getShape(), csr.getRowPtr(), csr.getColIndices(), std::move(converted));
+}
+
 // multiply two CSR objects
-template <typename T>
-CSR<T> CSRMult(const CSR<T> &csr1, const CSR<T> &csr2)
+template <typename Acc, typename T, typename Index>
+CSR<T, Index> CSRMult(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2)
 {
-    // Check for compatibility, <isMultiplicable, isBroadcastingRequired>
-    auto analysis = _areMultiplicable(csr1, csr2);
-    if (!std::get<0>(analysis))
+    SPARSE_OPS_STATS_CALL("CSRMult");
+    BatchLayout layout;
+    std::vector<size_t> resultShape;
+    if (!_areMultiplicable(csr1, csr2, layout, resultShape))
     {
         throw std::invalid_argument("Tensors are not compatible for multiplication");
     }
 
-    // Resulting shape
-    std::vector<size_t> resultShape(csr1.shape);
-    resultShape.back() = csr2.shape.back();
+    return _gustavsonMultiply<AccumulatorType<Acc, T>>(csr1, csr2, std::move(resultShape), layout);
+}
 
-    // Result storage
-    std::vector<T> resultValues;
-    std::vector<std::vector<size_t>> resultIndices(resultShape.size());
+// multiply two CSR objects with pruned output rows
+template <typename T, typename Index>
+CSR<T, Index> CSRMult(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, const PruneOptions &prune)
+{
+    SPARSE_OPS_STATS_CALL("CSRMult");
+    BatchLayout layout;
+    std::vector<size_t> resultShape;
+    if (!_areMultiplicable(csr1, csr2, layout, resultShape))
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    return _prunedMultiply(csr1, csr2, std::move(resultShape), layout, prune);
+}
 
-    // Map csr2 indices for quick lookup
-    std::unordered_map<size_t, std::vector<size_t>> indexMapB;
-    for (size_t i = 0; i < csr2.values.size(); ++i)
+/*
+Masked product, every row only spends work and memory on the entries the mask lets through.
+Rows accumulate like Gustavson and drop the products falling outside the mask as they are generated. With a
+structural mask a row can instead compute each of its mask entries as a dot product of the row of A with a column
+of B, which costs nnz(row of A) + nnz(column of B) per mask entry rather than all the flops of the row, and wins
+for rows whose mask is much sparser than their product. The columns of B are rows of its transpose, built only when
+the rows choosing dot products save more work than the transpose costs.
+*/
+template <typename T, typename Index, typename MaskT, typename MaskIndex>
+CSR<T, Index> CSRMult(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, const CSR<MaskT, MaskIndex> &mask, MaskMode mode)
+{
+    SPARSE_OPS_STATS_CALL("CSRMult");
+    BatchLayout layout;
+    std::vector<size_t> resultShape;
+    if (!_areMultiplicable(csr1, csr2, layout, resultShape))
     {
-        size_t key = csr2.indices.front()[i];
-        indexMapB[key].push_back(i);
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+    if (mask.getShape() != resultShape)
+    {
+        throw std::invalid_argument("Mask does not match the shape of the product");
     }
 
-    // Multiply non-zero values
-    for (size_t i = 0; i < csr1.values.size(); ++i)
+    size_t numRows = layout.rows();
+    size_t numCols = csr2.cols();
+    size_t inner = layout.innerPerBatch;
+    long long rowCount = static_cast<long long>(numRows);
+    std::vector<size_t> flops = _rowFlops(csr1, csr2, layout);
+
+    const auto &rowPtrA = csr1.getRowPtr();
+    const auto &maskRowPtr = mask.getRowPtr();
+    const MaskIndex *maskCols = mask.getColIndices().data();
+
+    // Pick a kernel per row, work holds the cost of the chosen one
+    auto gustavsonCost = [&](size_t row)
     {
-        size_t key = csr1.indices.back()[i];
+        return flops[row] + maskRowPtr[row + 1] - maskRowPtr[row];
+    };
+    std::vector<size_t> work(numRows);
+    std::vector<char> useDot(numRows, 0);
+    std::optional<CSR<T, Index>> columnsB;
+    if (mode == MaskMode::Structural && inner > 0 && numCols > 0)
+    {
+        // nonzeros of every column of every batch of B, the row pointers of its transpose
+        std::vector<size_t> columnCounts(csr2.rows() / inner * numCols, 0);
+        const auto &rowPtrB = csr2.getRowPtr();
+        const auto &colIndicesB = csr2.getColIndices();
+        for (size_t row = 0; row < csr2.rows(); ++row)
+        {
+            size_t *counts = columnCounts.data() + row / inner * numCols;
+            for (size_t j = rowPtrB[row]; j < rowPtrB[row + 1]; ++j)
+            {
+                ++counts[colIndicesB[j]];
+            }
+        }
 
-        // Find matching indices
-        auto it = indexMapB.find(key);
-        if (it != indexMapB.end())
+        size_t saved = 0;
+#pragma omp parallel for schedule(static) reduction(+ : saved) if (numRows > 10000)
+        for (long long row = 0; row < rowCount; ++row)
         {
-            for (size_t j : it->second)
+            size_t aRow = layout.aRow(row);
+            const size_t *counts = columnCounts.data() + layout.bBatch[row / layout.rowsPerBatch] * numCols;
+            size_t maskLength = maskRowPtr[row + 1] - maskRowPtr[row];
+            size_t dotCost = maskLength * (rowPtrA[aRow + 1] - rowPtrA[aRow]);
+            for (size_t p = maskRowPtr[row]; p < maskRowPtr[row + 1]; ++p)
             {
-                if (std::get<1>(analysis))
-                {
-                    // Requires broadcasting logic, combine indices
-                    std::vector<size_t> resultIndex(resultShape.size());
-                    for (size_t dim = 0; dim < resultShape.size(); ++dim)
-                    {
-                        size_t indexA = dim < csr1.indices.size() ? csr1.indices[dim][i] : 0;
-                        size_t indexB = dim < csr2.indices.size() ? csr2.indices[dim][j] : 0;
+                dotCost += counts[maskCols[p]];
+            }
 
-                        // Apply broadcasting
-                        resultIndex[dim] = (csr1.shape[dim] == 1) ? indexB : (csr2.shape[dim] == 1) ? indexA
-                                                                                                    : indexA;
-                    }
+            size_t cost = gustavsonCost(row);
+            useDot[row] = dotCost < cost;
+            work[row] = useDot[row] ? dotCost : cost;
+            if (useDot[row])
+            {
+                saved += cost - dotCost;
+            }
+        }
 
-                    // Compute the value and store it
-                    T value = csr1.values[i] * csr2.values[j];
-                    resultValues.push_back(value);
-                    for (size_t dim = 0; dim < resultShape.size(); ++dim)
-                    {
-                        resultIndices[dim].push_back(resultIndex[dim]);
-                    }
+        if (saved > csr2.nnz())
+        {
+            columnsB.emplace(CSRTranspose(csr2));
+        }
+        else
+        {
+            // without the transpose every row is Gustavson again, and so is its cost
+            std::fill(useDot.begin(), useDot.end(), 0);
+            for (size_t row = 0; row < numRows; ++row)
+            {
+                work[row] = gustavsonCost(row);
+            }
+        }
+    }
+    else
+    {
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            work[row] = gustavsonCost(row);
+        }
+    }
+
+    // Slots, a row never holds more entries than its products, nor than its mask row when the mask is structural
+    std::vector<size_t> slotPtr(numRows + 1, 0);
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        size_t bound = flops[row];
+        if (mode == MaskMode::Structural)
+        {
+            bound = std::min(bound, maskRowPtr[row + 1] - maskRowPtr[row]);
+        }
+        slotPtr[row + 1] = slotPtr[row] + bound;
+    }
+
+    bool parallel = false;
+    std::vector<size_t> bounds = _flopChunks(work, parallel);
+    long long chunkCount = static_cast<long long>(bounds.size() - 1);
+
+    std::vector<Index> slotCols(slotPtr.back());
+    std::vector<T> slotValues(slotPtr.back());
+    std::vector<size_t> resultRowPtr(numRows + 1, 0);
+#pragma omp parallel if (parallel)
+    {
+        SpGEMMWorkspace<AccumulatorType<void, T>> workspace;
+#pragma omp for schedule(dynamic, 1)
+        for (long long chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            for (size_t row = bounds[chunk]; row < bounds[chunk + 1]; ++row)
+            {
+                const MaskIndex *rowMask = maskCols + maskRowPtr[row];
+                size_t maskLength = maskRowPtr[row + 1] - maskRowPtr[row];
+                Index *rowCols = slotCols.data() + slotPtr[row];
+                T *rowValues = slotValues.data() + slotPtr[row];
+                if (useDot[row])
+                {
+                    size_t columnOffset = layout.bBatch[row / layout.rowsPerBatch] * numCols;
+                    resultRowPtr[row + 1] = _maskedDotRow<AccumulatorType<void, T>>(csr1, *columnsB, layout.aRow(row), columnOffset, rowMask,
+                                                          maskLength, rowCols, rowValues);
                 }
                 else
                 {
-                    // No broadcasting required, direct indices use and faster operations
-                    std::vector<size_t> resultIndex = csr1.indices[i];
-                    resultIndex.back() = csr2.indices.back()[j];
-
-                    T value = csr1.values[i] * csr2.values[j];
-                    resultValues.push_back(value);
-                    for (size_t dim = 0; dim < resultShape.size(); ++dim)
-                    {
-                        resultIndices[dim].push_back(resultIndex[dim]);
-                    }
+                    resultRowPtr[row + 1] = _maskedGustavsonRow(csr1, csr2, layout.aRow(row), layout.bOffset(row), flops[row],
+                                                                rowMask, maskLength, mode, rowCols, rowValues, workspace);
                 }
             }
         }
     }
 
-    return CSR<T>{resultShape, resultValues, resultIndices};
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        resultRowPtr[row + 1] += resultRowPtr[row];
+    }
+    _recordProductStats(csr1, csr2, flops, resultRowPtr.back());
+    if (resultRowPtr.back() == slotPtr.back())
+    {
+        return CSR<T, Index>(std::move(resultShape), std::move(resultRowPtr), std::move(slotCols), std::move(slotValues));
+    }
+
+    // Compact the rows that came out shorter than their slots
+    std::vector<Index> resultColIndices(resultRowPtr.back());
+    std::vector<T> resultValues(resultRowPtr.back());
+#pragma omp parallel for schedule(static) if (resultRowPtr.back() > 100000)
+    for (long long row = 0; row < rowCount; ++row)
+    {
+        size_t length = resultRowPtr[row + 1] - resultRowPtr[row];
+        std::copy(slotCols.begin() + slotPtr[row], slotCols.begin() + slotPtr[row] + length, resultColIndices.begin() + resultRowPtr[row]);
+        std::copy(slotValues.begin() + slotPtr[row], slotValues.begin() + slotPtr[row] + length, resultValues.begin() + resultRowPtr[row]);
+    }
+    return CSR<T, Index>(std::move(resultShape), std::move(resultRowPtr), std::move(resultColIndices), std::move(resultValues));
+}
+
+// multiply a CSR object with a dense vector
+template <typename Acc, typename T, typename Index, typename D>
+void CSRMultVec(const CSR<T, Index> &csr, const xt::xarray<D> &vector, xt::xarray<D> &result)
+{
+    _multVec<AccumulatorType<Acc, T, D>>(csr, vector, result);
+}
+
+template <typename Acc, typename T, typename D>
+void CSRMultVec(const VarintCSR<T> &csr, const xt::xarray<D> &vector, xt::xarray<D> &result)
+{
+    _multVec<AccumulatorType<Acc, T, D>>(csr, vector, result);
+}
+
+// multiply a CSR object with a dense matrix
+template <typename Acc, typename T, typename Index, typename D>
+void CSRMultDense(const CSR<T, Index> &csr, const xt::xarray<D> &dense, xt::xarray<D> &result)
+{
+    _multDense<AccumulatorType<Acc, T, D>>(csr, dense, result);
+}
+
+template <typename Acc, typename T, typename D>
+void CSRMultDense(const VarintCSR<T> &csr, const xt::xarray<D> &dense, xt::xarray<D> &result)
+{
+    _multDense<AccumulatorType<Acc, T, D>>(csr, dense, result);
+}
+
+template <typename Acc, typename T, typename Index, typename D>
+void CSRMultDense(const CSR<T, Index> &csr, const xt::xtensor<D, 2> &dense, xt::xtensor<D, 2> &result)
+{
+    if (csr.getShape().empty() || dense.shape()[0] != csr.cols())
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    if (result.shape()[0] != csr.rows() || result.shape()[1] != dense.shape()[1])
+    {
+        result.resize({csr.rows(), dense.shape()[1]});
+    }
+
+    _spmm<AccumulatorType<Acc, T, D>>(csr, dense.data(), dense.shape()[1], result.data());
+}
+
+/*
+Counting sort of the nonzeros by their row in the transpose, (batch, column) -> batch * N + column.
+The rows are split into parts of equal nonzeros, every part counts its entries per output row, and an exclusive
+scan over (output row, part) gives every part its own run of slots inside every output row. The parts then scatter
+in row order, so the entries of an output row arrive sorted by their new column without any sort.
+The histograms cost parts * output rows, so there are never more parts than that keeps below nnz.
+*/
+template <typename T, typename Index>
+CSR<T, Index> CSRTranspose(const CSR<T, Index> &csr)
+{
+    const auto &shape = csr.getShape();
+    if (shape.size() < 2)
+    {
+        throw std::invalid_argument("Tensor needs at least two dimensions to be transposed");
+    }
+
+    std::vector<size_t> resultShape(shape);
+    std::swap(resultShape[shape.size() - 2], resultShape[shape.size() - 1]);
+
+    size_t numRows = csr.rows();
+    size_t rowsPerBatch = shape[shape.size() - 2];
+    if (rowsPerBatch > CSR<T, Index>::maxCols())
+    {
+        throw std::invalid_argument("Index type is too narrow for the columns of the tensor");
+    }
+    size_t numCols = csr.cols();
+    size_t resultRows = CSR<T, Index>::rowsOf(resultShape);
+    size_t nnz = csr.nnz();
+
+    const auto &rowPtr = csr.getRowPtr();
+    const auto &colIndices = csr.getColIndices();
+    const auto &values = csr.getValues();
+
+    size_t numParts = 1;
+#ifdef _OPENMP
+    if (nnz > 100000)
+    {
+        numParts = std::min(static_cast<size_t>(omp_get_max_threads()), std::max<size_t>(1, nnz / std::max<size_t>(resultRows, 1)));
+    }
+#endif
+
+    // parts of equal nonzeros, found on rowPtr
+    std::vector<size_t> partRows(numParts + 1, numRows);
+    partRows[0] = 0;
+    for (size_t part = 1; part < numParts; ++part)
+    {
+        partRows[part] = std::upper_bound(rowPtr.begin(), rowPtr.end(), nnz / numParts * part) - rowPtr.begin() - 1;
+    }
+
+    // Count, offsets[part * resultRows + r] holds the entries of part in output row r
+    std::vector<size_t> offsets(numParts * resultRows, 0);
+    long long partCount = static_cast<long long>(numParts);
+#pragma omp parallel for schedule(static, 1) if (numParts > 1)
+    for (long long part = 0; part < partCount; ++part)
+    {
+        size_t *counts = offsets.data() + part * resultRows;
+        for (size_t row = partRows[part]; row < partRows[part + 1]; ++row)
+        {
+            size_t first = row / rowsPerBatch * numCols;
+            for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+            {
+                ++counts[first + colIndices[i]];
+            }
+        }
+    }
+
+    // Scan over (output row, part)
+    std::vector<size_t> resultRowPtr(resultRows + 1, 0);
+    size_t running = 0;
+    for (size_t r = 0; r < resultRows; ++r)
+    {
+        for (size_t part = 0; part < numParts; ++part)
+        {
+            size_t count = offsets[part * resultRows + r];
+            offsets[part * resultRows + r] = running;
+            running += count;
+        }
+        resultRowPtr[r + 1] = running;
+    }
+
+    // Scatter
+    std::vector<Index> resultColIndices(nnz);
+    std::vector<T> resultValues(nnz);
+#pragma omp parallel for schedule(static, 1) if (numParts > 1)
+    for (long long part = 0; part < partCount; ++part)
+    {
+        size_t *slots = offsets.data() + part * resultRows;
+        for (size_t row = partRows[part]; row < partRows[part + 1]; ++row)
+        {
+            size_t first = row / rowsPerBatch * numCols;
+            Index newCol = static_cast<Index>(row % rowsPerBatch);
+            for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+            {
+                size_t slot = slots[first + colIndices[i]]++;
+                resultColIndices[slot] = newCol;
+                resultValues[slot] = values[i];
+            }
+        }
+    }
+
+    return CSR<T, Index>(std::move(resultShape), std::move(resultRowPtr), std::move(resultColIndices), std::move(resultValues));
+}
+
+/*
+A^T * B is the sum over k of the outer products of row k of A with row k of B. Gustavson needs the rows of A^T, so
+one way transposes A once and runs CSRMult. The other pushes the row pairs straight into a dense result per thread,
+which skips the transpose and the hashing of every multiply add, see _pushMultBeatsTranspose for the choice.
+*/
+template <typename T, typename Index>
+CSR<T, Index> CSRTransposeMult(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2)
+{
+    std::vector<size_t> shapeA(csr1.getShape());
+    if (shapeA.size() < 2)
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+    std::swap(shapeA[shapeA.size() - 2], shapeA[shapeA.size() - 1]);
+
+    BatchLayout layout;
+    std::vector<size_t> resultShape;
+    if (!_batchLayout(shapeA, csr2.getShape(), CSR<T, Index>::rowsOf(shapeA), layout, resultShape))
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    // multiply adds of every output batch, row k of the batch of A against row k of the batch of B
+    const auto &rowPtrA = csr1.getRowPtr();
+    const auto &rowPtrB = csr2.getRowPtr();
+    size_t rowsPerBatch = csr1.cols();
+    size_t inner = shapeA.back();
+    size_t numBatches = rowsPerBatch == 0 ? 0 : layout.rows() / rowsPerBatch;
+    size_t flops = 0;
+    for (size_t batch = 0; batch < numBatches; ++batch)
+    {
+        size_t firstA = layout.aRow(batch * rowsPerBatch) / rowsPerBatch * inner;
+        size_t firstB = layout.bOffset(batch * rowsPerBatch);
+        for (size_t k = 0; k < inner; ++k)
+        {
+            flops += (rowPtrA[firstA + k + 1] - rowPtrA[firstA + k]) * (rowPtrB[firstB + k + 1] - rowPtrB[firstB + k]);
+        }
+    }
+
+    bool parallel = false;
+    if (_pushMultBeatsTranspose(layout.rows(), csr2.cols(), flops, parallel))
+    {
+        return _pushTransposeMult<AccumulatorType<void, T>>(csr1, csr2, std::move(resultShape), layout, parallel);
+    }
+    return CSRMult(CSRTranspose(csr1), csr2);
+}
+
+// multiply the transpose of a CSR matrix with a dense vector
+template <typename T, typename Index>
+void CSRTransposeMultVec(const CSR<T, Index> &csr, const xt::xarray<T> &vector, xt::xarray<T> &result)
+{
+    const auto &shape = csr.getShape();
+    if (shape.size() != 2 || vector.dimension() != 1 || vector.shape()[0] != csr.rows())
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    if (result.dimension() != 1 || result.shape()[0] != csr.cols())
+    {
+        result.resize(std::vector<size_t>{csr.cols()});
+    }
+
+    if (_pushBeatsTranspose(csr))
+    {
+        _pushSpmm(csr, vector.data(), 1, result.data());
+    }
+    else
+    {
+        _spmv<AccumulatorType<void, T>>(CSRTranspose(csr), vector.data(), result.data());
+    }
+}
+
+// multiply the transpose of a CSR matrix with a dense matrix
+template <typename T, typename Index>
+void CSRTransposeMultDense(const CSR<T, Index> &csr, const xt::xarray<T> &dense, xt::xarray<T> &result)
+{
+    const auto &shape = csr.getShape();
+    if (shape.size() != 2 || dense.dimension() != 2 || dense.shape()[0] != csr.rows())
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    size_t denseCols = dense.shape()[1];
+    if (result.dimension() != 2 || result.shape()[0] != csr.cols() || result.shape()[1] != denseCols)
+    {
+        result.resize(std::vector<size_t>{csr.cols(), denseCols});
+    }
+
+    if (_pushBeatsTranspose(csr))
+    {
+        _pushSpmm(csr, dense.data(), denseCols, result.data());
+    }
+    else
+    {
+        _spmm<AccumulatorType<void, T>>(CSRTranspose(csr), dense.data(), denseCols, result.data());
+    }
 }
 
 // Anonymous namespace
 namespace
 {
-    template <typename T>
-    std::tuple<bool, bool> _areMultiplicable(const CSR<T> &csr1, const CSR<T> &csr2)
+    // (..., K) x (K) -> (...) for any compressed row format
+    template <typename Acc, typename Matrix, typename D>
+    void _multVec(const Matrix &csr, const xt::xarray<D> &vector, xt::xarray<D> &result)
+    {
+        if (csr.getShape().empty() || vector.dimension() != 1 || vector.shape()[0] != csr.cols())
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
+
+        // result has the leading dimensions of csr, only reallocated if the caller's shape differs
+        std::vector<size_t> resultShape(csr.getShape().begin(), csr.getShape().end() - 1);
+        if (!std::equal(resultShape.begin(), resultShape.end(), result.shape().begin(), result.shape().end()))
+        {
+            result.resize(resultShape);
+        }
+
+        _spmv<Acc>(csr, vector.data(), result.data());
+    }
+
+    // (..., K) x (K, N) -> (..., N) for any compressed row format
+    template <typename Acc, typename Matrix, typename D>
+    void _multDense(const Matrix &csr, const xt::xarray<D> &dense, xt::xarray<D> &result)
     {
-        // Ensure valid dimensions
-        if (csr1.shape.empty() || csr2.shape.empty())
+        if (csr.getShape().empty() || dense.dimension() != 2 || dense.shape()[0] != csr.cols())
         {
-            return {false, false};
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
         }
 
-        if (csr1.shape.back() != csr2.shape.front())
+        std::vector<size_t> resultShape(csr.getShape());
+        resultShape.back() = dense.shape()[1];
+        if (!std::equal(resultShape.begin(), resultShape.end(), result.shape().begin(), result.shape().end()))
         {
-            return {false, false};
+            result.resize(resultShape);
         }
 
-        // check for broadcasting
-        size_t dimA = csr1.shape.size();
-        size_t dimB = csr2.shape.size();
-        size_t maxDims = std::max(dimA, dimB);
+        _spmm<Acc>(csr, dense.data(), dense.shape()[1], result.data());
+    }
 
-        std::tuple<bool, bool> result = {true, false};
+    template <typename T, typename Index>
+    bool _areMultiplicable(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, BatchLayout &layout, std::vector<size_t> &resultShape)
+    {
+        // Batches are runs of rows of the flattened operands, so the layout only needs the shapes
+        return _batchLayout(csr1.getShape(), csr2.getShape(), csr1.rows(), layout, resultShape);
+    }
 
-        for (size_t i = 1; i < maxDims; ++i)
+    // result[row] = dot(row of csr, vector), rows are independent so they split across threads
+    template <typename Acc, typename T, typename Index, typename D>
+    void _spmv(const CSR<T, Index> &csr, const D *vector, D *result)
+    {
+        const size_t *rowPtr = csr.getRowPtr().data();
+        const Index *colIndices = csr.getColIndices().data();
+        const T *values = csr.getValues().data();
+
+        long long numRows = static_cast<long long>(csr.rows());
+#pragma omp parallel for schedule(dynamic, 256) if (csr.nnz() > 50000)
+        for (long long row = 0; row < numRows; ++row)
         {
-            size_t dimA_index = (i < dimA) ? csr1.shape[dimA - 1 - i] : 1;
-            size_t dimB_index = (i < dimB) ? csr2.shape[dimB - 1 - i] : 1;
+            Acc sum = Acc(0);
+            for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+            {
+                sum += static_cast<Acc>(values[i]) * static_cast<Acc>(vector[colIndices[i]]);
+            }
+            result[row] = static_cast<D>(sum);
+        }
+    }
 
-            if (dimA_index != 1 && dimB_index != 1 && dimA_index != dimB_index)
+    /*
+    result row = sum over the nonzeros (k, a) of the row of a * dense row k.
+    Every nonzero becomes an axpy over the dense columns, which is where the SIMD lanes go.
+    Wide outputs are processed in column tiles so the tile of the result row stays in L1 across the nonzeros.
+    When the result is narrower than the accumulator the tile is summed in a wide scratch tile and rounded once.
+    */
+    template <typename Acc, typename T, typename Index, typename D>
+    void _spmm(const CSR<T, Index> &csr, const D *dense, size_t denseCols, D *result)
+    {
+        const size_t *rowPtr = csr.getRowPtr().data();
+        const Index *colIndices = csr.getColIndices().data();
+        const T *values = csr.getValues().data();
+
+        constexpr size_t tileCols = 512;
+        long long numRows = static_cast<long long>(csr.rows());
+#pragma omp parallel if (csr.nnz() * denseCols > 50000)
+        {
+            std::vector<Acc> sums(std::is_same_v<D, Acc> ? 0 : std::min(tileCols, denseCols));
+#pragma omp for schedule(dynamic, 64)
+            for (long long row = 0; row < numRows; ++row)
             {
-                return {false, false};
+                D *resultRow = result + row * denseCols;
+                if constexpr (std::is_same_v<D, Acc>)
+                {
+                    std::fill(resultRow, resultRow + denseCols, D(0));
+                }
+                for (size_t tile = 0; tile < denseCols; tile += tileCols)
+                {
+                    size_t width = std::min(tileCols, denseCols - tile);
+                    if constexpr (std::is_same_v<D, Acc>)
+                    {
+                        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+                        {
+                            _axpy(width, static_cast<Acc>(values[i]), dense + colIndices[i] * denseCols + tile, resultRow + tile);
+                        }
+                    }
+                    else
+                    {
+                        std::fill(sums.begin(), sums.begin() + width, Acc(0));
+                        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+                        {
+                            _axpyWiden(width, static_cast<Acc>(values[i]), dense + colIndices[i] * denseCols + tile, sums.data());
+                        }
+                        std::transform(sums.begin(), sums.begin() + width, resultRow + tile, [](Acc sum)
+                                       { return static_cast<D>(sum); });
+                    }
+                }
             }
+        }
+    }
+
+    /*
+    A transposed product can push, every row of csr scattering its nonzeros into the result, or transpose once
+    and pull rows like the plain kernels. Pushing needs a private copy of the result per thread to avoid races,
+    so it only wins while those copies are smaller than the nonzeros a transpose would move.
+    */
+    template <typename T, typename Index>
+    bool _pushBeatsTranspose(const CSR<T, Index> &csr)
+    {
+        size_t numThreads = 1;
+#ifdef _OPENMP
+        numThreads = static_cast<size_t>(omp_get_max_threads());
+#endif
+        return numThreads == 1 || csr.nnz() <= 50000 || numThreads * csr.cols() <= csr.nnz();
+    }
 
-            if (dimA_index == 1 || dimB_index == 1)
+    // result (cols x denseCols) = csr^T * dense, rows of dense scattered to the columns of their nonzeros
+    template <typename T, typename Index>
+    void _pushSpmm(const CSR<T, Index> &csr, const T *dense, size_t denseCols, T *result)
+    {
+        const size_t *rowPtr = csr.getRowPtr().data();
+        const Index *colIndices = csr.getColIndices().data();
+        const T *values = csr.getValues().data();
+        size_t resultSize = csr.cols() * denseCols;
+        std::fill(result, result + resultSize, T(0));
+
+        auto scatterRow = [&](size_t row, T *out)
+        {
+            const T *denseRow = dense + row * denseCols;
+            for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
             {
-                result.second = true;
+                if (denseCols == 1)
+                {
+                    out[colIndices[i]] += values[i] * denseRow[0];
+                }
+                else
+                {
+                    _axpy(denseCols, values[i], denseRow, out + colIndices[i] * denseCols);
+                }
+            }
+        };
+
+        size_t numThreads = 1;
+#ifdef _OPENMP
+        numThreads = static_cast<size_t>(omp_get_max_threads());
+#endif
+        long long numRows = static_cast<long long>(csr.rows());
+        if (numThreads == 1 || csr.nnz() * denseCols <= 50000)
+        {
+            for (long long row = 0; row < numRows; ++row)
+            {
+                scatterRow(row, result);
+            }
+            return;
+        }
+
+        // private results, summed once every thread is done
+        std::vector<T> partial(numThreads * resultSize, T(0));
+        long long sizeCount = static_cast<long long>(resultSize);
+#pragma omp parallel
+        {
+            size_t thread = 0;
+#ifdef _OPENMP
+            thread = static_cast<size_t>(omp_get_thread_num());
+#endif
+            T *local = partial.data() + thread * resultSize;
+#pragma omp for schedule(dynamic, 256)
+            for (long long row = 0; row < numRows; ++row)
+            {
+                scatterRow(row, local);
+            }
+
+#pragma omp for schedule(static)
+            for (long long i = 0; i < sizeCount; ++i)
+            {
+                T sum = T(0);
+                for (size_t t = 0; t < numThreads; ++t)
+                {
+                    sum += partial[t * resultSize + i];
+                }
+                result[i] = sum;
+            }
+        }
+    }
+
+    /*
+    Pushing writes and scans a dense M x N result per thread for every batch, while transposing moves the nonzeros
+    of A once more and Gustavson hashes every multiply add. Pushing wins while its dense results are no larger than
+    the multiply adds.
+    */
+    inline bool _pushMultBeatsTranspose(size_t rows, size_t cols, size_t flops, bool &parallel)
+    {
+        size_t numThreads = 1;
+#ifdef _OPENMP
+        numThreads = static_cast<size_t>(omp_get_max_threads());
+#endif
+        parallel = numThreads > 1 && flops > 50000;
+        size_t budget = flops / (parallel ? numThreads : 1);
+        return cols == 0 || rows <= budget / cols;
+    }
+
+    // csr1^T * csr2 batch by batch, the outer products of the row pairs summed into private dense results
+    template <typename Acc, typename T, typename Index>
+    CSR<T, Index> _pushTransposeMult(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2,
+                                     std::vector<size_t> resultShape, const BatchLayout &layout, bool parallel)
+    {
+        const size_t *rowPtrA = csr1.getRowPtr().data();
+        const Index *colIndicesA = csr1.getColIndices().data();
+        const T *valuesA = csr1.getValues().data();
+        const size_t *rowPtrB = csr2.getRowPtr().data();
+        const Index *colIndicesB = csr2.getColIndices().data();
+        const T *valuesB = csr2.getValues().data();
+
+        size_t rowsPerBatch = csr1.cols();
+        size_t inner = csr1.getShape()[csr1.getShape().size() - 2];
+        size_t cols = csr2.cols();
+        size_t numBatches = rowsPerBatch == 0 ? 0 : layout.rows() / rowsPerBatch;
+        size_t batchSize = rowsPerBatch * cols;
+
+        size_t numThreads = 1;
+#ifdef _OPENMP
+        numThreads = parallel ? static_cast<size_t>(omp_get_max_threads()) : 1;
+#endif
+        std::vector<Acc> sums(numThreads * batchSize, Acc(0));
+        std::vector<char> touched(numThreads * batchSize, 0);
+        std::vector<size_t> rowPtr(layout.rows() + 1, 0);
+        std::vector<Index> colIndices;
+        std::vector<T> values;
+
+        long long innerCount = static_cast<long long>(inner);
+        long long rowCount = static_cast<long long>(rowsPerBatch);
+        for (size_t batch = 0; batch < numBatches; ++batch)
+        {
+            size_t firstA = layout.aRow(batch * rowsPerBatch) / rowsPerBatch * inner;
+            size_t firstB = layout.bOffset(batch * rowsPerBatch);
+            size_t *batchRowPtr = rowPtr.data() + batch * rowsPerBatch;
+
+#pragma omp parallel if (parallel)
+            {
+                size_t thread = 0;
+#ifdef _OPENMP
+                thread = parallel ? static_cast<size_t>(omp_get_thread_num()) : 0;
+#endif
+                Acc *localSums = sums.data() + thread * batchSize;
+                char *localTouched = touched.data() + thread * batchSize;
+#pragma omp for schedule(dynamic, 256)
+                for (long long k = 0; k < innerCount; ++k)
+                {
+                    size_t rowA = firstA + k;
+                    size_t rowB = firstB + k;
+                    for (size_t i = rowPtrA[rowA]; i < rowPtrA[rowA + 1]; ++i)
+                    {
+                        Acc a = static_cast<Acc>(valuesA[i]);
+                        size_t offset = colIndicesA[i] * cols;
+                        for (size_t j = rowPtrB[rowB]; j < rowPtrB[rowB + 1]; ++j)
+                        {
+                            localSums[offset + colIndicesB[j]] += a * static_cast<Acc>(valuesB[j]);
+                            localTouched[offset + colIndicesB[j]] = 1;
+                        }
+                    }
+                }
+
+                // fold the private results into the first one and count the entries of every output row
+#pragma omp for schedule(static)
+                for (long long row = 0; row < rowCount; ++row)
+                {
+                    size_t count = 0;
+                    for (size_t at = row * cols; at < (row + 1) * cols; ++at)
+                    {
+                        for (size_t t = 1; t < numThreads; ++t)
+                        {
+                            sums[at] += sums[t * batchSize + at];
+                            touched[at] |= touched[t * batchSize + at];
+                        }
+                        count += touched[at];
+                    }
+                    batchRowPtr[row + 1] = count;
+                }
+            }
+
+            for (size_t row = 0; row < rowsPerBatch; ++row)
+            {
+                batchRowPtr[row + 1] += batchRowPtr[row];
+            }
+            colIndices.resize(batchRowPtr[rowsPerBatch]);
+            values.resize(batchRowPtr[rowsPerBatch]);
+
+            // Gather the touched entries, then clear the dense results for the next batch
+#pragma omp parallel for schedule(static) if (parallel)
+            for (long long row = 0; row < rowCount; ++row)
+            {
+                size_t slot = batchRowPtr[row];
+                for (size_t col = 0; col < cols; ++col)
+                {
+                    if (touched[row * cols + col])
+                    {
+                        colIndices[slot] = static_cast<Index>(col);
+                        values[slot] = static_cast<T>(sums[row * cols + col]);
+                        ++slot;
+                    }
+                }
+            }
+            std::fill(sums.begin(), sums.end(), Acc(0));
+            std::fill(touched.begin(), touched.end(), 0);
+        }
+
+        return CSR<T, Index>(std::move(resultShape), std::move(rowPtr), std::move(colIndices), std::move(values));
+    }
+
+    // same kernels over the varint column stream, columns are rebuilt from the gaps as the row is walked
+    template <typename Acc, typename T, typename D>
+    void _spmv(const VarintCSR<T> &csr, const D *vector, D *result)
+    {
+        const size_t *rowPtr = csr.getRowPtr().data();
+        const size_t *streamPtr = csr.getStreamPtr().data();
+        const uint8_t *stream = csr.getColumnStream().data();
+        const T *values = csr.getValues().data();
+
+        long long numRows = static_cast<long long>(csr.rows());
+#pragma omp parallel for schedule(dynamic, 256) if (csr.nnz() > 50000)
+        for (long long row = 0; row < numRows; ++row)
+        {
+            const uint8_t *cursor = stream + streamPtr[row];
+            size_t col = 0;
+            Acc sum = Acc(0);
+            for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+            {
+                col += _readVarint(cursor);
+                sum += static_cast<Acc>(values[i]) * static_cast<Acc>(vector[col]);
+            }
+            result[row] = static_cast<D>(sum);
+        }
+    }
+
+    template <typename Acc, typename T, typename D>
+    void _spmm(const VarintCSR<T> &csr, const D *dense, size_t denseCols, D *result)
+    {
+        const size_t *rowPtr = csr.getRowPtr().data();
+        const size_t *streamPtr = csr.getStreamPtr().data();
+        const uint8_t *stream = csr.getColumnStream().data();
+        const T *values = csr.getValues().data();
+
+        constexpr size_t tileCols = 512;
+        long long numRows = static_cast<long long>(csr.rows());
+#pragma omp parallel if (csr.nnz() * denseCols > 50000)
+        {
+            std::vector<Acc> sums(std::is_same_v<D, Acc> ? 0 : std::min(tileCols, denseCols));
+#pragma omp for schedule(dynamic, 64)
+            for (long long row = 0; row < numRows; ++row)
+            {
+                D *resultRow = result + row * denseCols;
+                if constexpr (std::is_same_v<D, Acc>)
+                {
+                    std::fill(resultRow, resultRow + denseCols, D(0));
+                }
+                for (size_t tile = 0; tile < denseCols; tile += tileCols)
+                {
+                    size_t width = std::min(tileCols, denseCols - tile);
+                    const uint8_t *cursor = stream + streamPtr[row];
+                    size_t col = 0;
+                    if constexpr (std::is_same_v<D, Acc>)
+                    {
+                        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+                        {
+                            col += _readVarint(cursor);
+                            _axpy(width, static_cast<Acc>(values[i]), dense + col * denseCols + tile, resultRow + tile);
+                        }
+                    }
+                    else
+                    {
+                        std::fill(sums.begin(), sums.begin() + width, Acc(0));
+                        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+                        {
+                            col += _readVarint(cursor);
+                            _axpyWiden(width, static_cast<Acc>(values[i]), dense + col * denseCols + tile, sums.data());
+                        }
+                        std::transform(sums.begin(), sums.begin() + width, resultRow + tile, [](Acc sum)
+                                       { return static_cast<D>(sum); });
+                    }
+                }
             }
         }
-        return result;
     }
 }
 
-#endif // CSR_OPERATIONS_IMPL_HPP
\ No newline at end of file
+#endif // CSR_OPERATIONS_IMPL_HPP
@@ -0,0 +1,102 @@
+#ifndef CSR_REORDER_HPP
+#define CSR_REORDER_HPP
+
+#include "csr_adt.hpp"
+#include "csr_operations.hpp"
+#include <vector>
+
+/*
+Symmetric reordering of square sparse matrices for locality. Irregular graphs scatter the nonzeros of a row over
+the whole column range, so a product reads B, or the dense operand, at random. Renumbering the vertices so that
+neighbours get close numbers keeps those reads inside a narrow band of rows that stays in cache.
+An ordering lists the old index of every new index, order[new] = old, and is applied to rows and columns alike.
+*/
+enum class ReorderMethod
+{
+    ReverseCuthillMcKee, // breadth first from a peripheral vertex, neighbours by increasing degree, reversed
+    Degree               // vertices by decreasing degree, the hubs and their rows of B end up next to each other
+};
+
+// bandwidth reducing ordering of a square matrix, over the pattern of csr + csr^T
+template <typename T, typename Index>
+std::vector<size_t> CSROrdering(const CSR<T, Index>& csr, ReorderMethod method = ReorderMethod::ReverseCuthillMcKee);
+
+// new row i is old row rowOrder[i] and new column j is old column colOrder[j], an empty colOrder keeps the columns
+template <typename T, typename Index>
+CSR<T, Index> CSRPermute(const CSR<T, Index>& csr, const std::vector<size_t>& rowOrder, const std::vector<size_t>& colOrder);
+
+// largest distance of a nonzero from the diagonal
+template <typename T, typename Index>
+size_t CSRBandwidth(const CSR<T, Index>& csr);
+
+/*
+A square matrix stored in a locality improving ordering, P A P^T, together with the ordering, so dense operands can be
+brought into the ordering and results mapped back. Operands sharing one ordering multiply without leaving it:
+(P A P^T)(P B P^T) = P AB P^T. The reordering pays for itself when the matrix is multiplied more than once.
+*/
+template <typename T, typename Index = size_t>
+class ReorderedCSR
+{
+private:
+    std::vector<size_t> order;   // order[new] = old
+    std::vector<size_t> inverse; // inverse[old] = new
+    CSR<T, Index> matrix;        // the matrix in the ordering
+
+    ReorderedCSR(CSR<T, Index> matrix, std::vector<size_t> order, std::vector<size_t> inverse);
+
+public:
+    // compute an ordering of csr and apply it
+    explicit ReorderedCSR(const CSR<T, Index>& csr, ReorderMethod method = ReorderMethod::ReverseCuthillMcKee);
+
+    // apply a given ordering, typically the one of another operand
+    ReorderedCSR(const CSR<T, Index>& csr, std::vector<size_t> order);
+
+    // wrap a matrix that is already in the ordering
+    static ReorderedCSR fromReordered(CSR<T, Index> matrix, std::vector<size_t> order);
+
+    // the matrix in the original ordering
+    CSR<T, Index> toCSR() const;
+
+    // rows of a dense vector or matrix into the ordering, and back
+    xt::xarray<T> permute(const xt::xarray<T>& dense) const;
+    xt::xarray<T> restore(const xt::xarray<T>& dense) const;
+
+    // Accessors
+    const CSR<T, Index>& getMatrix() const;
+    const std::vector<size_t>& getOrder() const;
+    const std::vector<size_t>& getInverse() const;
+    size_t size() const;
+};
+
+// product of two matrices in the same ordering, stays in that ordering
+template <typename T, typename Index>
+ReorderedCSR<T, Index> CSRMult(const ReorderedCSR<T, Index>& csr1, const ReorderedCSR<T, Index>& csr2);
+
+// multiply a reordered matrix with a dense vector or matrix given and returned in the original ordering
+template <typename T, typename Index>
+void CSRMultVec(const ReorderedCSR<T, Index>& csr, const xt::xarray<T>& vector, xt::xarray<T>& result);
+
+template <typename T, typename Index>
+void CSRMultDense(const ReorderedCSR<T, Index>& csr, const xt::xarray<T>& dense, xt::xarray<T>& result);
+
+namespace
+{
+    // helper functions
+    template <typename T, typename Index>
+    void _symmetricGraph(const CSR<T, Index>& csr, std::vector<size_t>& adjacencyPtr, std::vector<size_t>& adjacency);
+
+    inline size_t _peripheralVertex(size_t start, const std::vector<size_t>& adjacencyPtr,
+                                    const std::vector<size_t>& adjacency, std::vector<size_t>& levels);
+
+    template <typename T, typename Index>
+    size_t _squareSize(const CSR<T, Index>& csr);
+
+    inline std::vector<size_t> _inversePermutation(const std::vector<size_t>& order, size_t size);
+
+    template <typename T>
+    void _permuteRows(const xt::xarray<T>& dense, const std::vector<size_t>& from, xt::xarray<T>& result, bool scatter);
+}
+
+#include "csr_reorder_impl.hpp"
+
+#endif // CSR_REORDER_HPP
@@ -0,0 +1,429 @@
+#ifndef CSR_REORDER_IMPL_HPP
+#define CSR_REORDER_IMPL_HPP
+
+#include "csr_reorder.hpp"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+/*
+Reverse Cuthill-McKee. Every connected component is walked breadth first from a pseudo-peripheral vertex, the end
+of a long shortest path, so the levels of the search are many and thin. Neighbours are numbered by increasing degree
+and the final order is reversed, which keeps the band and the fill of the profile small.
+Components are started from their vertex of smallest degree, so the walk does not depend on the numbering given.
+*/
+template <typename T, typename Index>
+std::vector<size_t> CSROrdering(const CSR<T, Index> &csr, ReorderMethod method)
+{
+    size_t n = _squareSize(csr);
+    std::vector<size_t> adjacencyPtr, adjacency;
+    _symmetricGraph(csr, adjacencyPtr, adjacency);
+    auto degree = [&](size_t vertex)
+    { return adjacencyPtr[vertex + 1] - adjacencyPtr[vertex]; };
+
+    std::vector<size_t> byDegree(n);
+    std::iota(byDegree.begin(), byDegree.end(), 0);
+    if (method == ReorderMethod::Degree)
+    {
+        std::stable_sort(byDegree.begin(), byDegree.end(), [&](size_t lhs, size_t rhs)
+                         { return degree(lhs) > degree(rhs); });
+        return byDegree;
+    }
+
+    std::stable_sort(byDegree.begin(), byDegree.end(), [&](size_t lhs, size_t rhs)
+                     { return degree(lhs) < degree(rhs); });
+
+    // the order doubles as the queue of the breadth first search
+    std::vector<size_t> order;
+    order.reserve(n);
+    std::vector<char> visited(n, 0);
+    std::vector<size_t> levels(n, static_cast<size_t>(-1));
+    std::vector<size_t> neighbours;
+    for (size_t candidate : byDegree)
+    {
+        if (visited[candidate])
+        {
+            continue;
+        }
+
+        size_t root = _peripheralVertex(candidate, adjacencyPtr, adjacency, levels);
+        visited[root] = 1;
+        order.push_back(root);
+        for (size_t head = order.size() - 1; head < order.size(); ++head)
+        {
+            size_t vertex = order[head];
+            neighbours.clear();
+            for (size_t i = adjacencyPtr[vertex]; i < adjacencyPtr[vertex + 1]; ++i)
+            {
+                if (!visited[adjacency[i]])
+                {
+                    visited[adjacency[i]] = 1;
+                    neighbours.push_back(adjacency[i]);
+                }
+            }
+            std::sort(neighbours.begin(), neighbours.end(), [&](size_t lhs, size_t rhs)
+                      { return degree(lhs) != degree(rhs) ? degree(lhs) < degree(rhs) : lhs < rhs; });
+            order.insert(order.end(), neighbours.begin(), neighbours.end());
+        }
+    }
+
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// rows are gathered, then the columns of every row renumbered and sorted again
+template <typename T, typename Index>
+CSR<T, Index> CSRPermute(const CSR<T, Index> &csr, const std::vector<size_t> &rowOrder, const std::vector<size_t> &colOrder)
+{
+    const auto &shape = csr.getShape();
+    if (shape.size() != 2)
+    {
+        throw std::invalid_argument("Only matrices can be permuted");
+    }
+    _inversePermutation(rowOrder, shape[0]);
+    std::vector<size_t> colInverse = colOrder.empty() ? std::vector<size_t>() : _inversePermutation(colOrder, shape[1]);
+
+    const auto &rowPtr = csr.getRowPtr();
+    const auto &colIndices = csr.getColIndices();
+    const auto &values = csr.getValues();
+    size_t numRows = shape[0];
+
+    std::vector<size_t> resultRowPtr(numRows + 1, 0);
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        resultRowPtr[row + 1] = resultRowPtr[row] + rowPtr[rowOrder[row] + 1] - rowPtr[rowOrder[row]];
+    }
+
+    std::vector<Index> resultColIndices(csr.nnz());
+    std::vector<T> resultValues(csr.nnz());
+    long long rows = static_cast<long long>(numRows);
+#pragma omp parallel if (csr.nnz() > 100000)
+    {
+        std::vector<std::pair<Index, T>> entries;
+#pragma omp for schedule(dynamic, 256)
+        for (long long row = 0; row < rows; ++row)
+        {
+            size_t from = rowPtr[rowOrder[row]];
+            size_t length = rowPtr[rowOrder[row] + 1] - from;
+            size_t to = resultRowPtr[row];
+            if (colInverse.empty())
+            {
+                std::copy(colIndices.begin() + from, colIndices.begin() + from + length, resultColIndices.begin() + to);
+                std::copy(values.begin() + from, values.begin() + from + length, resultValues.begin() + to);
+                continue;
+            }
+
+            entries.clear();
+            for (size_t i = from; i < from + length; ++i)
+            {
+                entries.emplace_back(static_cast<Index>(colInverse[colIndices[i]]), values[i]);
+            }
+            std::sort(entries.begin(), entries.end(), [](const auto &lhs, const auto &rhs)
+                      { return lhs.first < rhs.first; });
+            for (size_t i = 0; i < length; ++i)
+            {
+                resultColIndices[to + i] = entries[i].first;
+                resultValues[to + i] = entries[i].second;
+            }
+        }
+    }
+
+    return CSR<T, Index>(shape, std::move(resultRowPtr), std::move(resultColIndices), std::move(resultValues));
+}
+
+template <typename T, typename Index>
+size_t CSRBandwidth(const CSR<T, Index> &csr)
+{
+    const auto &rowPtr = csr.getRowPtr();
+    const auto &colIndices = csr.getColIndices();
+    size_t bandwidth = 0;
+    for (size_t row = 0; row < csr.rows(); ++row)
+    {
+        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+        {
+            size_t col = colIndices[i];
+            bandwidth = std::max(bandwidth, col > row ? col - row : row - col);
+        }
+    }
+    return bandwidth;
+}
+
+// Constructors
+template <typename T, typename Index>
+ReorderedCSR<T, Index>::ReorderedCSR(CSR<T, Index> matrix, std::vector<size_t> order, std::vector<size_t> inverse)
+    : order(std::move(order)), inverse(std::move(inverse)), matrix(std::move(matrix))
+{
+}
+
+template <typename T, typename Index>
+ReorderedCSR<T, Index>::ReorderedCSR(const CSR<T, Index> &csr, ReorderMethod method)
+    : ReorderedCSR(csr, CSROrdering(csr, method))
+{
+}
+
+template <typename T, typename Index>
+ReorderedCSR<T, Index>::ReorderedCSR(const CSR<T, Index> &csr, std::vector<size_t> order)
+    : order(std::move(order)), inverse(_inversePermutation(this->order, _squareSize(csr))),
+      matrix(CSRPermute(csr, this->order, this->order))
+{
+}
+
+template <typename T, typename Index>
+ReorderedCSR<T, Index> ReorderedCSR<T, Index>::fromReordered(CSR<T, Index> matrix, std::vector<size_t> order)
+{
+    std::vector<size_t> inverse = _inversePermutation(order, _squareSize(matrix));
+    return ReorderedCSR(std::move(matrix), std::move(order), std::move(inverse));
+}
+
+template <typename T, typename Index>
+CSR<T, Index> ReorderedCSR<T, Index>::toCSR() const
+{
+    return CSRPermute(matrix, inverse, inverse);
+}
+
+template <typename T, typename Index>
+xt::xarray<T> ReorderedCSR<T, Index>::permute(const xt::xarray<T> &dense) const
+{
+    xt::xarray<T> result;
+    _permuteRows(dense, order, result, false);
+    return result;
+}
+
+template <typename T, typename Index>
+xt::xarray<T> ReorderedCSR<T, Index>::restore(const xt::xarray<T> &dense) const
+{
+    xt::xarray<T> result;
+    _permuteRows(dense, order, result, true);
+    return result;
+}
+
+// Accessors
+template <typename T, typename Index>
+const CSR<T, Index> &ReorderedCSR<T, Index>::getMatrix() const
+{
+    return matrix;
+}
+
+template <typename T, typename Index>
+const std::vector<size_t> &ReorderedCSR<T, Index>::getOrder() const
+{
+    return order;
+}
+
+template <typename T, typename Index>
+const std::vector<size_t> &ReorderedCSR<T, Index>::getInverse() const
+{
+    return inverse;
+}
+
+template <typename T, typename Index>
+size_t ReorderedCSR<T, Index>::size() const
+{
+    return order.size();
+}
+
+// Operations
+template <typename T, typename Index>
+ReorderedCSR<T, Index> CSRMult(const ReorderedCSR<T, Index> &csr1, const ReorderedCSR<T, Index> &csr2)
+{
+    if (csr1.getOrder() != csr2.getOrder())
+    {
+        throw std::invalid_argument("Operands are not in the same ordering");
+    }
+    return ReorderedCSR<T, Index>::fromReordered(CSRMult(csr1.getMatrix(), csr2.getMatrix()), csr1.getOrder());
+}
+
+template <typename T, typename Index>
+void CSRMultVec(const ReorderedCSR<T, Index> &csr, const xt::xarray<T> &vector, xt::xarray<T> &result)
+{
+    xt::xarray<T> permuted;
+    xt::xarray<T> product;
+    _permuteRows(vector, csr.getOrder(), permuted, false);
+    CSRMultVec(csr.getMatrix(), permuted, product);
+    _permuteRows(product, csr.getOrder(), result, true);
+}
+
+template <typename T, typename Index>
+void CSRMultDense(const ReorderedCSR<T, Index> &csr, const xt::xarray<T> &dense, xt::xarray<T> &result)
+{
+    xt::xarray<T> permuted;
+    xt::xarray<T> product;
+    _permuteRows(dense, csr.getOrder(), permuted, false);
+    CSRMultDense(csr.getMatrix(), permuted, product);
+    _permuteRows(product, csr.getOrder(), result, true);
+}
+
+// Anonymous namespace
+namespace
+{
+    // pattern of csr + csr^T without the diagonal, merged row by row with the rows of the transpose
+    template <typename T, typename Index>
+    void _symmetricGraph(const CSR<T, Index> &csr, std::vector<size_t> &adjacencyPtr, std::vector<size_t> &adjacency)
+    {
+        CSR<T, Index> transposed = CSRTranspose(csr);
+        const auto &rowPtr = csr.getRowPtr();
+        const auto &colIndices = csr.getColIndices();
+        const auto &rowPtrT = transposed.getRowPtr();
+        const auto &colIndicesT = transposed.getColIndices();
+        size_t n = csr.rows();
+        long long rows = static_cast<long long>(n);
+
+        // merge of two sorted rows, counts when out is null
+        auto merge = [&](size_t row, size_t *out)
+        {
+            size_t count = 0;
+            size_t i = rowPtr[row], j = rowPtrT[row];
+            while (i < rowPtr[row + 1] || j < rowPtrT[row + 1])
+            {
+                size_t left = i < rowPtr[row + 1] ? static_cast<size_t>(colIndices[i]) : n;
+                size_t right = j < rowPtrT[row + 1] ? static_cast<size_t>(colIndicesT[j]) : n;
+                size_t col = std::min(left, right);
+                i += left == col;
+                j += right == col;
+                if (col != row)
+                {
+                    if (out != nullptr)
+                    {
+                        out[count] = col;
+                    }
+                    ++count;
+                }
+            }
+            return count;
+        };
+
+        adjacencyPtr.assign(n + 1, 0);
+#pragma omp parallel for schedule(dynamic, 256) if (csr.nnz() > 100000)
+        for (long long row = 0; row < rows; ++row)
+        {
+            adjacencyPtr[row + 1] = merge(row, nullptr);
+        }
+        for (size_t row = 0; row < n; ++row)
+        {
+            adjacencyPtr[row + 1] += adjacencyPtr[row];
+        }
+
+        adjacency.resize(adjacencyPtr.back());
+#pragma omp parallel for schedule(dynamic, 256) if (csr.nnz() > 100000)
+        for (long long row = 0; row < rows; ++row)
+        {
+            merge(row, adjacency.data() + adjacencyPtr[row]);
+        }
+    }
+
+    /*
+    George and Liu's pseudo-peripheral vertex: search breadth first from start, move to the vertex of smallest degree
+    on the last level, and repeat while the number of levels grows. levels is scratch of n entries, all unset.
+    */
+    inline size_t _peripheralVertex(size_t start, const std::vector<size_t> &adjacencyPtr,
+                                    const std::vector<size_t> &adjacency, std::vector<size_t> &levels)
+    {
+        constexpr size_t unset = static_cast<size_t>(-1);
+        std::vector<size_t> queue;
+        size_t root = start;
+        size_t depth = 0;
+        while (true)
+        {
+            queue.assign(1, root);
+            levels[root] = 0;
+            for (size_t head = 0; head < queue.size(); ++head)
+            {
+                size_t vertex = queue[head];
+                for (size_t i = adjacencyPtr[vertex]; i < adjacencyPtr[vertex + 1]; ++i)
+                {
+                    if (levels[adjacency[i]] == unset)
+                    {
+                        levels[adjacency[i]] = levels[vertex] + 1;
+                        queue.push_back(adjacency[i]);
+                    }
+                }
+            }
+
+            size_t lastLevel = levels[queue.back()];
+            size_t next = queue.back();
+            for (size_t i = queue.size(); i > 0 && levels[queue[i - 1]] == lastLevel; --i)
+            {
+                size_t vertex = queue[i - 1];
+                if (adjacencyPtr[vertex + 1] - adjacencyPtr[vertex] <= adjacencyPtr[next + 1] - adjacencyPtr[next])
+                {
+                    next = vertex;
+                }
+            }
+            for (size_t vertex : queue)
+            {
+                levels[vertex] = unset;
+            }
+
+            // stop once the number of levels no longer grows
+            if (lastLevel == 0 || (root != start && lastLevel <= depth))
+            {
+                return root;
+            }
+            depth = lastLevel;
+            root = next;
+        }
+    }
+
+    // rows of a square matrix, throws for anything else
+    template <typename T, typename Index>
+    size_t _squareSize(const CSR<T, Index> &csr)
+    {
+        const auto &shape = csr.getShape();
+        if (shape.size() != 2 || shape[0] != shape[1])
+        {
+            throw std::invalid_argument("Reordering needs a square matrix");
+        }
+        return shape[0];
+    }
+
+    // inverse of a permutation of 0 .. size - 1, throws if order is not one
+    inline std::vector<size_t> _inversePermutation(const std::vector<size_t> &order, size_t size)
+    {
+        constexpr size_t unset = static_cast<size_t>(-1);
+        std::vector<size_t> inverse(size, unset);
+        if (order.size() != size)
+        {
+            throw std::invalid_argument("Ordering is not a permutation of the rows");
+        }
+        for (size_t i = 0; i < size; ++i)
+        {
+            if (order[i] >= size || inverse[order[i]] != unset)
+            {
+                throw std::invalid_argument("Ordering is not a permutation of the rows");
+            }
+            inverse[order[i]] = i;
+        }
+        return inverse;
+    }
+
+    // row i of result is row from[i] of dense, or with scatter row from[i] of result is row i of dense
+    template <typename T>
+    void _permuteRows(const xt::xarray<T> &dense, const std::vector<size_t> &from, xt::xarray<T> &result, bool scatter)
+    {
+        if (dense.dimension() == 0 || dense.dimension() > 2 || dense.shape()[0] != from.size())
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
+
+        std::vector<size_t> shape(dense.shape().begin(), dense.shape().end());
+        if (!std::equal(shape.begin(), shape.end(), result.shape().begin(), result.shape().end()))
+        {
+            result.resize(shape);
+        }
+
+        size_t width = dense.dimension() == 2 ? shape[1] : 1;
+        const T *source = dense.data();
+        T *target = result.data();
+        long long rows = static_cast<long long>(from.size());
+#pragma omp parallel for schedule(static) if (dense.size() > 100000)
+        for (long long row = 0; row < rows; ++row)
+        {
+            const T *in = source + (scatter ? row : from[row]) * width;
+            T *out = target + (scatter ? from[row] : row) * width;
+            std::copy(in, in + width, out);
+        }
+    }
+}
+
+#endif // CSR_REORDER_IMPL_HPP
@@ -0,0 +1,248 @@
+#ifndef CSR_SPGEMM_HPP
+#define CSR_SPGEMM_HPP
+
+#include "csr_adt.hpp"
+#include "stats.hpp"
+#include <optional>
+#include <utility>
+#include <vector>
+
+/*
+Gustavson row-by-row sparse matrix multiplication.
+Row i of C = A * B is the sum of the rows of B selected by the nonzeros of row i of A, so each
+output row is built in an accumulator and written out sorted. The product runs in two phases:
+a symbolic phase counting the distinct columns of every output row, which sizes the result exactly,
+and a numeric phase writing the values straight into their final positions.
+
+Batched products [..., M, K] x [..., K, N] are one product over all output rows: every output row knows the
+row of A and the batch of B it reads, so broadcast batches are shared by offset instead of copied, and the
+batches are scheduled together with the rows.
+
+With OpenMP both phases run in parallel over chunks of rows holding equal numbers of flops, so a few
+heavy rows do not serialize the product. Every row owns a fixed slice of the result, which keeps the
+output identical regardless of the thread count.
+
+Products are summed in an accumulator type that may be wider than the stored values, see AccumulatorType, and
+every entry is rounded to the storage type once, when its row is written out.
+*/
+
+// Accumulator over the full column range, best for rows that touch a large share of the columns
+template <typename T>
+class DenseAccumulator
+{
+private:
+    std::vector<T> values;      // running sums, indexed by column
+    std::vector<size_t> stamps; // row stamp of the last write to each column, avoids clearing between rows
+    size_t stamp = 0;
+
+public:
+    explicit DenseAccumulator(size_t cols);
+
+    // start a new output row
+    void nextRow();
+
+    // symbolic phase, returns true if the column is new for this row
+    bool insert(size_t col);
+
+    // numeric phase, returns true if the column is new for this row
+    bool accumulate(size_t col, T value);
+
+    // read the sum of a column inserted in this row
+    T get(size_t col) const;
+};
+
+// Open addressing accumulator sized by the row's flops, best for rows that touch few columns
+template <typename T>
+class HashAccumulator
+{
+private:
+    std::vector<size_t> keys; // column stored in each slot, emptyKey if free
+    std::vector<T> values;    // running sums of each slot
+    std::vector<size_t> used; // occupied slots, in insertion order
+    size_t shift = 64;
+#ifdef SPARSE_OPS_STATS
+    size_t probes = 0; // slots visited past the home slot of a column, over the lifetime of the accumulator
+#endif
+
+    static constexpr size_t emptyKey = static_cast<size_t>(-1);
+
+    size_t slotOf(size_t col) const;
+
+public:
+    // clear the table and size it for at most maxEntries distinct columns
+    void reset(size_t maxEntries);
+
+    // symbolic phase, returns true if the column is new for this row
+    bool insert(size_t col);
+
+    // numeric phase, returns true if the column is new for this row
+    bool accumulate(size_t col, T value);
+
+    // number of distinct columns in this row
+    size_t size() const;
+
+    // probes past the home slot since construction, always 0 unless SPARSE_OPS_STATS is defined
+    size_t collisions() const;
+
+    // write the (column, value) pairs of this row sorted by column, values converted to Out
+    template <typename Index, typename Out>
+    void extractSorted(Index *cols, Out *out, std::vector<std::pair<size_t, T>> &scratch) const;
+};
+
+/*
+Split of a batched product [..., M, K] x [..., K, N] into 2-D problems. Output batch b multiplies batch aBatch[b]
+of A with batch bBatch[b] of B, both given as flat indices over the leading dimensions.
+Products where B has no batch dimensions collapse to a single batch holding all the rows of A.
+*/
+struct BatchLayout
+{
+    size_t rowsPerBatch = 0;   // M, rows of a batch of A and of the result
+    size_t innerPerBatch = 0;  // K, rows of a batch of B
+    std::vector<size_t> aBatch;
+    std::vector<size_t> bBatch;
+    bool broadcast = false;    // some batch of an operand is reused by several output batches
+
+    // rows of the result
+    size_t rows() const;
+
+    // row of A and first row of the batch of B read by an output row
+    size_t aRow(size_t row) const;
+    size_t bOffset(size_t row) const;
+};
+
+// Scratch state of one thread of the multiplication
+template <typename T>
+struct SpGEMMWorkspace
+{
+    std::optional<DenseAccumulator<T>> dense; // only built once a row needs it
+    HashAccumulator<T> hash;
+    std::vector<std::pair<size_t, T>> scratch;
+
+    // masked products, the mask row is stamped over the columns and sums holds one slot per mask entry
+    std::vector<size_t> maskStamps;
+    std::vector<size_t> maskSlots;
+    std::vector<T> maskSums;
+    std::vector<char> maskHits;
+    size_t maskStamp = 0;
+
+    DenseAccumulator<T> &denseFor(size_t cols);
+};
+
+// pruning applied inside the accumulator to every output row of a product, before the row is written
+struct PruneOptions
+{
+    double dropTolerance = 0.0; // entries with a magnitude below this are dropped
+    bool relative = false;      // dropTolerance is a fraction of the largest magnitude of the row
+    size_t topK = 0;            // keep at most this many entries per row, the largest in magnitude, 0 keeps all
+};
+
+// which entries of a product a mask keeps
+enum class MaskMode
+{
+    Structural, // only the positions stored in the mask
+    Complement  // only the positions missing from the mask
+};
+
+/*
+Product of two fixed sparsity patterns whose values change between calls, like the operators of an iterative solver.
+The constructor runs the symbolic phase once and keeps the output pattern together with a scatter map, the slot of
+every multiply add inside its output row. execute then only streams the values of A and B through the map, with no
+accumulator, no hashing and no allocation: every output row is cleared and summed into in place. Values narrower
+than their accumulator, like bfloat16, are summed in per thread rows of wide scratch sized by the constructor, so
+calls on one plan must not overlap. The map costs one Index per multiply add of the product.
+*/
+template <typename T, typename Index = size_t>
+class SpGEMMPlan
+{
+private:
+    BatchLayout layout;
+    std::vector<size_t> shapeA, shapeB;
+    std::vector<size_t> plannedRowPtrA, plannedRowPtrB; // operand patterns, the scatter is only valid for them
+    std::vector<Index> plannedColsA, plannedColsB;
+    std::vector<size_t> scatterPtr; // first scatter entry of every output row
+    std::vector<Index> scatter;     // slot of every multiply add in its output row, in the order execute visits them
+    std::vector<size_t> bounds;     // chunks of rows holding equal numbers of multiply adds
+    bool parallel = false;
+    CSR<T, Index> result;           // output pattern, values rewritten by every execute
+    size_t numThreads = 1;          // threads execute runs on, the ones the scratch was sized for
+    size_t sumsStride = 0;          // longest output row when T is narrower than its accumulator, else 0
+    mutable std::vector<AccumulatorType<void, T>> sums; // one row of wide sums per thread
+
+    // throws unless the operands have the planned shapes and patterns
+    void checkOperands(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2) const;
+
+public:
+    // symbolic phase of csr1 * csr2, with the batching rules of CSRMult
+    SpGEMMPlan(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2);
+
+    // numeric phase for operands with the planned patterns, the returned product is overwritten by the next call
+    const CSR<T, Index> &execute(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2);
+
+    // numeric phase into a product holding the planned pattern, like a copy of getResult()
+    void execute(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, CSR<T, Index> &product) const;
+
+    // Accessors
+    const CSR<T, Index> &getResult() const;
+    size_t flops() const;
+};
+
+namespace
+{
+    // helper functions
+    inline bool _batchLayout(const std::vector<size_t> &shapeA, const std::vector<size_t> &shapeB, size_t rowsA,
+                             BatchLayout &layout, std::vector<size_t> &resultShape);
+
+    template <typename T, typename Index>
+    std::vector<size_t> _rowFlops(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, const BatchLayout &layout);
+
+    template <typename T, typename Index>
+    std::vector<size_t> _rowFlops(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2);
+
+    inline std::vector<size_t> _partitionByWork(const std::vector<size_t> &work, size_t numChunks);
+
+    inline std::vector<size_t> _flopChunks(const std::vector<size_t> &flops, bool &parallel);
+
+    template <typename T, typename Index>
+    void _recordProductStats(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, const std::vector<size_t> &flops,
+                             size_t nnzOut);
+
+    inline bool _useDenseAccumulator(size_t flops, size_t cols);
+
+    template <typename T, typename Index, typename Acc>
+    size_t _symbolicRow(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, size_t aRow, size_t bOffset, size_t flops,
+                        SpGEMMWorkspace<Acc> &workspace);
+
+    template <typename T, typename Index, typename Acc>
+    size_t _numericRow(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, size_t aRow, size_t bOffset, size_t flops,
+                       Index *rowCols, T *rowValues, SpGEMMWorkspace<Acc> &workspace);
+
+    template <typename T, typename Index>
+    size_t _pruneRow(Index *rowCols, T *rowValues, size_t count, const PruneOptions &prune, std::vector<double> &magnitudes);
+
+    template <typename T, typename Index>
+    CSR<T, Index> _prunedMultiply(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, std::vector<size_t> resultShape,
+                                  const BatchLayout &layout, const PruneOptions &prune);
+
+    template <typename Acc, typename T, typename Index>
+    CSR<T, Index> _gustavsonMultiply(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, std::vector<size_t> resultShape,
+                              const BatchLayout &layout);
+
+    template <typename T, typename MaskIndex>
+    void _stampMaskRow(const MaskIndex *maskCols, size_t maskLength, size_t cols, SpGEMMWorkspace<T> &workspace);
+
+    template <typename T, typename Index, typename MaskIndex, typename Acc>
+    size_t _maskedGustavsonRow(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, size_t aRow, size_t bOffset,
+                               size_t flops, const MaskIndex *maskCols, size_t maskLength, MaskMode mode, Index *rowCols,
+                               T *rowValues, SpGEMMWorkspace<Acc> &workspace);
+
+    template <typename Acc, typename T, typename Index, typename MaskIndex>
+    size_t _maskedDotRow(const CSR<T, Index> &csr1, const CSR<T, Index> &columnsB, size_t aRow, size_t columnOffset,
+                         const MaskIndex *maskCols, size_t maskLength, Index *rowCols, T *rowValues);
+
+    template <typename T, typename Index>
+    CSR<T, Index> _plannedProduct(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, BatchLayout &layout);
+}
+
+#include "csr_spgemm_impl.hpp"
+
+#endif // CSR_SPGEMM_HPP
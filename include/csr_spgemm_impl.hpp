@@ -0,0 +1,1053 @@
+#ifndef CSR_SPGEMM_IMPL_HPP
+#define CSR_SPGEMM_IMPL_HPP
+
+#include "csr_spgemm.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// DenseAccumulator
+template <typename T>
+DenseAccumulator<T>::DenseAccumulator(size_t cols) : values(cols, T(0)), stamps(cols, 0)
+{
+}
+
+template <typename T>
+void DenseAccumulator<T>::nextRow()
+{
+    ++stamp;
+}
+
+template <typename T>
+bool DenseAccumulator<T>::insert(size_t col)
+{
+    if (stamps[col] == stamp)
+    {
+        return false;
+    }
+    stamps[col] = stamp;
+    return true;
+}
+
+template <typename T>
+bool DenseAccumulator<T>::accumulate(size_t col, T value)
+{
+    if (stamps[col] == stamp)
+    {
+        values[col] += value;
+        return false;
+    }
+    stamps[col] = stamp;
+    values[col] = value;
+    return true;
+}
+
+template <typename T>
+T DenseAccumulator<T>::get(size_t col) const
+{
+    return values[col];
+}
+
+// HashAccumulator
+template <typename T>
+size_t HashAccumulator<T>::slotOf(size_t col) const
+{
+    // Fibonacci hashing, the high bits of the product are well mixed even for consecutive columns
+    return static_cast<size_t>((static_cast<unsigned long long>(col) * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+template <typename T>
+void HashAccumulator<T>::reset(size_t maxEntries)
+{
+    // load factor of at most one half
+    size_t bits = 1;
+    while ((size_t(1) << bits) < 2 * maxEntries)
+    {
+        ++bits;
+    }
+
+    if (keys.size() != (size_t(1) << bits))
+    {
+        keys.assign(size_t(1) << bits, emptyKey);
+        values.assign(size_t(1) << bits, T(0));
+    }
+    else
+    {
+        for (size_t slot : used)
+        {
+            keys[slot] = emptyKey;
+        }
+    }
+    used.clear();
+    shift = 64 - bits;
+}
+
+template <typename T>
+bool HashAccumulator<T>::insert(size_t col)
+{
+    size_t mask = keys.size() - 1;
+    for (size_t slot = slotOf(col);; slot = (slot + 1) & mask)
+    {
+        if (keys[slot] == col)
+        {
+            return false;
+        }
+        if (keys[slot] == emptyKey)
+        {
+            keys[slot] = col;
+            used.push_back(slot);
+            return true;
+        }
+#ifdef SPARSE_OPS_STATS
+        ++probes;
+#endif
+    }
+}
+
+template <typename T>
+bool HashAccumulator<T>::accumulate(size_t col, T value)
+{
+    size_t mask = keys.size() - 1;
+    for (size_t slot = slotOf(col);; slot = (slot + 1) & mask)
+    {
+        if (keys[slot] == col)
+        {
+            values[slot] += value;
+            return false;
+        }
+        if (keys[slot] == emptyKey)
+        {
+            keys[slot] = col;
+            values[slot] = value;
+            used.push_back(slot);
+            return true;
+        }
+#ifdef SPARSE_OPS_STATS
+        ++probes;
+#endif
+    }
+}
+
+template <typename T>
+size_t HashAccumulator<T>::size() const
+{
+    return used.size();
+}
+
+template <typename T>
+size_t HashAccumulator<T>::collisions() const
+{
+#ifdef SPARSE_OPS_STATS
+    return probes;
+#else
+    return 0;
+#endif
+}
+
+template <typename T>
+template <typename Index, typename Out>
+void HashAccumulator<T>::extractSorted(Index *cols, Out *out, std::vector<std::pair<size_t, T>> &scratch) const
+{
+    scratch.clear();
+    for (size_t slot : used)
+    {
+        scratch.emplace_back(keys[slot], values[slot]);
+    }
+    std::sort(scratch.begin(), scratch.end(), [](const auto &lhs, const auto &rhs)
+              { return lhs.first < rhs.first; });
+    for (size_t i = 0; i < scratch.size(); ++i)
+    {
+        cols[i] = static_cast<Index>(scratch[i].first);
+        out[i] = static_cast<Out>(scratch[i].second);
+    }
+}
+
+// BatchLayout
+inline size_t BatchLayout::rows() const
+{
+    return aBatch.size() * rowsPerBatch;
+}
+
+inline size_t BatchLayout::aRow(size_t row) const
+{
+    return aBatch[row / rowsPerBatch] * rowsPerBatch + row % rowsPerBatch;
+}
+
+inline size_t BatchLayout::bOffset(size_t row) const
+{
+    return bBatch[row / rowsPerBatch] * innerPerBatch;
+}
+
+// SpGEMMWorkspace
+template <typename T>
+DenseAccumulator<T> &SpGEMMWorkspace<T>::denseFor(size_t cols)
+{
+    if (!dense)
+    {
+        dense.emplace(cols);
+    }
+    return *dense;
+}
+
+// SpGEMMPlan
+template <typename T, typename Index>
+SpGEMMPlan<T, Index>::SpGEMMPlan(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2)
+    : shapeA(csr1.getShape()), shapeB(csr2.getShape()), plannedRowPtrA(csr1.getRowPtr().begin(), csr1.getRowPtr().end()),
+      plannedRowPtrB(csr2.getRowPtr().begin(), csr2.getRowPtr().end()),
+      plannedColsA(csr1.getColIndices().begin(), csr1.getColIndices().end()),
+      plannedColsB(csr2.getColIndices().begin(), csr2.getColIndices().end()), result(_plannedProduct(csr1, csr2, layout))
+{
+    std::vector<size_t> flops = _rowFlops(csr1, csr2, layout);
+    size_t numRows = flops.size();
+    scatterPtr.assign(numRows + 1, 0);
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        scatterPtr[row + 1] = scatterPtr[row] + flops[row];
+    }
+    bounds = _flopChunks(flops, parallel);
+#ifdef _OPENMP
+    numThreads = parallel ? static_cast<size_t>(omp_get_max_threads()) : 1;
+#endif
+
+    // slot of every multiply add, found by binary search in the sorted output row
+    const auto &rowPtrA = csr1.getRowPtr();
+    const auto &colIndicesA = csr1.getColIndices();
+    const auto &rowPtrB = csr2.getRowPtr();
+    const auto &colIndicesB = csr2.getColIndices();
+    const auto &resultRowPtr = result.getRowPtr();
+    const Index *resultCols = result.getColIndices().data();
+
+    scatter.resize(scatterPtr.back());
+    long long rowCount = static_cast<long long>(numRows);
+#pragma omp parallel for schedule(dynamic, 256) if (parallel)
+    for (long long row = 0; row < rowCount; ++row)
+    {
+        size_t aRow = layout.aRow(row);
+        size_t bOffset = layout.bOffset(row);
+        const Index *first = resultCols + resultRowPtr[row];
+        const Index *last = resultCols + resultRowPtr[row + 1];
+        Index *slot = scatter.data() + scatterPtr[row];
+        for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+        {
+            size_t k = bOffset + colIndicesA[i];
+            for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+            {
+                *slot++ = static_cast<Index>(std::lower_bound(first, last, colIndicesB[j]) - first);
+            }
+        }
+    }
+
+    if constexpr (!std::is_same_v<AccumulatorType<void, T>, T>)
+    {
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            sumsStride = std::max(sumsStride, resultRowPtr[row + 1] - resultRowPtr[row]);
+        }
+        sums.assign(numThreads * sumsStride, AccumulatorType<void, T>(0));
+    }
+}
+
+template <typename T, typename Index>
+void SpGEMMPlan<T, Index>::checkOperands(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2) const
+{
+    // same nonzero count with another pattern would scatter into the wrong slots, or past the end of a row
+    auto samePattern = [](const CSR<T, Index> &csr, const std::vector<size_t> &rowPtr, const std::vector<Index> &colIndices)
+    {
+        return std::equal(rowPtr.begin(), rowPtr.end(), csr.getRowPtr().begin(), csr.getRowPtr().end()) &&
+               std::equal(colIndices.begin(), colIndices.end(), csr.getColIndices().begin(), csr.getColIndices().end());
+    };
+    if (csr1.getShape() != shapeA || csr2.getShape() != shapeB || !samePattern(csr1, plannedRowPtrA, plannedColsA) ||
+        !samePattern(csr2, plannedRowPtrB, plannedColsB))
+    {
+        throw std::invalid_argument("Tensors do not have the patterns of the plan");
+    }
+}
+
+template <typename T, typename Index>
+const CSR<T, Index> &SpGEMMPlan<T, Index>::execute(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2)
+{
+    execute(csr1, csr2, result);
+    return result;
+}
+
+template <typename T, typename Index>
+void SpGEMMPlan<T, Index>::execute(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, CSR<T, Index> &product) const
+{
+    checkOperands(csr1, csr2);
+    if (&product != &result &&
+        (product.getShape() != result.getShape() ||
+         !std::equal(result.getRowPtr().begin(), result.getRowPtr().end(), product.getRowPtr().begin(),
+                     product.getRowPtr().end()) ||
+         !std::equal(result.getColIndices().begin(), result.getColIndices().end(), product.getColIndices().begin(),
+                     product.getColIndices().end())))
+    {
+        throw std::invalid_argument("Result does not have the pattern of the plan");
+    }
+
+    const auto &rowPtrA = csr1.getRowPtr();
+    const auto &colIndicesA = csr1.getColIndices();
+    const auto &valuesA = csr1.getValues();
+    const auto &rowPtrB = csr2.getRowPtr();
+    const auto &valuesB = csr2.getValues();
+    const auto &resultRowPtr = result.getRowPtr();
+    T *resultValues = product.getMutableValues().mutableData();
+
+    long long chunkCount = static_cast<long long>(bounds.size() - 1);
+    using Acc = AccumulatorType<void, T>;
+    if constexpr (std::is_same_v<Acc, T>)
+    {
+#pragma omp parallel for schedule(dynamic, 1) if (parallel)
+        for (long long chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            for (size_t row = bounds[chunk]; row < bounds[chunk + 1]; ++row)
+            {
+                T *rowValues = resultValues + resultRowPtr[row];
+                std::fill(rowValues, resultValues + resultRowPtr[row + 1], T(0));
+
+                size_t aRow = layout.aRow(row);
+                size_t bOffset = layout.bOffset(row);
+                const Index *slot = scatter.data() + scatterPtr[row];
+                for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+                {
+                    size_t k = bOffset + colIndicesA[i];
+                    T a = valuesA[i];
+                    for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+                    {
+                        rowValues[*slot++] += a * valuesB[j];
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        // narrow storage, every row is summed in the wide scratch row of its thread and rounded once
+#pragma omp parallel num_threads(numThreads) if (parallel)
+        {
+            size_t thread = 0;
+#ifdef _OPENMP
+            thread = static_cast<size_t>(omp_get_thread_num());
+#endif
+            Acc *rowSums = sums.data() + thread * sumsStride;
+#pragma omp for schedule(dynamic, 1)
+            for (long long chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                for (size_t row = bounds[chunk]; row < bounds[chunk + 1]; ++row)
+                {
+                    size_t length = resultRowPtr[row + 1] - resultRowPtr[row];
+                    std::fill(rowSums, rowSums + length, Acc(0));
+
+                    size_t aRow = layout.aRow(row);
+                    size_t bOffset = layout.bOffset(row);
+                    const Index *slot = scatter.data() + scatterPtr[row];
+                    for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+                    {
+                        size_t k = bOffset + colIndicesA[i];
+                        Acc a = static_cast<Acc>(valuesA[i]);
+                        for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+                        {
+                            rowSums[*slot++] += a * static_cast<Acc>(valuesB[j]);
+                        }
+                    }
+
+                    T *rowValues = resultValues + resultRowPtr[row];
+                    for (size_t p = 0; p < length; ++p)
+                    {
+                        rowValues[p] = static_cast<T>(rowSums[p]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename T, typename Index>
+const CSR<T, Index> &SpGEMMPlan<T, Index>::getResult() const
+{
+    return result;
+}
+
+template <typename T, typename Index>
+size_t SpGEMMPlan<T, Index>::flops() const
+{
+    return scatter.size();
+}
+
+namespace
+{
+    /*
+    Matmul semantics over the leading batch dimensions, which broadcast like numpy: aligned from the right, each pair
+    equal or one of them 1. A vector A of shape (K) acts as a single row and that dimension is dropped from the result.
+    */
+    inline bool _batchLayout(const std::vector<size_t> &shapeA, const std::vector<size_t> &shapeB, size_t rowsA,
+                             BatchLayout &layout, std::vector<size_t> &resultShape)
+    {
+        // Ensure valid dimensions, the last dimension of A is contracted with the second to last of B
+        if (shapeA.empty() || shapeB.size() < 2 || shapeA.back() != shapeB[shapeB.size() - 2])
+        {
+            return false;
+        }
+
+        size_t rankA = shapeA.size();
+        size_t rankB = shapeB.size();
+        size_t batchRankA = rankA >= 2 ? rankA - 2 : 0;
+        size_t batchRankB = rankB - 2;
+        size_t batchRank = std::max(batchRankA, batchRankB);
+
+        // broadcast batch dimensions and the batch strides of both operands, 0 where an operand is broadcast
+        std::vector<size_t> batchShape(batchRank), stridesA(batchRank, 0), stridesB(batchRank, 0);
+        size_t strideA = 1, strideB = 1;
+        for (size_t i = batchRank; i > 0; --i)
+        {
+            size_t dim = i - 1;
+            size_t extentA = dim + batchRankA >= batchRank ? shapeA[dim + batchRankA - batchRank] : 1;
+            size_t extentB = dim + batchRankB >= batchRank ? shapeB[dim + batchRankB - batchRank] : 1;
+            if (extentA != extentB && extentA != 1 && extentB != 1)
+            {
+                return false;
+            }
+
+            batchShape[dim] = extentA == 1 ? extentB : extentA;
+            stridesA[dim] = extentA == 1 ? 0 : strideA;
+            stridesB[dim] = extentB == 1 ? 0 : strideB;
+            strideA *= extentA;
+            strideB *= extentB;
+            layout.broadcast = layout.broadcast || extentA != extentB;
+        }
+
+        resultShape = batchShape;
+        if (rankA >= 2)
+        {
+            resultShape.push_back(shapeA[rankA - 2]);
+        }
+        resultShape.push_back(shapeB.back());
+
+        layout.innerPerBatch = shapeA.back();
+        layout.aBatch.clear();
+        layout.bBatch.clear();
+
+        // B without batches, every row of A is one problem against the same B
+        if (strideB == 1)
+        {
+            layout.rowsPerBatch = rowsA;
+            layout.aBatch.push_back(0);
+            layout.bBatch.push_back(0);
+            return true;
+        }
+
+        // enumerate the output batches with an odometer over the broadcast batch shape
+        size_t numBatches = 1;
+        for (size_t extent : batchShape)
+        {
+            numBatches *= extent;
+        }
+        layout.rowsPerBatch = rankA >= 2 ? shapeA[rankA - 2] : 1;
+        layout.aBatch.reserve(numBatches);
+        layout.bBatch.reserve(numBatches);
+
+        std::vector<size_t> index(batchRank, 0);
+        size_t indexA = 0, indexB = 0;
+        for (size_t batch = 0; batch < numBatches; ++batch)
+        {
+            layout.aBatch.push_back(indexA);
+            layout.bBatch.push_back(indexB);
+            for (size_t dim = batchRank; dim > 0; --dim)
+            {
+                size_t d = dim - 1;
+                indexA += stridesA[d];
+                indexB += stridesB[d];
+                if (++index[d] < batchShape[d])
+                {
+                    break;
+                }
+                indexA -= stridesA[d] * batchShape[d];
+                indexB -= stridesB[d] * batchShape[d];
+                index[d] = 0;
+            }
+        }
+        return true;
+    }
+
+    // Upper bound on the entries of every output row, the number of multiply adds it needs
+    template <typename T, typename Index>
+    std::vector<size_t> _rowFlops(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, const BatchLayout &layout)
+    {
+        const auto &rowPtrA = csr1.getRowPtr();
+        const auto &colIndicesA = csr1.getColIndices();
+        const auto &rowPtrB = csr2.getRowPtr();
+
+        long long numRows = static_cast<long long>(layout.rows());
+        std::vector<size_t> flops(numRows, 0);
+#pragma omp parallel for schedule(static) if (csr1.nnz() > 100000)
+        for (long long row = 0; row < numRows; ++row)
+        {
+            size_t aRow = layout.aRow(row);
+            size_t bOffset = layout.bOffset(row);
+            size_t count = 0;
+            for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+            {
+                size_t k = bOffset + colIndicesA[i];
+                count += rowPtrB[k + 1] - rowPtrB[k];
+            }
+            flops[row] = count;
+        }
+        return flops;
+    }
+
+    // Same for a plain (..., K) x (K, N) product
+    template <typename T, typename Index>
+    std::vector<size_t> _rowFlops(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2)
+    {
+        BatchLayout layout;
+        layout.rowsPerBatch = csr1.rows();
+        layout.innerPerBatch = csr2.rows();
+        layout.aBatch.push_back(0);
+        layout.bBatch.push_back(0);
+        return _rowFlops(csr1, csr2, layout);
+    }
+
+    /*
+    Split the rows into numChunks contiguous ranges of roughly equal total work.
+    Returns numChunks + 1 boundaries, chunk c covers rows [bounds[c], bounds[c + 1]).
+    A single row heavier than a chunk gets a chunk of its own.
+    */
+    inline std::vector<size_t> _partitionByWork(const std::vector<size_t> &work, size_t numChunks)
+    {
+        std::vector<size_t> prefix(work.size() + 1, 0);
+        for (size_t row = 0; row < work.size(); ++row)
+        {
+            prefix[row + 1] = prefix[row] + work[row] + 1; // +1 so that empty rows still cost something
+        }
+
+        std::vector<size_t> bounds(numChunks + 1, work.size());
+        bounds[0] = 0;
+        for (size_t chunk = 1; chunk < numChunks; ++chunk)
+        {
+            size_t target = prefix.back() / numChunks * chunk;
+            size_t row = std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin();
+            bounds[chunk] = std::max(bounds[chunk - 1], std::min(row, work.size()));
+        }
+        return bounds;
+    }
+
+    // Chunks of equal flops, several per thread so that dynamic scheduling can even out the rest
+    inline std::vector<size_t> _flopChunks(const std::vector<size_t> &flops, bool &parallel)
+    {
+        size_t totalFlops = 0;
+        for (size_t rowFlops : flops)
+        {
+            totalFlops += rowFlops;
+        }
+
+        size_t numThreads = 1;
+#ifdef _OPENMP
+        numThreads = static_cast<size_t>(omp_get_max_threads());
+#endif
+        parallel = numThreads > 1 && totalFlops > 50000;
+        size_t numChunks = parallel ? std::min(flops.size(), numThreads * 8) : 1;
+        return _partitionByWork(flops, std::max<size_t>(numChunks, 1));
+    }
+
+    /*
+    Counts of a Gustavson product for the stats of the current call, does nothing unless SPARSE_OPS_STATS is defined.
+    Bytes moved: both phases read the columns of A and of every row of B they touch, the numeric phase also reads
+    the values and writes the result.
+    */
+    template <typename T, typename Index>
+    void _recordProductStats([[maybe_unused]] const CSR<T, Index> &csr1, [[maybe_unused]] const CSR<T, Index> &csr2,
+                             [[maybe_unused]] const std::vector<size_t> &flops, [[maybe_unused]] size_t nnzOut)
+    {
+#ifdef SPARSE_OPS_STATS
+        size_t totalFlops = 0;
+        for (size_t rowFlops : flops)
+        {
+            totalFlops += rowFlops;
+        }
+        size_t entryBytes = sizeof(Index) + sizeof(T);
+        SPARSE_OPS_STATS_SET(nnzA, csr1.nnz());
+        SPARSE_OPS_STATS_SET(nnzB, csr2.nnz());
+        SPARSE_OPS_STATS_SET(nnzOut, nnzOut);
+        SPARSE_OPS_STATS_SET(flops, totalFlops);
+        SPARSE_OPS_STATS_ADD(bytesMoved, (csr1.nnz() + totalFlops) * (sizeof(Index) + entryBytes) +
+                                             nnzOut * entryBytes + (flops.size() + 1) * sizeof(size_t));
+#endif
+    }
+
+    /*
+    The dense accumulator costs one cache line per touched column and its footprint is the whole row of C,
+    the hash accumulator costs a probe per product but stays small. Rows whose products cover more than
+    1/16 of the columns are cheaper to accumulate densely.
+    */
+    inline bool _useDenseAccumulator(size_t flops, size_t cols)
+    {
+        return flops * 16 >= cols;
+    }
+
+    // Symbolic phase of one row, number of distinct columns of the output row
+    template <typename T, typename Index, typename Acc>
+    size_t _symbolicRow(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, size_t aRow, size_t bOffset, size_t flops,
+                        SpGEMMWorkspace<Acc> &workspace)
+    {
+        if (flops == 0)
+        {
+            return 0;
+        }
+
+        const auto &rowPtrA = csr1.getRowPtr();
+        const auto &colIndicesA = csr1.getColIndices();
+        const auto &rowPtrB = csr2.getRowPtr();
+        const auto &colIndicesB = csr2.getColIndices();
+
+        size_t count = 0;
+        if (_useDenseAccumulator(flops, csr2.cols()))
+        {
+            DenseAccumulator<Acc> &dense = workspace.denseFor(csr2.cols());
+            dense.nextRow();
+            for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+            {
+                size_t k = bOffset + colIndicesA[i];
+                for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+                {
+                    count += dense.insert(colIndicesB[j]);
+                }
+            }
+        }
+        else
+        {
+            workspace.hash.reset(flops);
+            for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+            {
+                size_t k = bOffset + colIndicesA[i];
+                for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+                {
+                    count += workspace.hash.insert(colIndicesB[j]);
+                }
+            }
+        }
+        return count;
+    }
+
+    // Numeric phase of one row, writes the sorted row into its slice of the result and returns its length
+    template <typename T, typename Index, typename Acc>
+    size_t _numericRow(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, size_t aRow, size_t bOffset, size_t flops,
+                       Index *rowCols, T *rowValues, SpGEMMWorkspace<Acc> &workspace)
+    {
+        if (flops == 0)
+        {
+            return 0;
+        }
+
+        const auto &rowPtrA = csr1.getRowPtr();
+        const auto &colIndicesA = csr1.getColIndices();
+        const auto &valuesA = csr1.getValues();
+        const auto &rowPtrB = csr2.getRowPtr();
+        const auto &colIndicesB = csr2.getColIndices();
+        const auto &valuesB = csr2.getValues();
+
+        if (_useDenseAccumulator(flops, csr2.cols()))
+        {
+            DenseAccumulator<Acc> &dense = workspace.denseFor(csr2.cols());
+            dense.nextRow();
+            size_t count = 0;
+            for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+            {
+                size_t k = bOffset + colIndicesA[i];
+                Acc a = static_cast<Acc>(valuesA[i]);
+                for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+                {
+                    if (dense.accumulate(colIndicesB[j], a * static_cast<Acc>(valuesB[j])))
+                    {
+                        rowCols[count++] = colIndicesB[j];
+                    }
+                }
+            }
+
+            std::sort(rowCols, rowCols + count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                rowValues[i] = static_cast<T>(dense.get(rowCols[i]));
+            }
+            return count;
+        }
+        else
+        {
+            HashAccumulator<Acc> &hash = workspace.hash;
+            hash.reset(flops);
+            for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+            {
+                size_t k = bOffset + colIndicesA[i];
+                Acc a = static_cast<Acc>(valuesA[i]);
+                for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+                {
+                    hash.accumulate(colIndicesB[j], a * static_cast<Acc>(valuesB[j]));
+                }
+            }
+            hash.extractSorted(rowCols, rowValues, workspace.scratch);
+            return hash.size();
+        }
+    }
+
+    /*
+    Prune a sorted output row in place and return its new length, the kept entries stay sorted by column.
+    The top k are found with a selection on the magnitudes, entries tied with the k-th largest magnitude are
+    kept from the left so the result does not depend on the order the row was accumulated in.
+    */
+    template <typename T, typename Index>
+    size_t _pruneRow(Index *rowCols, T *rowValues, size_t count, const PruneOptions &prune, std::vector<double> &magnitudes)
+    {
+        double threshold = prune.dropTolerance;
+        if (prune.relative)
+        {
+            double largest = 0.0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                largest = std::max(largest, static_cast<double>(std::abs(rowValues[i])));
+            }
+            threshold *= largest;
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (static_cast<double>(std::abs(rowValues[i])) >= threshold)
+            {
+                rowCols[kept] = rowCols[i];
+                rowValues[kept++] = rowValues[i];
+            }
+        }
+
+        if (prune.topK == 0 || kept <= prune.topK)
+        {
+            return kept;
+        }
+
+        magnitudes.resize(kept);
+        for (size_t i = 0; i < kept; ++i)
+        {
+            magnitudes[i] = static_cast<double>(std::abs(rowValues[i]));
+        }
+        std::nth_element(magnitudes.begin(), magnitudes.begin() + (prune.topK - 1), magnitudes.end(), std::greater<double>());
+        double kth = magnitudes[prune.topK - 1];
+        size_t above = 0;
+        for (size_t i = 0; i < kept; ++i)
+        {
+            above += static_cast<double>(std::abs(rowValues[i])) > kth;
+        }
+
+        size_t ties = prune.topK - above;
+        size_t top = 0;
+        for (size_t i = 0; i < kept; ++i)
+        {
+            double magnitude = static_cast<double>(std::abs(rowValues[i]));
+            if (magnitude > kth || (magnitude == kth && ties > 0))
+            {
+                ties -= magnitude == kth;
+                rowCols[top] = rowCols[i];
+                rowValues[top++] = rowValues[i];
+            }
+        }
+        return top;
+    }
+
+    template <typename Acc, typename T, typename Index>
+    CSR<T, Index> _gustavsonMultiply(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, std::vector<size_t> resultShape,
+                              const BatchLayout &layout)
+    {
+        size_t numRows = layout.rows();
+        SPARSE_OPS_STATS_PHASE(Symbolic);
+        std::vector<size_t> flops = _rowFlops(csr1, csr2, layout);
+
+        bool parallel = false;
+        std::vector<size_t> bounds = _flopChunks(flops, parallel);
+        long long chunkCount = static_cast<long long>(bounds.size() - 1);
+
+        // Symbolic phase, count the distinct columns of every output row
+        std::vector<size_t> resultRowPtr(numRows + 1, 0);
+#pragma omp parallel if (parallel)
+        {
+            SpGEMMWorkspace<Acc> workspace;
+#pragma omp for schedule(dynamic, 1)
+            for (long long chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                for (size_t row = bounds[chunk]; row < bounds[chunk + 1]; ++row)
+                {
+                    resultRowPtr[row + 1] = _symbolicRow(csr1, csr2, layout.aRow(row), layout.bOffset(row), flops[row], workspace);
+                }
+            }
+        }
+
+        SPARSE_OPS_STATS_END(Symbolic);
+
+        // Prefix sum gives every row its fixed slice of the result
+        SPARSE_OPS_STATS_PHASE(Assemble);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            resultRowPtr[row + 1] += resultRowPtr[row];
+        }
+
+        // Numeric phase, the result is allocated once and every row is written in place
+        std::vector<Index> resultColIndices(resultRowPtr.back());
+        std::vector<T> resultValues(resultRowPtr.back());
+        SPARSE_OPS_STATS_END(Assemble);
+
+        SPARSE_OPS_STATS_PHASE(Numeric);
+        SPARSE_OPS_STATS_THREADS(threadStats);
+#pragma omp parallel if (parallel)
+        {
+            SpGEMMWorkspace<Acc> workspace;
+#pragma omp for schedule(dynamic, 1)
+            for (long long chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                SPARSE_OPS_STATS_BUSY(threadStats);
+                for (size_t row = bounds[chunk]; row < bounds[chunk + 1]; ++row)
+                {
+                    _numericRow(csr1, csr2, layout.aRow(row), layout.bOffset(row), flops[row],
+                                resultColIndices.data() + resultRowPtr[row], resultValues.data() + resultRowPtr[row], workspace);
+                }
+            }
+            SPARSE_OPS_STATS_COLLISIONS(threadStats, workspace.hash.collisions());
+        }
+        SPARSE_OPS_STATS_END(Numeric);
+        SPARSE_OPS_STATS_REPORT(threadStats);
+        _recordProductStats(csr1, csr2, flops, resultRowPtr.back());
+
+        return CSR<T, Index>(std::move(resultShape), std::move(resultRowPtr), std::move(resultColIndices), std::move(resultValues));
+    }
+
+    // mark the columns of a mask row, maskSlots[col] is the position of col in the row
+    template <typename T, typename MaskIndex>
+    void _stampMaskRow(const MaskIndex *maskCols, size_t maskLength, size_t cols, SpGEMMWorkspace<T> &workspace)
+    {
+        if (workspace.maskStamps.size() != cols)
+        {
+            workspace.maskStamps.assign(cols, 0);
+            workspace.maskSlots.assign(cols, 0);
+            workspace.maskStamp = 0;
+        }
+        ++workspace.maskStamp;
+        for (size_t p = 0; p < maskLength; ++p)
+        {
+            workspace.maskStamps[maskCols[p]] = workspace.maskStamp;
+            workspace.maskSlots[maskCols[p]] = p;
+        }
+    }
+
+    /*
+    Gustavson row keeping only the products the mask allows. A structural row sums straight into one slot per
+    mask entry, so its footprint is the mask row and the output comes out in mask order, already sorted.
+    A complemented row accumulates the columns left out of the mask in the hash accumulator.
+    */
+    template <typename T, typename Index, typename MaskIndex, typename Acc>
+    size_t _maskedGustavsonRow(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, size_t aRow, size_t bOffset,
+                               size_t flops, const MaskIndex *maskCols, size_t maskLength, MaskMode mode, Index *rowCols,
+                               T *rowValues, SpGEMMWorkspace<Acc> &workspace)
+    {
+        if (flops == 0 || (mode == MaskMode::Structural && maskLength == 0))
+        {
+            return 0;
+        }
+
+        const auto &rowPtrA = csr1.getRowPtr();
+        const auto &colIndicesA = csr1.getColIndices();
+        const auto &valuesA = csr1.getValues();
+        const auto &rowPtrB = csr2.getRowPtr();
+        const auto &colIndicesB = csr2.getColIndices();
+        const auto &valuesB = csr2.getValues();
+
+        _stampMaskRow(maskCols, maskLength, csr2.cols(), workspace);
+        const size_t *stamps = workspace.maskStamps.data();
+        size_t stamp = workspace.maskStamp;
+
+        if (mode == MaskMode::Structural)
+        {
+            workspace.maskSums.assign(maskLength, Acc(0));
+            workspace.maskHits.assign(maskLength, 0);
+            for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+            {
+                size_t k = bOffset + colIndicesA[i];
+                Acc a = static_cast<Acc>(valuesA[i]);
+                for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+                {
+                    if (stamps[colIndicesB[j]] == stamp)
+                    {
+                        size_t slot = workspace.maskSlots[colIndicesB[j]];
+                        workspace.maskSums[slot] += a * static_cast<Acc>(valuesB[j]);
+                        workspace.maskHits[slot] = 1;
+                    }
+                }
+            }
+
+            size_t count = 0;
+            for (size_t p = 0; p < maskLength; ++p)
+            {
+                if (workspace.maskHits[p])
+                {
+                    rowCols[count] = static_cast<Index>(maskCols[p]);
+                    rowValues[count++] = static_cast<T>(workspace.maskSums[p]);
+                }
+            }
+            return count;
+        }
+
+        HashAccumulator<Acc> &hash = workspace.hash;
+        hash.reset(flops);
+        for (size_t i = rowPtrA[aRow]; i < rowPtrA[aRow + 1]; ++i)
+        {
+            size_t k = bOffset + colIndicesA[i];
+            Acc a = static_cast<Acc>(valuesA[i]);
+            for (size_t j = rowPtrB[k]; j < rowPtrB[k + 1]; ++j)
+            {
+                if (stamps[colIndicesB[j]] != stamp)
+                {
+                    hash.accumulate(colIndicesB[j], a * static_cast<Acc>(valuesB[j]));
+                }
+            }
+        }
+        hash.extractSorted(rowCols, rowValues, workspace.scratch);
+        return hash.size();
+    }
+
+    // structural row as one sparse dot product per mask entry, row aRow of A merged with a row of the transpose of B
+    template <typename Acc, typename T, typename Index, typename MaskIndex>
+    size_t _maskedDotRow(const CSR<T, Index> &csr1, const CSR<T, Index> &columnsB, size_t aRow, size_t columnOffset,
+                         const MaskIndex *maskCols, size_t maskLength, Index *rowCols, T *rowValues)
+    {
+        const auto &rowPtrA = csr1.getRowPtr();
+        const Index *colIndicesA = csr1.getColIndices().data();
+        const T *valuesA = csr1.getValues().data();
+        const auto &rowPtrB = columnsB.getRowPtr();
+        const Index *rowIndicesB = columnsB.getColIndices().data();
+        const T *valuesB = columnsB.getValues().data();
+
+        size_t count = 0;
+        for (size_t p = 0; p < maskLength; ++p)
+        {
+            size_t column = columnOffset + maskCols[p];
+            size_t i = rowPtrA[aRow], iEnd = rowPtrA[aRow + 1];
+            size_t j = rowPtrB[column], jEnd = rowPtrB[column + 1];
+            Acc sum = Acc(0);
+            bool hit = false;
+            while (i < iEnd && j < jEnd)
+            {
+                if (colIndicesA[i] < rowIndicesB[j])
+                {
+                    ++i;
+                }
+                else if (rowIndicesB[j] < colIndicesA[i])
+                {
+                    ++j;
+                }
+                else
+                {
+                    sum += static_cast<Acc>(valuesA[i++]) * static_cast<Acc>(valuesB[j++]);
+                    hit = true;
+                }
+            }
+            if (hit)
+            {
+                rowCols[count] = static_cast<Index>(maskCols[p]);
+                rowValues[count++] = static_cast<T>(sum);
+            }
+        }
+        return count;
+    }
+
+    /*
+    Product with pruning. The unpruned length of a row is never needed, so there is no symbolic phase: every row is
+    accumulated into per thread scratch sized by its flops, pruned, and appended to the output of its chunk.
+    The chunks are stitched together at the end, so the output only ever holds the entries that survive.
+    */
+    template <typename T, typename Index>
+    CSR<T, Index> _prunedMultiply(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, std::vector<size_t> resultShape,
+                                  const BatchLayout &layout, const PruneOptions &prune)
+    {
+        size_t numRows = layout.rows();
+        SPARSE_OPS_STATS_PHASE(Symbolic);
+        std::vector<size_t> flops = _rowFlops(csr1, csr2, layout);
+
+        bool parallel = false;
+        std::vector<size_t> bounds = _flopChunks(flops, parallel);
+        long long chunkCount = static_cast<long long>(bounds.size() - 1);
+
+        std::vector<std::vector<Index>> chunkCols(chunkCount);
+        std::vector<std::vector<T>> chunkValues(chunkCount);
+        std::vector<size_t> resultRowPtr(numRows + 1, 0);
+        SPARSE_OPS_STATS_END(Symbolic);
+
+        SPARSE_OPS_STATS_PHASE(Numeric);
+        SPARSE_OPS_STATS_THREADS(threadStats);
+#pragma omp parallel if (parallel)
+        {
+            SpGEMMWorkspace<AccumulatorType<void, T>> workspace;
+            std::vector<Index> rowCols;
+            std::vector<T> rowValues;
+            std::vector<double> magnitudes;
+#pragma omp for schedule(dynamic, 1)
+            for (long long chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                SPARSE_OPS_STATS_BUSY(threadStats);
+                for (size_t row = bounds[chunk]; row < bounds[chunk + 1]; ++row)
+                {
+                    if (rowCols.size() < flops[row])
+                    {
+                        rowCols.resize(flops[row]);
+                        rowValues.resize(flops[row]);
+                    }
+                    size_t count = _numericRow(csr1, csr2, layout.aRow(row), layout.bOffset(row), flops[row],
+                                               rowCols.data(), rowValues.data(), workspace);
+                    count = _pruneRow(rowCols.data(), rowValues.data(), count, prune, magnitudes);
+
+                    chunkCols[chunk].insert(chunkCols[chunk].end(), rowCols.begin(), rowCols.begin() + count);
+                    chunkValues[chunk].insert(chunkValues[chunk].end(), rowValues.begin(), rowValues.begin() + count);
+                    resultRowPtr[row + 1] = count;
+                }
+            }
+            SPARSE_OPS_STATS_COLLISIONS(threadStats, workspace.hash.collisions());
+        }
+        SPARSE_OPS_STATS_END(Numeric);
+        SPARSE_OPS_STATS_REPORT(threadStats);
+
+        SPARSE_OPS_STATS_PHASE(Assemble);
+        for (size_t row = 0; row < numRows; ++row)
+        {
+            resultRowPtr[row + 1] += resultRowPtr[row];
+        }
+
+        // Stitch, every chunk is a contiguous run of rows, released as soon as it is copied
+        std::vector<Index> resultColIndices(resultRowPtr.back());
+        std::vector<T> resultValues(resultRowPtr.back());
+#pragma omp parallel for schedule(dynamic, 1) if (parallel)
+        for (long long chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            size_t offset = resultRowPtr[bounds[chunk]];
+            std::copy(chunkCols[chunk].begin(), chunkCols[chunk].end(), resultColIndices.begin() + offset);
+            std::copy(chunkValues[chunk].begin(), chunkValues[chunk].end(), resultValues.begin() + offset);
+            std::vector<Index>().swap(chunkCols[chunk]);
+            std::vector<T>().swap(chunkValues[chunk]);
+        }
+        SPARSE_OPS_STATS_END(Assemble);
+        _recordProductStats(csr1, csr2, flops, resultRowPtr.back());
+
+        return CSR<T, Index>(std::move(resultShape), std::move(resultRowPtr), std::move(resultColIndices), std::move(resultValues));
+    }
+
+    // full product of the operands of a plan, layout is filled for the later numeric phases
+    template <typename T, typename Index>
+    CSR<T, Index> _plannedProduct(const CSR<T, Index> &csr1, const CSR<T, Index> &csr2, BatchLayout &layout)
+    {
+        std::vector<size_t> resultShape;
+        if (!_batchLayout(csr1.getShape(), csr2.getShape(), csr1.rows(), layout, resultShape))
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
+        return _gustavsonMultiply<AccumulatorType<void, T>>(csr1, csr2, std::move(resultShape), layout);
+    }
+}
+
+#endif // CSR_SPGEMM_IMPL_HPP
@@ -0,0 +1,114 @@
+#ifndef CSR_STREAM_HPP
+#define CSR_STREAM_HPP
+
+#include "csr_adt.hpp"
+#include "csr_io.hpp"
+#include "csr_operations.hpp"
+#include <string>
+#include <vector>
+
+/*
+Out of core products over binary CSR files, see csr_io.hpp. The left operand is read from its file in row panels of
+bounded size and every panel is multiplied on its own, row i of AB only needs row i of A and all of B. B stays
+resident, or memory mapped with LoadCSR, and the result goes to a CSR file panel by panel, so memory is bounded by B
+and a few panels instead of the operands and the product.
+*/
+
+// bytes of column indices, values and row offsets of A read per panel, unless the caller picks another size
+constexpr size_t defaultPanelBytes = size_t(64) << 20;
+
+// Reads a binary CSR file one panel of consecutive rows at a time, with plain reads instead of a mapping
+template <typename T, typename Index = size_t>
+class CSRPanelReader
+{
+private:
+    std::string path;
+    int fd = -1;
+    CSRFileHeader header;
+    std::vector<size_t> shape;
+    size_t panelBytes;
+    size_t nextRow = 0; // first row of the next panel
+
+public:
+    CSRPanelReader(std::string path, size_t panelBytes = defaultPanelBytes);
+    ~CSRPanelReader();
+
+    CSRPanelReader(const CSRPanelReader &) = delete;
+    CSRPanelReader &operator=(const CSRPanelReader &) = delete;
+
+    // the next rows of the file, as many as fit into panelBytes and at least one, shape (rows of the panel, cols)
+    CSR<T, Index> next();
+
+    // every row has been read
+    bool done() const;
+
+    // Accessors
+    const std::vector<size_t> &getShape() const;
+    size_t position() const; // first row of the next panel
+    size_t rows() const;
+    size_t cols() const;
+    size_t nnz() const;
+};
+
+/*
+Writes a binary CSR file from panels of consecutive rows. The row offsets and column indices go to their final place
+in the file as the panels arrive. The offset of the values depends on the final number of nonzeros, so they are
+spooled to path + ".values" and copied behind the indices by finish(). An unfinished file is removed.
+*/
+template <typename T, typename Index = size_t>
+class CSRPanelWriter
+{
+private:
+    std::string path;
+    std::string valuesPath;
+    std::vector<size_t> shape;
+    int fd = -1;
+    int valuesFd = -1;
+    uint64_t colIndicesOffset; // does not depend on the number of nonzeros
+    uint64_t rowPtrOffset;
+    size_t nextRow = 0;
+    size_t written = 0; // nonzeros written so far
+    bool finished = false;
+
+    void close();
+
+public:
+    // start a file for a tensor of the given shape, rows are the flattened leading dimensions
+    CSRPanelWriter(std::string path, std::vector<size_t> shape);
+    ~CSRPanelWriter();
+
+    CSRPanelWriter(const CSRPanelWriter &) = delete;
+    CSRPanelWriter &operator=(const CSRPanelWriter &) = delete;
+
+    // the next rows of the tensor, a 2-D panel with the columns of the tensor
+    void append(const CSR<T, Index> &panel);
+
+    // write the header and the values once every row has been appended
+    void finish();
+
+    // Accessors
+    size_t rowsWritten() const;
+    size_t nnz() const;
+};
+
+/*
+Product of the CSR file pathA [..., M, K] with csr2 (K, N), written to the CSR file resultPath [..., M, N].
+Panel k of A is multiplied while panel k + 1 is read and the product of panel k - 1 is written on their own threads,
+so reads and writes overlap the multiplications. At most two panels of A and two product panels are in memory.
+Acc is the accumulator type of the products, like for CSRMult.
+*/
+template <typename Acc = void, typename T, typename Index>
+void CSRMultFile(const std::string &pathA, const CSR<T, Index> &csr2, const std::string &resultPath,
+                 size_t panelBytes = defaultPanelBytes);
+
+namespace
+{
+    // helper functions
+    inline void _readAt(int fd, void *data, size_t bytes, uint64_t offset, const std::string &path);
+
+    inline void _writeAt(int fd, const void *data, size_t bytes, uint64_t offset, const std::string &path);
+}
+
+#include "csr_stream_impl.hpp"
+
+#endif // CSR_STREAM_HPP
@@ -0,0 +1,372 @@
+#ifndef CSR_STREAM_IMPL_HPP
+#define CSR_STREAM_IMPL_HPP
+
+#include "csr_stream.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <future>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// CSRPanelReader
+template <typename T, typename Index>
+CSRPanelReader<T, Index>::CSRPanelReader(std::string path, size_t panelBytes)
+    : path(std::move(path)), panelBytes(panelBytes)
+{
+    fd = ::open(this->path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot open " + this->path);
+    }
+
+    try
+    {
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < sizeof(CSRFileHeader))
+        {
+            throw std::runtime_error(this->path + " is not a CSR file");
+        }
+        _readAt(fd, &header, sizeof(header), 0, this->path);
+        _checkHeader<T, Index>(header, static_cast<uint64_t>(info.st_size), this->path);
+
+        std::vector<uint64_t> fileShape(header.rank);
+        _readAt(fd, fileShape.data(), fileShape.size() * sizeof(uint64_t), sizeof(header), this->path);
+        shape.assign(fileShape.begin(), fileShape.end());
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+}
+
+template <typename T, typename Index>
+CSRPanelReader<T, Index>::~CSRPanelReader()
+{
+    ::close(fd);
+}
+
+/*
+The row offsets are read in blocks ahead of the panel until the next row would overflow panelBytes, then the column
+indices and values of the panel are read with one call each. The offsets are rebased so the panel starts at 0.
+*/
+template <typename T, typename Index>
+CSR<T, Index> CSRPanelReader<T, Index>::next()
+{
+    if (done())
+    {
+        throw std::runtime_error("Every row of " + path + " has been read");
+    }
+
+    size_t first = nextRow;
+    size_t base;
+    _readAt(fd, &base, sizeof(base), header.rowPtrOffset + first * sizeof(size_t), path);
+
+    constexpr size_t blockRows = 8192;
+    std::vector<size_t> rowPtr(1, 0);
+    std::vector<size_t> block;
+    size_t end = first;
+    bool full = false;
+    while (!full && end < header.rows)
+    {
+        size_t count = std::min(blockRows, static_cast<size_t>(header.rows) - end);
+        block.resize(count);
+        _readAt(fd, block.data(), count * sizeof(size_t), header.rowPtrOffset + (end + 1) * sizeof(size_t), path);
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (block[i] < base + rowPtr.back() || block[i] > header.nnz)
+            {
+                throw std::runtime_error(path + " is truncated or corrupt");
+            }
+
+            size_t panelNnz = block[i] - base;
+            size_t panelRows = end + 1 - first;
+            if (panelRows > 1 && panelNnz * (sizeof(T) + sizeof(Index)) + panelRows * sizeof(size_t) > panelBytes)
+            {
+                full = true;
+                break;
+            }
+            rowPtr.push_back(panelNnz);
+            ++end;
+        }
+    }
+
+    size_t panelNnz = rowPtr.back();
+    std::vector<Index> colIndices(panelNnz);
+    std::vector<T> values(panelNnz);
+    _readAt(fd, colIndices.data(), panelNnz * sizeof(Index), header.colIndicesOffset + base * sizeof(Index), path);
+    _readAt(fd, values.data(), panelNnz * sizeof(T), header.valuesOffset + base * sizeof(T), path);
+    nextRow = end;
+
+    return CSR<T, Index>({end - first, cols()}, std::move(rowPtr), std::move(colIndices), std::move(values));
+}
+
+template <typename T, typename Index>
+bool CSRPanelReader<T, Index>::done() const
+{
+    return nextRow == header.rows;
+}
+
+template <typename T, typename Index>
+const std::vector<size_t> &CSRPanelReader<T, Index>::getShape() const
+{
+    return shape;
+}
+
+template <typename T, typename Index>
+size_t CSRPanelReader<T, Index>::position() const
+{
+    return nextRow;
+}
+
+template <typename T, typename Index>
+size_t CSRPanelReader<T, Index>::rows() const
+{
+    return header.rows;
+}
+
+template <typename T, typename Index>
+size_t CSRPanelReader<T, Index>::cols() const
+{
+    return CSR<T, Index>::colsOf(shape);
+}
+
+template <typename T, typename Index>
+size_t CSRPanelReader<T, Index>::nnz() const
+{
+    return header.nnz;
+}
+
+// CSRPanelWriter
+template <typename T, typename Index>
+CSRPanelWriter<T, Index>::CSRPanelWriter(std::string path, std::vector<size_t> shape)
+    : path(std::move(path)), shape(std::move(shape))
+{
+    if (this->shape.empty())
+    {
+        throw std::invalid_argument("CSR files hold tensors of at least one dimension");
+    }
+    if (CSR<T, Index>::colsOf(this->shape) > CSR<T, Index>::maxCols())
+    {
+        throw std::invalid_argument("Index type is too narrow for the columns of the tensor");
+    }
+
+    CSRFileHeader layout = _makeHeader(static_cast<uint32_t>(_valueTypeOf<T>()), sizeof(T), sizeof(Index),
+                                       static_cast<uint32_t>(this->shape.size()), CSR<T, Index>::rowsOf(this->shape), 0);
+    rowPtrOffset = layout.rowPtrOffset;
+    colIndicesOffset = layout.colIndicesOffset;
+
+    valuesPath = this->path + ".values";
+    fd = ::open(this->path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    valuesFd = ::open(valuesPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || valuesFd < 0)
+    {
+        close();
+        ::unlink(this->path.c_str());
+        ::unlink(valuesPath.c_str());
+        throw std::runtime_error("Cannot create " + this->path);
+    }
+}
+
+template <typename T, typename Index>
+CSRPanelWriter<T, Index>::~CSRPanelWriter()
+{
+    close();
+    if (!finished)
+    {
+        ::unlink(path.c_str());
+        ::unlink(valuesPath.c_str());
+    }
+}
+
+template <typename T, typename Index>
+void CSRPanelWriter<T, Index>::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    if (valuesFd >= 0)
+    {
+        ::close(valuesFd);
+        valuesFd = -1;
+    }
+}
+
+template <typename T, typename Index>
+void CSRPanelWriter<T, Index>::append(const CSR<T, Index> &panel)
+{
+    if (finished)
+    {
+        throw std::runtime_error(path + " has already been finished");
+    }
+    if (panel.getShape().size() != 2 || panel.cols() != CSR<T, Index>::colsOf(shape) ||
+        nextRow + panel.rows() > CSR<T, Index>::rowsOf(shape))
+    {
+        throw std::invalid_argument("Panel does not continue the rows of the tensor");
+    }
+
+    // offsets of the panel rows, shifted behind the nonzeros already written
+    std::vector<size_t> rowPtr(panel.getRowPtr().begin(), panel.getRowPtr().end() - 1);
+    for (size_t &offset : rowPtr)
+    {
+        offset += written;
+    }
+
+    _writeAt(fd, rowPtr.data(), rowPtr.size() * sizeof(size_t), rowPtrOffset + nextRow * sizeof(size_t), path);
+    _writeAt(fd, panel.getColIndices().data(), panel.nnz() * sizeof(Index), colIndicesOffset + written * sizeof(Index), path);
+    _writeAt(valuesFd, panel.getValues().data(), panel.nnz() * sizeof(T), written * sizeof(T), valuesPath);
+    nextRow += panel.rows();
+    written += panel.nnz();
+}
+
+template <typename T, typename Index>
+void CSRPanelWriter<T, Index>::finish()
+{
+    size_t rows = CSR<T, Index>::rowsOf(shape);
+    if (finished || nextRow != rows)
+    {
+        throw std::runtime_error("Not every row of " + path + " has been written");
+    }
+
+    CSRFileHeader header = _makeHeader(static_cast<uint32_t>(_valueTypeOf<T>()), sizeof(T), sizeof(Index),
+                                       static_cast<uint32_t>(shape.size()), rows, written);
+    _writeAt(fd, &written, sizeof(size_t), rowPtrOffset + rows * sizeof(size_t), path);
+
+    // values from the spool file to their offset, in blocks
+    std::vector<char> block(std::min<size_t>(size_t(8) << 20, std::max<size_t>(written * sizeof(T), 1)));
+    for (uint64_t copied = 0; copied < written * sizeof(T); copied += block.size())
+    {
+        size_t bytes = std::min<uint64_t>(block.size(), written * sizeof(T) - copied);
+        _readAt(valuesFd, block.data(), bytes, copied, valuesPath);
+        _writeAt(fd, block.data(), bytes, header.valuesOffset + copied, path);
+    }
+
+    // header last, a file cut short never looks complete, padding between the arrays reads as zeros
+    std::vector<uint64_t> fileShape(shape.begin(), shape.end());
+    _writeAt(fd, fileShape.data(), fileShape.size() * sizeof(uint64_t), sizeof(header), path);
+    _writeAt(fd, &header, sizeof(header), 0, path);
+    if (::ftruncate(fd, static_cast<off_t>(header.fileSize)) != 0)
+    {
+        throw std::runtime_error("Failed writing " + path);
+    }
+
+    close();
+    ::unlink(valuesPath.c_str());
+    finished = true;
+}
+
+template <typename T, typename Index>
+size_t CSRPanelWriter<T, Index>::rowsWritten() const
+{
+    return nextRow;
+}
+
+template <typename T, typename Index>
+size_t CSRPanelWriter<T, Index>::nnz() const
+{
+    return written;
+}
+
+// product of a CSR file with a resident matrix, one panel of rows at a time
+template <typename Acc, typename T, typename Index>
+void CSRMultFile(const std::string &pathA, const CSR<T, Index> &csr2, const std::string &resultPath, size_t panelBytes)
+{
+    SPARSE_OPS_STATS_CALL("CSRMultFile");
+    CSRPanelReader<T, Index> reader(pathA, panelBytes);
+    if (csr2.getShape().size() != 2 || reader.cols() != csr2.rows())
+    {
+        throw std::invalid_argument("Tensors are not compatible for multiplication");
+    }
+
+    std::vector<size_t> resultShape(reader.getShape());
+    resultShape.back() = csr2.cols();
+    CSRPanelWriter<T, Index> writer(resultPath, resultShape);
+
+    // only one read and one write are in flight, each waited for before the next one is started
+    auto read = [&reader]
+    {
+        return reader.next();
+    };
+    std::future<CSR<T, Index>> nextPanel;
+    std::future<void> pendingWrite;
+    if (!reader.done())
+    {
+        nextPanel = std::async(std::launch::async, read);
+    }
+
+    while (nextPanel.valid())
+    {
+        CSR<T, Index> panel = nextPanel.get();
+        if (!reader.done())
+        {
+            nextPanel = std::async(std::launch::async, read);
+        }
+
+        CSR<T, Index> product = CSRMult<Acc>(panel, csr2);
+        if (pendingWrite.valid())
+        {
+            pendingWrite.get();
+        }
+        pendingWrite = std::async(std::launch::async, [&writer, product = std::move(product)]
+                                  { writer.append(product); });
+    }
+
+    if (pendingWrite.valid())
+    {
+        pendingWrite.get();
+    }
+    writer.finish();
+}
+
+namespace
+{
+    // pread until every byte has arrived
+    inline void _readAt(int fd, void *data, size_t bytes, uint64_t offset, const std::string &path)
+    {
+        char *cursor = static_cast<char *>(data);
+        while (bytes > 0)
+        {
+            ssize_t count = ::pread(fd, cursor, bytes, static_cast<off_t>(offset));
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                throw std::runtime_error("Failed reading " + path);
+            }
+            cursor += count;
+            bytes -= static_cast<size_t>(count);
+            offset += static_cast<uint64_t>(count);
+        }
+    }
+
+    // pwrite until every byte has been written
+    inline void _writeAt(int fd, const void *data, size_t bytes, uint64_t offset, const std::string &path)
+    {
+        const char *cursor = static_cast<const char *>(data);
+        while (bytes > 0)
+        {
+            ssize_t count = ::pwrite(fd, cursor, bytes, static_cast<off_t>(offset));
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                throw std::runtime_error("Failed writing " + path);
+            }
+            cursor += count;
+            bytes -= static_cast<size_t>(count);
+            offset += static_cast<uint64_t>(count);
+        }
+    }
+}
+
+#endif // CSR_STREAM_IMPL_HPP
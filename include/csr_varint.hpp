@@ -0,0 +1,57 @@
+#ifndef CSR_VARINT_HPP
+#define CSR_VARINT_HPP
+
+#include "csr_adt.hpp"
+#include <cstdint>
+#include <vector>
+
+/*
+Read mostly CSR with a compressed column stream. Within a row the sorted columns are stored as the gap to the
+previous column (the first one as the gap from 0), every gap as a LEB128 varint: 7 bits per byte, the high bit set
+on all but the last byte. Clustered rows need a single byte per nonzero instead of 8.
+The multiply kernels decode the stream on the fly, it is never expanded in memory. Use decompress to modify it.
+*/
+template <typename T>
+class VarintCSR
+{
+private:
+    Buffer<T> values;              // non zero values, row by row
+    Buffer<uint8_t> columnStream;  // varint column gaps of each non zero value
+    Buffer<size_t> rowPtr;         // offset of each row into values, size is rows + 1
+    Buffer<size_t> streamPtr;      // offset of each row into columnStream, size is rows + 1
+    std::vector<size_t> shape;     // shape of original tensor
+
+public:
+    // constructor compressing the column indices of a CSR object
+    template <typename Index>
+    explicit VarintCSR(const CSR<T, Index> &csr);
+
+    // CSR object with plain column indices
+    template <typename Index = size_t>
+    CSR<T, Index> decompress() const;
+
+    // Accessors
+    const Buffer<T> &getValues() const;
+    const Buffer<uint8_t> &getColumnStream() const;
+    const Buffer<size_t> &getRowPtr() const;
+    const Buffer<size_t> &getStreamPtr() const;
+    const std::vector<size_t> &getShape() const;
+
+    size_t rows() const;
+    size_t cols() const;
+    size_t nnz() const;
+};
+
+namespace
+{
+    // helper functions
+    inline size_t _varintBytes(size_t value);
+
+    inline uint8_t *_writeVarint(size_t value, uint8_t *out);
+
+    inline size_t _readVarint(const uint8_t *&in);
+}
+
+#include "csr_varint_impl.hpp"
+
+#endif // CSR_VARINT_HPP
@@ -0,0 +1,175 @@
+#ifndef CSR_VARINT_IMPL_HPP
+#define CSR_VARINT_IMPL_HPP
+
+#include "csr_varint.hpp"
+#include <utility>
+
+/*
+Two passes over the rows, both parallel: the encoded size of every row, then after a prefix sum every row
+encodes straight into its slice of the stream. Values and row offsets are shared with the source when it
+borrows them, copied otherwise.
+*/
+template <typename T>
+template <typename Index>
+VarintCSR<T>::VarintCSR(const CSR<T, Index> &csr)
+    : values(csr.getValues()), rowPtr(csr.getRowPtr()), shape(csr.getShape())
+{
+    const size_t *rowStarts = csr.getRowPtr().data();
+    const Index *colIndices = csr.getColIndices().data();
+
+    // Pass 1, bytes per row
+    size_t numRows = csr.rows();
+    long long rowCount = static_cast<long long>(numRows);
+    std::vector<size_t> offsets(numRows + 1, 0);
+#pragma omp parallel for schedule(dynamic, 256) if (csr.nnz() > 100000)
+    for (long long row = 0; row < rowCount; ++row)
+    {
+        size_t bytes = 0;
+        size_t previous = 0;
+        for (size_t i = rowStarts[row]; i < rowStarts[row + 1]; ++i)
+        {
+            bytes += _varintBytes(colIndices[i] - previous);
+            previous = colIndices[i];
+        }
+        offsets[row + 1] = bytes;
+    }
+
+    for (size_t row = 0; row < numRows; ++row)
+    {
+        offsets[row + 1] += offsets[row];
+    }
+
+    // Pass 2, encode
+    std::vector<uint8_t> stream(offsets.back());
+#pragma omp parallel for schedule(dynamic, 256) if (csr.nnz() > 100000)
+    for (long long row = 0; row < rowCount; ++row)
+    {
+        uint8_t *out = stream.data() + offsets[row];
+        size_t previous = 0;
+        for (size_t i = rowStarts[row]; i < rowStarts[row + 1]; ++i)
+        {
+            out = _writeVarint(colIndices[i] - previous, out);
+            previous = colIndices[i];
+        }
+    }
+
+    columnStream = std::move(stream);
+    streamPtr = std::move(offsets);
+}
+
+template <typename T>
+template <typename Index>
+CSR<T, Index> VarintCSR<T>::decompress() const
+{
+    std::vector<Index> colIndices(nnz());
+    long long numRows = static_cast<long long>(rows());
+#pragma omp parallel for schedule(dynamic, 256) if (nnz() > 100000)
+    for (long long row = 0; row < numRows; ++row)
+    {
+        const uint8_t *cursor = columnStream.data() + streamPtr[row];
+        size_t col = 0;
+        for (size_t i = rowPtr[row]; i < rowPtr[row + 1]; ++i)
+        {
+            col += _readVarint(cursor);
+            colIndices[i] = static_cast<Index>(col);
+        }
+    }
+    return CSR<T, Index>(shape, rowPtr, std::move(colIndices), values);
+}
+
+// Accessors
+template <typename T>
+const Buffer<T> &VarintCSR<T>::getValues() const
+{
+    return values;
+}
+
+template <typename T>
+const Buffer<uint8_t> &VarintCSR<T>::getColumnStream() const
+{
+    return columnStream;
+}
+
+template <typename T>
+const Buffer<size_t> &VarintCSR<T>::getRowPtr() const
+{
+    return rowPtr;
+}
+
+template <typename T>
+const Buffer<size_t> &VarintCSR<T>::getStreamPtr() const
+{
+    return streamPtr;
+}
+
+template <typename T>
+const std::vector<size_t> &VarintCSR<T>::getShape() const
+{
+    return shape;
+}
+
+template <typename T>
+size_t VarintCSR<T>::rows() const
+{
+    return rowPtr.size() - 1;
+}
+
+template <typename T>
+size_t VarintCSR<T>::cols() const
+{
+    return CSR<T>::colsOf(shape);
+}
+
+template <typename T>
+size_t VarintCSR<T>::nnz() const
+{
+    return values.size();
+}
+
+namespace
+{
+    inline size_t _varintBytes(size_t value)
+    {
+        size_t bytes = 1;
+        while (value >= 0x80)
+        {
+            value >>= 7;
+            ++bytes;
+        }
+        return bytes;
+    }
+
+    inline uint8_t *_writeVarint(size_t value, uint8_t *out)
+    {
+        while (value >= 0x80)
+        {
+            *out++ = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<uint8_t>(value);
+        return out;
+    }
+
+    // decode one varint and advance past it, single byte gaps take the first branch
+    inline size_t _readVarint(const uint8_t *&in)
+    {
+        size_t value = *in++;
+        if (value < 0x80)
+        {
+            return value;
+        }
+
+        value &= 0x7f;
+        for (unsigned shift = 7;; shift += 7)
+        {
+            size_t byte = *in++;
+            value |= (byte & 0x7f) << shift;
+            if (byte < 0x80)
+            {
+                return value;
+            }
+        }
+    }
+}
+
+#endif // CSR_VARINT_IMPL_HPP
@@ -0,0 +1,90 @@
+#ifndef DISPATCH_HPP
+#define DISPATCH_HPP
+
+#include <xtensor/xarray.hpp>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace sparse_ops
+{
+    // kernels the dispatcher can route a product to
+    enum class MultiplyKernel
+    {
+        Dense,        // multiplyDense
+        SparseSparse, // both operands compressed, Gustavson SpGEMM
+        SparseDense   // tensorA compressed, tensorB used in place, SpMM
+    };
+
+    const char *kernelName(MultiplyKernel kernel);
+
+    /*
+    Per machine cost of every unit of work the kernels do, in seconds.
+    Measured by calibrateProfile, or the sparse_calibrate tool, and kept in a profile file that later processes read.
+    */
+    struct CostModel
+    {
+        double denseFlop;      // one multiply add of the dense kernel
+        double scanElement;    // one element of a dense operand scanned by the conversion or the sparsity estimate
+        double convertNonZero; // one nonzero written by the conversion
+        double sparseFlop;     // one multiply add of the SpGEMM, accumulator included
+        double sparseOutput;   // one nonzero of the SpGEMM result, symbolic phase, sort and write
+        double spmmFlop;       // one multiply add of the sparse times dense kernel
+        double denseOutput;    // one element of a dense result written
+    };
+
+    // conservative coefficients used when there is no profile
+    CostModel defaultCostModel();
+
+    // run the microbenchmarks, takes a few seconds, never run implicitly
+    CostModel calibrateCostModel();
+
+    // profile file, $SPARSE_OPS_PROFILE if set, otherwise ~/.sparse_ops_profile
+    std::string defaultProfilePath();
+    bool saveCostModel(const CostModel &model, const std::string &path);
+    bool loadCostModel(CostModel &model, const std::string &path);
+
+    // calibrate, write the profile to path and make it the active model, throws if the profile cannot be written
+    CostModel calibrateProfile(const std::string &path = defaultProfilePath());
+
+    // active model, read from the profile on first use, defaultCostModel() if there is none, the profile is never written
+    CostModel costModel();
+    void setCostModel(const CostModel &model);
+
+    // everything the dispatcher knew and predicted when routing one product
+    struct DispatchDecision
+    {
+        MultiplyKernel kernel;
+        std::vector<size_t> shapeA;
+        std::vector<size_t> shapeB;
+        double densityA;
+        double densityB;
+        double costDense;
+        double costSparseSparse;
+        double costSparseDense;
+        bool transposeA = false; // the product was tensorA^T x tensorB
+    };
+
+    /*
+    Every decision goes to the dispatch logger. The default one keeps the most recent decisions in memory,
+    see dispatchLog, and appends them to the file named by $SPARSE_OPS_DISPATCH_LOG when it is set.
+    */
+    using DispatchLogger = std::function<void(const DispatchDecision &)>;
+    void setDispatchLogger(DispatchLogger logger);
+    std::vector<DispatchDecision> dispatchLog();
+    std::string formatDecision(const DispatchDecision &decision);
+
+    // predicted cost of every kernel for operands of the given shapes and densities (nonzero fractions)
+    // with transposeA the product is tensorA^T x tensorB for matrices tensorA (K, M) and tensorB (K, N)
+    DispatchDecision chooseKernel(const std::vector<size_t> &shapeA, const std::vector<size_t> &shapeB,
+                                  double densityA, double densityB, const CostModel &model, bool transposeA = false);
+
+    // (..., K) x (K, N) -> (..., N) with the kernel the cost model predicts to be fastest
+    xt::xarray<double> multiply(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB);
+
+    // (K, M)^T x (K, N) -> (M, N) the same way, the transpose is never built densely
+    // the sparse kernels push the rows of tensorA into the result, the sparse sparse one transposes A when the result is too large
+    xt::xarray<double> multiplyTransposed(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB);
+}
+
+#endif // DISPATCH_HPP
@@ -0,0 +1,453 @@
+#ifndef SIMD_KERNELS_HPP
+#define SIMD_KERNELS_HPP
+
+#include "bfloat16.hpp"
+#include <cstddef>
+
+// GCC and Clang build the AVX-512 and AVX2 kernels through target attributes, whatever the -m flags of the build
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SPARSE_OPS_SIMD_DISPATCH
+#define SPARSE_OPS_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#define SPARSE_OPS_AVX2 __attribute__((target("avx2,fma")))
+#include <immintrin.h>
+#endif
+
+/*
+Small vector kernels shared by the conversions and the sparse times dense products.
+The instruction set is picked at run time from the CPU the library runs on, AVX-512, then AVX2 with FMA, then a
+scalar loop the compiler is free to auto vectorize, so a portable build still uses the widest kernels available.
+Other compilers and architectures only get the scalar loops.
+*/
+
+namespace
+{
+    // y[0:n] += a * x[0:n]
+    template <typename T>
+    void _axpy(size_t n, T a, const T *x, T *y)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            y[i] += a * x[i];
+        }
+    }
+
+    // y[0:n] += a * x[0:n] with x stored narrower than y, widened as it is loaded
+    template <typename Acc, typename X>
+    void _axpyWiden(size_t n, Acc a, const X *x, Acc *y)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            y[i] += a * static_cast<Acc>(x[i]);
+        }
+    }
+
+    // number of entries of data[0:n] that are not zero
+    template <typename Src>
+    size_t _countNonZeros(const Src *data, size_t n)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            count += data[i] != Src(0);
+        }
+        return count;
+    }
+
+    // copy the entries of src[0:n] that are not zero to values, and their position + indexBase to indices
+    template <typename Src, typename T, typename Index>
+    size_t _gatherNonZeros(const Src *src, size_t n, size_t indexBase, Index *indices, T *values)
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (src[i] != Src(0))
+            {
+                indices[count] = static_cast<Index>(indexBase + i);
+                values[count] = static_cast<T>(src[i]);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+#ifdef SPARSE_OPS_SIMD_DISPATCH
+    enum class _SimdLevel
+    {
+        Scalar,
+        Avx2,   // AVX2 with FMA
+        Avx512
+    };
+
+    // widest instruction set of the CPU, detected on the first call
+    inline _SimdLevel _simdLevel()
+    {
+        static const _SimdLevel level = []
+        {
+            __builtin_cpu_init();
+            bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+            if (avx2 && __builtin_cpu_supports("avx512f"))
+            {
+                return _SimdLevel::Avx512;
+            }
+            return avx2 ? _SimdLevel::Avx2 : _SimdLevel::Scalar;
+        }();
+        return level;
+    }
+
+    // AVX-512
+    SPARSE_OPS_AVX512 inline size_t _countNonZerosAvx512(const double *data, size_t n)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            count += __builtin_popcount(_mm512_cmp_pd_mask(_mm512_loadu_pd(data + i), _mm512_setzero_pd(), _CMP_NEQ_UQ));
+        }
+        for (; i < n; ++i)
+        {
+            count += data[i] != 0.0;
+        }
+        return count;
+    }
+
+    SPARSE_OPS_AVX512 inline size_t _countNonZerosAvx512(const float *data, size_t n)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            count += __builtin_popcount(_mm512_cmp_ps_mask(_mm512_loadu_ps(data + i), _mm512_setzero_ps(), _CMP_NEQ_UQ));
+        }
+        for (; i < n; ++i)
+        {
+            count += data[i] != 0.0f;
+        }
+        return count;
+    }
+
+    template <typename Index>
+    SPARSE_OPS_AVX512 inline size_t _gatherNonZerosAvx512(const double *src, size_t n, size_t indexBase, Index *indices, double *values)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            // skip all zero groups with one compare, visit the set bits of the others
+            unsigned mask = _mm512_cmp_pd_mask(_mm512_loadu_pd(src + i), _mm512_setzero_pd(), _CMP_NEQ_UQ);
+            while (mask)
+            {
+                size_t lane = __builtin_ctz(mask);
+                indices[count] = static_cast<Index>(indexBase + i + lane);
+                values[count] = src[i + lane];
+                ++count;
+                mask &= mask - 1;
+            }
+        }
+        return count + _gatherNonZeros<double, double>(src + i, n - i, indexBase + i, indices + count, values + count);
+    }
+
+    template <typename Index>
+    SPARSE_OPS_AVX512 inline size_t _gatherNonZerosAvx512(const float *src, size_t n, size_t indexBase, Index *indices, float *values)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            unsigned mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(src + i), _mm512_setzero_ps(), _CMP_NEQ_UQ);
+            while (mask)
+            {
+                size_t lane = __builtin_ctz(mask);
+                indices[count] = static_cast<Index>(indexBase + i + lane);
+                values[count] = src[i + lane];
+                ++count;
+                mask &= mask - 1;
+            }
+        }
+        return count + _gatherNonZeros<float, float>(src + i, n - i, indexBase + i, indices + count, values + count);
+    }
+
+    SPARSE_OPS_AVX512 inline void _axpyAvx512(size_t n, double a, const double *x, double *y)
+    {
+        __m512d va = _mm512_set1_pd(a);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm512_storeu_pd(y + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i)));
+        }
+        if (i < n)
+        {
+            __mmask8 tail = static_cast<__mmask8>((1u << (n - i)) - 1);
+            __m512d vy = _mm512_maskz_loadu_pd(tail, y + i);
+            _mm512_mask_storeu_pd(y + i, tail, _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(tail, x + i), vy));
+        }
+    }
+
+    SPARSE_OPS_AVX512 inline void _axpyAvx512(size_t n, float a, const float *x, float *y)
+    {
+        __m512 va = _mm512_set1_ps(a);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+        }
+        if (i < n)
+        {
+            __mmask16 tail = static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 vy = _mm512_maskz_loadu_ps(tail, y + i);
+            _mm512_mask_storeu_ps(y + i, tail, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(tail, x + i), vy));
+        }
+    }
+
+    // bfloat16 widens to float by moving its bits into the upper half of a 32 bit lane
+    SPARSE_OPS_AVX512 inline void _axpyWidenAvx512(size_t n, float a, const bfloat16 *x, float *y)
+    {
+        __m512 va = _mm512_set1_ps(a);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            // the zero masked forms, the unmasked ones read an undefined register gcc warns about
+            __m256i narrow = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i));
+            __m512i wide = _mm512_maskz_slli_epi32(0xffff, _mm512_maskz_cvtepu16_epi32(0xffff, narrow), 16);
+            _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_castsi512_ps(wide), _mm512_loadu_ps(y + i)));
+        }
+        for (; i < n; ++i)
+        {
+            y[i] += a * static_cast<float>(x[i]);
+        }
+    }
+
+    // AVX2 with FMA
+    SPARSE_OPS_AVX2 inline size_t _countNonZerosAvx2(const double *data, size_t n)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            count += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(data + i), _mm256_setzero_pd(), _CMP_NEQ_UQ)));
+        }
+        for (; i < n; ++i)
+        {
+            count += data[i] != 0.0;
+        }
+        return count;
+    }
+
+    SPARSE_OPS_AVX2 inline size_t _countNonZerosAvx2(const float *data, size_t n)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            count += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(data + i), _mm256_setzero_ps(), _CMP_NEQ_UQ)));
+        }
+        for (; i < n; ++i)
+        {
+            count += data[i] != 0.0f;
+        }
+        return count;
+    }
+
+    template <typename Index>
+    SPARSE_OPS_AVX2 inline size_t _gatherNonZerosAvx2(const double *src, size_t n, size_t indexBase, Index *indices, double *values)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            // skip all zero groups with one compare, visit the set bits of the others
+            unsigned mask = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(src + i), _mm256_setzero_pd(), _CMP_NEQ_UQ));
+            while (mask)
+            {
+                size_t lane = __builtin_ctz(mask);
+                indices[count] = static_cast<Index>(indexBase + i + lane);
+                values[count] = src[i + lane];
+                ++count;
+                mask &= mask - 1;
+            }
+        }
+        return count + _gatherNonZeros<double, double>(src + i, n - i, indexBase + i, indices + count, values + count);
+    }
+
+    template <typename Index>
+    SPARSE_OPS_AVX2 inline size_t _gatherNonZerosAvx2(const float *src, size_t n, size_t indexBase, Index *indices, float *values)
+    {
+        size_t count = 0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(src + i), _mm256_setzero_ps(), _CMP_NEQ_UQ));
+            while (mask)
+            {
+                size_t lane = __builtin_ctz(mask);
+                indices[count] = static_cast<Index>(indexBase + i + lane);
+                values[count] = src[i + lane];
+                ++count;
+                mask &= mask - 1;
+            }
+        }
+        return count + _gatherNonZeros<float, float>(src + i, n - i, indexBase + i, indices + count, values + count);
+    }
+
+    SPARSE_OPS_AVX2 inline void _axpyAvx2(size_t n, double a, const double *x, double *y)
+    {
+        __m256d va = _mm256_set1_pd(a);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+            _mm256_storeu_pd(y + i + 4, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+        }
+        for (; i + 4 <= n; i += 4)
+        {
+            _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+        }
+        for (; i < n; ++i)
+        {
+            y[i] += a * x[i];
+        }
+    }
+
+    SPARSE_OPS_AVX2 inline void _axpyAvx2(size_t n, float a, const float *x, float *y)
+    {
+        __m256 va = _mm256_set1_ps(a);
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+            _mm256_storeu_ps(y + i + 8, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8)));
+        }
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+        }
+        for (; i < n; ++i)
+        {
+            y[i] += a * x[i];
+        }
+    }
+
+    SPARSE_OPS_AVX2 inline void _axpyWidenAvx2(size_t n, float a, const bfloat16 *x, float *y)
+    {
+        __m256 va = _mm256_set1_ps(a);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m128i narrow = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+            __m256i wide = _mm256_slli_epi32(_mm256_cvtepu16_epi32(narrow), 16);
+            _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_castsi256_ps(wide), _mm256_loadu_ps(y + i)));
+        }
+        for (; i < n; ++i)
+        {
+            y[i] += a * static_cast<float>(x[i]);
+        }
+    }
+
+    // entry points, one switch per call picks the kernel of the detected instruction set
+    inline size_t _countNonZeros(const double *data, size_t n)
+    {
+        switch (_simdLevel())
+        {
+        case _SimdLevel::Avx512:
+            return _countNonZerosAvx512(data, n);
+        case _SimdLevel::Avx2:
+            return _countNonZerosAvx2(data, n);
+        default:
+            return _countNonZeros<double>(data, n);
+        }
+    }
+
+    inline size_t _countNonZeros(const float *data, size_t n)
+    {
+        switch (_simdLevel())
+        {
+        case _SimdLevel::Avx512:
+            return _countNonZerosAvx512(data, n);
+        case _SimdLevel::Avx2:
+            return _countNonZerosAvx2(data, n);
+        default:
+            return _countNonZeros<float>(data, n);
+        }
+    }
+
+    template <typename Index>
+    inline size_t _gatherNonZeros(const double *src, size_t n, size_t indexBase, Index *indices, double *values)
+    {
+        switch (_simdLevel())
+        {
+        case _SimdLevel::Avx512:
+            return _gatherNonZerosAvx512(src, n, indexBase, indices, values);
+        case _SimdLevel::Avx2:
+            return _gatherNonZerosAvx2(src, n, indexBase, indices, values);
+        default:
+            return _gatherNonZeros<double, double>(src, n, indexBase, indices, values);
+        }
+    }
+
+    template <typename Index>
+    inline size_t _gatherNonZeros(const float *src, size_t n, size_t indexBase, Index *indices, float *values)
+    {
+        switch (_simdLevel())
+        {
+        case _SimdLevel::Avx512:
+            return _gatherNonZerosAvx512(src, n, indexBase, indices, values);
+        case _SimdLevel::Avx2:
+            return _gatherNonZerosAvx2(src, n, indexBase, indices, values);
+        default:
+            return _gatherNonZeros<float, float>(src, n, indexBase, indices, values);
+        }
+    }
+
+    template <>
+    inline void _axpy<double>(size_t n, double a, const double *x, double *y)
+    {
+        switch (_simdLevel())
+        {
+        case _SimdLevel::Avx512:
+            return _axpyAvx512(n, a, x, y);
+        case _SimdLevel::Avx2:
+            return _axpyAvx2(n, a, x, y);
+        default:
+            for (size_t i = 0; i < n; ++i)
+            {
+                y[i] += a * x[i];
+            }
+        }
+    }
+
+    template <>
+    inline void _axpy<float>(size_t n, float a, const float *x, float *y)
+    {
+        switch (_simdLevel())
+        {
+        case _SimdLevel::Avx512:
+            return _axpyAvx512(n, a, x, y);
+        case _SimdLevel::Avx2:
+            return _axpyAvx2(n, a, x, y);
+        default:
+            for (size_t i = 0; i < n; ++i)
+            {
+                y[i] += a * x[i];
+            }
+        }
+    }
+
+    template <>
+    inline void _axpyWiden<float, bfloat16>(size_t n, float a, const bfloat16 *x, float *y)
+    {
+        switch (_simdLevel())
+        {
+        case _SimdLevel::Avx512:
+            return _axpyWidenAvx512(n, a, x, y);
+        case _SimdLevel::Avx2:
+            return _axpyWidenAvx2(n, a, x, y);
+        default:
+            for (size_t i = 0; i < n; ++i)
+            {
+                y[i] += a * static_cast<float>(x[i]);
+            }
+        }
+    }
+#endif
+}
+
+#endif // SIMD_KERNELS_HPP
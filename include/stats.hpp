@@ -0,0 +1,177 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+Opt in statistics of the hot paths, compiled in only when SPARSE_OPS_STATS is defined (cmake -DSPARSE_OPS_STATS=ON).
+Every call of an instrumented entry point produces one CallStats record. Instrumented calls nested inside another
+one, like the conversions inside multiplyCompressedFormat, fold into the record of the outermost call: their times,
+bytes and collisions add up, and their counts fill the fields the outer call did not set itself.
+Without the macro the SPARSE_OPS_STATS_* macros expand to nothing and stats() stays empty.
+*/
+namespace sparse_ops
+{
+    // phases of a product, time spent outside of them only shows up in the total
+    enum class StatsPhase
+    {
+        Convert,  // dense operands compressed
+        Symbolic, // flops counted and output rows sized
+        Numeric,  // output values accumulated
+        Assemble  // prefix sums, stitching and conversion of the result
+    };
+
+    constexpr size_t statsPhaseCount = 4;
+
+    const char *phaseName(StatsPhase phase);
+
+    struct CallStats
+    {
+        std::string operation;  // outermost instrumented call
+        std::string kernel;     // kernel chosen by the dispatcher, empty when the call was not dispatched
+        size_t nnzA = 0;
+        size_t nnzB = 0;
+        size_t nnzOut = 0;
+        size_t flops = 0;       // multiply adds
+        size_t bytesMoved = 0;  // estimated bytes read and written by the kernels
+        size_t collisions = 0;  // probes of the numeric hash accumulators past the home slot of a column
+        size_t threads = 1;     // team size of the numeric phase
+        double imbalance = 1.0; // busiest thread over the mean of the team, idle threads included, 1 is a perfect balance
+        double phaseSeconds[statsPhaseCount] = {};
+        double totalSeconds = 0.0;
+    };
+
+    struct StatsSnapshot
+    {
+        std::vector<CallStats> calls; // most recent calls, oldest first
+        size_t totalCalls = 0;        // calls recorded since the last reset, including those no longer kept
+
+        std::string toJson() const;
+    };
+
+    constexpr bool statsEnabled()
+    {
+#ifdef SPARSE_OPS_STATS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // copy of the recorded calls, and a reset of them
+    StatsSnapshot stats();
+    void resetStats();
+
+    // one instrumented call, only the scope that opens first on a thread records, inner scopes fold into it
+    class StatsScope
+    {
+    private:
+        CallStats record;
+        StatsScope *outer;
+        size_t phaseDepth = 0;
+        std::chrono::steady_clock::time_point start;
+
+        friend class PhaseTimer;
+
+    public:
+        explicit StatsScope(const char *operation);
+        ~StatsScope();
+
+        StatsScope(const StatsScope &) = delete;
+        StatsScope &operator=(const StatsScope &) = delete;
+
+        // record of the innermost open call of this thread, nullptr outside of instrumented calls
+        static CallStats *current();
+    };
+
+    // time of a phase, a phase opened inside another one of the same call is not counted twice
+    class PhaseTimer
+    {
+    private:
+        StatsScope *scope;
+        StatsPhase phase;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit PhaseTimer(StatsPhase phase);
+        ~PhaseTimer();
+
+        // end the phase before the end of the enclosing block
+        void stop();
+
+        PhaseTimer(const PhaseTimer &) = delete;
+        PhaseTimer &operator=(const PhaseTimer &) = delete;
+    };
+
+    // per thread busy time and collisions of a parallel region, reported to the current call from the calling thread
+    class ThreadStats
+    {
+    private:
+        std::vector<double> busySeconds;
+        std::vector<size_t> collisions;
+        std::atomic<size_t> teamSize{1}; // threads of the region, recorded by the threads that did work
+
+    public:
+        ThreadStats();
+
+        // called from inside the region, every thread writes only its own slot
+        void addBusy(double seconds);
+        void addCollisions(size_t count);
+
+        // called after the region
+        void report() const;
+    };
+
+    // busy time of one piece of work of a parallel region
+    class BusyTimer
+    {
+    private:
+        ThreadStats &threadStats;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit BusyTimer(ThreadStats &threadStats);
+        ~BusyTimer();
+
+        BusyTimer(const BusyTimer &) = delete;
+        BusyTimer &operator=(const BusyTimer &) = delete;
+    };
+}
+
+#ifdef SPARSE_OPS_STATS
+#define SPARSE_OPS_STATS_CALL(operation) sparse_ops::StatsScope _statsScope(operation)
+#define SPARSE_OPS_STATS_PHASE(phase) sparse_ops::PhaseTimer _statsPhase##phase(sparse_ops::StatsPhase::phase)
+#define SPARSE_OPS_STATS_END(phase) _statsPhase##phase.stop()
+#define SPARSE_OPS_STATS_SET(field, value)                                     \
+    do                                                                         \
+    {                                                                          \
+        if (sparse_ops::CallStats *_statsCall = sparse_ops::StatsScope::current()) \
+            _statsCall->field = (value);                                       \
+    } while (0)
+#define SPARSE_OPS_STATS_ADD(field, value)                                     \
+    do                                                                         \
+    {                                                                          \
+        if (sparse_ops::CallStats *_statsCall = sparse_ops::StatsScope::current()) \
+            _statsCall->field += (value);                                      \
+    } while (0)
+#define SPARSE_OPS_STATS_THREADS(name) sparse_ops::ThreadStats name
+#define SPARSE_OPS_STATS_BUSY(name) sparse_ops::BusyTimer _statsBusy(name)
+#define SPARSE_OPS_STATS_COLLISIONS(name, count) name.addCollisions(count)
+#define SPARSE_OPS_STATS_REPORT(name) name.report()
+#else
+#define SPARSE_OPS_STATS_CALL(operation)
+#define SPARSE_OPS_STATS_PHASE(phase)
+#define SPARSE_OPS_STATS_END(phase)
+#define SPARSE_OPS_STATS_SET(field, value)
+#define SPARSE_OPS_STATS_ADD(field, value)
+#define SPARSE_OPS_STATS_THREADS(name)
+#define SPARSE_OPS_STATS_BUSY(name)
+#define SPARSE_OPS_STATS_COLLISIONS(name, count)
+#define SPARSE_OPS_STATS_REPORT(name)
+#endif
+
+#endif // STATS_HPP
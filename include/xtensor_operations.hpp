@@ -1,20 +1,67 @@
 #ifndef SPARSE_OPERATIONS_HPP
 #define SPARSE_OPERATIONS_HPP
 
+#include "csr_adt.hpp"
+#include "csr_spgemm.hpp"
 #include <xtensor/xarray.hpp>
 #include <xtensor/xtensor.hpp>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace sparse_ops
 {
+    // result of a sampled sparsity estimate, the true sparsity lies in [lower, upper] with the requested confidence
+    struct SparsityEstimate
+    {
+        double sparsity;
+        double lower;
+        double upper;
+        size_t samples;
+        bool exact; // the tensor was small enough to count exactly
+    };
+
     // operations to check if a tensor/array is sparse based on threshold, and operation to return sparsity percentage
     template <typename Tensor>
     bool isSparse(const Tensor &tensor, double threshold = 0.8);
 
+    template <typename Tensor>
+    bool isSparseParallel(const Tensor &tensor, double threshold = 0.8);
+
     template <typename Tensor>
     double sparsity(const Tensor &tensor);
 
+    // approximate sparsity and sparse check for routing decisions, cost is independent of the tensor size
+    template <typename Tensor>
+    SparsityEstimate estimateSparsity(const Tensor &tensor, double tolerance = 0.01, double confidence = 0.95, uint64_t seed = 0);
+
+    template <typename Tensor>
+    bool isSparseSampled(const Tensor &tensor, double threshold = 0.8, double confidence = 0.95, uint64_t seed = 0);
+
+    // multiplication of two tensors through their compressed form, batched matmul [..., M, K] x [..., K, N] -> [..., M, N]
+    // with the batch dimensions broadcast against each other
+    inline auto multiplyCompressedFormat(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> xt::xarray<double>;
+
+    // same product computed densely
+    inline auto multiplyDense(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> xt::xarray<double>;
+
+    // same product kept in compressed form, memory scales with the nonzeros of the result, use CSRToDense to expand it
+    inline auto multiplyCompressedFormatSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> CSR<double>;
+
+    // products with every output row pruned inside the accumulator, see PruneOptions
+    inline auto multiplyCompressedFormat(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB,
+                                         const PruneOptions &prune) -> xt::xarray<double>;
+
+    inline auto multiplyCompressedFormatSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB,
+                                               const PruneOptions &prune) -> CSR<double>;
+
+    // products with the operands compressed to Storage values, float or bfloat16, summed in Acc, see CSRMult
+    template <typename Storage, typename Acc = void>
     auto multiplyCompressedFormat(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> xt::xarray<double>;
+
+    template <typename Storage, typename Acc = void>
+    auto multiplyCompressedFormatSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> CSR<Storage>;
 }
 
 namespace
@@ -24,15 +71,35 @@ namespace
     {
         bool isMultiplcable;
         bool requiresBroadcasting;
+        BatchLayout layout;
+        std::vector<size_t> resultShape;
+    };
+
+    // true for tensor types exposing their buffer through data()
+    template <typename Tensor, typename = void>
+    struct _hasContiguousData : std::false_type
+    {
+    };
+
+    template <typename Tensor>
+    struct _hasContiguousData<Tensor, std::void_t<decltype(std::declval<const Tensor &>().data()),
+                                                  decltype(std::declval<const Tensor &>().data_offset())>> : std::true_type
+    {
     };
 
     // helper functions
     template <typename Tensor>
-    auto _toCompressedFormat(const Tensor &tensor) -> std::tuple<std::vector<double>, std::vector<std::vector<size_t>>>;
+    auto _contiguousData(const Tensor &tensor) -> const typename Tensor::value_type *;
 
-    TensorMultiplicabilityAnalysisStruct _areTensorsMultiplicable(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB);
+    inline size_t _zerosNeeded(size_t size, double threshold);
 
-    bool _worthUsingSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB);
+    template <typename Storage = double, typename Tensor>
+    auto _toCompressedFormat(const Tensor &tensor) -> CSR<Storage>;
+
+    template <typename Storage>
+    void _recordConversionStats(const CSR<Storage> &csr);
+
+    TensorMultiplicabilityAnalysisStruct _areTensorsMultiplicable(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB);
 }
 
 #include "xtensor_operations_impl.hpp"
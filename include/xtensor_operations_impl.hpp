@@ -2,273 +2,422 @@
 #define XTENSOR_OPERATIONS_IMPL_HPP
 
 #include "xtensor_operations.hpp"
+#include "csr_operations.hpp"
+#include "simd_kernels.hpp"
 #include <xtensor/xarray.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
 #include <stdexcept>
-#include <tuple>
-#include <unordered_map>
+#include <type_traits>
+#include <utility>
 
 namespace sparse_ops
 {
+    /*
+    Zeros are counted block by block straight from the tensor's buffer with the SIMD scan, no temporary is created.
+    After every block the answer is decided as soon as possible either way, sparse once the zeros reach the threshold,
+    dense once the zeros left to scan can no longer reach it.
+    */
     template <typename Tensor>
     bool isSparse(const Tensor &tensor, double threshold)
     {
-        /*
-        Two approaches:
-        1. xt::equal and xt::sum are highly optimized in xtensor making it faster than a linear scan,
-           however, it creates a temporary tensor which can be memory intensive
-        2. Linear scan with early stopping doesn't create a temporary tensor but is slower
-        */
-        // Approach 1
-        auto zero_count = xt::sum(xt::equal(tensor, 0.0));
-        double sparsity = static_cast<double>(zero_count()) / tensor.size();
-        return sparsity >= threshold;
-        // Approach 2
-        /*
+        size_t size = tensor.size();
+        if (size == 0)
+        {
+            return false;
+        }
+        size_t needed = _zerosNeeded(size, threshold);
+
+        const auto *data = _contiguousData(tensor);
+        if (data == nullptr)
+        {
+            // expressions without a buffer, same decision element by element
+            size_t zero_count = 0;
+            size_t remaining = size;
+            for (const auto &val : tensor)
+            {
+                zero_count += val == 0;
+                --remaining;
+                if (zero_count >= needed)
+                {
+                    return true;
+                }
+                if (zero_count + remaining < needed)
+                {
+                    return false;
+                }
+            }
+            return false;
+        }
+
+        constexpr size_t blockSize = 4096;
         size_t zero_count = 0;
-        size_t max_zeros = static_cast<size_t>(tensor.size() * threshold);
-          for (const auto& val : tensor) {
-             if (val == 0.0) {
-                 zero_count++;
-                 if(zero_count >= max_zeros) {
-                     return true;
-                 }
-             }
-          }
-          return false;
-        */
+        for (size_t begin = 0; begin < size; begin += blockSize)
+        {
+            size_t length = std::min(blockSize, size - begin);
+            zero_count += length - _countNonZeros(data + begin, length);
+            if (zero_count >= needed)
+            {
+                return true;
+            }
+            if (zero_count + (size - begin - length) < needed)
+            {
+                return false;
+            }
+        }
+        return zero_count >= needed;
     }
+
+    // Same decision with the blocks scanned by all threads, the first thread able to decide stops the others
     template <typename Tensor>
-    double sparsity(const Tensor &tensor)
+    bool isSparseParallel(const Tensor &tensor, double threshold)
     {
-        auto zero_count = xt::sum(xt::equal(tensor, 0.0));
-        return static_cast<double>(zero_count()) / tensor.size();
+        size_t size = tensor.size();
+        const auto *data = _contiguousData(tensor);
+        if (size == 0 || data == nullptr)
+        {
+            return isSparse(tensor, threshold);
+        }
+        size_t needed = _zerosNeeded(size, threshold);
+
+        /*
+        Two monotonic counters keep every intermediate read safe to decide on:
+        zeros found so far only grows, zeros still possible (found + unscanned) only shrinks.
+        */
+        constexpr size_t blockSize = size_t(1) << 16;
+        long long numBlocks = static_cast<long long>((size + blockSize - 1) / blockSize);
+        std::atomic<size_t> zerosFound{0};
+        std::atomic<size_t> zerosPossible{size};
+        std::atomic<bool> decided{false};
+
+#pragma omp parallel for schedule(dynamic, 1)
+        for (long long block = 0; block < numBlocks; ++block)
+        {
+            if (decided.load(std::memory_order_relaxed))
+            {
+                continue;
+            }
+
+            size_t begin = block * blockSize;
+            size_t length = std::min(blockSize, size - begin);
+            size_t nonZeros = _countNonZeros(data + begin, length);
+
+            size_t found = zerosFound.fetch_add(length - nonZeros) + length - nonZeros;
+            size_t possible = zerosPossible.fetch_sub(nonZeros) - nonZeros;
+            if (found >= needed || possible < needed)
+            {
+                decided.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        return zerosPossible.load() >= needed && zerosFound.load() >= needed;
     }
 
-    // multiplication of two tensors in compressed format
-    auto multiplyCompressedFormat(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> xt::xarray<double>
+    template <typename Tensor>
+    double sparsity(const Tensor &tensor)
     {
-        // Convert tensorA and tensorB to CSR format
-        auto [valuesA, indicesA] = _toCompressedFormat(tensorA);
-        auto [valuesB, indicesB] = _toCompressedFormat(tensorB);
+        size_t size = tensor.size();
+        const auto *data = _contiguousData(tensor);
 
-        // Check dimension compatibility
-        TensorMultiplicabilityAnalysisStruct analysis = _areTensorsMultiplicable(tensorA, tensorB);
-        if (!analysis.isMultiplcable)
+        size_t zero_count = 0;
+        if (data == nullptr)
         {
-            throw std::invalid_argument("Tensors are not compatible for multiplication");
+            for (const auto &val : tensor)
+            {
+                zero_count += val == 0;
+            }
         }
+        else
+        {
+            // SIMD count, split across threads for large tensors
+            constexpr size_t blockSize = size_t(1) << 16;
+            long long numBlocks = static_cast<long long>((size + blockSize - 1) / blockSize);
+            size_t nonZeros = 0;
+#pragma omp parallel for schedule(static) reduction(+ : nonZeros) if (numBlocks > 1)
+            for (long long block = 0; block < numBlocks; ++block)
+            {
+                size_t begin = block * blockSize;
+                nonZeros += _countNonZeros(data + begin, std::min(blockSize, size - begin));
+            }
+            zero_count = size - nonZeros;
+        }
+        return static_cast<double>(zero_count) / size;
+    }
 
-        // Resulting shape
-        std::vector<size_t> resultShape(tensorA.shape().begin(), tensorA.shape().end());
-        resultShape.back() = tensorB.shape().back();
-
-        // Resulting tensor
-        xt::xarray<double> result = xt::zeros<double>(resultShape);
+    /*
+    Uniform sampling with replacement. By Hoeffding's inequality, n samples put the sample zero fraction within
+    eps = sqrt(ln(2 / delta) / (2n)) of the true sparsity with probability 1 - delta, so the number of samples only
+    depends on the tolerance and confidence, not on the size of the tensor.
+    */
+    template <typename Tensor>
+    SparsityEstimate estimateSparsity(const Tensor &tensor, double tolerance, double confidence, uint64_t seed)
+    {
+        // written so NaN fails too, a tolerance of 0 or a confidence of 1 would need infinitely many samples
+        if (!(tolerance > 0.0) || !(confidence > 0.0 && confidence < 1.0))
+        {
+            throw std::invalid_argument("Sparsity estimate needs tolerance > 0 and 0 < confidence < 1");
+        }
 
-        // Multiply the tensors in compressed format
-        size_t numNonZerosValuesA = valuesA.size();
-        size_t numNonZerosValuesB = valuesB.size();
+        size_t size = tensor.size();
+        const auto *data = _contiguousData(tensor);
+        double delta = 1.0 - confidence;
+        double needed = std::ceil(std::log(2.0 / delta) / (2.0 * tolerance * tolerance));
 
-        std::unordered_map<size_t, std::vector<size_t>> indexMapB;
-        for (size_t j = 0; j < numNonZerosValuesB; ++j)
+        // sampling is no cheaper than an exact count, compared before the cast so huge counts cannot overflow it
+        if (data == nullptr || needed >= static_cast<double>(size))
         {
-            indexMapB[indicesB.front()[j]].push_back(j);
+            double exact = sparsity(tensor);
+            return {exact, exact, exact, size, true};
         }
+        size_t samples = static_cast<size_t>(needed);
 
-        for (size_t i = 0; i < numNonZerosValuesA; ++i)
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<size_t> position(0, size - 1);
+        size_t zero_count = 0;
+        for (size_t i = 0; i < samples; ++i)
         {
-            // Find matching inner dimensions
-            auto it = indexMapB.find(indicesA.back()[i]);
-            if (it != indexMapB.end())
-            {
-                for (size_t j : it->second)
-                {
-                    if (analysis.requiresBroadcasting)
-                    {
-                        // create the resulting index with broadcasting logic
-                        std::vector<size_t> resultIndex(resultShape.size());
-                        for (size_t dim = 0; dim < resultShape.size(); ++dim)
-                        {
-                            size_t indexA = dim < indicesA.size() ? indicesA[dim][i] : 0;
-                            size_t indexB = dim < indicesB.size() ? indicesB[dim][j] : 0;
-
-                            // Apply broadcasting
-                            resultIndex[dim] = (tensorA.shape()[dim] == 1) ? indexB : (tensorB.shape()[dim] == 1) ? indexA
-                                                                                                                  : indexA;
-                        }
-
-                        result(resultIndex) += valuesA[i] * valuesB[j];
-                    }
-                    else
-                    {
-                        // No broadcasting logic required, direct indices use and faster operation
-                        std::vector<size_t> resultIndex = indicesA[i];
-                        resultIndex.back() = indicesB.back()[j];
-
-                        result(resultIndex) += valuesA[i] * valuesB[j];
-                    }
-                }
-            }
+            zero_count += data[position(rng)] == 0;
         }
 
-        return result;
+        double estimate = static_cast<double>(zero_count) / samples;
+        return {estimate, std::max(0.0, estimate - tolerance), std::min(1.0, estimate + tolerance), samples, false};
     }
 
-} // namespace sparse_ops
-
-namespace
-{
-    // Private helper to convert to xarray to CSR format, generalized for any tensor shape
+    /*
+    Sequential version of the estimate for routing. Samples are drawn in doubling rounds and after round j the
+    Hoeffding interval is checked at confidence delta / 2^(j+1), so the chance of any wrong early answer stays below
+    delta. Tensors close to the threshold fall back to the exact early exit scan once sampling stops paying off.
+    */
     template <typename Tensor>
-    auto _toCompressedFormat(const Tensor &tensor) -> std::tuple<std::vector<double>, std::vector<std::vector<size_t>>>
+    bool isSparseSampled(const Tensor &tensor, double threshold, double confidence, uint64_t seed)
     {
-        // storing all non zero values
-        // linear list of all non zero values in the tensor
-        std::vector<double> values;
-        // indices of the non zero values for each dimension of the tensor
-        /*
-        Size of indices is # of dimensions * # of non zero values.
-        The nth vector shows the index of all the non zero values in the nth dimension.
-        */
-        std::vector<std::vector<size_t>> indices(tensor.dimension());
+        // written so NaN fails too, a confidence of 1 leaves no room for a wrong early answer
+        if (!(confidence > 0.0 && confidence < 1.0))
+        {
+            throw std::invalid_argument("Sampled sparsity check needs 0 < confidence < 1");
+        }
 
-        auto shape = tensor.shape();
-#pragma omp parallel
+        size_t size = tensor.size();
+        const auto *data = _contiguousData(tensor);
+        if (data == nullptr || size < 4096)
         {
-            std::vector<double> local_values;
-            std::vector<std::vector<size_t>> local_indices(tensor.dimension());
+            return isSparse(tensor, threshold);
+        }
 
-#pragma omp for
-            for (size_t flat_index = 0; flat_index < total_elements; ++flat_index)
-            {
-                // Map flat index to dimensional index, ex. index 3 in (2,3) tensor is (1,0)
-                std::vector<size_t> multi_index(tensor.dimension());
-                size_t temp = flat_index;
-                // Figure out the multi index from the flat index
-                for (size_t dim = tensor.dimension(); dim > 0; --dim)
-                {
-                    size_t current_dim = dime - 1;
-                    multi_index[current_dim] = temp % shape[current_dim];
-                    temp /= shape[current_dim];
-                }
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<size_t> position(0, size - 1);
+        double delta = 1.0 - confidence;
 
-                // Check if the value is non zero
-                if (tensor(flat_index) != 0.0)
-                {
-                    local_values.push_back(tensor(flat_index));
-                    for (size_t dim = 0; dim < tensor.dimension(); ++dim)
-                    {
-                        local_indices[dim].push_back(multi_index[dim]);
-                    }
-                }
+        size_t drawn = 0;
+        size_t zero_count = 0;
+        size_t target = 64;
+        for (int round = 0; target <= size / 8; ++round, target *= 2)
+        {
+            for (; drawn < target; ++drawn)
+            {
+                zero_count += data[position(rng)] == 0;
             }
 
-#pragma omp critical
+            double estimate = static_cast<double>(zero_count) / drawn;
+            double roundDelta = delta / std::pow(2.0, round + 1);
+            double halfWidth = std::sqrt(std::log(2.0 / roundDelta) / (2.0 * drawn));
+            if (estimate - halfWidth >= threshold)
             {
-                values.insert(values.end(), local_values.begin(), local_values.end());
-                for (size_t dim = 0; dim < tensor.dimension(); ++dim)
-                {
-                    indices[dim].insert(indices[dim].end(), local_indices[dim].begin(), local_indices[dim].end());
-                }
+                return true;
+            }
+            if (estimate + halfWidth < threshold)
+            {
+                return false;
             }
         }
-        return {values, indices};
+        return isSparse(tensor, threshold);
     }
 
-    // check if the dimensions of the tensors are compatible for multiplication
-    TensorMultiplicabilityAnalysisStruct _areTensorsMultiplicable(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+    // multiplication of two tensors in compressed format
+    inline auto multiplyCompressedFormat(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> xt::xarray<double>
     {
-        // get shapes of the tensors
-        std::vector<size_t> shapeA(tensorA.shape().begin(), tensorA.shape().end());
-        std::vector<size_t> shapeB(tensorB.shape().begin(), tensorB.shape().end());
+        SPARSE_OPS_STATS_CALL("multiplyCompressedFormat");
+        CSR<double> product = multiplyCompressedFormatSparse(tensorA, tensorB);
+        SPARSE_OPS_STATS_PHASE(Assemble);
+        return CSRToDense(product);
+    }
 
-        TensorMultiplicabilityAnalysisStruct result = {true, false};
+    // dense product, every row of the result is a sum of rows of tensorB scaled by the row of tensorA
+    inline auto multiplyDense(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> xt::xarray<double>
+    {
+        TensorMultiplicabilityAnalysisStruct analysis = _areTensorsMultiplicable(tensorA, tensorB);
+        if (!analysis.isMultiplcable)
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
 
-        // Ensure valid dimensions
-        if (shapeA.empty() || shapeB.empty())
+        xt::xarray<double> result = xt::zeros<double>(analysis.resultShape);
+
+        // output rows of all batches split across threads, broadcast batches are read in place
+        const BatchLayout &layout = analysis.layout;
+        size_t inner = layout.innerPerBatch;
+        size_t cols = tensorB.shape().back();
+        long long rows = static_cast<long long>(layout.rows());
+        const double *a = tensorA.data();
+        const double *b = tensorB.data();
+        double *c = result.data();
+#pragma omp parallel for schedule(static) if (rows * inner * cols > 100000)
+        for (long long row = 0; row < rows; ++row)
         {
-            result.isMultiplcable = false;
-            return result;
+            const double *rowA = a + layout.aRow(row) * inner;
+            const double *batchB = b + layout.bOffset(row) * cols;
+            for (size_t k = 0; k < inner; ++k)
+            {
+                _axpy(cols, rowA[k], batchB + k * cols, c + row * cols);
+            }
         }
+        return result;
+    }
 
-        // Check if the last dimension of tensorA is equal to the first dimension of tensorB
-        if (shapeA.back() != shapeB.front())
+    // multiplication of two tensors in compressed format, without expanding the result
+    inline auto multiplyCompressedFormatSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> CSR<double>
+    {
+        SPARSE_OPS_STATS_CALL("multiplyCompressedFormatSparse");
+        // Check dimension compatibility before paying for the conversion
+        TensorMultiplicabilityAnalysisStruct analysis = _areTensorsMultiplicable(tensorA, tensorB);
+        if (!analysis.isMultiplcable)
         {
-            result.isMultiplcable = false;
-            return result;
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
         }
 
-        // Check for broadcasting
-        size_t dimA = shapeA.size();
-        size_t dimB = shapeB.size();
-        size_t maxDims = std::max(dimA, dimB);
+        // Convert tensorA and tensorB to CSR format
+        CSR<double> csrA = _toCompressedFormat(tensorA);
+        CSR<double> csrB = _toCompressedFormat(tensorB);
+
+        // Gustavson product over the rows of all batches, runs in parallel over flop balanced row chunks when OpenMP is enabled
+        return _gustavsonMultiply<double>(csrA, csrB, std::move(analysis.resultShape), analysis.layout);
+    }
 
-        for (size_t i = 1; i <= maxDims - 1; ++i)
+    inline auto multiplyCompressedFormat(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB,
+                                         const PruneOptions &prune) -> xt::xarray<double>
+    {
+        SPARSE_OPS_STATS_CALL("multiplyCompressedFormat");
+        CSR<double> product = multiplyCompressedFormatSparse(tensorA, tensorB, prune);
+        SPARSE_OPS_STATS_PHASE(Assemble);
+        return CSRToDense(product);
+    }
+
+    inline auto multiplyCompressedFormatSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB,
+                                               const PruneOptions &prune) -> CSR<double>
+    {
+        SPARSE_OPS_STATS_CALL("multiplyCompressedFormatSparse");
+        TensorMultiplicabilityAnalysisStruct analysis = _areTensorsMultiplicable(tensorA, tensorB);
+        if (!analysis.isMultiplcable)
         {
-            size_t dimA_index = (i <= dimA - 1) ? shapeA[dimA - 1 - i] : 1;
-            size_t dimB_index = (i <= dimB - 1) ? shapeB[dimB - 1 - i] : 1;
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
 
-            if (dimA_index != dimB_index && dimA_index != 1 && dimB_index != 1)
-            {
-                result.isMultiplcable = false;
-                return result;
-            }
+        CSR<double> csrA = _toCompressedFormat(tensorA);
+        CSR<double> csrB = _toCompressedFormat(tensorB);
+        return _prunedMultiply(csrA, csrB, std::move(analysis.resultShape), analysis.layout, prune);
+    }
 
-            if (dimA_index == 1 || dimB_index == 1)
-            {
-                result.requiresBroadcasting = true;
-            }
+    template <typename Storage, typename Acc>
+    auto multiplyCompressedFormat(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> xt::xarray<double>
+    {
+        SPARSE_OPS_STATS_CALL("multiplyCompressedFormat");
+        CSR<Storage> product = multiplyCompressedFormatSparse<Storage, Acc>(tensorA, tensorB);
+        SPARSE_OPS_STATS_PHASE(Assemble);
+        return CSRToDense(CSRCast<double>(product));
+    }
+
+    // the operands are rounded to Storage while they are compressed, the dense tensors are never copied
+    template <typename Storage, typename Acc>
+    auto multiplyCompressedFormatSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB) -> CSR<Storage>
+    {
+        SPARSE_OPS_STATS_CALL("multiplyCompressedFormatSparse");
+        TensorMultiplicabilityAnalysisStruct analysis = _areTensorsMultiplicable(tensorA, tensorB);
+        if (!analysis.isMultiplcable)
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
         }
 
-        return result;
+        CSR<Storage> csrA = _toCompressedFormat<Storage>(tensorA);
+        CSR<Storage> csrB = _toCompressedFormat<Storage>(tensorB);
+        return _gustavsonMultiply<AccumulatorType<Acc, Storage>>(csrA, csrB, std::move(analysis.resultShape), analysis.layout);
     }
 
-    /*
-    Without hardware and processing optimizations (will be considered and implemented later):
-    xarray multiplication for dense tensors follows a normal routine for matrix multiplication.
-    For higher dimensional tensors, it performs tensor constraction algorithms to convert the tensor
-    into matrices and perform matrix multiplication before reshaping to the higher dimensional result.
-
-    For a matrix multiplication of A (MxK) and B (KxN), the time complexity is O(M*K*N).
-    For a higher dimensional tensor, with tensor contraction, the runtime is based on size of the resulting tensor,
-    O(size of resulting tensor + reshaping overhead)
-
-    For sparse tensor implementation, the runtime is based on converting to CSR format and multiplication of non zero values.
-    Runtime becomes O(size of A + size of B + nnz(A) * nnz(B)), making it faster for cases where the tensors are very sparse and
-    the size of the resulting tensor is much greater than the size of the input tensors. nnz << size of tensor, say 0.05 * size of the tensor.
-    */
+} // namespace sparse_ops
 
-    bool _worthUsingSparse(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+namespace
+{
+    // pointer to the first element of tensors stored in one contiguous buffer, nullptr for anything else
+    template <typename Tensor>
+    auto _contiguousData(const Tensor &tensor) -> const typename Tensor::value_type *
     {
-        // calculating terms of sparsity runtime calculation
-        double sparsityA = sparse_ops::sparsity(tensorA);
-        double sparsityB = sparse_ops::sparsity(tensorB);
+        if constexpr (_hasContiguousData<Tensor>::value)
+        {
+            if (tensor.layout() == xt::layout_type::row_major || tensor.layout() == xt::layout_type::column_major)
+            {
+                return tensor.data() + tensor.data_offset();
+            }
+        }
+        return nullptr;
+    }
 
-        size_t total_elementsA = tensorA.size();
-        size_t nnzA = static_cast<size_t>(total_elementsA * sparsityA);
+    // smallest zero count for which zeros / size >= threshold
+    inline size_t _zerosNeeded(size_t size, double threshold)
+    {
+        double needed = std::ceil(threshold * static_cast<double>(size));
+        return needed <= 0.0 ? 0 : static_cast<size_t>(needed);
+    }
 
-        size_t total_elementsB = tensorB.size();
-        size_t nnzB = static_cast<size_t>(total_elementsB * sparsityB);
+    // Private helper to convert to xarray to CSR format, generalized for any tensor shape
+    template <typename Storage, typename Tensor>
+    auto _toCompressedFormat(const Tensor &tensor) -> CSR<Storage>
+    {
+        // containers are read in place by the parallel two pass conversion, leading dimensions are flattened into rows
+        SPARSE_OPS_STATS_CALL("toCompressedFormat");
+        SPARSE_OPS_STATS_PHASE(Convert);
+        std::vector<size_t> shape(tensor.shape().begin(), tensor.shape().end());
+        const auto *data = _contiguousData(tensor);
+        if (data != nullptr && tensor.layout() == xt::layout_type::row_major)
+        {
+            CSR<Storage> csr(data, std::move(shape));
+            _recordConversionStats(csr);
+            return csr;
+        }
 
-        size_t sparse_runtime = total_elementsA + total_elementsB + nnzA * nnzB;
+        // anything else is evaluated into a row major buffer first
+        xt::xarray<double> evaluated(tensor);
+        CSR<Storage> csr(evaluated.data(), std::move(shape));
+        _recordConversionStats(csr);
+        return csr;
+    }
 
-        // calculating terms for the dense runtime calculation
+    // the dense operand is scanned once, then the nonzeros and the row pointers are written
+    template <typename Storage>
+    void _recordConversionStats([[maybe_unused]] const CSR<Storage> &csr)
+    {
+#ifdef SPARSE_OPS_STATS
+        size_t size = CSR<Storage>::rowsOf(csr.getShape()) * csr.cols();
+        SPARSE_OPS_STATS_SET(nnzOut, csr.nnz());
+        SPARSE_OPS_STATS_ADD(bytesMoved, size * sizeof(double) + csr.nnz() * (sizeof(Storage) + sizeof(size_t)) +
+                                             (csr.rows() + 1) * sizeof(size_t));
+#endif
+    }
 
-        // finding resulting tensor size
-        auto shapeA = tensorA.shape();
-        auto shapeB = tensorB.shape();
+    // check if the dimensions of the tensors are compatible for multiplication
+    TensorMultiplicabilityAnalysisStruct _areTensorsMultiplicable(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+    {
+        // get shapes of the tensors
+        std::vector<size_t> shapeA(tensorA.shape().begin(), tensorA.shape().end());
+        std::vector<size_t> shapeB(tensorB.shape().begin(), tensorB.shape().end());
 
-        std::vector<size_t> resultShape;
-        resultShape.insert(resultShape.end(), shapeA.begin(), shapeA.end() - 1);
-        resultShape.insert(resultShape.end(), shapeB.begin() + 1, shapeB.end());
+        TensorMultiplicabilityAnalysisStruct result = {true, false, {}, {}};
 
-        size_t resultSize = 1;
-        for (const auto &dim : resultShape)
-        {
-            resultSize *= dim;
-        }
+        // batched matmul, [..., M, K] x [..., K, N] with the batch dimensions broadcast against each other
+        result.isMultiplcable = _batchLayout(shapeA, shapeB, CSR<double>::rowsOf(shapeA), result.layout, result.resultShape);
+        result.requiresBroadcasting = result.layout.broadcast;
 
-        return sparse_runtime < resultSize;
+        return result;
     }
 }
 
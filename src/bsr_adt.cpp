@@ -0,0 +1,4 @@
+#include "../include/bsr_adt.hpp"
+
+template class BSR<double>;
+template class BSR<float>;
\ No newline at end of file
@@ -0,0 +1,4 @@
+#include "../include/csc_adt.hpp"
+
+template class CSC<double>;
+template class CSC<float>;
\ No newline at end of file
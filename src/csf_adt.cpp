@@ -0,0 +1,4 @@
+#include "../include/csf_adt.hpp"
+
+template class CSF<double>;
+template class CSF<float>;
\ No newline at end of file
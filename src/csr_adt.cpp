@@ -1,4 +1,9 @@
 #include "../include/csr_adt.hpp"
 
 template class CSR<double>;
-template class CSR<float>;
\ No newline at end of file
+template class CSR<float>;
+template class CSR<double, uint32_t>;
+template class CSR<float, uint32_t>;
+template class CSR<double, uint16_t>;
+template class CSR<float, uint16_t>;
+template class CSR<bfloat16>;
\ No newline at end of file
@@ -0,0 +1,4 @@
+#include "../include/csr_dynamic.hpp"
+
+template class DynamicCSR<double>;
+template class DynamicCSR<float>;
\ No newline at end of file
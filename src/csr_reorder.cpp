@@ -0,0 +1,4 @@
+#include "../include/csr_reorder.hpp"
+
+template class ReorderedCSR<double>;
+template class ReorderedCSR<float>;
\ No newline at end of file
@@ -0,0 +1,8 @@
+#include "../include/csr_stream.hpp"
+
+template class CSRPanelReader<double>;
+template class CSRPanelReader<float>;
+template class CSRPanelReader<bfloat16>;
+template class CSRPanelWriter<double>;
+template class CSRPanelWriter<float>;
+template class CSRPanelWriter<bfloat16>;
\ No newline at end of file
@@ -0,0 +1,520 @@
+#include "../include/dispatch.hpp"
+#include "../include/csr_operations.hpp"
+#include "../include/stats.hpp"
+#include "../include/xtensor_operations.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    // state behind costModel() and the dispatch logger
+    std::mutex modelMutex;
+    bool modelLoaded = false;
+    sparse_ops::CostModel activeModel;
+
+    std::mutex logMutex;
+    sparse_ops::DispatchLogger activeLogger;
+    std::deque<sparse_ops::DispatchDecision> recentDecisions;
+    constexpr size_t maxRecentDecisions = 1024;
+
+    // fastest of a few runs, in seconds
+    template <typename F>
+    double _bestOf(int repetitions, F &&run)
+    {
+        double best = 1e30;
+        for (int i = 0; i < repetitions; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+
+    xt::xarray<double> _randomTensor(size_t rows, size_t cols, double density, unsigned seed)
+    {
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        xt::xarray<double> tensor = xt::zeros<double>(std::vector<size_t>{rows, cols});
+        for (auto &val : tensor)
+        {
+            if (uniform(rng) < density)
+            {
+                val = uniform(rng) + 0.5;
+            }
+        }
+        return tensor;
+    }
+
+    // seconds per flop and per output nonzero of one SpGEMM run
+    struct SpGEMMSample
+    {
+        double seconds;
+        double flops;
+        double outputs;
+    };
+
+    SpGEMMSample _sampleSpGEMM(size_t n, double density, unsigned seed)
+    {
+        CSR<double> a(_randomTensor(n, n, density, seed));
+        CSR<double> b(_randomTensor(n, n, density, seed + 1));
+        size_t flops = 0;
+        for (size_t rowFlops : _rowFlops(a, b))
+        {
+            flops += rowFlops;
+        }
+        size_t outputs = 0;
+        double seconds = _bestOf(3, [&]
+                                 { outputs = CSRMult(a, b).nnz(); });
+        return {seconds, static_cast<double>(flops), static_cast<double>(outputs)};
+    }
+
+    void _writeDecision(const sparse_ops::DispatchDecision &decision)
+    {
+        recentDecisions.push_back(decision);
+        if (recentDecisions.size() > maxRecentDecisions)
+        {
+            recentDecisions.pop_front();
+        }
+
+        if (const char *path = std::getenv("SPARSE_OPS_DISPATCH_LOG"))
+        {
+            std::ofstream out(path, std::ios::app);
+            out << sparse_ops::formatDecision(decision) << "\n";
+        }
+    }
+
+    // counts of a sparse times dense product for the stats of the current call
+    void _recordSparseDenseStats([[maybe_unused]] const CSR<double> &csrA, [[maybe_unused]] const xt::xarray<double> &tensorB,
+                                 [[maybe_unused]] const xt::xarray<double> &result)
+    {
+#ifdef SPARSE_OPS_STATS
+        size_t cols = tensorB.shape().back();
+        SPARSE_OPS_STATS_SET(nnzA, csrA.nnz());
+        SPARSE_OPS_STATS_SET(nnzB, tensorB.size());
+        SPARSE_OPS_STATS_SET(nnzOut, result.size());
+        SPARSE_OPS_STATS_SET(flops, csrA.nnz() * cols);
+        SPARSE_OPS_STATS_ADD(bytesMoved, csrA.nnz() * (sizeof(double) + sizeof(size_t)) +
+                                             (csrA.nnz() * cols + result.size()) * sizeof(double));
+#endif
+    }
+
+    // hand a decision to the log and to the active logger, the logger runs outside the lock
+    void _recordDecision(const sparse_ops::DispatchDecision &decision)
+    {
+        sparse_ops::DispatchLogger logger;
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            _writeDecision(decision);
+            logger = activeLogger;
+        }
+        if (logger)
+        {
+            logger(decision);
+        }
+    }
+}
+
+namespace sparse_ops
+{
+    const char *kernelName(MultiplyKernel kernel)
+    {
+        switch (kernel)
+        {
+        case MultiplyKernel::Dense:
+            return "dense";
+        case MultiplyKernel::SparseSparse:
+            return "sparse_sparse";
+        case MultiplyKernel::SparseDense:
+            return "sparse_dense";
+        }
+        return "unknown";
+    }
+
+    // roughly a single core of a recent x86 machine
+    CostModel defaultCostModel()
+    {
+        return {0.25e-9, 0.1e-9, 2e-9, 4e-9, 10e-9, 0.5e-9, 0.5e-9};
+    }
+
+    CostModel calibrateCostModel()
+    {
+        CostModel model = defaultCostModel();
+
+        // writing a dense result
+        std::vector<size_t> outputShape{2048, 1024};
+        double seconds = _bestOf(3, [&]
+                                 { xt::xarray<double> out = xt::zeros<double>(outputShape); });
+        model.denseOutput = seconds / (2048.0 * 1024.0);
+
+        // dense kernel
+        size_t n = 192;
+        xt::xarray<double> denseA = _randomTensor(n, n, 1.0, 1);
+        xt::xarray<double> denseB = _randomTensor(n, n, 1.0, 2);
+        seconds = _bestOf(3, [&]
+                          { multiplyDense(denseA, denseB); });
+        model.denseFlop = std::max(seconds - n * n * model.denseOutput, seconds / 2) / (double(n) * n * n);
+
+        // scanning and converting
+        xt::xarray<double> scanned = _randomTensor(2048, 1024, 0.05, 3);
+        seconds = _bestOf(3, [&]
+                          { sparsity(scanned); });
+        model.scanElement = seconds / scanned.size();
+
+        seconds = _bestOf(3, [&]
+                          { CSR<double> converted(scanned); });
+        double nonZeros = std::max(1.0, (1.0 - sparsity(scanned)) * scanned.size());
+        model.convertNonZero = std::max(seconds - scanned.size() * model.scanElement, seconds / 4) / nonZeros;
+
+        /*
+        SpGEMM time is flops * sparseFlop + outputs * sparseOutput. One run with almost no merging and one with
+        heavy merging give two equations for the two coefficients.
+        */
+        SpGEMMSample unmerged = _sampleSpGEMM(3000, 0.001, 4);
+        SpGEMMSample merged = _sampleSpGEMM(300, 0.15, 6);
+        double determinant = unmerged.flops * merged.outputs - merged.flops * unmerged.outputs;
+        double sparseFlop = (unmerged.seconds * merged.outputs - merged.seconds * unmerged.outputs) / determinant;
+        double sparseOutput = (unmerged.flops * merged.seconds - merged.flops * unmerged.seconds) / determinant;
+        if (std::isfinite(sparseFlop) && std::isfinite(sparseOutput) && sparseFlop > 0 && sparseOutput > 0)
+        {
+            model.sparseFlop = sparseFlop;
+            model.sparseOutput = sparseOutput;
+        }
+        else
+        {
+            // noisy timings, charge everything to the flops
+            model.sparseFlop = merged.seconds / merged.flops;
+            model.sparseOutput = model.sparseFlop;
+        }
+
+        // sparse times dense
+        CSR<double> sparseA(_randomTensor(1000, 1000, 0.01, 8));
+        xt::xarray<double> denseX = _randomTensor(1000, 64, 1.0, 9);
+        xt::xarray<double> product;
+        seconds = _bestOf(3, [&]
+                          { CSRMultDense(sparseA, denseX, product); });
+        model.spmmFlop = seconds / std::max<double>(1.0, sparseA.nnz() * 64.0);
+
+        return model;
+    }
+
+    std::string defaultProfilePath()
+    {
+        if (const char *path = std::getenv("SPARSE_OPS_PROFILE"))
+        {
+            return path;
+        }
+        if (const char *home = std::getenv("HOME"))
+        {
+            return std::string(home) + "/.sparse_ops_profile";
+        }
+        return ".sparse_ops_profile";
+    }
+
+    bool saveCostModel(const CostModel &model, const std::string &path)
+    {
+        std::ofstream out(path);
+        out.precision(17);
+        out << "sparse_ops_cost_model 1\n"
+            << "denseFlop " << model.denseFlop << "\n"
+            << "scanElement " << model.scanElement << "\n"
+            << "convertNonZero " << model.convertNonZero << "\n"
+            << "sparseFlop " << model.sparseFlop << "\n"
+            << "sparseOutput " << model.sparseOutput << "\n"
+            << "spmmFlop " << model.spmmFlop << "\n"
+            << "denseOutput " << model.denseOutput << "\n";
+        return static_cast<bool>(out);
+    }
+
+    bool loadCostModel(CostModel &model, const std::string &path)
+    {
+        std::ifstream in(path);
+        std::string key;
+        int version = 0;
+        if (!(in >> key >> version) || key != "sparse_ops_cost_model" || version != 1)
+        {
+            return false;
+        }
+
+        CostModel loaded{};
+        std::pair<const char *, double *> fields[] = {
+            {"denseFlop", &loaded.denseFlop},
+            {"scanElement", &loaded.scanElement},
+            {"convertNonZero", &loaded.convertNonZero},
+            {"sparseFlop", &loaded.sparseFlop},
+            {"sparseOutput", &loaded.sparseOutput},
+            {"spmmFlop", &loaded.spmmFlop},
+            {"denseOutput", &loaded.denseOutput}};
+
+        size_t found = 0;
+        double value;
+        while (in >> key >> value)
+        {
+            for (auto &field : fields)
+            {
+                if (key == field.first && value > 0)
+                {
+                    *field.second = value;
+                    ++found;
+                }
+            }
+        }
+        if (found != std::size(fields))
+        {
+            return false;
+        }
+
+        model = loaded;
+        return true;
+    }
+
+    CostModel calibrateProfile(const std::string &path)
+    {
+        CostModel model = calibrateCostModel();
+        if (!saveCostModel(model, path))
+        {
+            throw std::runtime_error("Cannot write the cost model profile " + path);
+        }
+        setCostModel(model);
+        return model;
+    }
+
+    CostModel costModel()
+    {
+        std::lock_guard<std::mutex> lock(modelMutex);
+        if (!modelLoaded)
+        {
+            if (!loadCostModel(activeModel, defaultProfilePath()))
+            {
+                activeModel = defaultCostModel();
+            }
+            modelLoaded = true;
+        }
+        return activeModel;
+    }
+
+    void setCostModel(const CostModel &model)
+    {
+        std::lock_guard<std::mutex> lock(modelMutex);
+        activeModel = model;
+        modelLoaded = true;
+    }
+
+    void setDispatchLogger(DispatchLogger logger)
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        activeLogger = std::move(logger);
+    }
+
+    std::vector<DispatchDecision> dispatchLog()
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        return std::vector<DispatchDecision>(recentDecisions.begin(), recentDecisions.end());
+    }
+
+    std::string formatDecision(const DispatchDecision &decision)
+    {
+        auto formatShape = [](const std::vector<size_t> &shape)
+        {
+            std::string text = "[";
+            for (size_t i = 0; i < shape.size(); ++i)
+            {
+                text += std::to_string(shape[i]) + (i + 1 < shape.size() ? "," : "");
+            }
+            return text + "]";
+        };
+
+        std::ostringstream out;
+        out << "kernel=" << kernelName(decision.kernel)
+            << " shapeA=" << formatShape(decision.shapeA) << " shapeB=" << formatShape(decision.shapeB)
+            << " densityA=" << decision.densityA << " densityB=" << decision.densityB
+            << " costDense=" << decision.costDense << " costSparseSparse=" << decision.costSparseSparse
+            << " costSparseDense=" << decision.costSparseDense;
+        if (decision.transposeA)
+        {
+            out << " transposeA=1";
+        }
+        return out.str();
+    }
+
+    /*
+    Predicted seconds of every kernel for A (M x K) times B (K x N), with nonzeros spread uniformly. For batched
+    products M counts the output rows of all batches:
+    - dense: M * K * N multiply adds and the M * N result
+    - sparse sparse: scan and convert both operands, nnz(A) * density(B) * N multiply adds,
+      the expected distinct outputs M * N * (1 - (1 - dA * dB)^K), then the dense result
+    - sparse dense: scan and convert A, nnz(A) * N multiply adds, then the dense result
+    A transposed A costs the dense kernel a transposed copy. The sparse sparse kernel pays for one more pass moving
+    the nonzeros of A into rows of A^T, or for a dense result when pushing the rows of A into it is cheaper, see
+    CSRTransposeMult. The sparse dense kernel pushes the rows of A straight into the result.
+    */
+    DispatchDecision chooseKernel(const std::vector<size_t> &shapeA, const std::vector<size_t> &shapeB,
+                                  double densityA, double densityB, const CostModel &model, bool transposeA)
+    {
+        if (transposeA && (shapeA.size() != 2 || shapeB.size() != 2))
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
+        std::vector<size_t> productShapeA = transposeA ? std::vector<size_t>{shapeA[1], shapeA[0]} : shapeA;
+
+        BatchLayout layout;
+        std::vector<size_t> resultShape;
+        if (!_batchLayout(productShapeA, shapeB, CSR<double>::rowsOf(productShapeA), layout, resultShape))
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
+
+        // rows of the result over all batches, broadcast operands are only scanned and converted once
+        double inner = static_cast<double>(productShapeA.back());
+        double rows = static_cast<double>(layout.rows());
+        double cols = static_cast<double>(shapeB.back());
+
+        double sizeA = static_cast<double>(CSR<double>::rowsOf(productShapeA)) * inner;
+        double sizeB = static_cast<double>(CSR<double>::rowsOf(shapeB)) * cols;
+        double sizeResult = rows * cols;
+        double nnzA = densityA * sizeA;
+        double nnzB = densityB * sizeB;
+        double productNnzA = densityA * rows * inner;
+        double sparseFlops = productNnzA * densityB * cols;
+        double outputs = sizeResult * -std::expm1(inner * std::log1p(-std::min(densityA * densityB, 1.0 - 1e-12)));
+
+        DispatchDecision decision;
+        decision.shapeA = shapeA;
+        decision.shapeB = shapeB;
+        decision.densityA = densityA;
+        decision.densityB = densityB;
+        decision.costDense = rows * inner * cols * model.denseFlop + sizeResult * model.denseOutput;
+        decision.costSparseSparse = (sizeA + sizeB) * model.scanElement + (nnzA + nnzB) * model.convertNonZero +
+                                    sparseFlops * model.sparseFlop + outputs * model.sparseOutput +
+                                    sizeResult * model.denseOutput;
+        // the SpMM kernel takes a single dense matrix, batched B always goes through the other kernels
+        decision.costSparseDense = shapeB.size() > 2 ? std::numeric_limits<double>::infinity()
+                                                     : sizeA * model.scanElement + nnzA * model.convertNonZero +
+                                                           productNnzA * cols * model.spmmFlop + sizeResult * model.denseOutput;
+        decision.transposeA = transposeA;
+        if (transposeA)
+        {
+            decision.costDense += sizeA * (model.scanElement + model.denseOutput);
+            decision.costSparseSparse += std::min(nnzA * model.convertNonZero, sizeResult * model.denseOutput);
+        }
+
+        decision.kernel = MultiplyKernel::Dense;
+        double best = decision.costDense;
+        if (decision.costSparseDense < best)
+        {
+            decision.kernel = MultiplyKernel::SparseDense;
+            best = decision.costSparseDense;
+        }
+        if (decision.costSparseSparse < best)
+        {
+            decision.kernel = MultiplyKernel::SparseSparse;
+        }
+        return decision;
+    }
+
+    xt::xarray<double> multiply(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+    {
+        SPARSE_OPS_STATS_CALL("multiply");
+        TensorMultiplicabilityAnalysisStruct analysis = _areTensorsMultiplicable(tensorA, tensorB);
+        if (!analysis.isMultiplcable)
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
+
+        // sampled densities, the routing does not need them exactly
+        double densityA = 1.0 - estimateSparsity(tensorA).sparsity;
+        double densityB = 1.0 - estimateSparsity(tensorB).sparsity;
+
+        std::vector<size_t> shapeA(tensorA.shape().begin(), tensorA.shape().end());
+        std::vector<size_t> shapeB(tensorB.shape().begin(), tensorB.shape().end());
+        DispatchDecision decision = chooseKernel(shapeA, shapeB, densityA, densityB, costModel());
+
+        _recordDecision(decision);
+        SPARSE_OPS_STATS_SET(kernel, kernelName(decision.kernel));
+
+        switch (decision.kernel)
+        {
+        case MultiplyKernel::SparseSparse:
+            return multiplyCompressedFormat(tensorA, tensorB);
+        case MultiplyKernel::SparseDense:
+        {
+            xt::xarray<double> result;
+            CSR<double> csrA = _toCompressedFormat(tensorA);
+            CSRMultDense(csrA, tensorB, result);
+            _recordSparseDenseStats(csrA, tensorB, result);
+            return result;
+        }
+        case MultiplyKernel::Dense:
+        default:
+            return multiplyDense(tensorA, tensorB);
+        }
+    }
+
+    xt::xarray<double> multiplyTransposed(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+    {
+        SPARSE_OPS_STATS_CALL("multiplyTransposed");
+        if (tensorA.dimension() != 2 || tensorB.dimension() != 2 || tensorA.shape()[0] != tensorB.shape()[0])
+        {
+            throw std::invalid_argument("Tensors are not compatible for multiplication");
+        }
+
+        double densityA = 1.0 - estimateSparsity(tensorA).sparsity;
+        double densityB = 1.0 - estimateSparsity(tensorB).sparsity;
+
+        std::vector<size_t> shapeA(tensorA.shape().begin(), tensorA.shape().end());
+        std::vector<size_t> shapeB(tensorB.shape().begin(), tensorB.shape().end());
+        DispatchDecision decision = chooseKernel(shapeA, shapeB, densityA, densityB, costModel(), true);
+        _recordDecision(decision);
+        SPARSE_OPS_STATS_SET(kernel, kernelName(decision.kernel));
+
+        switch (decision.kernel)
+        {
+        case MultiplyKernel::SparseSparse:
+        {
+            CSR<double> csrA = _toCompressedFormat(tensorA);
+            CSR<double> csrB = _toCompressedFormat(tensorB);
+            CSR<double> product = CSRTransposeMult(csrA, csrB);
+            SPARSE_OPS_STATS_SET(nnzA, csrA.nnz());
+            SPARSE_OPS_STATS_SET(nnzB, csrB.nnz());
+            SPARSE_OPS_STATS_SET(nnzOut, product.nnz());
+            SPARSE_OPS_STATS_PHASE(Assemble);
+            return CSRToDense(product);
+        }
+        case MultiplyKernel::SparseDense:
+        {
+            xt::xarray<double> result;
+            CSR<double> csrA = _toCompressedFormat(tensorA);
+            CSRTransposeMultDense(csrA, tensorB, result);
+            _recordSparseDenseStats(csrA, tensorB, result);
+            return result;
+        }
+        case MultiplyKernel::Dense:
+        default:
+        {
+            size_t inner = shapeA[0];
+            size_t rows = shapeA[1];
+            xt::xarray<double> transposed = xt::zeros<double>(std::vector<size_t>{rows, inner});
+            const double *from = tensorA.data();
+            double *to = transposed.data();
+            for (size_t k = 0; k < inner; ++k)
+            {
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    to[i * inner + k] = from[k * rows + i];
+                }
+            }
+            return multiplyDense(transposed, tensorB);
+        }
+        }
+    }
+}
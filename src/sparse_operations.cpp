@@ -7,4 +7,13 @@ namespace sparse_ops {
 
     template double sparse_ops::sparsity<xt::xarray<double>>(const xt::xarray<double>&);
     template double sparse_ops::sparsity<xt::xtensor<float, 2>>(const xt::xtensor<float, 2>&);
+
+    template bool sparse_ops::isSparseParallel<xt::xarray<double>>(const xt::xarray<double>&, double);
+    template bool sparse_ops::isSparseParallel<xt::xtensor<float, 2>>(const xt::xtensor<float, 2>&, double);
+
+    template sparse_ops::SparsityEstimate sparse_ops::estimateSparsity<xt::xarray<double>>(const xt::xarray<double>&, double, double, uint64_t);
+    template sparse_ops::SparsityEstimate sparse_ops::estimateSparsity<xt::xtensor<float, 2>>(const xt::xtensor<float, 2>&, double, double, uint64_t);
+
+    template bool sparse_ops::isSparseSampled<xt::xarray<double>>(const xt::xarray<double>&, double, double, uint64_t);
+    template bool sparse_ops::isSparseSampled<xt::xtensor<float, 2>>(const xt::xtensor<float, 2>&, double, double, uint64_t);
 }
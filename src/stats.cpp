@@ -0,0 +1,240 @@
+#include "../include/stats.hpp"
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace
+{
+    // recorded calls behind stats()
+    std::mutex statsMutex;
+    std::deque<sparse_ops::CallStats> recentCalls;
+    size_t totalCalls = 0;
+    constexpr size_t maxRecentCalls = 1024;
+
+    // innermost open call of every thread
+    thread_local sparse_ops::StatsScope *openScope = nullptr;
+
+    double _secondsSince(std::chrono::steady_clock::time_point start)
+    {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count();
+    }
+
+    int _threadSlot()
+    {
+#ifdef _OPENMP
+        return omp_get_thread_num();
+#else
+        return 0;
+#endif
+    }
+
+    // times, bytes and collisions add up, counts fill the fields the outer call left unset
+    void _fold(sparse_ops::CallStats &outer, const sparse_ops::CallStats &inner)
+    {
+        for (size_t phase = 0; phase < sparse_ops::statsPhaseCount; ++phase)
+        {
+            outer.phaseSeconds[phase] += inner.phaseSeconds[phase];
+        }
+        outer.bytesMoved += inner.bytesMoved;
+        outer.collisions += inner.collisions;
+        outer.nnzA = outer.nnzA != 0 ? outer.nnzA : inner.nnzA;
+        outer.nnzB = outer.nnzB != 0 ? outer.nnzB : inner.nnzB;
+        outer.nnzOut = outer.nnzOut != 0 ? outer.nnzOut : inner.nnzOut;
+        outer.flops = outer.flops != 0 ? outer.flops : inner.flops;
+        if (outer.kernel.empty())
+        {
+            outer.kernel = inner.kernel;
+        }
+        if (inner.threads > outer.threads)
+        {
+            outer.threads = inner.threads;
+            outer.imbalance = inner.imbalance;
+        }
+    }
+
+    void _writeJson(std::ostringstream &out, const sparse_ops::CallStats &call)
+    {
+        out << "{\"operation\": \"" << call.operation << "\", \"kernel\": \"" << call.kernel << "\""
+            << ", \"nnz_a\": " << call.nnzA << ", \"nnz_b\": " << call.nnzB << ", \"nnz_out\": " << call.nnzOut
+            << ", \"flops\": " << call.flops << ", \"bytes_moved\": " << call.bytesMoved
+            << ", \"collisions\": " << call.collisions << ", \"threads\": " << call.threads
+            << ", \"imbalance\": " << call.imbalance << ", \"seconds\": {\"total\": " << call.totalSeconds;
+        for (size_t phase = 0; phase < sparse_ops::statsPhaseCount; ++phase)
+        {
+            out << ", \"" << sparse_ops::phaseName(static_cast<sparse_ops::StatsPhase>(phase))
+                << "\": " << call.phaseSeconds[phase];
+        }
+        out << "}}";
+    }
+}
+
+namespace sparse_ops
+{
+    const char *phaseName(StatsPhase phase)
+    {
+        switch (phase)
+        {
+        case StatsPhase::Convert:
+            return "convert";
+        case StatsPhase::Symbolic:
+            return "symbolic";
+        case StatsPhase::Numeric:
+            return "numeric";
+        case StatsPhase::Assemble:
+            return "assemble";
+        }
+        return "unknown";
+    }
+
+    std::string StatsSnapshot::toJson() const
+    {
+        std::ostringstream out;
+        out << "{\n  \"total_calls\": " << totalCalls << ",\n  \"calls\": [\n";
+        for (size_t i = 0; i < calls.size(); ++i)
+        {
+            out << "    ";
+            _writeJson(out, calls[i]);
+            out << (i + 1 < calls.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        return out.str();
+    }
+
+    StatsSnapshot stats()
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        StatsSnapshot snapshot;
+        snapshot.calls.assign(recentCalls.begin(), recentCalls.end());
+        snapshot.totalCalls = totalCalls;
+        return snapshot;
+    }
+
+    void resetStats()
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        recentCalls.clear();
+        totalCalls = 0;
+    }
+
+    // StatsScope
+    StatsScope::StatsScope(const char *operation)
+        : outer(openScope), start(std::chrono::steady_clock::now())
+    {
+        record.operation = operation;
+        openScope = this;
+    }
+
+    StatsScope::~StatsScope()
+    {
+        record.totalSeconds = _secondsSince(start);
+        openScope = outer;
+        if (outer != nullptr)
+        {
+            _fold(outer->record, record);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        recentCalls.push_back(std::move(record));
+        if (recentCalls.size() > maxRecentCalls)
+        {
+            recentCalls.pop_front();
+        }
+        ++totalCalls;
+    }
+
+    CallStats *StatsScope::current()
+    {
+        return openScope != nullptr ? &openScope->record : nullptr;
+    }
+
+    // PhaseTimer
+    PhaseTimer::PhaseTimer(StatsPhase phase)
+        : scope(openScope), phase(phase), start(std::chrono::steady_clock::now())
+    {
+        if (scope != nullptr)
+        {
+            ++scope->phaseDepth;
+        }
+    }
+
+    PhaseTimer::~PhaseTimer()
+    {
+        stop();
+    }
+
+    void PhaseTimer::stop()
+    {
+        if (scope != nullptr && --scope->phaseDepth == 0)
+        {
+            scope->record.phaseSeconds[static_cast<size_t>(phase)] += _secondsSince(start);
+        }
+        scope = nullptr;
+    }
+
+    // ThreadStats
+    ThreadStats::ThreadStats()
+    {
+        size_t numThreads = 1;
+#ifdef _OPENMP
+        numThreads = static_cast<size_t>(omp_get_max_threads());
+#endif
+        busySeconds.assign(numThreads, 0.0);
+        collisions.assign(numThreads, 0);
+    }
+
+    void ThreadStats::addBusy(double seconds)
+    {
+        busySeconds[_threadSlot()] += seconds;
+#ifdef _OPENMP
+        teamSize.store(static_cast<size_t>(omp_get_num_threads()), std::memory_order_relaxed);
+#endif
+    }
+
+    void ThreadStats::addCollisions(size_t count)
+    {
+        collisions[_threadSlot()] += count;
+    }
+
+    void ThreadStats::report() const
+    {
+        CallStats *call = StatsScope::current();
+        if (call == nullptr)
+        {
+            return;
+        }
+
+        // a thread of the team that got no work counts as idle, so one thread doing everything reports the team size
+        size_t threads = teamSize.load(std::memory_order_relaxed);
+        double busiest = 0.0;
+        double total = 0.0;
+        for (size_t slot = 0; slot < busySeconds.size(); ++slot)
+        {
+            call->collisions += collisions[slot];
+            busiest = std::max(busiest, busySeconds[slot]);
+            total += busySeconds[slot];
+        }
+        if (total > 0.0 && threads >= call->threads)
+        {
+            call->threads = threads;
+            call->imbalance = busiest * threads / total;
+        }
+    }
+
+    // BusyTimer
+    BusyTimer::BusyTimer(ThreadStats &threadStats)
+        : threadStats(threadStats), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    BusyTimer::~BusyTimer()
+    {
+        threadStats.addBusy(_secondsSince(start));
+    }
+}
@@ -0,0 +1,2012 @@
+#include "../include/bsr_operations.hpp"
+#include "../include/csc_operations.hpp"
+#include "../include/csf_operations.hpp"
+#include "../include/csr_dynamic.hpp"
+#include "../include/csr_expression.hpp"
+#include "../include/csr_io.hpp"
+#include "../include/csr_operations.hpp"
+#include "../include/csr_reorder.hpp"
+#include "../include/csr_stream.hpp"
+#include "../include/csr_varint.hpp"
+#include "../include/dispatch.hpp"
+#include "../include/xtensor_operations.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+Checks of the CSR kernels against dense references. Every check runs, failures are counted and reported, and the
+exit code is nonzero when any failed, so the test works the same with and without NDEBUG.
+*/
+
+static int failures = 0;
+
+#define CHECK(condition)                                                                        \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(condition))                                                                       \
+        {                                                                                       \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                                         \
+        }                                                                                       \
+    } while (0)
+
+// the statement may hold commas, so it comes last
+#define CHECK_THROWS(exception, ...) \
+    do                               \
+    {                                \
+        bool thrown = false;         \
+        try                          \
+        {                            \
+            __VA_ARGS__;             \
+        }                            \
+        catch (const exception &)    \
+        {                            \
+            thrown = true;           \
+        }                            \
+        CHECK(thrown);               \
+    } while (0)
+
+namespace
+{
+    // helper functions
+    xt::xarray<double> _randomTensor(const std::vector<size_t> &shape, double density, std::mt19937 &generator)
+    {
+        xt::xarray<double> tensor = xt::zeros<double>(shape);
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (size_t i = 0; i < tensor.size(); ++i)
+        {
+            if (uniform(generator) < density)
+            {
+                // small integers keep every product exact whatever order it is summed in
+                tensor.data()[i] = std::floor(uniform(generator) * 9) + 1;
+            }
+        }
+        return tensor;
+    }
+
+    bool _sameTensor(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+    {
+        if (tensorA.shape() != tensorB.shape())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < tensorA.size(); ++i)
+        {
+            double a = tensorA.data()[i];
+            double b = tensorB.data()[i];
+            if (std::fabs(a - b) > 1e-9 * std::max(1.0, std::fabs(b)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // product of two matrices computed densely
+    xt::xarray<double> _denseProduct(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+    {
+        size_t rows = tensorA.shape()[0];
+        size_t inner = tensorA.shape()[1];
+        size_t cols = tensorB.shape()[1];
+        xt::xarray<double> result = xt::zeros<double>(std::vector<size_t>{rows, cols});
+        for (size_t i = 0; i < rows; ++i)
+        {
+            for (size_t k = 0; k < inner; ++k)
+            {
+                for (size_t j = 0; j < cols; ++j)
+                {
+                    result.data()[i * cols + j] += tensorA.data()[i * inner + k] * tensorB.data()[k * cols + j];
+                }
+            }
+        }
+        return result;
+    }
+
+    xt::xarray<float> _toFloat(const xt::xarray<double> &tensor)
+    {
+        xt::xarray<float> result = xt::zeros<float>(tensor.shape());
+        std::copy(tensor.data(), tensor.data() + tensor.size(), result.data());
+        return result;
+    }
+
+    template <typename T>
+    xt::xarray<double> _toDouble(const xt::xarray<T> &tensor)
+    {
+        xt::xarray<double> result = xt::zeros<double>(tensor.shape());
+        std::copy(tensor.data(), tensor.data() + tensor.size(), result.data());
+        return result;
+    }
+
+    // an axpy kernel matches the scalar loop for every length, so every vector tail is covered
+    template <typename T, typename Kernel>
+    bool _matchesAxpy(Kernel kernel, std::mt19937 &generator)
+    {
+        for (size_t n = 0; n < 70; ++n)
+        {
+            std::vector<T> x(n), y(n), expected(n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                x[i] = static_cast<T>(generator() % 9);
+                y[i] = static_cast<T>(generator() % 9);
+                expected[i] = y[i] + T(3) * x[i];
+            }
+            kernel(n, T(3), x.data(), y.data());
+            if (y != expected)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // a count and gather pair matches the scalar loops for every length and share of zeros
+    template <typename T, typename Count, typename Gather>
+    bool _matchesGather(Count count, Gather gather, std::mt19937 &generator)
+    {
+        for (size_t n = 0; n < 70; ++n)
+        {
+            for (unsigned zeros : {0u, 2u, 9u})
+            {
+                std::vector<T> src(n);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    src[i] = generator() % 10 < zeros ? T(0) : static_cast<T>(1 + generator() % 9);
+                }
+                size_t expected = _countNonZeros<T>(src.data(), n);
+                std::vector<uint32_t> indices(n), expectedIndices(n);
+                std::vector<T> values(n), expectedValues(n);
+                _gatherNonZeros<T, T>(src.data(), n, 7, expectedIndices.data(), expectedValues.data());
+                if (count(src.data(), n) != expected || gather(src.data(), n, 7, indices.data(), values.data()) != expected ||
+                    !std::equal(indices.begin(), indices.begin() + expected, expectedIndices.begin()) ||
+                    !std::equal(values.begin(), values.begin() + expected, expectedValues.begin()))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // compressed arrays of a row major buffer, built one element at a time
+    template <typename T>
+    CSR<T> _serialCSR(const T *data, const std::vector<size_t> &shape)
+    {
+        size_t cols = shape.back();
+        size_t rows = CSR<T>::rowsOf(shape);
+        std::vector<size_t> rowPtr(1, 0);
+        std::vector<size_t> colIndices;
+        std::vector<T> values;
+        for (size_t row = 0; row < rows; ++row)
+        {
+            for (size_t col = 0; col < cols; ++col)
+            {
+                if (data[row * cols + col] != T(0))
+                {
+                    colIndices.push_back(col);
+                    values.push_back(data[row * cols + col]);
+                }
+            }
+            rowPtr.push_back(values.size());
+        }
+        return CSR<T>(shape, std::move(rowPtr), std::move(colIndices), std::move(values));
+    }
+
+    std::string _tempPath(const std::string &name)
+    {
+        return (std::filesystem::temp_directory_path() / ("test_sparse_operations_" + name)).string();
+    }
+
+    // tensor whose nonzeros cluster in full blockSize x blockSize tiles, a share density of the tiles is stored
+    xt::xarray<double> _blockTensor(const std::vector<size_t> &shape, size_t blockSize, double density,
+                                    std::mt19937 &generator)
+    {
+        xt::xarray<double> tensor = xt::zeros<double>(shape);
+        size_t cols = shape.back();
+        size_t rows = tensor.size() / cols;
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (size_t blockRow = 0; blockRow < rows; blockRow += blockSize)
+        {
+            for (size_t blockCol = 0; blockCol < cols; blockCol += blockSize)
+            {
+                if (uniform(generator) >= density)
+                {
+                    continue;
+                }
+                for (size_t i = blockRow; i < blockRow + blockSize; ++i)
+                {
+                    for (size_t j = blockCol; j < blockCol + blockSize; ++j)
+                    {
+                        tensor.data()[i * cols + j] = std::floor(uniform(generator) * 9) + 1;
+                    }
+                }
+            }
+        }
+        return tensor;
+    }
+
+    void _writeText(const std::string &path, const std::string &text)
+    {
+        std::ofstream(path) << text;
+    }
+
+    // overwrite bytes of a file in place, like a corrupted or crafted file
+    template <typename Field>
+    void _patchFile(const std::string &path, uint64_t offset, Field field)
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char *>(&field), sizeof(field));
+    }
+
+    CSRFileHeader _readHeader(const std::string &path)
+    {
+        CSRFileHeader header{};
+        std::ifstream(path, std::ios::binary).read(reinterpret_cast<char *>(&header), sizeof(header));
+        return header;
+    }
+
+    template <typename T, typename Index>
+    bool _sameCSR(const CSR<T, Index> &csrA, const CSR<T, Index> &csrB)
+    {
+        return csrA.getShape() == csrB.getShape() && csrA.nnz() == csrB.nnz() &&
+               std::equal(csrA.getRowPtr().begin(), csrA.getRowPtr().end(), csrB.getRowPtr().begin()) &&
+               std::equal(csrA.getColIndices().begin(), csrA.getColIndices().end(), csrB.getColIndices().begin()) &&
+               std::equal(csrA.getValues().begin(), csrA.getValues().end(), csrB.getValues().begin());
+    }
+
+    // batched product [..., M, K] x [..., K, N] computed densely, batch dimensions broadcast, a 1-D A is a single row
+    xt::xarray<double> _batchedProduct(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB)
+    {
+        std::vector<size_t> shapeA(tensorA.shape().begin(), tensorA.shape().end());
+        std::vector<size_t> shapeB(tensorB.shape().begin(), tensorB.shape().end());
+        size_t rows = shapeA.size() >= 2 ? shapeA[shapeA.size() - 2] : 1;
+        size_t inner = shapeA.back();
+        size_t cols = shapeB.back();
+        size_t batchRankA = shapeA.size() >= 2 ? shapeA.size() - 2 : 0;
+        size_t batchRankB = shapeB.size() - 2;
+        size_t batchRank = std::max(batchRankA, batchRankB);
+
+        // extents of both operands aligned to the right, 1 where an operand has no such dimension
+        std::vector<size_t> extentsA(batchRank, 1), extentsB(batchRank, 1), batchShape(batchRank);
+        for (size_t dim = 0; dim < batchRank; ++dim)
+        {
+            if (dim + batchRankA >= batchRank)
+            {
+                extentsA[dim] = shapeA[dim + batchRankA - batchRank];
+            }
+            if (dim + batchRankB >= batchRank)
+            {
+                extentsB[dim] = shapeB[dim + batchRankB - batchRank];
+            }
+            batchShape[dim] = std::max(extentsA[dim], extentsB[dim]);
+        }
+
+        std::vector<size_t> resultShape = batchShape;
+        if (shapeA.size() >= 2)
+        {
+            resultShape.push_back(rows);
+        }
+        resultShape.push_back(cols);
+        xt::xarray<double> result = xt::zeros<double>(resultShape);
+
+        size_t numBatches = result.size() / (rows * cols);
+        for (size_t batch = 0; batch < numBatches; ++batch)
+        {
+            // flat batch of each operand, a broadcast dimension always reads index 0
+            size_t remaining = batch, batchA = 0, batchB = 0, strideA = 1, strideB = 1;
+            for (size_t dim = batchRank; dim > 0; --dim)
+            {
+                size_t index = remaining % batchShape[dim - 1];
+                remaining /= batchShape[dim - 1];
+                batchA += (extentsA[dim - 1] == 1 ? 0 : index) * strideA;
+                batchB += (extentsB[dim - 1] == 1 ? 0 : index) * strideB;
+                strideA *= extentsA[dim - 1];
+                strideB *= extentsB[dim - 1];
+            }
+
+            const double *a = tensorA.data() + batchA * rows * inner;
+            const double *b = tensorB.data() + batchB * inner * cols;
+            double *c = result.data() + batch * rows * cols;
+            for (size_t i = 0; i < rows; ++i)
+            {
+                for (size_t k = 0; k < inner; ++k)
+                {
+                    for (size_t j = 0; j < cols; ++j)
+                    {
+                        c[i * cols + j] += a[i * inner + k] * b[k * cols + j];
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    // every row holds strictly increasing columns
+    template <typename T, typename Index>
+    bool _isSorted(const CSR<T, Index> &csr)
+    {
+        const auto &rowPtr = csr.getRowPtr();
+        const auto &colIndices = csr.getColIndices();
+        for (size_t row = 0; row < csr.rows(); ++row)
+        {
+            for (size_t i = rowPtr[row] + 1; i < rowPtr[row + 1]; ++i)
+            {
+                if (colIndices[i - 1] >= colIndices[i])
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // the last two axes swapped
+    xt::xarray<double> _denseTranspose(const xt::xarray<double> &tensor)
+    {
+        std::vector<size_t> shape(tensor.shape().begin(), tensor.shape().end());
+        size_t rows = shape[shape.size() - 2];
+        size_t cols = shape[shape.size() - 1];
+        std::swap(shape[shape.size() - 2], shape[shape.size() - 1]);
+        xt::xarray<double> result = xt::zeros<double>(shape);
+        for (size_t batch = 0; batch < tensor.size() / std::max<size_t>(rows * cols, 1); ++batch)
+        {
+            for (size_t i = 0; i < rows; ++i)
+            {
+                for (size_t j = 0; j < cols; ++j)
+                {
+                    result.data()[batch * rows * cols + j * rows + i] = tensor.data()[batch * rows * cols + i * cols + j];
+                }
+            }
+        }
+        return result;
+    }
+
+    // every row of a dense product pruned like PruneOptions says, ties of topK go to the lower columns
+    xt::xarray<double> _prunedProduct(const xt::xarray<double> &product, const PruneOptions &prune)
+    {
+        xt::xarray<double> result = product;
+        size_t cols = product.shape()[product.dimension() - 1];
+        for (size_t row = 0; row < product.size() / std::max<size_t>(cols, 1); ++row)
+        {
+            double *values = result.data() + row * cols;
+            double threshold = prune.dropTolerance;
+            if (prune.relative)
+            {
+                double largest = 0.0;
+                for (size_t col = 0; col < cols; ++col)
+                {
+                    largest = std::max(largest, std::fabs(values[col]));
+                }
+                threshold *= largest;
+            }
+
+            std::vector<size_t> kept;
+            for (size_t col = 0; col < cols; ++col)
+            {
+                if (values[col] != 0 && std::fabs(values[col]) < threshold)
+                {
+                    values[col] = 0;
+                }
+                else if (values[col] != 0)
+                {
+                    kept.push_back(col);
+                }
+            }
+            if (prune.topK == 0 || kept.size() <= prune.topK)
+            {
+                continue;
+            }
+            std::stable_sort(kept.begin(), kept.end(), [&](size_t lhs, size_t rhs)
+                             { return std::fabs(values[lhs]) > std::fabs(values[rhs]); });
+            for (size_t i = prune.topK; i < kept.size(); ++i)
+            {
+                values[kept[i]] = 0;
+            }
+        }
+        return result;
+    }
+
+    // every value rounded once to bfloat16, the exact result of a product stored in it
+    xt::xarray<double> _roundedToBfloat16(const xt::xarray<double> &tensor)
+    {
+        xt::xarray<double> result = tensor;
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            result.data()[i] = static_cast<float>(bfloat16(static_cast<float>(result.data()[i])));
+        }
+        return result;
+    }
+
+    // same pattern with other values
+    xt::xarray<double> _newValues(const xt::xarray<double> &tensor, double offset)
+    {
+        xt::xarray<double> result = tensor;
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            if (result.data()[i] != 0)
+            {
+                result.data()[i] = offset + static_cast<double>(i % 7);
+            }
+        }
+        return result;
+    }
+
+    // numpy.tensordot computed densely, a full contraction has shape (1)
+    xt::xarray<double> _denseContract(const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB,
+                                      const std::vector<size_t> &axesA, const std::vector<size_t> &axesB)
+    {
+        std::vector<size_t> shapeA(tensorA.shape().begin(), tensorA.shape().end());
+        std::vector<size_t> shapeB(tensorB.shape().begin(), tensorB.shape().end());
+        std::vector<size_t> freeA, freeB, resultShape;
+        for (size_t axis = 0; axis < shapeA.size(); ++axis)
+        {
+            if (std::find(axesA.begin(), axesA.end(), axis) == axesA.end())
+            {
+                freeA.push_back(axis);
+                resultShape.push_back(shapeA[axis]);
+            }
+        }
+        for (size_t axis = 0; axis < shapeB.size(); ++axis)
+        {
+            if (std::find(axesB.begin(), axesB.end(), axis) == axesB.end())
+            {
+                freeB.push_back(axis);
+                resultShape.push_back(shapeB[axis]);
+            }
+        }
+        if (resultShape.empty())
+        {
+            resultShape.push_back(1);
+        }
+
+        // fills the given axes of a coordinate from a flat index over their extents, the last axis fastest
+        auto unflatten = [](size_t flat, const std::vector<size_t> &axes, const std::vector<size_t> &shape,
+                            std::vector<size_t> &coordinate)
+        {
+            for (size_t i = axes.size(); i > 0; --i)
+            {
+                coordinate[axes[i - 1]] = flat % shape[axes[i - 1]];
+                flat /= shape[axes[i - 1]];
+            }
+        };
+        auto flatten = [](const std::vector<size_t> &coordinate, const std::vector<size_t> &shape)
+        {
+            size_t flat = 0;
+            for (size_t dim = 0; dim < shape.size(); ++dim)
+            {
+                flat = flat * shape[dim] + coordinate[dim];
+            }
+            return flat;
+        };
+        auto extent = [](const std::vector<size_t> &axes, const std::vector<size_t> &shape)
+        {
+            size_t count = 1;
+            for (size_t axis : axes)
+            {
+                count *= shape[axis];
+            }
+            return count;
+        };
+
+        size_t countA = extent(freeA, shapeA);
+        size_t countB = extent(freeB, shapeB);
+        size_t countContracted = extent(axesA, shapeA);
+        xt::xarray<double> result = xt::zeros<double>(resultShape);
+        std::vector<size_t> coordinateA(shapeA.size()), coordinateB(shapeB.size());
+        for (size_t i = 0; i < countA; ++i)
+        {
+            unflatten(i, freeA, shapeA, coordinateA);
+            for (size_t j = 0; j < countB; ++j)
+            {
+                unflatten(j, freeB, shapeB, coordinateB);
+                double sum = 0.0;
+                for (size_t k = 0; k < countContracted; ++k)
+                {
+                    unflatten(k, axesA, shapeA, coordinateA);
+                    unflatten(k, axesB, shapeB, coordinateB);
+                    sum += tensorA.data()[flatten(coordinateA, shapeA)] * tensorB.data()[flatten(coordinateB, shapeB)];
+                }
+                result.data()[i * countB + j] = sum;
+            }
+        }
+        return result;
+    }
+}
+
+static void testRoundTrips()
+{
+    std::mt19937 generator(1);
+    std::vector<std::vector<size_t>> shapes = {{40, 30}, {3, 20, 15}, {25}};
+    for (const std::vector<size_t> &shape : shapes)
+    {
+        xt::xarray<double> tensor = _randomTensor(shape, 0.2, generator);
+        CSR<double> csr = DenseToCSR(tensor);
+        CHECK(csr.getShape() == shape);
+        CHECK(csr.rows() * csr.cols() == tensor.size());
+        CHECK(csr.getRowPtr().size() == csr.rows() + 1);
+        CHECK(csr.getRowPtr()[csr.rows()] == csr.nnz());
+        CHECK(_isSorted(csr));
+        CHECK(_sameTensor(CSRToDense(csr), tensor));
+    }
+
+    // empty tensor and all zero rows
+    xt::xarray<double> zeros = xt::zeros<double>(std::vector<size_t>{5, 4});
+    CSR<double> empty(zeros);
+    CHECK(empty.nnz() == 0);
+    CHECK(_sameTensor(CSRToDense(empty), zeros));
+
+    // explicit arrays, checked by the constructor
+    CSR<double> built({2, 3}, std::vector<size_t>{0, 2, 3}, std::vector<size_t>{0, 2, 1}, std::vector<double>{1, 2, 3});
+    xt::xarray<double> expected{{1, 0, 2}, {0, 3, 0}};
+    CHECK(_sameTensor(CSRToDense(built), expected));
+    CHECK_THROWS(std::invalid_argument,
+                 CSR<double>({2, 3}, std::vector<size_t>{0, 2}, std::vector<size_t>{0, 2}, std::vector<double>{1, 2}));
+}
+
+static void testSpGEMM()
+{
+    std::mt19937 generator(2);
+
+    // small product computed by hand
+    xt::xarray<double> a{{1, 0, 2}, {0, 0, 3}};
+    xt::xarray<double> b{{1, 0}, {0, 1}, {4, 0}};
+    xt::xarray<double> expected{{9, 0}, {12, 0}};
+    CHECK(_sameTensor(CSRToDense(CSRMult(DenseToCSR(a), DenseToCSR(b))), expected));
+
+    // sparse rows go to the hash accumulator, dense ones to the dense accumulator
+    for (double density : {0.0, 0.01, 0.05, 0.3, 0.9})
+    {
+        xt::xarray<double> tensorA = _randomTensor({60, 50}, density, generator);
+        xt::xarray<double> tensorB = _randomTensor({50, 70}, density, generator);
+        CSR<double> product = CSRMult(CSR<double>(tensorA), CSR<double>(tensorB));
+        CHECK(product.getShape() == (std::vector<size_t>{60, 70}));
+        CHECK(_isSorted(product));
+        CHECK(_sameTensor(CSRToDense(product), _denseProduct(tensorA, tensorB)));
+    }
+
+    // entries cancelling to zero are still stored, the pattern is structural
+    xt::xarray<double> c{{1, -1}};
+    xt::xarray<double> d = xt::zeros<double>(std::vector<size_t>{2, 1});
+    d(0, 0) = 1;
+    d(1, 0) = 1;
+    CSR<double> cancelled = CSRMult(DenseToCSR(c), DenseToCSR(d));
+    CHECK(cancelled.nnz() == 1);
+
+    CSR<double> left(_randomTensor({4, 5}, 0.5, generator));
+    CSR<double> right(_randomTensor({6, 3}, 0.5, generator));
+    CHECK_THROWS(std::invalid_argument, CSRMult(left, right));
+}
+
+static void testParallelSpGEMM()
+{
+    std::mt19937 generator(3);
+
+    // large enough to run in parallel, with a few heavy rows the chunks have to balance
+    xt::xarray<double> tensorA = _randomTensor({1000, 700}, 0.05, generator);
+    for (size_t row = 0; row < 1000; row += 250)
+    {
+        for (size_t col = 0; col < 700; ++col)
+        {
+            tensorA(row, col) = 1 + col % 5;
+        }
+    }
+    xt::xarray<double> tensorB = _randomTensor({700, 900}, 0.05, generator);
+    CSR<double> csrA(tensorA), csrB(tensorB);
+    CSR<double> product = CSRMult(csrA, csrB);
+    CHECK(_isSorted(product));
+    CHECK(_sameTensor(CSRToDense(product), _denseProduct(tensorA, tensorB)));
+
+    // the result does not depend on the number of threads
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+    for (int count : {1, 3, 8})
+    {
+        omp_set_num_threads(count);
+        CHECK(_sameCSR(CSRMult(csrA, csrB), product));
+    }
+    omp_set_num_threads(threads);
+#endif
+
+    // chunks cover every row once, in order, and split the work evenly
+    std::vector<size_t> work(1000, 1);
+    work[10] = 5000;
+    std::vector<size_t> bounds = _partitionByWork(work, 8);
+    CHECK(bounds.size() == 9);
+    CHECK(bounds.front() == 0 && bounds.back() == work.size());
+    CHECK(std::is_sorted(bounds.begin(), bounds.end()));
+    std::vector<size_t> even(800, 3);
+    bounds = _partitionByWork(even, 8);
+    for (size_t chunk = 0; chunk + 1 < bounds.size(); ++chunk)
+    {
+        CHECK(bounds[chunk + 1] - bounds[chunk] == 100);
+    }
+}
+
+static void testSparseDense()
+{
+    std::mt19937 generator(4);
+
+    // vectors and matrices of every width up to a few vector registers, plain and batched left operands
+    std::vector<std::vector<size_t>> shapes = {{60, 50}, {3, 20, 50}};
+    for (const std::vector<size_t> &shape : shapes)
+    {
+        xt::xarray<double> tensor = _randomTensor(shape, 0.2, generator);
+        CSR<double> csr(tensor);
+        std::vector<size_t> matrixShape = {csr.rows(), csr.cols()};
+        xt::xarray<double> matrix = xt::zeros<double>(matrixShape);
+        std::copy(tensor.data(), tensor.data() + tensor.size(), matrix.data());
+
+        xt::xarray<double> vector = _randomTensor({50}, 0.7, generator);
+        xt::xarray<double> vectorResult;
+        CSRMultVec(csr, vector, vectorResult);
+        xt::xarray<double> column = xt::zeros<double>(std::vector<size_t>{50, 1});
+        std::copy(vector.data(), vector.data() + vector.size(), column.data());
+        std::vector<size_t> vectorShape(shape.begin(), shape.end() - 1);
+        CHECK(vectorResult.shape() == vectorShape);
+        CHECK(std::equal(vectorResult.begin(), vectorResult.end(), _denseProduct(matrix, column).begin()));
+
+        for (size_t width : {1, 3, 8, 17, 40})
+        {
+            xt::xarray<double> dense = _randomTensor({50, width}, 0.5, generator);
+            xt::xarray<double> expected = _denseProduct(matrix, dense);
+            xt::xarray<double> result;
+            CSRMultDense(csr, dense, result);
+            CHECK(std::equal(result.begin(), result.end(), expected.begin()));
+
+            xt::xarray<float> floatResult;
+            CSRMultDense(CSR<float>(_toFloat(tensor)), _toFloat(dense), floatResult);
+            CHECK(std::equal(floatResult.begin(), floatResult.end(), expected.begin()));
+        }
+    }
+
+    // fixed rank operands
+    xt::xarray<double> tensor = _randomTensor({30, 20}, 0.3, generator);
+    xt::xarray<double> dense = _randomTensor({20, 9}, 0.5, generator);
+    xt::xtensor<double, 2> fixed = xt::xtensor<double, 2>::from_shape({20, 9});
+    std::copy(dense.data(), dense.data() + dense.size(), fixed.data());
+    xt::xtensor<double, 2> fixedResult;
+    CSRMultDense(CSR<double>(tensor), fixed, fixedResult);
+    xt::xarray<double> expected = _denseProduct(tensor, dense);
+    CHECK(std::equal(fixedResult.begin(), fixedResult.end(), expected.begin()));
+
+    xt::xarray<double> result;
+    CHECK_THROWS(std::invalid_argument, CSRMultDense(CSR<double>(tensor), _randomTensor({21, 9}, 0.5, generator), result));
+    CHECK_THROWS(std::invalid_argument, CSRMultVec(CSR<double>(tensor), _randomTensor({19}, 0.5, generator), result));
+
+    // the dispatched kernels and every instruction set this CPU supports agree with the scalar loops
+    CHECK(_matchesAxpy<double>([](size_t n, double a, const double *x, double *y) { _axpy(n, a, x, y); }, generator));
+    CHECK(_matchesAxpy<float>([](size_t n, float a, const float *x, float *y) { _axpy(n, a, x, y); }, generator));
+    CHECK((_matchesGather<double>([](const double *src, size_t n) { return _countNonZeros(src, n); },
+                                  [](const double *src, size_t n, size_t base, uint32_t *indices, double *values)
+                                  { return _gatherNonZeros(src, n, base, indices, values); },
+                                  generator)));
+#ifdef SPARSE_OPS_SIMD_DISPATCH
+    if (_simdLevel() != _SimdLevel::Scalar)
+    {
+        CHECK(_matchesAxpy<double>([](size_t n, double a, const double *x, double *y) { _axpyAvx2(n, a, x, y); }, generator));
+        CHECK(_matchesAxpy<float>([](size_t n, float a, const float *x, float *y) { _axpyAvx2(n, a, x, y); }, generator));
+        CHECK((_matchesGather<double>([](const double *src, size_t n) { return _countNonZerosAvx2(src, n); },
+                                      [](const double *src, size_t n, size_t base, uint32_t *indices, double *values)
+                                      { return _gatherNonZerosAvx2(src, n, base, indices, values); },
+                                      generator)));
+        CHECK((_matchesGather<float>([](const float *src, size_t n) { return _countNonZerosAvx2(src, n); },
+                                     [](const float *src, size_t n, size_t base, uint32_t *indices, float *values)
+                                     { return _gatherNonZerosAvx2(src, n, base, indices, values); },
+                                     generator)));
+    }
+    if (_simdLevel() == _SimdLevel::Avx512)
+    {
+        CHECK(_matchesAxpy<double>([](size_t n, double a, const double *x, double *y) { _axpyAvx512(n, a, x, y); }, generator));
+        CHECK(_matchesAxpy<float>([](size_t n, float a, const float *x, float *y) { _axpyAvx512(n, a, x, y); }, generator));
+        CHECK((_matchesGather<double>([](const double *src, size_t n) { return _countNonZerosAvx512(src, n); },
+                                      [](const double *src, size_t n, size_t base, uint32_t *indices, double *values)
+                                      { return _gatherNonZerosAvx512(src, n, base, indices, values); },
+                                      generator)));
+        CHECK((_matchesGather<float>([](const float *src, size_t n) { return _countNonZerosAvx512(src, n); },
+                                     [](const float *src, size_t n, size_t base, uint32_t *indices, float *values)
+                                     { return _gatherNonZerosAvx512(src, n, base, indices, values); },
+                                     generator)));
+    }
+#endif
+}
+
+static void testSparseOutput()
+{
+    std::mt19937 generator(5);
+    for (double density : {0.0, 0.02, 0.3})
+    {
+        xt::xarray<double> tensorA = _randomTensor({40, 30}, density, generator);
+        xt::xarray<double> tensorB = _randomTensor({30, 50}, density, generator);
+        xt::xarray<double> expected = _denseProduct(tensorA, tensorB);
+
+        CSR<double> product = sparse_ops::multiplyCompressedFormatSparse(tensorA, tensorB);
+        CHECK(_isSorted(product));
+        CHECK(_sameTensor(CSRToDense(product), expected));
+        CHECK(_sameTensor(sparse_ops::multiplyCompressedFormat(tensorA, tensorB), expected));
+    }
+}
+
+static void testParallelConversion()
+{
+    std::mt19937 generator(6);
+
+    // a single row spanning many blocks, many short rows mostly empty, and rows straddling the block edges
+    std::vector<std::vector<size_t>> shapes = {{1, 300000}, {200000, 3}, {7, 65537}, {4, 50, 1000}};
+    for (const std::vector<size_t> &shape : shapes)
+    {
+        xt::xarray<double> tensor = _randomTensor(shape, 0.01, generator);
+        CSR<double> expected = _serialCSR(tensor.data(), shape);
+        CSR<double> csr(tensor);
+        CHECK(_sameCSR(csr, expected));
+
+#ifdef _OPENMP
+        int threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+        CHECK(_sameCSR(CSR<double>(tensor), expected));
+        omp_set_num_threads(threads);
+#endif
+
+        // conversion from another value type
+        xt::xarray<float> narrow = _toFloat(tensor);
+        CSR<double> widened(narrow.data(), shape);
+        CHECK(_sameCSR(widened, expected));
+    }
+}
+
+static void testSparsityChecks()
+{
+    std::mt19937 generator(7);
+
+    // zero fractions of about 0.5, 0.9 and 0.99 on tensors below and above the sampling cutoff
+    for (size_t size : {1000, 200000})
+    {
+        for (double density : {0.5, 0.1, 0.01})
+        {
+            xt::xarray<double> tensor = _randomTensor({size}, density, generator);
+            double exact = 0;
+            for (double value : tensor)
+            {
+                exact += value == 0;
+            }
+            exact /= static_cast<double>(size);
+
+            CHECK(std::fabs(sparse_ops::sparsity(tensor) - exact) < 1e-12);
+            for (double threshold : {0.3, 0.7, 0.95})
+            {
+                CHECK(sparse_ops::isSparse(tensor, threshold) == (exact >= threshold));
+                CHECK(sparse_ops::isSparseParallel(tensor, threshold) == (exact >= threshold));
+                // thresholds far from the sparsity are decided correctly by sampling
+                if (std::fabs(exact - threshold) > 0.05)
+                {
+                    CHECK(sparse_ops::isSparseSampled(tensor, threshold) == (exact >= threshold));
+                }
+            }
+
+            sparse_ops::SparsityEstimate estimate = sparse_ops::estimateSparsity(tensor, 0.02, 0.99, 11);
+            CHECK(estimate.lower <= estimate.sparsity && estimate.sparsity <= estimate.upper);
+            CHECK(estimate.lower - 0.02 <= exact && exact <= estimate.upper + 0.02);
+            CHECK(estimate.exact == (estimate.samples == size));
+        }
+    }
+
+    xt::xarray<double> tensor = _randomTensor({10000}, 0.1, generator);
+    CHECK_THROWS(std::invalid_argument, sparse_ops::estimateSparsity(tensor, 0.0));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::estimateSparsity(tensor, 0.01, 1.0));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::estimateSparsity(tensor, 0.01, std::nan("")));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::isSparseSampled(tensor, 0.8, 1.0));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::isSparseSampled(tensor, 0.8, 0.0));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::isSparseSampled(tensor, 0.8, std::nan("")));
+}
+
+static void testDispatch()
+{
+    std::mt19937 generator(8);
+    sparse_ops::setCostModel(sparse_ops::defaultCostModel());
+
+    // very sparse, moderately sparse and dense operands, every kernel has to agree with the dense product
+    for (double density : {0.001, 0.05, 0.9})
+    {
+        xt::xarray<double> tensorA = _randomTensor({120, 90}, density, generator);
+        xt::xarray<double> tensorB = _randomTensor({90, 80}, density, generator);
+        xt::xarray<double> expected = _denseProduct(tensorA, tensorB);
+        CHECK(_sameTensor(sparse_ops::multiplyDense(tensorA, tensorB), expected));
+        CHECK(_sameTensor(sparse_ops::multiply(tensorA, tensorB), expected));
+
+        std::vector<sparse_ops::DispatchDecision> log = sparse_ops::dispatchLog();
+        CHECK(!log.empty());
+        CHECK(log.back().shapeA == (std::vector<size_t>{120, 90}));
+    }
+
+    // a model pricing out all but one kernel routes every product to it
+    xt::xarray<double> tensorA = _randomTensor({4, 30, 20}, 0.1, generator);
+    xt::xarray<double> tensorB = _randomTensor({20, 25}, 0.1, generator);
+    xt::xarray<double> expected = sparse_ops::multiplyDense(tensorA, tensorB);
+    for (sparse_ops::MultiplyKernel kernel : {sparse_ops::MultiplyKernel::Dense, sparse_ops::MultiplyKernel::SparseSparse,
+                                              sparse_ops::MultiplyKernel::SparseDense})
+    {
+        sparse_ops::CostModel model = sparse_ops::defaultCostModel();
+        if (kernel != sparse_ops::MultiplyKernel::Dense)
+        {
+            model.denseFlop = 1.0;
+        }
+        if (kernel != sparse_ops::MultiplyKernel::SparseSparse)
+        {
+            model.sparseFlop = 1.0;
+        }
+        if (kernel != sparse_ops::MultiplyKernel::SparseDense)
+        {
+            model.spmmFlop = 1.0;
+        }
+        sparse_ops::setCostModel(model);
+        CHECK(_sameTensor(sparse_ops::multiply(tensorA, tensorB), expected));
+        CHECK(sparse_ops::dispatchLog().back().kernel == kernel);
+    }
+
+    // profiles round trip, a missing or foreign file leaves the model alone
+    sparse_ops::CostModel model = sparse_ops::defaultCostModel();
+    model.sparseFlop = 1.25e-9;
+    std::string path = _tempPath("profile");
+    CHECK(sparse_ops::saveCostModel(model, path));
+    sparse_ops::CostModel loaded = sparse_ops::defaultCostModel();
+    CHECK(sparse_ops::loadCostModel(loaded, path));
+    CHECK(loaded.sparseFlop == model.sparseFlop && loaded.denseFlop == model.denseFlop);
+    std::filesystem::remove(path);
+    CHECK(!sparse_ops::loadCostModel(loaded, path));
+    CHECK(loaded.sparseFlop == model.sparseFlop);
+
+    sparse_ops::setCostModel(sparse_ops::defaultCostModel());
+}
+
+static void testBinaryFiles()
+{
+    std::mt19937 generator(10);
+    std::string path = _tempPath("roundtrip.bin");
+
+    // binary files round trip through the memory mapping, with every value type and index width
+    xt::xarray<double> tensor = _randomTensor({60, 50}, 0.1, generator);
+    CSR<double> csr(tensor);
+    SaveCSR(csr, path);
+    CHECK(_sameCSR(LoadCSR<double, size_t>(path), csr));
+    CHECK(_sameCSR(LoadCSR<double, size_t>(path, true), csr));
+
+    CSR<float, uint16_t> narrow(_toFloat(_randomTensor({2, 30, 40}, 0.2, generator)));
+    SaveCSR(narrow, path);
+    CHECK(_sameCSR(LoadCSR<float, uint16_t>(path), narrow));
+    CHECK_THROWS(std::runtime_error, LoadCSR<double, size_t>(path));
+    CHECK_THROWS(std::runtime_error, LoadCSR<float, uint32_t>(path));
+
+    CSR<double> empty(xt::xarray<double>(xt::zeros<double>(std::vector<size_t>{0, 7})));
+    SaveCSR(empty, path);
+    CHECK(_sameCSR(LoadCSR<double, size_t>(path), empty));
+
+    // the mapping outlives the file name
+    SaveCSR(csr, path);
+    CSR<double> mapped = LoadCSR<double, size_t>(path);
+    std::filesystem::remove(path);
+    CHECK(_sameTensor(CSRToDense(mapped), tensor));
+    CHECK_THROWS(std::runtime_error, LoadCSR<double, size_t>(path));
+
+    // truncated files, decreasing row offsets, out of range columns and headers whose offsets overflow
+    SaveCSR(csr, path);
+    CSRFileHeader header = _readHeader(path);
+    std::filesystem::resize_file(path, header.fileSize - 64);
+    CHECK_THROWS(std::runtime_error, LoadCSR<double, size_t>(path));
+
+    SaveCSR(csr, path);
+    _patchFile(path, header.rowPtrOffset + 5 * sizeof(size_t), size_t(csr.nnz() + 1));
+    CHECK_THROWS(std::invalid_argument, LoadCSR<double, size_t>(path));
+
+    SaveCSR(csr, path);
+    _patchFile(path, header.colIndicesOffset + 3 * sizeof(size_t), size_t(1) << 40);
+    CHECK_THROWS(std::runtime_error, LoadCSR<double, size_t>(path, true));
+
+    SaveCSR(csr, path);
+    CSRFileHeader hostile = header;
+    hostile.nnz = std::numeric_limits<uint64_t>::max() / 8 + 2;
+    _patchFile(path, 0, hostile);
+    CHECK_THROWS(std::runtime_error, LoadCSR<double, size_t>(path));
+    hostile = header;
+    hostile.rows = std::numeric_limits<uint64_t>::max();
+    _patchFile(path, 0, hostile);
+    CHECK_THROWS(std::runtime_error, LoadCSR<double, size_t>(path));
+    std::filesystem::remove(path);
+
+    // Matrix Market files, general with duplicates summed, symmetric, skew symmetric and pattern
+    std::string mtxPath = _tempPath("matrix.mtx");
+    _writeText(mtxPath, "%%MatrixMarket matrix coordinate real general\n% comment\n3 4 5\n"
+                        "1 4 2.5\n3 1 -1\n1 2 1\n1 4 0.5\n2 3 7\n");
+    MatrixMarketToCSRFile<double>(mtxPath, path);
+    xt::xarray<double> expected{{0, 1, 0, 3}, {0, 0, 7, 0}, {-1, 0, 0, 0}};
+    CSR<double> converted = LoadCSR<double, size_t>(path, true);
+    CHECK(converted.nnz() == 4);
+    CHECK(_isSorted(converted));
+    CHECK(_sameTensor(CSRToDense(converted), expected));
+
+    _writeText(mtxPath, "%%MatrixMarket matrix coordinate real symmetric\n3 3 3\n1 1 2\n3 1 4\n3 2 5\n");
+    MatrixMarketToCSRFile<float, uint32_t>(mtxPath, path);
+    xt::xarray<double> symmetric{{2, 0, 4}, {0, 0, 5}, {4, 5, 0}};
+    CHECK(_sameTensor(_toDouble(CSRToDense(LoadCSR<float, uint32_t>(path))), symmetric));
+
+    _writeText(mtxPath, "%%MatrixMarket matrix coordinate real skew-symmetric\n2 2 1\n2 1 3\n");
+    MatrixMarketToCSRFile<double>(mtxPath, path);
+    xt::xarray<double> skew{{0, -3}, {3, 0}};
+    CHECK(_sameTensor(CSRToDense(LoadCSR<double, size_t>(path)), skew));
+
+    _writeText(mtxPath, "%%MatrixMarket matrix coordinate pattern general\n2 3 2\n1 3\n2 1\n");
+    MatrixMarketToCSRFile<double>(mtxPath, path);
+    xt::xarray<double> pattern{{0, 0, 1}, {1, 0, 0}};
+    CHECK(_sameTensor(CSRToDense(LoadCSR<double, size_t>(path)), pattern));
+
+    // broken inputs leave no output behind
+    std::filesystem::remove(path);
+    _writeText(mtxPath, "%%MatrixMarket matrix coordinate real general\n2 2 3\n1 1 1\n2 2 1\n");
+    CHECK_THROWS(std::runtime_error, MatrixMarketToCSRFile<double>(mtxPath, path));
+    _writeText(mtxPath, "%%MatrixMarket matrix coordinate real general\n2 2 1\n3 1 1\n");
+    CHECK_THROWS(std::runtime_error, MatrixMarketToCSRFile<double>(mtxPath, path));
+    _writeText(mtxPath, "%%MatrixMarket matrix array real general\n2 2\n1\n2\n3\n4\n");
+    CHECK_THROWS(std::runtime_error, MatrixMarketToCSRFile<double>(mtxPath, path));
+    CHECK(!std::filesystem::exists(path));
+    _writeText(mtxPath, "%%MatrixMarket matrix coordinate real general\n2 70000 1\n1 1 1\n");
+    CHECK_THROWS(std::invalid_argument, MatrixMarketToCSRFile<double, uint16_t>(mtxPath, path));
+    std::filesystem::remove(mtxPath);
+}
+
+static void testBatchedSpGEMM()
+{
+    std::mt19937 generator(11);
+
+    // batches of both operands, broadcast batches, a shared 2-D B, extra leading dimensions and a vector times matrix
+    std::vector<std::pair<std::vector<size_t>, std::vector<size_t>>> shapes = {
+        {{3, 20, 15}, {3, 15, 10}},
+        {{2, 1, 20, 15}, {3, 15, 10}},
+        {{1, 20, 15}, {4, 15, 10}},
+        {{3, 20, 15}, {15, 10}},
+        {{2, 3, 20, 15}, {2, 3, 15, 10}},
+        {{15}, {15, 10}},
+        {{15}, {2, 15, 10}}};
+    for (const auto &[shapeA, shapeB] : shapes)
+    {
+        xt::xarray<double> tensorA = _randomTensor(shapeA, 0.2, generator);
+        xt::xarray<double> tensorB = _randomTensor(shapeB, 0.2, generator);
+        xt::xarray<double> expected = _batchedProduct(tensorA, tensorB);
+
+        CSR<double> product = CSRMult(CSR<double>(tensorA), CSR<double>(tensorB));
+        CHECK(product.getShape() == std::vector<size_t>(expected.shape().begin(), expected.shape().end()));
+        CHECK(_isSorted(product));
+        CHECK(_sameTensor(CSRToDense(product), expected));
+        CHECK(_sameTensor(sparse_ops::multiplyCompressedFormat(tensorA, tensorB), expected));
+    }
+
+    // batch dimensions that cannot broadcast
+    CSR<double> left(_randomTensor({3, 4, 5}, 0.5, generator));
+    CSR<double> right(_randomTensor({2, 5, 6}, 0.5, generator));
+    CHECK_THROWS(std::invalid_argument, CSRMult(left, right));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::multiplyCompressedFormat(_randomTensor({3, 4, 5}, 0.5, generator),
+                                                                             _randomTensor({2, 5, 6}, 0.5, generator)));
+}
+
+static void testCompactIndices()
+{
+    std::mt19937 generator(12);
+
+    // every index width converts and multiplies like size_t
+    xt::xarray<double> tensorA = _randomTensor({3, 40, 30}, 0.2, generator);
+    xt::xarray<double> tensorB = _randomTensor({30, 50}, 0.2, generator);
+    xt::xarray<double> expected = _batchedProduct(tensorA, tensorB);
+    CSR<double, uint16_t> narrowA(tensorA), narrowB(tensorB);
+    CSR<double, uint32_t> mediumA(tensorA), mediumB(tensorB);
+    CHECK(_sameTensor(CSRToDense(narrowA), tensorA));
+    CHECK(_sameTensor(CSRToDense(CSRMult(narrowA, narrowB)), expected));
+    CHECK(_sameTensor(CSRToDense(CSRMult(mediumA, mediumB)), expected));
+
+    // the narrowest index fitting the columns, and too narrow indices rejected
+    CHECK((std::holds_alternative<CSR<double, uint16_t>>(makeCompactCSR(tensorA))));
+    xt::xarray<double> wide = _randomTensor({2, 70000}, 0.001, generator);
+    CompactCSR<double> compact = makeCompactCSR(wide);
+    CHECK((std::holds_alternative<CSR<double, uint32_t>>(compact)));
+    CHECK(_sameTensor(CSRToDense(std::get<CSR<double, uint32_t>>(compact)), wide));
+    CHECK_THROWS(std::invalid_argument, CSR<double, uint16_t>{wide});
+
+    // varints of every length round trip
+    for (size_t value : {size_t(0), size_t(1), size_t(127), size_t(128), size_t(16383), size_t(16384), size_t(1) << 35,
+                         std::numeric_limits<size_t>::max()})
+    {
+        uint8_t bytes[16];
+        uint8_t *end = _writeVarint(value, bytes);
+        CHECK(static_cast<size_t>(end - bytes) == _varintBytes(value));
+        const uint8_t *cursor = bytes;
+        CHECK(_readVarint(cursor) == value);
+        CHECK(cursor == end);
+    }
+
+    // column streams with one, two and three byte gaps, decoded by the products without expanding them
+    for (size_t cols : {100, 5000, 300000})
+    {
+        xt::xarray<double> tensor = _randomTensor({2, 20, cols}, 20.0 / cols, generator);
+        CSR<double> csr(tensor);
+        VarintCSR<double> varint(csr);
+        CHECK(varint.getShape() == csr.getShape());
+        CHECK(varint.nnz() == csr.nnz());
+        CHECK(varint.getColumnStream().size() <= csr.nnz() * 3);
+        CHECK(_sameCSR(varint.decompress(), csr));
+        CHECK(_sameCSR(varint.decompress<uint32_t>(), CSR<double, uint32_t>(tensor)));
+
+        xt::xarray<double> vector = _randomTensor({cols}, 0.5, generator);
+        xt::xarray<double> dense = _randomTensor({cols, 5}, 0.01, generator);
+        xt::xarray<double> expectedVector, expectedDense, resultVector, resultDense;
+        CSRMultVec(csr, vector, expectedVector);
+        CSRMultDense(csr, dense, expectedDense);
+        CSRMultVec(varint, vector, resultVector);
+        CSRMultDense(varint, dense, resultDense);
+        CHECK(_sameTensor(resultVector, expectedVector));
+        CHECK(_sameTensor(resultDense, expectedDense));
+    }
+}
+
+static void testBSR()
+{
+    std::mt19937 generator(13);
+
+    // detection finds the tile size of clustered tensors and falls back to 1 for scattered ones
+    xt::xarray<double> tiled = _blockTensor({64, 48}, 4, 0.3, generator);
+    CHECK(BSR<double>::detectBlockSize(tiled.data(), {64, 48}) == std::make_pair(size_t(4), size_t(4)));
+    CHECK(BSR<double>::detectBlockSize(CSR<double>(tiled)) == std::make_pair(size_t(4), size_t(4)));
+    xt::xarray<double> scattered = _randomTensor({64, 48}, 0.02, generator);
+    CHECK(BSR<double>::detectBlockSize(scattered.data(), {64, 48}) == std::make_pair(size_t(1), size_t(1)));
+
+    // every constructor holds the tensor, explicit zeros of partially filled tiles are dropped by toCSR
+    BSR<double> detected(tiled);
+    CHECK(detected.getBlockRows() == 4 && detected.getBlockCols() == 4);
+    CHECK(_sameTensor(BSRToDense(detected), tiled));
+    CHECK(_sameCSR(detected.toCSR(), CSR<double>(tiled)));
+    CHECK(_sameTensor(BSRToDense(BSR<double>(CSR<double>(tiled))), tiled));
+    CHECK(_sameTensor(BSRToDense(BSR<double>(scattered, 2, 4)), scattered));
+    CHECK(_sameCSR(BSR<double>(CSR<double, uint32_t>(scattered), 8, 2).toCSR<uint32_t>(), CSR<double, uint32_t>(scattered)));
+    xt::xarray<double> batched = _blockTensor({2, 16, 24}, 8, 0.4, generator);
+    BSR<double> batchedBSR(batched, 8, 8);
+    CHECK(batchedBSR.rows() == 32 && batchedBSR.cols() == 24);
+    CHECK(_sameTensor(BSRToDense(batchedBSR), batched));
+
+    BSR<double> built({4, 4}, 2, 2, std::vector<size_t>{0, 1, 2}, std::vector<size_t>{1, 0}, std::vector<double>{1, 2, 3, 4, 5, 6, 7, 8});
+    xt::xarray<double> expected{{0, 0, 1, 2}, {0, 0, 3, 4}, {5, 6, 0, 0}, {7, 8, 0, 0}};
+    CHECK(_sameTensor(BSRToDense(built), expected));
+    CHECK_THROWS(std::invalid_argument, BSR<double>({4, 4}, 2, 2, std::vector<size_t>{0, 1, 2}, std::vector<size_t>{1, 2},
+                                                    std::vector<double>(8, 1.0)));
+    CHECK_THROWS(std::invalid_argument, BSR<double>(tiled, 5, 4));
+    CHECK_THROWS(std::invalid_argument, BSR<double>(CSR<double>(tiled), 4, 7));
+
+    // every register blocked size, panels narrower and wider than a strip so every tail width runs
+    std::vector<std::pair<size_t, size_t>> blockSizes = {{1, 1}, {2, 2}, {4, 4}, {8, 8}, {2, 4}, {3, 3}};
+    for (const auto &[blockRows, blockCols] : blockSizes)
+    {
+        xt::xarray<double> tensor = _blockTensor({48, 72}, std::min(blockRows, blockCols), 0.3, generator);
+        BSR<double> bsr(tensor, blockRows, blockCols);
+        BSR<float> narrow(_toFloat(tensor), blockRows, blockCols);
+        for (size_t width = 1; width <= 33; ++width)
+        {
+            xt::xarray<double> dense = _randomTensor({72, width}, 0.5, generator);
+            xt::xarray<double> product = _denseProduct(tensor, dense);
+            xt::xarray<double> result;
+            BSRMultDense(bsr, dense, result);
+            CHECK(_sameTensor(result, product));
+
+            xt::xarray<float> narrowResult;
+            BSRMultDense(narrow, _toFloat(dense), narrowResult);
+            CHECK(_sameTensor(_toDouble(narrowResult), product));
+        }
+
+        // block columns of the left operand match the block rows of the right one
+        xt::xarray<double> right = _blockTensor({72, 24}, std::min(blockRows, blockCols), 0.3, generator);
+        BSR<double> rightBSR(right, blockCols, blockRows);
+        BSR<double> product = BSRMult(bsr, rightBSR);
+        CHECK(_sameTensor(BSRToDense(product), _denseProduct(tensor, right)));
+    }
+
+    xt::xarray<double> result;
+    CHECK_THROWS(std::invalid_argument, BSRMultDense(detected, _randomTensor({47, 3}, 0.5, generator), result));
+    CHECK_THROWS(std::invalid_argument, BSRMult(detected, BSR<double>(_randomTensor({48, 8}, 0.5, generator), 2, 2)));
+}
+
+static void testCSF()
+{
+    std::mt19937 generator(14);
+    xt::xarray<double> tensor = _randomTensor({4, 5, 6}, 0.3, generator);
+
+    // every constructor and mode order holds the tensor
+    CSF<double> csf(tensor);
+    CHECK(csf.rank() == 3 && csf.getModeOrder() == std::vector<size_t>({0, 1, 2}));
+    CHECK(csf.nnz() == CSR<double>(tensor).nnz());
+    CHECK(_sameTensor(CSFToDense(csf), tensor));
+    CHECK(_sameTensor(CSFToDense(CSF<double>(tensor, {2, 0, 1})), tensor));
+    CHECK(_sameTensor(CSFToDense(CSF<double>(CSR<double, uint32_t>(tensor), {1, 2, 0})), tensor));
+
+    // permuted keeps the tensor, and its coordinates rebuild it in any other order
+    CSF<double> permuted = csf.permuted({2, 1, 0});
+    CHECK(permuted.getModeOrder() == std::vector<size_t>({2, 1, 0}));
+    CHECK(permuted.nnz() == csf.nnz() && permuted.numNodes(2) == csf.nnz());
+    CHECK(_sameTensor(CSFToDense(permuted), tensor));
+    const auto &permutedValues = permuted.getValues();
+    std::vector<double> values(permutedValues.data(), permutedValues.data() + permuted.nnz());
+    CHECK(_sameTensor(CSFToDense(CSF<double>({4, 5, 6}, permuted.coordinates(), values)), tensor));
+
+    // coordinates sum their duplicates and must lie inside the tensor
+    CSF<double> summed({2, 3}, {1, 2, 0, 1, 1, 2}, {1.0, 2.0, 3.0}, {1, 0});
+    xt::xarray<double> expected = xt::zeros<double>(std::vector<size_t>{2, 3});
+    expected.data()[5] = 4.0;
+    expected.data()[1] = 2.0;
+    CHECK(summed.nnz() == 2);
+    CHECK(_sameTensor(CSFToDense(summed), expected));
+    CHECK_THROWS(std::invalid_argument, CSF<double>({2, 3}, {2, 0}, {1.0}));
+    CHECK_THROWS(std::invalid_argument, CSF<double>({2, 3}, {1, 0, 1}, {1.0}));
+    CHECK_THROWS(std::invalid_argument, CSF<double>(tensor, {0, 0, 1}));
+
+    // contractions against numpy.tensordot, stored orders that need no reordering and ones that do
+    xt::xarray<double> left = _randomTensor({6, 5, 7}, 0.4, generator);
+    xt::xarray<double> right = _randomTensor({7, 3, 5}, 0.4, generator);
+    std::vector<std::pair<std::vector<size_t>, std::vector<size_t>>> pairings = {
+        {{2}, {0}}, {{2, 1}, {0, 2}}, {{1, 2}, {2, 0}}, {{1}, {2}}};
+    for (const auto &[axesA, axesB] : pairings)
+    {
+        xt::xarray<double> reference = _denseContract(left, right, axesA, axesB);
+        CHECK(_sameTensor(CSFToDense(sparse_ops::contract(CSF<double>(left), CSF<double>(right), axesA, axesB)), reference));
+        CHECK(_sameTensor(CSFToDense(sparse_ops::contract(CSF<double>(left, {1, 2, 0}), CSF<double>(right, {2, 1, 0}),
+                                                          axesA, axesB)),
+                          reference));
+    }
+
+    // a full contraction has shape (1), no axes is the outer product
+    xt::xarray<double> same = _randomTensor({6, 5, 7}, 0.4, generator);
+    CSF<double> full = sparse_ops::contract(CSF<double>(left), CSF<double>(same), {0, 1, 2}, {0, 1, 2});
+    CHECK(full.getShape() == std::vector<size_t>({1}));
+    CHECK(_sameTensor(CSFToDense(full), _denseContract(left, same, {0, 1, 2}, {0, 1, 2})));
+    CHECK(_sameTensor(CSFToDense(sparse_ops::contract(CSF<double>(left), CSF<double>(same), {2, 0, 1}, {2, 0, 1})),
+                      _denseContract(left, same, {2, 0, 1}, {2, 0, 1})));
+    xt::xarray<double> small = _randomTensor({3, 4}, 0.5, generator);
+    CSF<double> outer = sparse_ops::contract(CSF<double>(small), CSF<double>(right), {}, {});
+    CHECK(outer.getShape() == std::vector<size_t>({3, 4, 7, 3, 5}));
+    CHECK(_sameTensor(CSFToDense(outer), _denseContract(small, right, {}, {})));
+
+    // enough multiply adds to run in parallel chunks
+    xt::xarray<double> wide = _randomTensor({40, 30, 20}, 0.5, generator);
+    xt::xarray<double> deep = _randomTensor({20, 30, 40}, 0.5, generator);
+    CHECK(_sameTensor(CSFToDense(sparse_ops::contract(CSF<double>(wide), CSF<double>(deep), {1, 2}, {1, 0})),
+                      _denseContract(wide, deep, {1, 2}, {1, 0})));
+
+    CHECK_THROWS(std::invalid_argument, sparse_ops::contract(CSF<double>(left), CSF<double>(right), {0}, {0}));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::contract(CSF<double>(left), CSF<double>(right), {2, 2}, {0, 0}));
+    CHECK_THROWS(std::invalid_argument, sparse_ops::contract(CSF<double>(left), CSF<double>(right), {2}, {0, 2}));
+}
+
+static void testExpressions()
+{
+    std::mt19937 generator(15);
+
+    // elementwise reference over the dense tensors
+    auto combine = [](const xt::xarray<double> &tensorA, const xt::xarray<double> &tensorB, auto op)
+    {
+        xt::xarray<double> result = xt::zeros<double>(tensorA.shape());
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            result.data()[i] = op(tensorA.data()[i], tensorB.data()[i]);
+        }
+        return result;
+    };
+    auto plus = [](double a, double b) { return a + b; };
+    auto minus = [](double a, double b) { return a - b; };
+    auto times = [](double a, double b) { return a * b; };
+
+    for (const std::vector<size_t> &shape : {std::vector<size_t>{30, 40}, std::vector<size_t>{3, 10, 12},
+                                             std::vector<size_t>{20000, 50}})
+    {
+        xt::xarray<double> a = _randomTensor(shape, 0.3, generator);
+        xt::xarray<double> b = _randomTensor(shape, 0.3, generator);
+        xt::xarray<double> c = _randomTensor(shape, 0.3, generator);
+        CSR<double> csrA(a), csrB(b), csrC(c);
+        xt::xarray<double> zero = xt::zeros<double>(a.shape());
+
+        // the fused chain matches the dense result, overlapping patterns take the compaction path
+        xt::xarray<double> expected = combine(a, combine(b, c, times), [](double x, double y) { return 2.0 * x - 3.0 * y; });
+        CSR<double> fused = CSREvaluate(2.0 * csrA + -3.0 * CSRHadamard(csrB, csrC));
+        CHECK(_isSorted(fused));
+        CHECK(_sameTensor(CSRToDense(fused), expected));
+
+        CHECK(_sameTensor(CSRToDense(CSREvaluate(csrA + csrB)), combine(a, b, plus)));
+        CHECK(_sameTensor(CSRToDense(CSREvaluate(csrA - csrB)), combine(a, b, minus)));
+        CHECK(_sameTensor(CSRToDense(CSREvaluate(CSRHadamard(csrA, csrB))), combine(a, b, times)));
+        CHECK(_sameTensor(CSRToDense(CSREvaluate(-csrA * 0.5)), combine(a, zero, [](double x, double) { return -0.5 * x; })));
+        CHECK(_sameTensor(CSRToDense(CSREvaluate(CSRMap(csrA + csrB, [](double x) { return x * x; }))),
+                          combine(a, b, [](double x, double y) { return (x + y) * (x + y); })));
+        CHECK(_sameTensor(_toDouble(CSRToDense(CSREvaluate<uint32_t>(csrA + CSRHadamard(csrB, csrC)))),
+                          combine(a, combine(b, c, times), plus)));
+
+        // results are structural, a union keeps both patterns and cancelled values stay stored
+        CSR<double> cancelled = CSREvaluate(csrA - csrA);
+        CHECK(cancelled.nnz() == csrA.nnz());
+        CHECK(_sameTensor(CSRToDense(cancelled), zero));
+        CHECK(CSREvaluate(CSRHadamard(csrA, csrA)).nnz() == csrA.nnz());
+    }
+
+    // disjoint patterns fill every slot of a union and leave an intersection empty
+    xt::xarray<double> even = _randomTensor({40, 30}, 0.6, generator);
+    xt::xarray<double> odd = _randomTensor({40, 30}, 0.6, generator);
+    for (size_t i = 0; i < even.size(); ++i)
+    {
+        (i % 2 == 0 ? odd : even).data()[i] = 0.0;
+    }
+    CSR<double> csrEven(even), csrOdd(odd);
+    CSR<double> merged = CSREvaluate(csrEven + 2.0 * csrOdd);
+    CHECK(merged.nnz() == csrEven.nnz() + csrOdd.nnz());
+    CHECK(_sameTensor(CSRToDense(merged), combine(even, odd, [](double x, double y) { return x + 2.0 * y; })));
+    CHECK(CSREvaluate(CSRHadamard(csrEven, csrOdd)).nnz() == 0);
+
+    // operands must share their shape, and the result index must hold every column
+    CSR<double> wide(_randomTensor({30, 400}, 0.1, generator));
+    CHECK_THROWS(std::invalid_argument, csrEven + CSR<double>(_randomTensor({30, 40}, 0.3, generator)));
+    CHECK_THROWS(std::invalid_argument, CSRHadamard(csrEven, CSR<double>(_randomTensor({2, 20, 30}, 0.3, generator))));
+    CHECK_THROWS(std::invalid_argument, CSREvaluate<uint8_t>(wide + wide));
+    CHECK(CSREvaluate<uint16_t>(wide + wide).nnz() == wide.nnz());
+}
+
+static void testSpGEMMPlan()
+{
+    std::mt19937 generator(16);
+    xt::xarray<double> tensorA = _randomTensor({300, 200}, 0.05, generator);
+    xt::xarray<double> tensorB = _randomTensor({200, 250}, 0.05, generator);
+    CSR<double> csrA(tensorA), csrB(tensorB);
+
+    SpGEMMPlan<double> plan(csrA, csrB);
+    CHECK(_sameTensor(CSRToDense(plan.getResult()), _denseProduct(tensorA, tensorB)));
+
+    // the plan is reused for new values on the same patterns
+    for (int iteration = 1; iteration <= 3; ++iteration)
+    {
+        xt::xarray<double> newA = _newValues(tensorA, iteration);
+        xt::xarray<double> newB = _newValues(tensorB, 2 * iteration);
+        CSR<double> expected = CSRMult(CSR<double>(newA), CSR<double>(newB));
+        CHECK(_sameCSR(plan.execute(CSR<double>(newA), CSR<double>(newB)), expected));
+        CHECK(_sameTensor(CSRToDense(plan.getResult()), _denseProduct(newA, newB)));
+
+        CSR<double> product = plan.getResult();
+        plan.execute(csrA, csrB, product);
+        CHECK(_sameTensor(CSRToDense(product), _denseProduct(tensorA, tensorB)));
+    }
+
+    // batched and broadcast operands, compact indices, and enough multiply adds to run in parallel
+    xt::xarray<double> batchedA = _randomTensor({3, 40, 30}, 0.2, generator);
+    xt::xarray<double> sharedB = _randomTensor({30, 20}, 0.2, generator);
+    CSR<double, uint32_t> compactA(batchedA), compactB(sharedB);
+    SpGEMMPlan<double, uint32_t> batchedPlan(compactA, compactB);
+    CHECK(_sameTensor(CSRToDense(batchedPlan.execute(compactA, compactB)), _batchedProduct(batchedA, sharedB)));
+    xt::xarray<double> newBatchedA = _newValues(batchedA, 3);
+    CHECK(_sameTensor(CSRToDense(batchedPlan.execute(CSR<double, uint32_t>(newBatchedA), compactB)),
+                      _batchedProduct(newBatchedA, sharedB)));
+
+    CSR<double> largeA(_randomTensor({2000, 500}, 0.05, generator));
+    CSR<double> largeB(_randomTensor({500, 400}, 0.05, generator));
+    SpGEMMPlan<double> largePlan(largeA, largeB);
+    CHECK(largePlan.flops() > 50000);
+    CHECK(_sameCSR(largePlan.execute(largeA, largeB), CSRMult(largeA, largeB)));
+
+    // operands of another shape
+    CHECK_THROWS(std::invalid_argument, plan.execute(csrB, csrA));
+    CHECK_THROWS(std::invalid_argument, SpGEMMPlan<double>(csrA, csrA));
+
+    // same shape and number of nonzeros, one nonzero moved to another column
+    xt::xarray<double> x = xt::zeros<double>(std::vector<size_t>{3, 3});
+    x(0, 0) = 1;
+    x(1, 1) = 2;
+    xt::xarray<double> moved = xt::zeros<double>(std::vector<size_t>{3, 3});
+    moved(0, 1) = 1;
+    moved(1, 1) = 2;
+    CSR<double> csrX(x), csrMoved(moved), csrY(_randomTensor({3, 3}, 0.6, generator));
+    SpGEMMPlan<double> small(csrX, csrY);
+    CHECK(csrX.nnz() == csrMoved.nnz());
+    CHECK_THROWS(std::invalid_argument, small.execute(csrMoved, csrY));
+
+    // a product of another pattern is rejected rather than overwritten
+    CSR<double> wrong(csrMoved);
+    CHECK_THROWS(std::invalid_argument, small.execute(csrX, csrY, wrong));
+}
+
+static void testTranspose()
+{
+    std::mt19937 generator(17);
+
+    // transposes of matrices and batches, large enough for the parallel counting sort too
+    for (const std::vector<size_t> &shape : {std::vector<size_t>{30, 50}, std::vector<size_t>{3, 20, 40},
+                                             std::vector<size_t>{600, 400}})
+    {
+        xt::xarray<double> tensor = _randomTensor(shape, 0.5, generator);
+        CSR<double> transposed = CSRTranspose(CSR<double>(tensor));
+        CHECK(_isSorted(transposed));
+        CHECK(_sameTensor(CSRToDense(transposed), _denseTranspose(tensor)));
+    }
+
+    // the rows of a tall matrix become columns, which a narrow index type cannot hold
+    xt::xarray<double> tall = _randomTensor({300, 10}, 0.3, generator);
+    CHECK_THROWS(std::invalid_argument, CSRTranspose(CSR<double, uint8_t>(tall)));
+    CHECK_THROWS(std::invalid_argument, CSC<double, uint8_t>{tall});
+    CHECK(_sameTensor(CSRToDense(CSRTranspose(CSR<double, uint16_t>(tall))), _denseTranspose(tall)));
+    CHECK_THROWS(std::invalid_argument, CSRTranspose(CSR<double>(_randomTensor({10}, 0.5, generator))));
+
+    // CSC stores the columns and hands out the transpose without a copy
+    xt::xarray<double> matrix = _randomTensor({40, 30}, 0.3, generator);
+    CSC<double> csc(matrix);
+    CHECK(csc.rows() == 40 && csc.cols() == 30 && csc.nnz() == CSR<double>(matrix).nnz());
+    CHECK(_sameTensor(CSCToDense(csc), matrix));
+    CHECK(_sameTensor(CSRToDense(csc.toCSR()), matrix));
+    CHECK(_sameTensor(CSRToDense(csc.transposed()), _denseTranspose(matrix)));
+    CHECK(_sameTensor(CSCToDense(CSC<double, uint32_t>(CSR<double, uint32_t>(matrix))), matrix));
+    CSC<double> built({2, 3}, std::vector<size_t>{0, 1, 1, 3}, std::vector<size_t>{1, 0, 1}, std::vector<double>{1, 2, 3});
+    xt::xarray<double> expected = xt::zeros<double>(std::vector<size_t>{2, 3});
+    expected.data()[3] = 1;
+    expected.data()[2] = 2;
+    expected.data()[5] = 3;
+    CHECK(_sameTensor(CSCToDense(built), expected));
+    CHECK_THROWS(std::invalid_argument, CSC<double>(_randomTensor({2, 3, 4}, 0.5, generator)));
+
+    // products of CSC and of transposed CSR matrices with dense operands, vectors checked as one column matrices
+    auto asColumn = [](const xt::xarray<double> &vector)
+    {
+        xt::xarray<double> column = xt::zeros<double>(std::vector<size_t>{vector.size(), 1});
+        std::copy(vector.data(), vector.data() + vector.size(), column.data());
+        return column;
+    };
+    auto sameVector = [&](const xt::xarray<double> &result, const xt::xarray<double> &product)
+    {
+        return result.dimension() == 1 && _sameTensor(asColumn(result), product);
+    };
+
+    xt::xarray<double> vector = _randomTensor({30}, 0.8, generator);
+    xt::xarray<double> vectorT = _randomTensor({40}, 0.8, generator);
+    xt::xarray<double> dense = _randomTensor({30, 7}, 0.8, generator);
+    xt::xarray<double> denseT = _randomTensor({40, 7}, 0.8, generator);
+    xt::xarray<double> result;
+    CSCMultVec(csc, vector, result);
+    CHECK(sameVector(result, _denseProduct(matrix, asColumn(vector))));
+    CSCMultDense(csc, dense, result);
+    CHECK(_sameTensor(result, _denseProduct(matrix, dense)));
+    CSCTransposeMultVec(csc, vectorT, result);
+    CHECK(sameVector(result, _denseProduct(_denseTranspose(matrix), asColumn(vectorT))));
+    CSCTransposeMultDense(csc, denseT, result);
+    CHECK(_sameTensor(result, _denseProduct(_denseTranspose(matrix), denseT)));
+
+    // A^T x pushes rows while the private results are small, and transposes once otherwise
+    xt::xarray<double> few = _randomTensor({200, 300}, 0.3, generator);
+    xt::xarray<double> many = _randomTensor({4, 30000}, 0.6, generator);
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+    CHECK(_pushBeatsTranspose(CSR<double>(few)));
+    CHECK(!_pushBeatsTranspose(CSR<double>(many)));
+#endif
+    for (const xt::xarray<double> &tensor : {matrix, few, many})
+    {
+        CSR<double> csr(tensor);
+        size_t rows = tensor.shape()[0];
+        xt::xarray<double> left = _randomTensor({rows}, 0.8, generator);
+        xt::xarray<double> right = _randomTensor({rows, 5}, 0.8, generator);
+        CSRTransposeMultVec(csr, left, result);
+        CHECK(sameVector(result, _denseProduct(_denseTranspose(tensor), asColumn(left))));
+        CSRTransposeMultDense(csr, right, result);
+        CHECK(_sameTensor(result, _denseProduct(_denseTranspose(tensor), right)));
+    }
+    CHECK_THROWS(std::invalid_argument, CSRTransposeMultVec(csc.toCSR(), vector, result));
+    CHECK_THROWS(std::invalid_argument, CSRTransposeMultDense(csc.toCSR(), dense, result));
+
+    // sparse A^T B pushes the row pairs into dense results while they cost less than the multiply adds
+    bool parallel = false;
+    xt::xarray<double> deep = _randomTensor({400, 10}, 0.5, generator);
+    xt::xarray<double> deepB = _randomTensor({400, 12}, 0.5, generator);
+    xt::xarray<double> flat = _randomTensor({20, 300}, 0.05, generator);
+    xt::xarray<double> flatB = _randomTensor({20, 250}, 0.05, generator);
+    CHECK(_pushMultBeatsTranspose(10, 12, 10000, parallel));
+    CHECK(!_pushMultBeatsTranspose(300, 250, 5000, parallel));
+    CHECK(_sameTensor(CSRToDense(CSRTransposeMult(CSR<double>(deep), CSR<double>(deepB))),
+                      _denseProduct(_denseTranspose(deep), deepB)));
+    CHECK(_sameTensor(CSRToDense(CSRTransposeMult(CSR<double>(flat), CSR<double>(flatB))),
+                      _denseProduct(_denseTranspose(flat), flatB)));
+    CHECK(_sameCSR(CSRTransposeMult(CSR<double>(deep), CSR<double>(deepB)),
+                   CSRMult(CSRTranspose(CSR<double>(deep)), CSR<double>(deepB))));
+
+    // pushed in parallel, with a narrow index that could not hold the rows of A as columns
+    xt::xarray<double> long1 = _randomTensor({5000, 30}, 0.5, generator);
+    xt::xarray<double> long2 = _randomTensor({5000, 40}, 0.5, generator);
+    CHECK(_pushMultBeatsTranspose(30, 40, 5000 * 15 * 20, parallel));
+    CHECK(_sameTensor(CSRToDense(CSRTransposeMult(CSR<double, uint8_t>(long1), CSR<double, uint8_t>(long2))),
+                      _denseProduct(_denseTranspose(long1), long2)));
+#ifdef _OPENMP
+    CHECK(parallel);
+    omp_set_num_threads(threads);
+#endif
+
+    // batched and broadcast operands on both routes
+    std::vector<std::pair<std::vector<size_t>, std::vector<size_t>>> shapes = {
+        {{3, 40, 10}, {3, 40, 12}}, {{40, 10}, {3, 40, 12}}, {{3, 40, 10}, {40, 12}}, {{2, 1, 6, 80}, {3, 6, 90}}};
+    for (const auto &[shapeA, shapeB] : shapes)
+    {
+        xt::xarray<double> tensorA = _randomTensor(shapeA, 0.4, generator);
+        xt::xarray<double> tensorB = _randomTensor(shapeB, 0.4, generator);
+        CSR<double> product = CSRTransposeMult(CSR<double>(tensorA), CSR<double>(tensorB));
+        CHECK(_isSorted(product));
+        CHECK(_sameTensor(CSRToDense(product), _batchedProduct(_denseTranspose(tensorA), tensorB)));
+    }
+    CHECK_THROWS(std::invalid_argument, CSRTransposeMult(CSR<double>(deep), CSR<double>(flatB)));
+    CHECK_THROWS(std::invalid_argument, CSRTransposeMult(CSR<double>(vector), CSR<double>(deepB)));
+}
+
+static void testMaskedSpGEMM()
+{
+    std::mt19937 generator(18);
+
+    // the masked product is the dense product filtered by the mask, sparse masks pick dot products too
+    auto filter = [](const xt::xarray<double> &product, const xt::xarray<double> &maskTensor, bool inside)
+    {
+        xt::xarray<double> result = product;
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            if ((maskTensor.data()[i] != 0) != inside)
+            {
+                result.data()[i] = 0;
+            }
+        }
+        return result;
+    };
+    for (double maskDensity : {0.0, 0.001, 0.05, 0.5, 1.0})
+    {
+        xt::xarray<double> tensorA = _randomTensor({200, 150}, 0.2, generator);
+        xt::xarray<double> tensorB = _randomTensor({150, 180}, 0.2, generator);
+        xt::xarray<double> maskTensor = _randomTensor({200, 180}, maskDensity, generator);
+        CSR<double> csrA(tensorA), csrB(tensorB), mask(maskTensor);
+        xt::xarray<double> product = _denseProduct(tensorA, tensorB);
+
+        CSR<double> structural = CSRMult(csrA, csrB, mask, MaskMode::Structural);
+        CSR<double> complement = CSRMult(csrA, csrB, mask, MaskMode::Complement);
+        CHECK(_isSorted(structural));
+        CHECK(_isSorted(complement));
+        CHECK(_sameTensor(CSRToDense(structural), filter(product, maskTensor, true)));
+        CHECK(_sameTensor(CSRToDense(complement), filter(product, maskTensor, false)));
+    }
+
+    // rows of very different cost, split into parallel chunks by the cost of the kernel each row picked
+    xt::xarray<double> skewedA = _randomTensor({3000, 200}, 0.02, generator);
+    for (size_t row = 0; row < 3000; row += 100)
+    {
+        for (size_t k = 0; k < 200; ++k)
+        {
+            skewedA.data()[row * 200 + k] = 1.0 + static_cast<double>(k % 5);
+        }
+    }
+    xt::xarray<double> skewedB = _randomTensor({200, 300}, 0.3, generator);
+    xt::xarray<double> sparseMask = _randomTensor({3000, 300}, 0.002, generator);
+    CSR<double> skewed = CSRMult(CSR<double>(skewedA), CSR<double>(skewedB), CSR<double>(sparseMask), MaskMode::Structural);
+    CHECK(_sameTensor(CSRToDense(skewed), filter(_denseProduct(skewedA, skewedB), sparseMask, true)));
+
+    // batched operands with a mask of other types
+    xt::xarray<double> tensorA = _randomTensor({3, 20, 15}, 0.3, generator);
+    xt::xarray<double> tensorB = _randomTensor({15, 12}, 0.3, generator);
+    xt::xarray<double> maskTensor = _randomTensor({3, 20, 12}, 0.2, generator);
+    CSR<double> csrA(tensorA), csrB(tensorB);
+    CSR<float, uint16_t> mask(_toFloat(maskTensor));
+    xt::xarray<double> product = _batchedProduct(tensorA, tensorB);
+    CHECK(_sameTensor(CSRToDense(CSRMult(csrA, csrB, mask, MaskMode::Structural)), filter(product, maskTensor, true)));
+    CHECK(_sameTensor(CSRToDense(CSRMult(csrA, csrB, mask, MaskMode::Complement)), filter(product, maskTensor, false)));
+
+    CSR<double> wrongMask(_randomTensor({3, 20, 15}, 0.2, generator));
+    CHECK_THROWS(std::invalid_argument, CSRMult(csrA, csrB, wrongMask, MaskMode::Structural));
+}
+
+static void testPrunedSpGEMM()
+{
+    std::mt19937 generator(19);
+    auto options = [](double dropTolerance, bool relative, size_t topK)
+    {
+        PruneOptions prune;
+        prune.dropTolerance = dropTolerance;
+        prune.relative = relative;
+        prune.topK = topK;
+        return prune;
+    };
+    std::vector<PruneOptions> prunes = {options(0.0, false, 0), options(20.0, false, 0), options(0.5, true, 0),
+                                        options(0.0, false, 3),  options(10.0, false, 2), options(0.3, true, 1),
+                                        options(0.0, false, 1000)};
+
+    // negative operands check that magnitudes are compared, integer values make ties that topK breaks by column
+    xt::xarray<double> tensorA = _randomTensor({120, 80}, 0.1, generator);
+    xt::xarray<double> negativeA = tensorA;
+    for (size_t i = 0; i < negativeA.size(); ++i)
+    {
+        negativeA.data()[i] = -negativeA.data()[i];
+    }
+    xt::xarray<double> tensorB = _randomTensor({80, 90}, 0.1, generator);
+    xt::xarray<double> batchedA = _randomTensor({2, 30, 20}, 0.3, generator);
+    xt::xarray<double> sharedB = _randomTensor({20, 25}, 0.3, generator);
+    xt::xarray<double> largeA = _randomTensor({600, 300}, 0.05, generator);
+    xt::xarray<double> largeB = _randomTensor({300, 400}, 0.05, generator);
+    for (const PruneOptions &prune : prunes)
+    {
+        for (const xt::xarray<double> &left : {tensorA, negativeA})
+        {
+            CSR<double> pruned = CSRMult(CSR<double>(left), CSR<double>(tensorB), prune);
+            CHECK(_isSorted(pruned));
+            CHECK(_sameTensor(CSRToDense(pruned), _prunedProduct(_denseProduct(left, tensorB), prune)));
+        }
+
+        xt::xarray<double> batched = _prunedProduct(_batchedProduct(batchedA, sharedB), prune);
+        CHECK(_sameTensor(CSRToDense(CSRMult(CSR<double>(batchedA), CSR<double>(sharedB), prune)), batched));
+        CHECK(_sameTensor(sparse_ops::multiplyCompressedFormat(batchedA, sharedB, prune), batched));
+        CHECK(_sameTensor(CSRToDense(sparse_ops::multiplyCompressedFormatSparse(batchedA, sharedB, prune)), batched));
+    }
+
+    // enough multiply adds to prune in parallel chunks, rows never hold more than topK entries
+    PruneOptions prune = options(0.2, true, 4);
+    CSR<double, uint32_t> large = CSRMult(CSR<double, uint32_t>(largeA), CSR<double, uint32_t>(largeB), prune);
+    CHECK(_sameTensor(CSRToDense(large), _prunedProduct(_denseProduct(largeA, largeB), prune)));
+    size_t longest = 0;
+    for (size_t row = 0; row < large.rows(); ++row)
+    {
+        longest = std::max(longest, large.getRowPtr()[row + 1] - large.getRowPtr()[row]);
+    }
+    CHECK(longest == 4);
+
+    CHECK_THROWS(std::invalid_argument, CSRMult(CSR<double>(tensorB), CSR<double>(tensorA), prune));
+}
+
+static void testReorder()
+{
+    std::mt19937 generator(21);
+    auto isPermutation = [](std::vector<size_t> order, size_t size)
+    {
+        std::sort(order.begin(), order.end());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            if (order[i] != i)
+            {
+                return false;
+            }
+        }
+        return order.size() == size;
+    };
+    // P A P^T computed densely, new (i, j) is old (order[i], order[j])
+    auto densePermute = [](const xt::xarray<double> &matrix, const std::vector<size_t> &rowOrder,
+                           const std::vector<size_t> &colOrder)
+    {
+        size_t cols = matrix.shape()[1];
+        xt::xarray<double> result = xt::zeros<double>(std::vector<size_t>{rowOrder.size(), colOrder.size()});
+        for (size_t i = 0; i < rowOrder.size(); ++i)
+        {
+            for (size_t j = 0; j < colOrder.size(); ++j)
+            {
+                result.data()[i * colOrder.size() + j] = matrix.data()[rowOrder[i] * cols + colOrder[j]];
+            }
+        }
+        return result;
+    };
+
+    // a full band of half width 3, scrambled by a random symmetric permutation
+    size_t n = 300;
+    xt::xarray<double> band = xt::zeros<double>(std::vector<size_t>{n, n});
+    for (size_t i = 0; i < n; ++i)
+    {
+        for (size_t j = i >= 3 ? i - 3 : 0; j < std::min(n, i + 4); ++j)
+        {
+            band.data()[i * n + j] = 1.0 + static_cast<double>(generator() % 9);
+        }
+    }
+    std::vector<size_t> scramble(n);
+    std::iota(scramble.begin(), scramble.end(), 0);
+    std::shuffle(scramble.begin(), scramble.end(), generator);
+    xt::xarray<double> scrambledTensor = densePermute(band, scramble, scramble);
+    CSR<double> scrambled(scrambledTensor);
+    CHECK(_sameTensor(CSRToDense(CSRPermute(CSR<double>(band), scramble, scramble)), scrambledTensor));
+    CHECK(CSRBandwidth(CSR<double>(band)) == 3);
+
+    std::vector<size_t> rcm = CSROrdering(scrambled);
+    CHECK(isPermutation(rcm, n));
+    CSR<double> recovered = CSRPermute(scrambled, rcm, rcm);
+    CHECK(_isSorted(recovered));
+    CHECK(_sameTensor(CSRToDense(recovered), densePermute(scrambledTensor, rcm, rcm)));
+    CHECK(CSRBandwidth(recovered) <= CSRBandwidth(scrambled));
+    CHECK(CSRBandwidth(recovered) <= 6);
+
+    // unsymmetric patterns with isolated vertices still get a full ordering, degree orders put the hubs first
+    xt::xarray<double> irregularTensor = _randomTensor({200, 200}, 0.01, generator);
+    for (size_t col = 0; col < 200; ++col)
+    {
+        irregularTensor.data()[17 * 200 + col] = 2.0;
+    }
+    CSR<double> irregular(irregularTensor);
+    for (ReorderMethod method : {ReorderMethod::ReverseCuthillMcKee, ReorderMethod::Degree})
+    {
+        std::vector<size_t> order = CSROrdering(irregular, method);
+        CHECK(isPermutation(order, 200));
+        CHECK(_sameTensor(CSRToDense(CSRPermute(irregular, order, order)), densePermute(irregularTensor, order, order)));
+    }
+    CHECK(CSROrdering(irregular, ReorderMethod::Degree)[0] == 17);
+
+    // rows only, and orderings that are not permutations
+    std::vector<size_t> reversed(200);
+    std::iota(reversed.rbegin(), reversed.rend(), 0);
+    std::vector<size_t> identity(200);
+    std::iota(identity.begin(), identity.end(), 0);
+    CHECK(_sameTensor(CSRToDense(CSRPermute(irregular, reversed, {})), densePermute(irregularTensor, reversed, identity)));
+    CHECK_THROWS(std::invalid_argument, CSRPermute(irregular, std::vector<size_t>(200, 0), {}));
+    CHECK_THROWS(std::invalid_argument, CSROrdering(CSR<double>(_randomTensor({20, 30}, 0.2, generator))));
+
+    // ReorderedCSR keeps P A P^T and maps dense operands in and out of the ordering
+    ReorderedCSR<double> reordered(scrambled);
+    CHECK(reordered.size() == n && reordered.getOrder() == rcm);
+    CHECK(_sameCSR(reordered.getMatrix(), recovered));
+    CHECK(_sameCSR(reordered.toCSR(), scrambled));
+    for (size_t i = 0; i < n; ++i)
+    {
+        CHECK(reordered.getInverse()[reordered.getOrder()[i]] == i);
+    }
+    xt::xarray<double> vector = _randomTensor({n}, 0.8, generator);
+    xt::xarray<double> dense = _randomTensor({n, 6}, 0.8, generator);
+    xt::xarray<double> permutedVector = reordered.permute(vector);
+    for (size_t i = 0; i < n; ++i)
+    {
+        CHECK(permutedVector.data()[i] == vector.data()[rcm[i]]);
+    }
+    CHECK(_sameTensor(reordered.restore(permutedVector), vector));
+    CHECK(_sameTensor(reordered.restore(reordered.permute(dense)), dense));
+
+    // reordered products match the products of the original matrices
+    xt::xarray<double> result, expected;
+    CSRMultVec(reordered, vector, result);
+    CSRMultVec(scrambled, vector, expected);
+    CHECK(_sameTensor(result, expected));
+    CSRMultDense(reordered, dense, result);
+    CHECK(_sameTensor(result, _denseProduct(scrambledTensor, dense)));
+
+    xt::xarray<double> otherTensor = _randomTensor({n, n}, 0.02, generator);
+    ReorderedCSR<double> other(CSR<double>(otherTensor), reordered.getOrder());
+    ReorderedCSR<double> product = CSRMult(reordered, other);
+    CHECK(product.getOrder() == rcm);
+    CHECK(_sameTensor(CSRToDense(product.toCSR()), _denseProduct(scrambledTensor, otherTensor)));
+    ReorderedCSR<double> wrapped = ReorderedCSR<double>::fromReordered(product.getMatrix(), rcm);
+    CHECK(_sameCSR(wrapped.toCSR(), product.toCSR()));
+
+    std::vector<size_t> unordered(n);
+    std::iota(unordered.begin(), unordered.end(), 0);
+    ReorderedCSR<double> unreordered(CSR<double>(otherTensor), unordered);
+    CHECK(_sameCSR(unreordered.getMatrix(), CSR<double>(otherTensor)));
+    CHECK_THROWS(std::invalid_argument, CSRMult(reordered, unreordered));
+    CHECK_THROWS(std::invalid_argument, ReorderedCSR<double>(scrambled, std::vector<size_t>(n, 1)));
+    CHECK_THROWS(std::invalid_argument, CSRMultVec(reordered, _randomTensor({n + 1}, 0.5, generator), result));
+}
+
+static void testDynamicCSR()
+{
+    std::mt19937 generator(22);
+    const size_t rows = 100;
+    const size_t cols = 80;
+    xt::xarray<double> reference = _randomTensor({rows, cols}, 0.05, generator);
+
+    // thresholds picking a default, merging rarely and merging after every update
+    for (size_t threshold : {size_t(0), size_t(50), size_t(1)})
+    {
+        xt::xarray<double> expected = reference;
+        DynamicCSR<double> dynamic(CSR<double>(reference), threshold);
+        for (size_t k = 0; k < 5000; ++k)
+        {
+            size_t row = generator() % rows;
+            size_t col = generator() % cols;
+            double value = static_cast<double>(k % 7) + 1;
+            switch (generator() % 3)
+            {
+            case 0:
+                dynamic.insert(row, col, value);
+                expected(row, col) = value;
+                break;
+            case 1:
+                CHECK(dynamic.update(row, col, value) == (expected(row, col) != 0));
+                if (expected(row, col) != 0)
+                {
+                    expected(row, col) = value;
+                }
+                break;
+            default:
+                CHECK(dynamic.erase(row, col) == (expected(row, col) != 0));
+                expected(row, col) = 0;
+                break;
+            }
+
+            if (k % 1000 == 0)
+            {
+                dynamic.mergeAsync();
+            }
+            if (k % 997 == 0)
+            {
+                CHECK(dynamic.get(row, col) == expected(row, col));
+            }
+        }
+
+        auto snapshot = dynamic.view();
+        CHECK(dynamic.pendingUpdates() == 0);
+        CHECK(_isSorted(*snapshot));
+        CHECK(_sameTensor(CSRToDense(*snapshot), expected));
+
+        // a snapshot does not see later updates
+        dynamic.insert(0, 0, 42);
+        dynamic.merge();
+        CHECK(dynamic.get(0, 0) == 42);
+        CHECK((*snapshot).nnz() == CSR<double>(expected).nnz());
+
+        // products of the current views
+        expected(0, 0) = 42;
+        xt::xarray<double> squareTensor = _randomTensor({cols, cols}, 0.1, generator);
+        DynamicCSR<double> square{CSR<double>(squareTensor)};
+        CHECK(_sameTensor(CSRToDense(CSRMult(dynamic, square)), _denseProduct(expected, squareTensor)));
+
+        // dense products merge the pending updates first
+        dynamic.erase(0, 0);
+        expected(0, 0) = 0;
+        xt::xarray<double> dense = _randomTensor({cols, 4}, 0.8, generator);
+        xt::xarray<double> result;
+        CSRMultDense(dynamic, dense, result);
+        CHECK(_sameTensor(result, _denseProduct(expected, dense)));
+        xt::xarray<double> vector = _randomTensor({cols}, 0.8, generator);
+        xt::xarray<double> expectedVector;
+        CSRMultVec(CSR<double>(expected), vector, expectedVector);
+        CSRMultVec(dynamic, vector, result);
+        CHECK(_sameTensor(result, expectedVector));
+    }
+
+    // an empty tensor filled by updates only, with a threshold set later
+    DynamicCSR<double, uint32_t> empty(std::vector<size_t>{4, 5});
+    empty.setMergeThreshold(2);
+    CHECK(empty.getMergeThreshold() == 2 && empty.getShape() == std::vector<size_t>({4, 5}));
+    CHECK(!empty.contains(1, 2) && !empty.update(1, 2, 3.0) && !empty.erase(1, 2));
+    empty.insert(1, 2, 3.0);
+    empty.insert(3, 4, 5.0);
+    empty.insert(1, 2, 6.0);
+    CHECK(empty.contains(1, 2) && empty.get(1, 2) == 6.0);
+    xt::xarray<double> filled = xt::zeros<double>(std::vector<size_t>{4, 5});
+    filled(1, 2) = 6.0;
+    filled(3, 4) = 5.0;
+    CHECK(_sameTensor(CSRToDense(*empty.view()), filled));
+
+    CHECK_THROWS(std::invalid_argument, DynamicCSR<double>(std::vector<size_t>{3, 3}).insert(3, 0, 1));
+}
+
+static void testReducedPrecision()
+{
+    std::mt19937 generator(23);
+
+    // round to nearest even on the upper 16 bits of a float, NaN and infinities survive
+    CHECK(bfloat16(1.0f).bits == 0x3f80 && static_cast<float>(bfloat16(-2.5f)) == -2.5f);
+    CHECK(static_cast<float>(bfloat16(1.0f + 1.0f / 256)) == 1.0f);
+    CHECK(static_cast<float>(bfloat16(1.0f + 3.0f / 256)) == 1.0f + 1.0f / 64);
+    CHECK(static_cast<float>(bfloat16(1.0f + 1.0f / 128)) == 1.0f + 1.0f / 128);
+    CHECK(std::isnan(static_cast<float>(bfloat16(std::numeric_limits<float>::quiet_NaN()))));
+    CHECK(std::isinf(static_cast<float>(bfloat16(std::numeric_limits<float>::infinity()))));
+    CHECK(static_cast<float>(bfloat16(257.0f)) == 256.0f);
+    CHECK((std::is_same_v<AccumulatorType<void, bfloat16>, float>));
+    CHECK((std::is_same_v<AccumulatorType<void, float, double>, double>));
+    CHECK((std::is_same_v<AccumulatorType<double, bfloat16>, double>));
+
+    // storage keeps the pattern, CSRCast only converts the values
+    xt::xarray<double> tensorA = _randomTensor({90, 70}, 0.2, generator);
+    xt::xarray<double> tensorB = _randomTensor({70, 50}, 0.2, generator);
+    CSR<double> csrA(tensorA), csrB(tensorB);
+    CSR<bfloat16> halfA = CSRCast<bfloat16>(csrA);
+    CSR<bfloat16> halfB = CSRCast<bfloat16>(csrB);
+    CHECK(halfA.nnz() == csrA.nnz());
+    CHECK(_sameTensor(_toDouble(CSRToDense(halfA)), tensorA));
+    CHECK(_sameCSR(CSRCast<double>(CSRCast<float>(csrA)), csrA));
+
+    // integer products are exact in float, so every result is the exact product rounded once
+    xt::xarray<double> product = _denseProduct(tensorA, tensorB);
+    CHECK(_sameTensor(_toDouble(CSRToDense(CSRMult(halfA, halfB))), _roundedToBfloat16(product)));
+    CHECK(_sameTensor(_toDouble(CSRToDense(CSRMult<double>(halfA, halfB))), _roundedToBfloat16(product)));
+    SpGEMMPlan<bfloat16> plan(halfA, halfB);
+    CHECK(_sameTensor(_toDouble(CSRToDense(plan.execute(halfA, halfB))), _roundedToBfloat16(product)));
+    CHECK(_sameTensor(sparse_ops::multiplyCompressedFormat<bfloat16>(tensorA, tensorB), _roundedToBfloat16(product)));
+    CHECK(_sameTensor(_toDouble(CSRToDense(sparse_ops::multiplyCompressedFormatSparse<float, double>(tensorA, tensorB))),
+                      product));
+
+    // dense operands of float or bfloat16, every panel width so the widening vector tails run
+    auto toHalf = [](const xt::xarray<double> &tensor)
+    {
+        xt::xarray<bfloat16> result = xt::zeros<bfloat16>(tensor.shape());
+        std::transform(tensor.data(), tensor.data() + tensor.size(), result.data(), [](double value)
+                       { return bfloat16(static_cast<float>(value)); });
+        return result;
+    };
+    for (size_t width = 1; width <= 33; ++width)
+    {
+        xt::xarray<double> dense = _randomTensor({70, width}, 0.5, generator);
+        xt::xarray<double> expected = _denseProduct(tensorA, dense);
+        xt::xarray<float> floatResult;
+        CSRMultDense(halfA, _toFloat(dense), floatResult);
+        CHECK(_sameTensor(_toDouble(floatResult), expected));
+        xt::xarray<bfloat16> halfResult;
+        CSRMultDense(halfA, toHalf(dense), halfResult);
+        CHECK(_sameTensor(_toDouble(halfResult), _roundedToBfloat16(expected)));
+    }
+
+    xt::xarray<double> vector = _randomTensor({70}, 0.8, generator);
+    xt::xarray<double> column = xt::zeros<double>(std::vector<size_t>{70, 1});
+    std::copy(vector.data(), vector.data() + vector.size(), column.data());
+    xt::xarray<double> expectedVector = xt::zeros<double>(std::vector<size_t>{90});
+    xt::xarray<double> columnProduct = _denseProduct(tensorA, column);
+    std::copy(columnProduct.data(), columnProduct.data() + columnProduct.size(), expectedVector.data());
+    xt::xarray<float> floatVector;
+    CSRMultVec(halfA, _toFloat(vector), floatVector);
+    CHECK(_sameTensor(_toDouble(floatVector), expectedVector));
+    xt::xarray<bfloat16> halfVector;
+    CSRMultVec(halfA, toHalf(vector), halfVector);
+    CHECK(_sameTensor(_toDouble(halfVector), _roundedToBfloat16(expectedVector)));
+
+    // a long sum stalls at 256 when added up in bfloat16 and loses small terms in float, the wide sums keep both
+    size_t length = 1000;
+    xt::xarray<double> ones = xt::zeros<double>(std::vector<size_t>{1, length});
+    xt::xarray<double> onesColumn = xt::zeros<double>(std::vector<size_t>{length, 1});
+    xt::xarray<double> onesVector = xt::zeros<double>(std::vector<size_t>{length});
+    xt::xarray<double> drift = xt::zeros<double>(std::vector<size_t>{1, length});
+    std::fill(ones.data(), ones.data() + length, 1.0);
+    std::fill(onesColumn.data(), onesColumn.data() + length, 1.0);
+    std::fill(onesVector.data(), onesVector.data() + length, 1.0);
+    std::fill(drift.data(), drift.data() + length, std::ldexp(1.0, -24));
+    drift.data()[0] = 1.0;
+
+    CSR<bfloat16> halfOnes = CSRCast<bfloat16>(CSR<double>(ones));
+    CHECK(static_cast<float>(CSRMult(halfOnes, CSRCast<bfloat16>(CSR<double>(onesColumn))).getValues()[0]) == 1000.0f);
+    xt::xarray<bfloat16> halfSum;
+    CSRMultDense(halfOnes, toHalf(onesColumn), halfSum);
+    CHECK(static_cast<float>(halfSum.data()[0]) == 1000.0f);
+    CSRMultVec(halfOnes, toHalf(onesVector), halfSum);
+    CHECK(static_cast<float>(halfSum.data()[0]) == 1000.0f);
+
+    double exact = 1.0 + 999 * std::ldexp(1.0, -24);
+    double spacing = std::ldexp(1.0, -23);
+    CSR<float> floatDrift = CSRCast<float>(CSR<double>(drift));
+    CHECK(std::fabs(CSRMult<double>(floatDrift, CSRCast<float>(CSR<double>(onesColumn))).getValues()[0] - exact) <= spacing);
+    xt::xarray<float> floatSum;
+    CSRMultDense<double>(floatDrift, _toFloat(onesColumn), floatSum);
+    CHECK(std::fabs(floatSum.data()[0] - exact) <= spacing);
+    CSRMultVec<double>(floatDrift, _toFloat(onesVector), floatSum);
+    CHECK(std::fabs(floatSum.data()[0] - exact) <= spacing);
+
+    // the values are stored as their bits in CSR files
+    std::string path = _tempPath("bfloat16.bin");
+    SaveCSR(halfA, path);
+    CHECK(_readHeader(path).valueType == static_cast<uint32_t>(CSRValueType::BFloat16));
+    CHECK(_sameCSR(LoadCSR<bfloat16>(path), halfA));
+    CHECK_THROWS(std::runtime_error, LoadCSR<float>(path));
+    std::filesystem::remove(path);
+}
+
+static void testCSRMultFile()
+{
+    std::mt19937 generator(24);
+    std::string pathA = _tempPath("a.bin");
+    std::string pathResult = _tempPath("c.bin");
+
+    xt::xarray<double> tensorA = _randomTensor({700, 300}, 0.05, generator);
+    xt::xarray<double> tensorB = _randomTensor({300, 200}, 0.05, generator);
+    CSR<double> csrA(tensorA), csrB(tensorB);
+    SaveCSR(csrA, pathA);
+    xt::xarray<double> expected = _denseProduct(tensorA, tensorB);
+
+    // panels of a single row, of a few rows and of the whole file
+    for (size_t panelBytes : {size_t(0), size_t(4096), defaultPanelBytes})
+    {
+        CSRMultFile(pathA, csrB, pathResult, panelBytes);
+        CSR<double> product = LoadCSR<double, size_t>(pathResult, true);
+        CHECK(_sameTensor(CSRToDense(product), expected));
+        CHECK(_sameCSR(product, CSRMult(csrA, csrB)));
+        CHECK(!std::filesystem::exists(pathResult + ".values"));
+    }
+
+    // the reader hands out consecutive panels that make up the file
+    CSRPanelReader<double> reader(pathA, 4096);
+    CHECK(reader.rows() == 700 && reader.cols() == 300 && reader.nnz() == csrA.nnz());
+    size_t panels = 0;
+    xt::xarray<double> reassembled = xt::zeros<double>(std::vector<size_t>{700, 300});
+    while (!reader.done())
+    {
+        size_t first = reader.position();
+        xt::xarray<double> panel = CSRToDense(reader.next());
+        std::copy(panel.data(), panel.data() + panel.size(), reassembled.data() + first * 300);
+        ++panels;
+    }
+    CHECK(panels > 1 && reader.position() == 700);
+    CHECK(_sameTensor(reassembled, tensorA));
+    CHECK_THROWS(std::runtime_error, reader.next());
+
+    // the writer takes panels in row order, an unfinished file is removed with its spooled values
+    xt::xarray<double> tensor = _randomTensor({2, 30, 20}, 0.2, generator);
+    xt::xarray<double> top = xt::zeros<double>(std::vector<size_t>{25, 20});
+    xt::xarray<double> bottom = xt::zeros<double>(std::vector<size_t>{35, 20});
+    std::copy(tensor.data(), tensor.data() + 500, top.data());
+    std::copy(tensor.data() + 500, tensor.data() + 1200, bottom.data());
+    {
+        CSRPanelWriter<double> writer(pathResult, {2, 30, 20});
+        writer.append(CSR<double>(top));
+        CHECK_THROWS(std::runtime_error, writer.finish());
+        CHECK_THROWS(std::invalid_argument, writer.append(CSR<double>(_randomTensor({5, 21}, 0.2, generator))));
+        writer.append(CSR<double>(bottom));
+        writer.finish();
+        CHECK(writer.rowsWritten() == 60 && writer.nnz() == CSR<double>(tensor).nnz());
+    }
+    CHECK(_sameTensor(CSRToDense(LoadCSR<double>(pathResult)), tensor));
+    {
+        CSRPanelWriter<double> writer(pathResult, {2, 30, 20});
+        writer.append(CSR<double>(top));
+    }
+    CHECK(!std::filesystem::exists(pathResult));
+    CHECK(!std::filesystem::exists(pathResult + ".values"));
+
+    // batched left operand, narrow types and a wider accumulator
+    xt::xarray<double> batched = _randomTensor({3, 100, 80}, 0.1, generator);
+    xt::xarray<double> right = _randomTensor({80, 60}, 0.1, generator);
+    CSR<float, uint32_t> csrBatched(_toFloat(batched));
+    CSR<float, uint32_t> csrRight(_toFloat(right));
+    SaveCSR(csrBatched, pathA);
+    CSRMultFile(pathA, csrRight, pathResult, 2000);
+    CHECK(_sameTensor(_toDouble(CSRToDense(LoadCSR<float, uint32_t>(pathResult))), _batchedProduct(batched, right)));
+    CSRMultFile<double>(pathA, csrRight, pathResult, 2000);
+    CHECK(_sameCSR(LoadCSR<float, uint32_t>(pathResult), CSRMult<double>(csrBatched, csrRight)));
+
+    // a failed product leaves no file behind
+    std::filesystem::remove(pathResult);
+    CSR<float, uint32_t> mismatched(_toFloat(_randomTensor({60, 40}, 0.1, generator)));
+    CHECK_THROWS(std::invalid_argument, CSRMultFile(pathA, mismatched, pathResult));
+    CHECK(!std::filesystem::exists(pathResult));
+    CHECK_THROWS(std::runtime_error, CSRMultFile(_tempPath("missing.bin"), csrB, pathResult));
+
+    std::filesystem::remove(pathA);
+    std::filesystem::remove(pathResult);
+}
+
+int main()
+{
+    testRoundTrips();
+    testSpGEMM();
+    testParallelSpGEMM();
+    testSparseDense();
+    testSparseOutput();
+    testParallelConversion();
+    testSparsityChecks();
+    testDispatch();
+    testBinaryFiles();
+    testBatchedSpGEMM();
+    testCompactIndices();
+    testBSR();
+    testCSF();
+    testExpressions();
+    testSpGEMMPlan();
+    testTranspose();
+    testMaskedSpGEMM();
+    testPrunedSpGEMM();
+    testReorder();
+    testDynamicCSR();
+    testReducedPrecision();
+    testCSRMultFile();
+
+    if (failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}